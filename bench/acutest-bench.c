@@ -0,0 +1,243 @@
+/*
+ * Driver measuring the overhead of Acutest itself: It runs the synthetic test
+ * suite (see bench-suite.c) in each of the execution modes and reports how
+ * much time the runner adds per test, per check, per test case and per byte
+ * of the output, and how long it takes to select a test among many by a word
+ * of its name. (Compare the numbers of two builds to catch regressions.)
+ *
+ * On Unix, it also checks the default mode does not add much to the cost of
+ * the child process of each test: It fails if a test costs more than R times
+ * a bare fork(), exit() and waitpid() made by the suite itself.
+ *
+ * Usage: acutest-bench [--runs=N] [--max-fork-ratio=R] [SUITE]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench-suite.h"
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(__WINDOWS__)
+    #define BENCH_WIN       1
+    #include <windows.h>
+#endif
+
+#ifndef ACUTEST_BENCH_SUITE
+    #define ACUTEST_BENCH_SUITE     "acutest-bench-suite"
+#endif
+
+#define OUTPUT_FILE     "acutest-bench.out"
+
+
+/* Execution modes of the suite, as the options selecting them. */
+static const struct {
+    const char* name;
+    const char* options;
+} modes[] = {
+#ifdef BENCH_WIN
+    { "exec (CreateProcess)",   "--exec" },
+#else
+    { "exec (fork)",            "--exec" },
+    { "exec --persistent",      "--exec --persistent" },
+    { "exec --jobs=4",          "--exec --jobs=4" },
+#endif
+    { "no-exec",                "--no-exec" },
+    { NULL, NULL }
+};
+
+static const char* suite = ACUTEST_BENCH_SUITE;
+static int n_runs = 3;
+static double max_fork_ratio = 2.5;
+
+
+/* Monotonic clock, in seconds. */
+static double
+now(void)
+{
+#ifdef BENCH_WIN
+    LARGE_INTEGER freq, ts;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&ts);
+    return (double) ts.QuadPart / (double) freq.QuadPart;
+#elif defined CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#else
+    return (double) time(NULL);
+#endif
+}
+
+static long
+file_size(const char* path)
+{
+    FILE* f;
+    long size;
+
+    f = fopen(path, "rb");
+    if(f == NULL)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+/* Run the suite with the given options and test, with the output going into
+ * OUTPUT_FILE. Returns the best wall time of n_runs, and the size of the
+ * output. (The exit code is not interesting; e.g. "output" always fails.) */
+static double
+run(const char* options, const char* test, long* p_output_size)
+{
+    char cmdline[1024];
+    double best = -1.0;
+    int i;
+
+#ifdef BENCH_WIN
+    /* (cmd.exe strips the outer quotes.) */
+    snprintf(cmdline, sizeof(cmdline), "\"\"%s\" %s --color=never %s > %s 2>&1\"",
+             suite, options, test, OUTPUT_FILE);
+#else
+    snprintf(cmdline, sizeof(cmdline), "\"%s\" %s --color=never %s > %s 2>&1",
+             suite, options, test, OUTPUT_FILE);
+#endif
+
+    for(i = 0; i < n_runs; i++) {
+        double start, elapsed;
+        int ret;
+
+        start = now();
+        ret = system(cmdline);
+        elapsed = now() - start;
+
+        if(ret == -1  ||  file_size(OUTPUT_FILE) == 0) {
+            fprintf(stderr, "Cannot run '%s'.\n", cmdline);
+            exit(1);
+        }
+        if(best < 0.0  ||  elapsed < best)
+            best = elapsed;
+    }
+
+    if(p_output_size != NULL)
+        *p_output_size = file_size(OUTPUT_FILE);
+    return best;
+}
+
+static void
+format_time(char* buffer, size_t size, double secs)
+{
+    double ns = secs * 1e9;
+
+    if(ns < 0.0)
+        snprintf(buffer, size, "~0");
+    else if(ns < 1e3)
+        snprintf(buffer, size, "%.2f ns", ns);
+    else if(ns < 1e6)
+        snprintf(buffer, size, "%.2f us", ns / 1e3);
+    else if(ns < 1e9)
+        snprintf(buffer, size, "%.2f ms", ns / 1e6);
+    else
+        snprintf(buffer, size, "%.2f s", ns / 1e9);
+}
+
+int
+main(int argc, char** argv)
+{
+    double exec_per_test = 0.0;
+    int ret = 0;
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "--runs=", 7) == 0) {
+            n_runs = atoi(argv[i] + 7);
+            if(n_runs < 1) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --runs.\n", argv[0], argv[i] + 7);
+                return 2;
+            }
+        } else if(strncmp(argv[i], "--max-fork-ratio=", 17) == 0) {
+            max_fork_ratio = atof(argv[i] + 17);
+            if(max_fork_ratio <= 0.0) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --max-fork-ratio.\n", argv[0], argv[i] + 17);
+                return 2;
+            }
+        } else if(strcmp(argv[i], "--help") == 0  ||  strcmp(argv[i], "-h") == 0) {
+            printf("Usage: %s [--runs=N] [--max-fork-ratio=R] [SUITE]\n", argv[0]);
+            printf("Measure the overhead of Acutest on the synthetic test suite SUITE\n");
+            printf("(default: %s), taking the best of N runs (default: 3).\n", ACUTEST_BENCH_SUITE);
+            printf("Fail if a test in the default mode costs more than R times a bare\n");
+            printf("fork() (default: %g; not on Windows).\n", max_fork_ratio);
+            return 0;
+        } else {
+            suite = argv[i];
+        }
+    }
+
+    printf("Overhead of the runner (best of %d runs of %s):\n\n", n_runs, suite);
+    printf("%-22s %12s %12s %12s %16s\n", "Mode", "per test", "per check", "per case", "per output byte");
+
+    for(i = 0; modes[i].name != NULL; i++) {
+        char per_test[32], per_check[32], per_case[32], per_byte[32];
+        long base_size, output_size;
+        double base, per;
+
+        /* A single test, to subtract the start-up of the suite. */
+        base = run(modes[i].options, "empty/0", &base_size);
+
+        per = (run(modes[i].options, "empty", NULL) - base) / (BENCH_EMPTY_TESTS - 1);
+        if(i == 0)
+            exec_per_test = per;
+        format_time(per_test, sizeof(per_test), per);
+        format_time(per_check, sizeof(per_check),
+                    (run(modes[i].options, "checks", NULL) - base) / BENCH_CHECKS);
+        format_time(per_case, sizeof(per_case),
+                    (run(modes[i].options, "cases", NULL) - base) / BENCH_CASES);
+        format_time(per_byte, sizeof(per_byte),
+                    (run(modes[i].options, "output", &output_size) - base) /
+                    (double) (output_size > base_size ? output_size - base_size : 1));
+
+        printf("%-22s %12s %12s %12s %16s\n", modes[i].name, per_test, per_check, per_case, per_byte);
+        fflush(stdout);
+    }
+
+#ifndef BENCH_WIN
+    /* The first of the modes is the default one. The test "fork" makes its
+     * child processes from the same process, with the same tests, so the
+     * difference is only what the runner adds. */
+    {
+        char per_fork_str[32];
+        double base, per_fork, ratio;
+
+        base = run("--no-exec", "empty/0", NULL);
+        per_fork = (run("--no-exec", "fork", NULL) - base) / BENCH_FORKS;
+        ratio = (per_fork > 0.0) ? exec_per_test / per_fork : 0.0;
+        format_time(per_fork_str, sizeof(per_fork_str), per_fork);
+        printf("\nTest in the default mode: %.2fx a bare fork() (%s)\n", ratio, per_fork_str);
+        if(ratio > max_fork_ratio) {
+            printf("FAILED: More than --max-fork-ratio=%g.\n", max_fork_ratio);
+            ret = 1;
+        }
+    }
+#endif
+
+    /* E.g. "49999", i.e. only a word of "select/49999". Only the selection
+     * differs from the base run, which also runs a single empty test. */
+    {
+        char pattern[32], per_select[32];
+        double base;
+
+        snprintf(pattern, sizeof(pattern), "%d", BENCH_SELECT_TESTS - 1);
+#ifdef BENCH_WIN
+        _putenv(BENCH_SELECT_ENV "=1");
+#else
+        putenv((char*) BENCH_SELECT_ENV "=1");
+#endif
+        base = run("--no-exec", "empty/0", NULL);
+        format_time(per_select, sizeof(per_select), run("--no-exec", pattern, NULL) - base);
+        printf("\nSelection of a test by a word (among %d tests): %s\n",
+               BENCH_EMPTY_TESTS + BENCH_SELECT_TESTS + BENCH_OTHER_TESTS, per_select);
+    }
+
+    remove(OUTPUT_FILE);
+    return ret;
+}
@@ -0,0 +1,114 @@
+/*
+ * Synthetic test suite for measuring the overhead of Acutest itself, i.e. the
+ * cost the runner adds per test, per check, per output byte and per test case,
+ * and the cost of selecting a test among many by a pattern.
+ * The tests do (nearly) nothing else. Run it through acutest-bench.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "bench-suite.h"
+#include "acutest.h"
+
+#if !defined(_WIN32) && !defined(__WIN32__) && !defined(__WINDOWS__)
+    #define BENCH_FORK      1
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+
+static const void*
+gen_empty(size_t index)
+{
+    static const char dummy = 0;
+
+    return (index < BENCH_EMPTY_TESTS) ? &dummy : NULL;
+}
+
+static const void*
+gen_select(size_t index)
+{
+    static const char dummy = 0;
+    static int n = -1;
+
+    if(n < 0)
+        n = (getenv(BENCH_SELECT_ENV) != NULL) ? BENCH_SELECT_TESTS : 0;
+    return ((int) index < n) ? &dummy : NULL;
+}
+
+void
+test_empty(void)
+{
+    /* noop */
+}
+
+void
+test_checks(void)
+{
+    int i;
+
+    for(i = 0; i < BENCH_CHECKS; i++)
+        TEST_CHECK(i >= 0);
+}
+
+void
+test_output(void)
+{
+    unsigned char data[64];
+    int i;
+
+    for(i = 0; i < (int) sizeof(data); i++)
+        data[i] = (unsigned char) i;
+
+    /* TEST_MSG and TEST_DUMP only output something after a failed check. */
+    for(i = 0; i < BENCH_OUTPUT_CHECKS; i++) {
+        TEST_CHECK_(i < 0, "check #%d", i);
+        TEST_MSG("Message of the check #%d.", i);
+        TEST_DUMP("Data:", data, sizeof(data));
+    }
+}
+
+#ifdef BENCH_FORK
+/* The bare cost of a child process made by this very process, i.e. what the
+ * runner cannot avoid per test in the default (fork) mode. (Run with
+ * --no-exec, so the process is the same as the main process of the runner.) */
+void
+test_fork(void)
+{
+    int i;
+
+    for(i = 0; i < BENCH_FORKS; i++) {
+        pid_t pid = fork();
+
+        if(pid == 0)
+            exit(0);
+        TEST_CHECK(pid > 0  &&  waitpid(pid, NULL, 0) == pid);
+    }
+}
+#endif
+
+void
+test_cases(void)
+{
+    int i;
+
+    for(i = 0; i < BENCH_CASES; i++) {
+        TEST_CASE_("case #%d", i);
+        TEST_CHECK(i >= 0);
+    }
+    TEST_CASE_(NULL);
+}
+
+
+TEST_LIST = {
+    { "empty",  test_empty, 0, TEST_PARAMS_GEN(gen_empty) },    /* "empty/0", "empty/1", ... */
+    { "checks", test_checks },
+    { "output", test_output },
+    { "cases",  test_cases },
+#ifdef BENCH_FORK
+    { "fork",   test_fork },
+#endif
+    { "select", test_empty, 0, TEST_PARAMS_GEN(gen_select) },   /* "select/0", "select/1", ... */
+    { NULL, NULL }
+};
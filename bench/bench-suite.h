@@ -0,0 +1,28 @@
+/*
+ * Sizes of the workloads of the synthetic test suite (see bench-suite.c), as
+ * also needed by the driver (see acutest-bench.c) to normalize the times.
+ */
+
+#ifndef BENCH_SUITE_H
+#define BENCH_SUITE_H
+
+#define BENCH_EMPTY_TESTS       10000       /* Count of tests "empty/N". */
+#define BENCH_CHECKS            10000000    /* Count of passing checks in "checks". */
+#define BENCH_OUTPUT_CHECKS     10000       /* Count of failing checks (each with a message and dump) in "output". */
+#define BENCH_CASES             100000      /* Count of TEST_CASEs in "cases". */
+#define BENCH_SELECT_TESTS      50000       /* Count of tests "select/N", to select from. */
+#define BENCH_FORKS             10000       /* Count of child processes made by "fork". */
+
+/* Count of the other tests ("checks", "output", "cases" and, except on
+ * Windows, "fork"). */
+#if defined(_WIN32) || defined(__WIN32__) || defined(__WINDOWS__)
+    #define BENCH_OTHER_TESTS   3
+#else
+    #define BENCH_OTHER_TESTS   4
+#endif
+
+/* The "select/N" tests exist only with this set in the environment, so that
+ * the size of the suite does not affect the other measurements. */
+#define BENCH_SELECT_ENV        "ACUTEST_BENCH_SELECT"
+
+#endif  /* BENCH_SUITE_H */
@@ -1,6 +1,12 @@
 
 #include "acutest.h"
 
+#if defined(_WIN32) || defined(__WIN32__) || defined(__WINDOWS__)
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
 void
 test_tutorial(void)
 {
@@ -56,6 +62,63 @@ test_bad_skip(void)
     TEST_SKIP("Decided to skip.");      /* Cannot skip after any TEST_CHECK */
 }
 
+void
+test_bench(void)
+{
+    char buffer[64];
+    unsigned sum = 0;
+    size_t i;
+
+    memset(buffer, 'x', sizeof(buffer));
+
+    /* Measure how long it takes to sum all the bytes of the buffer. */
+    TEST_BENCH("sum-64-bytes") {
+        for(i = 0; i < sizeof(buffer); i++)
+            sum += (unsigned char) buffer[i];
+        TEST_DO_NOT_OPTIMIZE(sum);
+    }
+
+    TEST_CHECK(sum > 0);
+}
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(__WINDOWS__)
+static DWORD WINAPI
+worker(void* arg)
+#else
+static void*
+worker(void* arg)
+#endif
+{
+    int counter = *(int*) arg;
+
+    /* Checks (and messages) from other threads count into the test too. This
+     * one is designed to fail. */
+    TEST_CHECK(counter == 0);
+    TEST_MSG("counter: %d", counter);
+    return 0;
+}
+
+void
+test_thread(void)
+{
+    int counter = 42;
+#if defined(_WIN32) || defined(__WIN32__) || defined(__WINDOWS__)
+    HANDLE thread;
+
+    thread = CreateThread(NULL, 0, worker, &counter, 0, NULL);
+    if(!TEST_CHECK(thread != NULL))
+        return;
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_t thread;
+
+    if(!TEST_CHECK(pthread_create(&thread, NULL, worker, &counter) == 0))
+        return;
+    pthread_join(thread, NULL);
+#endif
+}
+
 static void
 helper(void)
 {
@@ -91,6 +154,8 @@ TEST_LIST = {
     { "fail",     test_fail },
     { "skip",     test_skip },
     { "bad-skip", test_bad_skip },
+    { "bench",    test_bench },
+    { "thread",   test_thread },
     { "abort",    test_abort },
     { "crash",    test_crash },
     { NULL, NULL }
@@ -70,9 +70,137 @@
  *
  *   void test_func(void);
  *
+ * Optionally, a record may also specify a timeout (in seconds) for the test,
+ * overriding the one set with the option --timeout:
+ *
+ *       { "slow_test", slow_test_func_ptr, 60 },
+ *
+ * And after the timeout (use 0 for the default), a record may specify a table
+ * of parameters with one of the macros TEST_PARAMS, TEST_PARAMS_N or
+ * TEST_PARAMS_GEN (see below), or TEST_NO_PARAMS; and then flags:
+ *
+ *       { "pure_test", pure_test_func_ptr, 0, TEST_NO_PARAMS, TEST_THREAD_SAFE },
+ *
+ * TEST_THREAD_SAFE allows running the test concurrently with other such
+ * tests in threads of a single process (see --threads and TEST_ENABLE_THREADS
+ * below). The test must not depend on anything (e.g. a global state) other
+ * tests could change, and it should not use the checks from any other threads
+ * it starts itself.
+ *
  * Note the list has to be ended with a zeroed record.
+ *
+ * (GCC and Clang with -Wextra warn about the records which leave out any of
+ * the optional members. Use -Wno-missing-field-initializers if that is in
+ * the way.)
+ */
+#define TEST_LIST               const struct acutest_test_ acutest_test_list_[]
+
+/* Flags of the test record. */
+#define TEST_THREAD_SAFE        0x0001
+
+
+/* Macro to register a unit test from anywhere, e.g. from the source file
+ * implementing it, instead of listing it in TEST_LIST. It takes the same
+ * members as a record of the TEST_LIST do:
+ *
+ *   void test_sum(void) { ... }
+ *   TEST_REGISTER("sum", test_sum);
+ *   TEST_REGISTER("big_sum", test_big_sum, 60, TEST_PARAMS(big_cases));
+ *
+ * The registered tests follow the ones of TEST_LIST (which is still needed,
+ * but it may be just the empty one, { { NULL, NULL } }), in the order the
+ * linker puts them (usually the order of the object files). The registry
+ * costs nothing at the run time: With GCC or Clang (except on Windows), it
+ * is an array of pointers in a dedicated linker section; otherwise, in C++
+ * only, a list built by static constructors.
+ *
+ * Note a test registered in an object file which the linker leaves out (of a
+ * static library, typically) does not exist. Use at most one TEST_REGISTER
+ * per line.
+ */
+#if (defined __GNUC__  ||  defined __clang__)  &&  !defined _WIN32
+    #if defined __APPLE__
+        #define ACUTEST_REGISTRY_SECTION_   "__DATA,acutest_tests"
+    #else
+        #define ACUTEST_REGISTRY_SECTION_   "acutest_tests"
+    #endif
+#endif
+
+#define ACUTEST_CONCAT2_(a, b)      a##b
+#define ACUTEST_CONCAT_(a, b)       ACUTEST_CONCAT2_(a, b)
+
+#define TEST_REGISTER(...)                                                     \
+    ACUTEST_REGISTER_(ACUTEST_CONCAT_(acutest_registered_, __LINE__), __VA_ARGS__)
+
+/* (The record may leave out the optional members. The warning about that is
+ * silenced only for the record itself.) */
+#if defined __GNUC__  ||  defined __clang__
+    #define ACUTEST_RECORD_(id, ...)                                           \
+        _Pragma("GCC diagnostic push")                                         \
+        _Pragma("GCC diagnostic ignored \"-Wmissing-field-initializers\"")     \
+        static const struct acutest_test_ id = { __VA_ARGS__ };                \
+        _Pragma("GCC diagnostic pop")
+#else
+    #define ACUTEST_RECORD_(id, ...)                                           \
+        static const struct acutest_test_ id = { __VA_ARGS__ };
+#endif
+
+#if defined ACUTEST_REGISTRY_SECTION_
+    #define ACUTEST_REGISTER_(id, ...)                                         \
+        ACUTEST_RECORD_(id, __VA_ARGS__)                                       \
+        static const struct acutest_test_* const ACUTEST_CONCAT_(id, _ptr_)    \
+            __attribute__((section(ACUTEST_REGISTRY_SECTION_), used)) = &id
+#elif defined __cplusplus
+    #define ACUTEST_REGISTER_(id, ...)                                         \
+        ACUTEST_RECORD_(id, __VA_ARGS__)                                       \
+        static const acutest_registrar_ ACUTEST_CONCAT_(id, _registrar_)(&id)
+#else
+    /* Sorry, not supported with this compiler. */
+    #define ACUTEST_REGISTER_(id, ...)                                         \
+        typedef char ACUTEST_CONCAT_(id, _TEST_REGISTER_not_supported_)[-1]
+#endif
+
+
+/* Macros for parameterized (data-driven) tests. A test record with one of
+ * them is expanded into one test per parameter set, named "<name>/<index>",
+ * so each of them can be selected, run in parallel with the others, sharded
+ * and reported on its own:
+ *
+ *   static const struct sum_case { int a, b, sum; } sum_cases[] = {
+ *       { 1, 2, 3 }, { 2, 2, 4 }, ...
+ *   };
+ *
+ *   void test_sum(void)
+ *   {
+ *       const struct sum_case* c = TEST_PARAM(struct sum_case);
+ *       TEST_CHECK(c->a + c->b == c->sum);
+ *   }
+ *
+ *   TEST_LIST = {
+ *       { "sum", test_sum, 0, TEST_PARAMS(sum_cases) },      // "sum/0", "sum/1", ...
+ *       ...
+ *   };
+ *
+ * TEST_PARAMS takes an array, TEST_PARAMS_N a pointer to the first of `n`
+ * parameter sets. TEST_PARAMS_GEN takes a function of the prototype
+ *
+ *   const void* gen_func(size_t index);
+ *
+ * which provides the parameter set of the given index, or NULL if there is
+ * no more of them. (The parameter sets have to stay valid for the whole run
+ * and the function has to always provide the same ones.)
+ *
+ * TEST_PARAM(type) gives the parameter set of the running test as a pointer
+ * to const `type` (or NULL if the test is not parameterized).
  */
-#define TEST_LIST               const struct acutest_test_ acutest_list_[]
+#define TEST_PARAMS(array)                                                     \
+    (const void*) (array), sizeof((array)[0]), sizeof(array) / sizeof((array)[0]), NULL
+#define TEST_PARAMS_N(ptr, n)                                                  \
+    (const void*) (ptr), sizeof((ptr)[0]), (size_t) (n), NULL
+#define TEST_PARAMS_GEN(gen_func)                                              \
+    NULL, 0, 0, (gen_func)
+#define TEST_NO_PARAMS          NULL, 0, 0, NULL
+#define TEST_PARAM(type)        ((const type*) acutest_param_)
 
 
 /* Macros for testing whether an unit test succeeds or fails. These macros
@@ -93,11 +221,61 @@
  *       TEST_CHECK(ptr->member1 < 100);
  *       TEST_CHECK(ptr->member2 > 200);
  *   }
+ *
+ * The checks (as well as TEST_MSG, TEST_DUMP and TEST_CASE) may also be used
+ * from other threads the test starts, as long as the test waits for them to
+ * finish. Their output is then tagged with a thread number. (TEST_ABORT from
+ * such a thread, however, ends the whole process running the test.)
  */
 #define TEST_CHECK_(cond,...)                                                  \
-    acutest_check_(!!(cond), __FILE__, __LINE__, __VA_ARGS__)
+    ((cond) ? ACUTEST_CHECK_PASSED_(__VA_ARGS__)                               \
+            : acutest_check_(0, __FILE__, __LINE__, __VA_ARGS__))
 #define TEST_CHECK(cond)                                                       \
-    acutest_check_(!!(cond), __FILE__, __LINE__, "%s", #cond)
+    TEST_CHECK_(cond, "%s", #cond)
+
+/* (Internal.) A passed check which has nothing to print (the usual case) is
+ * just counted inline. Only failed checks, or all checks with --verbose=3 or
+ * --format=jsonl, go to acutest_check_() to get formatted. */
+#define ACUTEST_CHECK_PASSED_(...)                                             \
+    (acutest_check_fast_                                                       \
+            ? (acutest_test_check_count_++, acutest_cond_failed_ = 0, 1)       \
+            : acutest_check_(1, __FILE__, __LINE__, __VA_ARGS__))
+
+
+/* Macro for checking that all elements of an array satisfy a predicate.
+ *
+ * The predicate is a name of a function (or a function-like macro) taking
+ * a single element of the array and returning non-zero if the element is
+ * fine. All n elements are always examined. However, no matter how long
+ * the array is, it counts as a single check and, if it fails, it produces
+ * only a single report saying how many elements have failed and which was
+ * the first of them:
+ *
+ *   static int is_sorted_pair(const struct pair p) { return p.a <= p.b; }
+ *
+ *   TEST_CHECK_ALL(pairs, n_pairs, is_sorted_pair);
+ */
+#define TEST_CHECK_ALL(array, n, predicate)                                    \
+    do {                                                                       \
+        size_t acutest_i_;                                                     \
+        size_t acutest_n_ = (size_t) (n);                                      \
+        size_t acutest_bad_ = 0;                                               \
+        size_t acutest_first_bad_ = 0;                                         \
+        for(acutest_i_ = 0; acutest_i_ < acutest_n_; acutest_i_++) {           \
+            if(!(predicate((array)[acutest_i_]))) {                            \
+                if(acutest_bad_ == 0)                                          \
+                    acutest_first_bad_ = acutest_i_;                           \
+                acutest_bad_++;                                                \
+            }                                                                  \
+        }                                                                      \
+        if(!TEST_CHECK_(acutest_bad_ == 0, "%s(%s[i]) for all i < %s",         \
+                        #predicate, #array, #n)) {                             \
+            acutest_message_("%lu of %lu elements have failed, "               \
+                        "the first one at index %lu.",                         \
+                        (unsigned long) acutest_bad_, (unsigned long) acutest_n_, \
+                        (unsigned long) acutest_first_bad_);                   \
+        }                                                                      \
+    } while(0)
 
 
 /* These macros are the same as TEST_CHECK_ and TEST_CHECK except that if the
@@ -117,12 +295,12 @@
  */
 #define TEST_ASSERT_(cond,...)                                                 \
     do {                                                                       \
-        if(!acutest_check_(!!(cond), __FILE__, __LINE__, __VA_ARGS__))         \
+        if(!TEST_CHECK_(cond, __VA_ARGS__))                                    \
             acutest_abort_();                                                  \
     } while(0)
 #define TEST_ASSERT(cond)                                                      \
     do {                                                                       \
-        if(!acutest_check_(!!(cond), __FILE__, __LINE__, "%s", #cond))         \
+        if(!TEST_CHECK_(cond, "%s", #cond))                                    \
             acutest_abort_();                                                  \
     } while(0)
 
@@ -262,6 +440,39 @@
 #endif
 
 
+/* Macro for checking that two blocks of memory are equal.
+ *
+ * It is a faster and more readable replacement for the following pattern,
+ * especially useful when comparing large buffers:
+ *
+ *   TEST_CHECK(memcmp(produced, expected, size) == 0);
+ *   TEST_DUMP("Produced:", produced, size);
+ *   TEST_DUMP("Expected:", expected, size);
+ *
+ * If the blocks differ, instead of dumping them whole, only the differing
+ * ranges are shown, each within a window of some surrounding context and with
+ * the two blocks side by side and the differing bytes highlighted:
+ *
+ *   TEST_CHECK_MEM(produced, expected, size);
+ *
+ * Like TEST_CHECK, the macro returns non-zero if the blocks are equal.
+ */
+#define TEST_CHECK_MEM(a, b, size)                                             \
+    acutest_check_mem_(__FILE__, __LINE__, #a, #b, (a), (b), (size))
+
+/* Maximal count of differing ranges shown by a single TEST_CHECK_MEM, and the
+ * count of bytes of context shown before and after each of them. Ranges which
+ * are closer to each other than twice the context are shown as one.
+ * You may define other limits prior including "acutest.h"
+ */
+#ifndef TEST_MEM_MAXDIFFS
+    #define TEST_MEM_MAXDIFFS   4
+#endif
+#ifndef TEST_MEM_CONTEXT
+    #define TEST_MEM_CONTEXT    16
+#endif
+
+
 /* Macros for marking the test as SKIPPED.
  * Note it can only be used at the beginning of a test, before any other
  * checking.
@@ -272,6 +483,119 @@
 #define TEST_SKIP(...)         acutest_skip_(__FILE__, __LINE__, __VA_ARGS__)
 
 
+/* Macros for micro-benchmarking.
+ *
+ * TEST_BENCH repeats the block (or statement) which follows it as many times
+ * as needed to measure its duration reliably, even if a single execution
+ * takes just few nanoseconds:
+ *
+ *   void test_bench_hash(void)
+ *   {
+ *       uint32_t h;
+ *
+ *       TEST_BENCH("hash-16-bytes") {
+ *           h = hash(data, 16);
+ *           TEST_DO_NOT_OPTIMIZE(h);
+ *       }
+ *   }
+ *
+ * At first, the count of iterations per sample is calibrated so that each
+ * sample takes a fair share of the time budget (see --bench-time). Then the
+ * given count of samples (see --bench-samples) is measured, and the minimum,
+ * median, 99th percentile and standard deviation of the time per single
+ * iteration are reported (with --verbose=2 or higher, in TAP output and in
+ * XUnit output as properties of the test case).
+ *
+ * The benchmarked code should pass its results through TEST_DO_NOT_OPTIMIZE
+ * so that the compiler cannot optimize the computation away. Its argument
+ * has to be an lvalue (e.g. a variable). TEST_CLOBBER_MEMORY() makes the
+ * compiler assume all memory may have been read and written.
+ *
+ * Note the benchmarks cannot be nested, and that 'break' and 'continue'
+ * inside the block only affect the current iteration loop.
+ */
+#define TEST_BENCH(name)                                                       \
+    for(acutest_bench_begin_(name); acutest_bench_next_(); )                   \
+        for(size_t acutest_bench_iter_ = acutest_bench_iterations_();          \
+            acutest_bench_iter_ > 0; acutest_bench_iter_--)
+
+/* Parameter sweeps of benchmarks.
+ *
+ * TEST_BENCH_RANGE(var, lo, hi) runs its body with the variable var set in
+ * turn to lo, 2*lo, 4*lo, ... up to hi, and TEST_BENCH_RANGE_STEP(var, lo,
+ * hi, step) with var set to lo, lo+step, lo+2*step, ... up to hi. Each
+ * TEST_BENCH in the body then measures one point of a scaling curve and it
+ * is reported under the name "NAME/var=VALUE":
+ *
+ *   void test_bench_memcpy(void)
+ *   {
+ *       size_t size;
+ *
+ *       TEST_BENCH_RANGE(size, 1 << 10, 1 << 30) {
+ *           char* src = (char*) calloc(size, 1);
+ *           char* dst = (char*) malloc(size);
+ *
+ *           TEST_BENCH_BYTES(size);
+ *           TEST_BENCH("memcpy") {
+ *               memcpy(dst, src, size);
+ *               TEST_CLOBBER_MEMORY();
+ *           }
+ *
+ *           free(src);
+ *           free(dst);
+ *       }
+ *   }
+ *
+ * Similarly, e.g. TEST_BENCH_RANGE_STEP(n_threads, 1, 8, 1) may be used to
+ * measure how some code scales with the count of threads it uses.
+ *
+ * TEST_BENCH_ITEMS(n) and TEST_BENCH_BYTES(n) announce that one iteration of
+ * the next TEST_BENCH processes n items, or n bytes, so that the throughput
+ * is reported too.
+ *
+ * When the sweep ends, the complexity of each curve is estimated: the times
+ * per iteration are fitted by the least squares method with each of O(1),
+ * O(log n), O(n), O(n log n) and O(n^2), and the one with the smallest
+ * relative RMS error is reported.
+ *
+ * See --bench-report=FILE for saving all the points (and curves) as CSV or
+ * JSON.
+ *
+ * Note the sweeps cannot be nested, and 'break' must not be used to leave
+ * them.
+ */
+#define TEST_BENCH_RANGE(var, lo, hi)                                          \
+    ACUTEST_BENCH_RANGE_(var, lo, hi, 2, 0)
+#define TEST_BENCH_RANGE_STEP(var, lo, hi, step)                               \
+    ACUTEST_BENCH_RANGE_(var, lo, hi, 0, step)
+#define TEST_BENCH_ITEMS(n)             acutest_bench_items_((double) (n))
+#define TEST_BENCH_BYTES(n)             acutest_bench_bytes_((double) (n))
+
+#define ACUTEST_BENCH_RANGE_(var, lo, hi, mult, step)                          \
+    for(acutest_bench_range_begin_(#var, (size_t) (lo), (size_t) (hi),         \
+                                   (size_t) (mult), (size_t) (step));          \
+        acutest_bench_range_next_() ? ((var) = acutest_bench_range_arg_(), 1) : 0; )
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define TEST_DO_NOT_OPTIMIZE(x)                                            \
+        __asm__ __volatile__("" : : "g"(&(x)) : "memory")
+    #define TEST_CLOBBER_MEMORY()                                              \
+        __asm__ __volatile__("" : : : "memory")
+#else
+    #define TEST_DO_NOT_OPTIMIZE(x)                                            \
+        acutest_do_not_optimize_((const void*) &(x))
+    #define TEST_CLOBBER_MEMORY()                                              \
+        acutest_do_not_optimize_(NULL)
+#endif
+
+/* Maximal length of the benchmark name. Longer names are cut.
+ * You may define another limit prior including "acutest.h"
+ */
+#ifndef TEST_BENCH_NAME_MAXSIZE
+    #define TEST_BENCH_NAME_MAXSIZE    64
+#endif
+
+
 /* Common test initialisation/clean-up
  *
  * In some test suites, it may be needed to perform some sort of the same
@@ -292,6 +616,56 @@
  * TEST_FINI is to be used in the same way.
  */
 
+/* Shared fixtures
+ *
+ * Expensive set-up (e.g. loading a large data set or building an index) can
+ * be done just once for all the tests which need it, instead of per test as
+ * with TEST_INIT. Define the macro TEST_FIXTURES prior including this header
+ * as a list of records, each specifying a name prefix and a set-up and a
+ * clean-up function. An empty prefix stands for the whole suite, otherwise
+ * the fixture is for the tests named as the prefix or starting with it and
+ * a word delimiter (e.g. "db" is for "db", "db/insert", "db-query" etc.):
+ *
+ *   static int load_dataset(void);     // returns 0 on success
+ *   static void free_dataset(void);
+ *
+ *   #define TEST_FIXTURES                                                   \
+ *       { "", suite_setup, suite_cleanup },                                 \
+ *       { "db", load_dataset, free_dataset }
+ *   #include "acutest.h"
+ *
+ * Before any test is run, the set-up of every fixture needed by some of the
+ * tests to run is called once, in the main process. The tests, even when run
+ * as child processes, then just inherit what it has prepared (on Unix with
+ * copy-on-write memory of fork(); on Windows, the child processes have to
+ * call the set-up on their own). The clean-up is called when all the tests
+ * are done, in the reverse order. If the set-up fails, all the tests of the
+ * fixture fail without running. Any of the functions may be NULL.
+ */
+
+/* Threads
+ *
+ * Running the tests marked TEST_THREAD_SAFE in threads of a single process
+ * (see --threads) is available only when the macro TEST_ENABLE_THREADS is
+ * defined prior including this header:
+ *
+ *   #define TEST_ENABLE_THREADS
+ *   #include "acutest.h"
+ *
+ * On Unix, the suite then has to be linked with the threads library (e.g. with
+ * -pthread) wherever the C library does not provide it on its own (e.g. glibc
+ * older than 2.34).
+ */
+
+/* Distributed execution
+ *
+ * Spreading the tests over agents on other machines (see --coordinator and
+ * --agent, Unix only) is available only when the macro TEST_ENABLE_DISTRIBUTED
+ * is defined prior including this header. (It makes the suite use the network
+ * API, including getaddrinfo(), which e.g. does not go well with static
+ * linking against glibc.)
+ */
+
 
 /**********************
  *** Implementation ***
@@ -299,6 +673,22 @@
 
 /* The unit test files should not rely on anything below. */
 
+/* In the strict ISO C mode (e.g. -std=c99), glibc and musl hide all the POSIX
+ * (and BSD) API we need, unless some feature-test macro asks for it. (This can
+ * work only if acutest.h is included before any system header. Otherwise, the
+ * features needing the API are left out below.) */
+#if !defined TEST_NO_MAIN  &&  defined __linux__  &&  defined __STRICT_ANSI__
+    #if !defined _POSIX_C_SOURCE  &&  !defined _XOPEN_SOURCE  &&              \
+        !defined _DEFAULT_SOURCE  &&  !defined _BSD_SOURCE  &&  !defined _GNU_SOURCE
+        #ifdef _FEATURES_H
+            #define ACUTEST_STRICT_ISO_C_   1   /* Too late for the macros. */
+        #else
+            #define _POSIX_C_SOURCE         200809L
+            #define _DEFAULT_SOURCE         1
+        #endif
+    #endif
+#endif
+
 #include <stdlib.h>
 
 /* Enable the use of the non-standard keyword __attribute__ to silence warnings under some compilers */
@@ -308,6 +698,19 @@
     #define ACUTEST_ATTRIBUTE_(attr)
 #endif
 
+/* Thread-local storage for the per-thread state of the checks. */
+#if defined(__GNUC__) || defined(__clang__)
+    #define ACUTEST_THREAD_LOCAL_       __thread
+#elif defined _MSC_VER
+    #define ACUTEST_THREAD_LOCAL_       __declspec(thread)
+#elif defined __cplusplus  &&  __cplusplus >= 201103L
+    #define ACUTEST_THREAD_LOCAL_       thread_local
+#elif defined __STDC_VERSION__  &&  __STDC_VERSION__ >= 201112L
+    #define ACUTEST_THREAD_LOCAL_       _Thread_local
+#else
+    #define ACUTEST_THREAD_LOCAL_
+#endif
+
 #ifdef __cplusplus
     extern "C" {
 #endif
@@ -321,18 +724,71 @@ enum acutest_state_ {
     ACUTEST_STATE_EXCLUDED = -1,
     ACUTEST_STATE_SUCCESS = 0,
     ACUTEST_STATE_FAILED = 1,
-    ACUTEST_STATE_SKIPPED = 2
+    ACUTEST_STATE_SKIPPED = 2,
+    ACUTEST_STATE_TIMEOUT = 3,      /* Killed by the main process (see --timeout). */
+    ACUTEST_STATE_FLAKY = 4         /* Mixed results of repeated runs (see --repeat). */
+};
+
+struct acutest_test_ {
+    const char* name;
+    void (*func)(void);
+    double timeout;         /* in seconds; 0 for the default (see --timeout). */
+
+    /* Parameters (see TEST_PARAMS). In the expanded list, params points to
+     * the parameter set of the test. */
+    const void* params;
+    size_t param_size;
+    size_t n_params;
+    const void* (*param_gen)(size_t);
+
+    int flags;              /* TEST_THREAD_SAFE */
 };
 
 int acutest_check_(int cond, const char* file, int line, const char* fmt, ...);
+extern ACUTEST_THREAD_LOCAL_ int acutest_check_fast_;
+extern ACUTEST_THREAD_LOCAL_ int acutest_test_check_count_;
+extern ACUTEST_THREAD_LOCAL_ int acutest_cond_failed_;
+extern ACUTEST_THREAD_LOCAL_ const void* acutest_param_;
 void acutest_case_(const char* fmt, ...);
 void acutest_message_(const char* fmt, ...);
 void acutest_dump_(const char* title, const void* addr, size_t size);
+int acutest_check_mem_(const char* file, int line, const char* a_str, const char* b_str,
+                       const void* a, const void* b, size_t size);
 void acutest_abort_(void) ACUTEST_ATTRIBUTE_(noreturn);
+void acutest_bench_begin_(const char* name);
+int acutest_bench_next_(void);
+size_t acutest_bench_iterations_(void);
+void acutest_bench_range_begin_(const char* var, size_t lo, size_t hi, size_t mult, size_t step);
+int acutest_bench_range_next_(void);
+size_t acutest_bench_range_arg_(void);
+void acutest_bench_items_(double n);
+void acutest_bench_bytes_(double n);
+void acutest_do_not_optimize_(const void* ptr);
 #ifdef __cplusplus
     }  /* extern "C" */
 #endif
 
+#if !defined ACUTEST_REGISTRY_SECTION_  &&  defined __cplusplus
+/* The registry of TEST_REGISTER where there are no linker sections for it:
+ * A list built by static constructors. (The function is inline, so that all
+ * the translation units share the same one.) */
+struct acutest_registrar_ {
+    const struct acutest_test_* test;
+    const acutest_registrar_* next;
+
+    static const acutest_registrar_*& head()
+    {
+        static const acutest_registrar_* head_ = 0;
+        return head_;
+    }
+
+    acutest_registrar_(const struct acutest_test_* t) : test(t), next(head())
+    {
+        head() = this;
+    }
+};
+#endif
+
 #ifndef TEST_NO_MAIN
 
 #include <ctype.h>
@@ -340,6 +796,7 @@ void acutest_abort_(void) ACUTEST_ATTRIBUTE_(noreturn);
 #include <stdio.h>
 #include <string.h>
 #include <setjmp.h>
+#include <time.h>
 
 #if defined(unix) || defined(__unix__) || defined(__unix) || defined(__APPLE__)
     #define ACUTEST_UNIX_       1
@@ -350,22 +807,105 @@ void acutest_abort_(void) ACUTEST_ATTRIBUTE_(noreturn);
     #include <sys/wait.h>
     #include <signal.h>
     #include <time.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/resource.h>
+    #include <regex.h>
+    #include <sys/stat.h>
+    #include <sys/time.h>
+
+    /* Whether the POSIX API is declared (see the feature-test macros above). */
+    #if !defined ACUTEST_STRICT_ISO_C_  &&  (!defined _POSIX_C_SOURCE  ||  _POSIX_C_SOURCE >= 200112L)
+        #define ACUTEST_HAS_POSIX_API_      1
+    #endif
+    /* And whether the BSD extensions (e.g. syscall() or wait4()) are. */
+    #if !defined ACUTEST_STRICT_ISO_C_  &&                                      \
+        (defined _DEFAULT_SOURCE  ||  defined _BSD_SOURCE  ||  defined _GNU_SOURCE  ||  \
+         defined _DARWIN_C_SOURCE  ||  (!defined _POSIX_C_SOURCE  &&  !defined _XOPEN_SOURCE))
+        #define ACUTEST_HAS_BSD_API_        1
+    #endif
+    /* Distributed execution (--coordinator, --agent) is opt-in, so that the
+     * suites which do not use it do not need the network API (see
+     * TEST_ENABLE_DISTRIBUTED). */
+    #if defined TEST_ENABLE_DISTRIBUTED  &&  defined ACUTEST_HAS_POSIX_API_
+        #include <sys/socket.h>
+        #include <netdb.h>
+        #ifdef AI_PASSIVE
+            #define ACUTEST_HAS_NET_        1
+        #endif
+    #endif
+    #ifndef ACUTEST_HAS_POSIX_API_
+        /* Killing the children (e.g. on --timeout) cannot be left out, nor
+         * passing the failed tests to the rebuilt binary (see --watch). */
+        int kill(pid_t pid, int sig);
+        int setenv(const char* name, const char* value, int overwrite);
+    #endif
 
     #if defined CLOCK_PROCESS_CPUTIME_ID  &&  defined CLOCK_MONOTONIC
         #define ACUTEST_HAS_POSIX_TIMER_    1
     #endif
+
+    #ifdef __has_include
+        #if __has_include(<execinfo.h>)
+            #define ACUTEST_HAS_BACKTRACE_      1
+        #endif
+    #elif defined __GLIBC__  ||  defined __APPLE__
+        #define ACUTEST_HAS_BACKTRACE_          1
+    #endif
+    #ifdef ACUTEST_HAS_BACKTRACE_
+        #include <execinfo.h>
+    #endif
+    /* The profiler (--profile) also needs sigaction() and setitimer(). */
+    #if defined ACUTEST_HAS_BACKTRACE_  &&  defined ACUTEST_HAS_POSIX_API_
+        #define ACUTEST_HAS_PROFILE_        1
+    #endif
 #endif
 
 #if defined(_gnu_linux_) || defined(__linux__)
     #define ACUTEST_LINUX_      1
     #include <fcntl.h>
     #include <sys/stat.h>
+    #include <sys/syscall.h>
+
+    /* (These have no wrappers in libc, only syscall().) */
+    #if defined SYS_sched_setaffinity  &&  defined ACUTEST_HAS_BSD_API_
+        #define ACUTEST_HAS_AFFINITY_       1
+    #endif
+
+    #if defined SYS_perf_event_open  &&  defined ACUTEST_HAS_BSD_API_
+        #ifdef __has_include
+            #if __has_include(<linux/perf_event.h>)
+                #define ACUTEST_HAS_PERF_EVENT_     1
+            #endif
+        #else
+            #define ACUTEST_HAS_PERF_EVENT_         1
+        #endif
+    #endif
+    #ifdef ACUTEST_HAS_PERF_EVENT_
+        #include <linux/perf_event.h>
+        #include <sys/ioctl.h>
+    #endif
 #endif
 
 #if defined(_WIN32) || defined(__WIN32__) || defined(__WINDOWS__)
     #define ACUTEST_WIN_        1
     #include <windows.h>
     #include <io.h>
+    #include <fcntl.h>
+    #ifndef PSAPI_VERSION
+        #define PSAPI_VERSION   2   /* So GetProcessMemoryInfo() lives in kernel32.dll. */
+    #endif
+    #include <psapi.h>
+    #define ACUTEST_HAS_AFFINITY_       1
+#endif
+
+/* The thread pool (--threads) is opt-in, so that the suites which do not use
+ * it do not need to be linked with the threads library. */
+#if defined TEST_ENABLE_THREADS  &&  (defined ACUTEST_UNIX_  ||  defined ACUTEST_WIN_)
+    #define ACUTEST_HAS_THREADS_        1
+    #ifdef ACUTEST_UNIX_
+        #include <pthread.h>
+    #endif
 #endif
 
 #if defined(__APPLE__)
@@ -375,6 +915,27 @@ void acutest_abort_(void) ACUTEST_ATTRIBUTE_(noreturn);
     #include <sys/types.h>
     #include <unistd.h>
     #include <sys/sysctl.h>
+    #include <mach-o/dyld.h>
+#endif
+
+#if (defined __GNUC__ || defined __clang__)  &&  (defined __x86_64__ || defined __i386__)
+    #define ACUTEST_HAS_RDTSC_  1
+#elif defined _MSC_VER  &&  (defined _M_X64 || defined _M_IX86)
+    #define ACUTEST_HAS_RDTSC_  1
+    #include <intrin.h>
+#endif
+
+/* SIMD used for searching mismatches in TEST_CHECK_MEM (as enabled for the
+ * compilation of the test suite). */
+#if defined __AVX2__
+    #define ACUTEST_HAS_AVX2_   1
+    #include <immintrin.h>
+#elif defined __SSE2__  ||  defined _M_X64  ||  (defined _M_IX86_FP  &&  _M_IX86_FP >= 2)
+    #define ACUTEST_HAS_SSE2_   1
+    #include <emmintrin.h>
+#elif defined __ARM_NEON  ||  defined __ARM_NEON__
+    #define ACUTEST_HAS_NEON_   1
+    #include <arm_neon.h>
 #endif
 
 #ifdef __cplusplus
@@ -389,6 +950,34 @@ void acutest_abort_(void) ACUTEST_ATTRIBUTE_(noreturn);
     #endif
 #endif
 
+/* Atomic operations on a volatile long (the increment gives the new value),
+ * and yielding the CPU, for the checks made from other threads than the one
+ * running the test. */
+#if defined(__GNUC__) || defined(__clang__)
+    #define ACUTEST_ATOMIC_INC_(var)        __sync_add_and_fetch(&(var), 1)
+    #define ACUTEST_ATOMIC_XCHG_(var, val)  __sync_lock_test_and_set(&(var), (val))
+    #define ACUTEST_ATOMIC_RELEASE_(var)    __sync_lock_release(&(var))
+#elif defined ACUTEST_WIN_
+    #define ACUTEST_ATOMIC_INC_(var)        InterlockedIncrement(&(var))
+    #define ACUTEST_ATOMIC_XCHG_(var, val)  InterlockedExchange(&(var), (val))
+    #define ACUTEST_ATOMIC_RELEASE_(var)    ((void) InterlockedExchange(&(var), 0))
+#else
+    /* No better idea: Hope the test is single-threaded. */
+    #define ACUTEST_ATOMIC_INC_(var)        (++(var))
+    #define ACUTEST_ATOMIC_XCHG_(var, val)  acutest_xchg_(&(var), (val))
+    #define ACUTEST_ATOMIC_RELEASE_(var)    ((void) ((var) = 0))
+    static long acutest_xchg_(volatile long* var, long val) { long old = *var; *var = val; return old; }
+#endif
+
+#if defined ACUTEST_WIN_
+    #define ACUTEST_YIELD_()    SwitchToThread()
+#elif defined ACUTEST_UNIX_
+    #include <sched.h>
+    #define ACUTEST_YIELD_()    sched_yield()
+#else
+    #define ACUTEST_YIELD_()
+#endif
+
 /* Note our global private identifiers end with '_' to mitigate risk of clash
  * with the unit tests implementation. */
 
@@ -405,18 +994,107 @@ void acutest_abort_(void) ACUTEST_ATTRIBUTE_(noreturn);
 #endif
 
 
-struct acutest_test_ {
-    const char* name;
-    void (*func)(void);
+struct acutest_fixture_ {
+    const char* prefix;
+    int (*setup)(void);
+    void (*teardown)(void);
+};
+
+/* Hardware performance counters (see --perf-counters). */
+#define ACUTEST_PERF_MAX_       6
+
+/* Resource usage of a test. Any member is -1 if unknown. */
+struct acutest_rusage_ {
+    long max_rss;           /* Peak resident set size, in kB. */
+    long minor_faults;      /* (On Windows, all page faults.) */
+    long major_faults;
+    long vol_csw;           /* Voluntary context switches. */
+    long invol_csw;         /* Involuntary context switches. */
+};
+
+/* Result of single TEST_BENCH. All the times are in nanoseconds per iteration. */
+struct acutest_bench_result_ {
+    char name[TEST_BENCH_NAME_MAXSIZE];
+    int samples;
+    double iterations;      /* per sample */
+    double min;
+    double median;
+    double p99;
+    double mean;
+    double stddev;
+    double items;           /* per iteration (see TEST_BENCH_ITEMS), or 0. */
+    double bytes;           /* per iteration (see TEST_BENCH_BYTES), or 0. */
+    double arg;             /* value of the TEST_BENCH_RANGE variable, or -1. */
+    int series;             /* 1-based id of the curve in the test, or 0. */
+};
+
+/* Growable memory buffer. */
+struct acutest_buffer_ {
+    char* data;
+    size_t size;
+    size_t alloc;
 };
 
 struct acutest_test_data_ {
     enum acutest_state_ state;
     double duration;
+    double cpu_time;        /* Negative if unknown. */
+    int check_count;
+    int failure_count;
+    double estimate;        /* Duration known from the timing database; negative if unknown. */
+    int shard;              /* 1-based shard the test belongs to (see --shard). */
+    struct acutest_bench_result_* benches;
+    int n_benches;
+    double perf[ACUTEST_PERF_MAX_];     /* Counters (see --perf-counters); -1 if unknown. */
+    struct acutest_rusage_ rusage;
+    struct acutest_buffer_ log;         /* Details about failures (for the XUnit output). */
+    int xml_written;
+    enum acutest_state_ last_state;     /* Outcome in the last run (see --rerun-failed). */
+
+    /* Aggregate over repeated runs (see --repeat). */
+    int repeat_runs;
+    int repeat_passed;
+    int repeat_skipped;
+    enum acutest_state_ repeat_fail_state;  /* State of the last failed run. */
+    double* repeat_durations;
+    size_t repeat_log_size;             /* Size of the log of the first failed run. */
+};
+
+#define ACUTEST_BASELINE_RUNS_          8
+#define ACUTEST_BASELINE_MIN_RUNS_      3
+#define ACUTEST_BASELINE_MIN_TIME_      0.005
+#define ACUTEST_BASELINE_NOISE_         0.02    /* relative standard error, at least */
+
+struct acutest_baseline_test_ {
+    double wall[ACUTEST_BASELINE_RUNS_];    /* (a ring buffer) */
+    int n;
+};
+
+struct acutest_baseline_bench_ {
+    int master_index;
+    char name[TEST_BENCH_NAME_MAXSIZE];
+    double median;      /* in seconds per iteration */
+    double stddev;
+    int samples;
 };
 
+extern const struct acutest_test_ acutest_test_list_[];
+
+/* The tests, with the registered ones added (see acutest_registry_merge_())
+ * and the parameterized ones expanded (see acutest_params_expand_()). */
+static const struct acutest_test_* acutest_list_ = acutest_test_list_;
+static struct acutest_test_* acutest_registered_list_ = NULL;
+static struct acutest_test_* acutest_expanded_list_ = NULL;
+static char* acutest_expanded_names_ = NULL;
 
-extern const struct acutest_test_ acutest_list_[];
+static const struct acutest_fixture_ acutest_fixtures_[] = {
+#ifdef TEST_FIXTURES
+    TEST_FIXTURES,
+#endif
+    { NULL, NULL, NULL }
+};
+/* 1 if set up, -1 if the set-up has failed, 0 otherwise. */
+static int acutest_fixture_state_[sizeof(acutest_fixtures_) / sizeof(acutest_fixtures_[0])];
 
 
 static char* acutest_argv0_ = NULL;
@@ -425,99 +1103,377 @@ static struct acutest_test_data_* acutest_test_data_ = NULL;
 static int acutest_no_exec_ = -1;
 static int acutest_no_summary_ = 0;
 static int acutest_tap_ = 0;
+static int acutest_jsonl_ = 0;
 static int acutest_exclude_mode_ = 0;
 static int acutest_worker_ = 0;
 static int acutest_worker_index_ = 0;
-static int acutest_cond_failed_ = 0;
+ACUTEST_THREAD_LOCAL_ int acutest_cond_failed_ = 0;
 static FILE *acutest_xml_output_ = NULL;
-
-static const struct acutest_test_* acutest_current_test_ = NULL;
-static int acutest_current_index_ = 0;
-static char acutest_case_name_[TEST_CASE_MAXSIZE] = "";
-static int acutest_test_check_count_ = 0;
-static int acutest_test_skip_count_ = 0;
-static char acutest_test_skip_reason_[256] = "";
-static int acutest_test_already_logged_ = 0;
-static int acutest_case_already_logged_ = 0;
+static int acutest_test_log_on_ = 0;        /* Collect details of failures (for the XUnit output). */
+static long acutest_xml_counts_pos_ = -1;  /* Where the XUnit header counts are (if seekable). */
+static long acutest_xml_tail_pos_ = -1;    /* Where the next <testcase> goes. */
+static int acutest_xml_counts_[4];          /* tests, errors, failures, skipped */
+static const char* acutest_xml_suite_name_ = "";
+
+/* The running test, shared by all the threads of the process (under the lock,
+ * see acutest_lock_()), so that also the threads the test starts report into
+ * it. (Only with --threads, each worker thread runs its own test, and the
+ * threads the tests start cannot tell which test is theirs.) */
+struct acutest_current_ {
+    const struct acutest_test_* test;
+    int index;
+    int already_logged;
+    struct acutest_buffer_ log_buf;     /* Details of the failures (see acutest_test_log_on_). */
+    size_t log_total;
+};
+static struct acutest_current_ acutest_process_current_ = { NULL, 0, 0, { NULL, 0, 0 }, 0 };
+static ACUTEST_THREAD_LOCAL_ struct acutest_current_* acutest_current_ = &acutest_process_current_;
+
+static ACUTEST_THREAD_LOCAL_ char acutest_case_name_[TEST_CASE_MAXSIZE] = "";
+ACUTEST_THREAD_LOCAL_ int acutest_test_check_count_ = 0;
+ACUTEST_THREAD_LOCAL_ int acutest_check_fast_ = 0;
+ACUTEST_THREAD_LOCAL_ const void* acutest_param_ = NULL;
+static ACUTEST_THREAD_LOCAL_ int acutest_test_skip_count_ = 0;
+static ACUTEST_THREAD_LOCAL_ char acutest_test_skip_reason_[256] = "";
+static ACUTEST_THREAD_LOCAL_ int acutest_case_already_logged_ = 0;
 static int acutest_verbose_level_ = 2;
-static int acutest_test_failures_ = 0;
+static ACUTEST_THREAD_LOCAL_ int acutest_test_failures_ = 0;
+
+/* Checks made from other threads of the test. The thread running the test is
+ * number 1, the others get their numbers when they first use the checks. They
+ * count their checks atomically aside, and they serialize their output with
+ * the lock (which is recursive per thread). */
+static ACUTEST_THREAD_LOCAL_ int acutest_thread_no_ = 0;
+static ACUTEST_THREAD_LOCAL_ int acutest_lock_depth_ = 0;
+static volatile long acutest_thread_count_ = 1;
+static volatile long acutest_thread_checks_ = 0;
+static volatile long acutest_thread_failures_ = 0;
+static volatile long acutest_lock_word_ = 0;
 static int acutest_colorize_ = 0;
 static int acutest_timer_ = 0;
+static int acutest_jobs_ = 1;
+static int acutest_threads_ = 1;            /* Count of threads for TEST_THREAD_SAFE tests (see --threads). */
+static const char* acutest_coordinator_ = NULL;     /* Address to listen on for agents (see --coordinator). */
+static const char* acutest_agent_ = NULL;           /* Address of the coordinator to serve (see --agent). */
+static int acutest_persistent_ = 0;
+static int acutest_persistent_max_tests_ = 0;
+static long acutest_persistent_max_rss_ = 0;     /* in kB */
+static int acutest_report_fd_ = -1;         /* Pipe to the parent, in a child process (see acutest_report_()). */
+static const char* acutest_rerun_file_ = NULL;
+static int acutest_watch_ = 0;              /* Rerun the tests whenever the binary is rebuilt (see --watch). */
+static int acutest_fail_fast_ = 0;          /* Stop after that many failed tests, or 0. */
+static int acutest_n_failed_ = 0;           /* Count of failed (or timed out) tests so far. */
+static int acutest_n_not_run_ = 0;          /* Count of tests left out because of --fail-fast. */
+static int acutest_repeat_ = 0;             /* Count of runs of each test (see --repeat), or 0. */
+static int acutest_until_fail_ = 0;
+static const char* acutest_timing_db_file_ = NULL;
+static FILE* acutest_timing_db_ = NULL;
+static ACUTEST_THREAD_LOCAL_ double acutest_test_cpu_start_ = 0.0;
+static ACUTEST_THREAD_LOCAL_ double acutest_test_cpu_time_ = -1.0;
+static int acutest_list_only_ = 0;
+static int acutest_shard_ = 0;          /* 1-based; 0 if not sharding. */
+static int acutest_shard_count_ = 0;
+static int acutest_shard_by_duration_ = 0;
+static double acutest_timeout_ = 0.0;    /* 0 if none. */
+static double acutest_bench_time_ = 0.5;
+static const char* acutest_perf_counters_arg_ = NULL;
+static unsigned acutest_perf_mask_ = 0;     /* Bit for each requested counter. */
+static ACUTEST_THREAD_LOCAL_ double acutest_perf_values_[ACUTEST_PERF_MAX_];
+static ACUTEST_THREAD_LOCAL_ struct acutest_rusage_ acutest_test_rusage_;
+static long acutest_max_rss_ = 0;       /* in kB; 0 if unlimited. */
+static int acutest_bench_samples_ = 10;
+static int acutest_warmup_ = 0;         /* Count of warm-up runs of each test (see --warmup). */
+static ACUTEST_THREAD_LOCAL_ int acutest_warmup_running_ = 0;
+static int acutest_env_report_ = 0;
+static const char* acutest_bench_report_file_ = NULL;
+static int* acutest_name_index_ = NULL;
+static unsigned acutest_name_index_mask_ = 0;
+
+struct acutest_word_ {
+    int test;           /* The word is acutest_list_[test].name[off, off+len). */
+    int off;
+    int len;
+    int first;          /* Head of the list of the tests containing the word. */
+};
+struct acutest_word_test_ {
+    int test;           /* Index into acutest_list_. */
+    int next;           /* Next in the list, or -1. */
+};
+static int* acutest_word_index_ = NULL;     /* Index into acutest_words_, or -1 for a free slot. */
+static unsigned acutest_word_index_mask_ = 0;
+static struct acutest_word_* acutest_words_ = NULL;
+static struct acutest_word_test_* acutest_word_tests_ = NULL;
+static const char* acutest_baseline_file_ = NULL;
+static double acutest_max_regression_ = 10.0;     /* in percent */
+static struct acutest_baseline_test_* acutest_baseline_tests_ = NULL;
+static struct acutest_baseline_bench_* acutest_baseline_benches_ = NULL;
+static int acutest_baseline_n_benches_ = 0;
+
+static ACUTEST_THREAD_LOCAL_ int acutest_abort_has_jmp_buf_ = 0;
+static ACUTEST_THREAD_LOCAL_ jmp_buf acutest_abort_jmp_buf_;
+
+/* Output layer.
+ *
+ * All our output is composed in a small line buffer, so that e.g. a line
+ * about a passed check takes just few memcpy()s and one fwrite() into stdio
+ * instead of a dozen of printf() calls. Every complete line is handed over to
+ * stdio immediately. (Stdio remains the only real buffer, so our output and
+ * any output of the tests themselves keep their mutual order. When stdout is
+ * not a terminal, it gets a large buffer which is flushed at test
+ * boundaries, or when a child process is about to be forked.) */
+#ifndef va_copy
+    #ifdef __va_copy
+        #define ACUTEST_VA_COPY_(dst, src)      __va_copy(dst, src)
+    #else
+        #define ACUTEST_VA_COPY_(dst, src)      ((dst) = (src))
+    #endif
+#else
+    #define ACUTEST_VA_COPY_(dst, src)          va_copy(dst, src)
+#endif
 
-static int acutest_abort_has_jmp_buf_ = 0;
-static jmp_buf acutest_abort_jmp_buf_;
+#define ACUTEST_OUT_SIZE_       1024
+#define ACUTEST_STDOUT_SIZE_    (64 * 1024)
 
-static int
-acutest_count_(enum acutest_state_ state)
+static ACUTEST_THREAD_LOCAL_ char acutest_out_buf_[ACUTEST_OUT_SIZE_];
+static ACUTEST_THREAD_LOCAL_ size_t acutest_out_len_ = 0;
+static int acutest_out_muted_ = 0;      /* Suppress the human-readable output (see --format=jsonl). */
+/* If set, the output of the thread goes there instead (see --threads). */
+static ACUTEST_THREAD_LOCAL_ struct acutest_buffer_* acutest_out_capture_ = NULL;
+
+static void acutest_buffer_append_(struct acutest_buffer_* buf, const void* data, size_t size);
+
+static void
+acutest_out_emit_(const char* str, size_t n)
 {
-    int i, n;
+    if(acutest_out_capture_ != NULL)
+        acutest_buffer_append_(acutest_out_capture_, str, n);
+    else
+        fwrite(str, 1, n, stdout);
+}
 
-    for(i = 0, n = 0; i < acutest_list_size_; i++) {
-        if(acutest_test_data_[i].state == state)
-            n++;
+static void
+acutest_out_flush_(void)
+{
+    if(acutest_out_len_ > 0) {
+        acutest_out_emit_(acutest_out_buf_, acutest_out_len_);
+        acutest_out_len_ = 0;
     }
+}
 
-    return n;
+/* Write, even if muted. */
+static void
+acutest_out_put_(const char* str, size_t n)
+{
+    if(acutest_out_len_ + n > ACUTEST_OUT_SIZE_) {
+        acutest_out_flush_();
+        if(n > ACUTEST_OUT_SIZE_) {
+            acutest_out_emit_(str, n);
+            return;
+        }
+    }
+
+    memcpy(acutest_out_buf_ + acutest_out_len_, str, n);
+    acutest_out_len_ += n;
+    if(memchr(str, '\n', n) != NULL)
+        acutest_out_flush_();
 }
 
 static void
-acutest_cleanup_(void)
+acutest_out_write_(const char* str, size_t n)
 {
-    free((void*) acutest_test_data_);
+    if(!acutest_out_muted_)
+        acutest_out_put_(str, n);
 }
 
-static void ACUTEST_ATTRIBUTE_(noreturn)
-acutest_exit_(int exit_code)
+/* Decimal integer without going through vsnprintf(); used for the frequent
+ * "file:line: " prefix. */
+static void
+acutest_out_int_(int val)
 {
-    acutest_cleanup_();
-    exit(exit_code);
+    char buf[16];
+    char* p = buf + sizeof(buf);
+    unsigned u = (val < 0) ? 0u - (unsigned) val : (unsigned) val;
+
+    do {
+        *--p = (char) ('0' + u % 10);
+        u /= 10;
+    } while(u != 0);
+    if(val < 0)
+        *--p = '-';
+
+    acutest_out_write_(p, (size_t) (buf + sizeof(buf) - p));
 }
 
+static int
+acutest_out_vprintf_(const char* fmt, va_list args)
+{
+    size_t avail = ACUTEST_OUT_SIZE_ - acutest_out_len_;
+    va_list args_copy;
+    int n;
 
-#if defined ACUTEST_WIN_
-    typedef LARGE_INTEGER acutest_timer_type_;
-    static LARGE_INTEGER acutest_timer_freq_;
-    static acutest_timer_type_ acutest_timer_start_;
-    static acutest_timer_type_ acutest_timer_end_;
+    if(acutest_out_muted_)
+        return 0;
 
-    static void
-    acutest_timer_init_(void)
-    {
-        QueryPerformanceFrequency(&acutest_timer_freq_);
-    }
+    ACUTEST_VA_COPY_(args_copy, args);
+    n = vsnprintf(acutest_out_buf_ + acutest_out_len_, avail, fmt, args_copy);
+    va_end(args_copy);
+    if(n < 0)
+        return n;
 
-    static void
-    acutest_timer_get_time_(LARGE_INTEGER* ts)
-    {
-        QueryPerformanceCounter(ts);
+    if((size_t) n >= avail) {
+        /* Does not fit. */
+        acutest_out_flush_();
+        if((size_t) n >= ACUTEST_OUT_SIZE_) {
+            char* tmp;
+
+            if(acutest_out_capture_ == NULL)
+                return vprintf(fmt, args);
+            tmp = (char*) malloc((size_t) n + 1);
+            if(tmp == NULL)
+                return -1;
+            n = vsnprintf(tmp, (size_t) n + 1, fmt, args);
+            if(n > 0)
+                acutest_out_emit_(tmp, (size_t) n);
+            free(tmp);
+            return n;
+        }
+        n = vsnprintf(acutest_out_buf_, ACUTEST_OUT_SIZE_, fmt, args);
     }
 
-    static double
-    acutest_timer_diff_(LARGE_INTEGER start, LARGE_INTEGER end)
-    {
-        double duration = (double)(end.QuadPart - start.QuadPart);
-        duration /= (double)acutest_timer_freq_.QuadPart;
-        return duration;
+    if(memchr(acutest_out_buf_ + acutest_out_len_, '\n', (size_t) n) != NULL) {
+        acutest_out_len_ += (size_t) n;
+        acutest_out_flush_();
+    } else {
+        acutest_out_len_ += (size_t) n;
     }
+    return n;
+}
 
-    static void
-    acutest_timer_print_diff_(void)
-    {
-        printf("%.6lf secs", acutest_timer_diff_(acutest_timer_start_, acutest_timer_end_));
-    }
-#elif defined ACUTEST_HAS_POSIX_TIMER_
-    static clockid_t acutest_timer_id_;
+static int ACUTEST_ATTRIBUTE_(format (printf, 1, 2))
+acutest_out_printf_(const char* fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = acutest_out_vprintf_(fmt, args);
+    va_end(args);
+    return n;
+}
+
+/* Flush our output all the way out of the process. */
+static void
+acutest_out_flush_all_(void)
+{
+    acutest_out_flush_();
+    fflush(stdout);
+    fflush(stderr);
+}
+
+/* With the large stdout buffer, a crashing test would take the lines about
+ * its failures away with it. So each of them is written out right away.
+ * (Failures are rare, so this costs next to nothing. What the test itself
+ * writes into stdio can still be lost if it crashes.) */
+static void
+acutest_out_flush_failure_(void)
+{
+    if(acutest_out_capture_ == NULL)
+        fflush(stdout);
+}
+
+static int
+acutest_count_(enum acutest_state_ state)
+{
+    int i, n;
+
+    for(i = 0, n = 0; i < acutest_list_size_; i++) {
+        if(acutest_test_data_[i].state == state)
+            n++;
+    }
+
+    return n;
+}
+
+static void
+acutest_cleanup_(void)
+{
+    int i;
+
+    /* (A child process is about to exit, so it does not have to walk all the
+     * tests. That would make each test cost as much as their count.) */
+    if(acutest_test_data_ != NULL  &&  !acutest_worker_) {
+        for(i = 0; i < acutest_list_size_; i++) {
+            free(acutest_test_data_[i].benches);
+            free(acutest_test_data_[i].log.data);
+            free(acutest_test_data_[i].repeat_durations);
+        }
+    }
+    free(acutest_registered_list_);
+    free(acutest_expanded_list_);
+    free(acutest_expanded_names_);
+    free(acutest_process_current_.log_buf.data);
+    free((void*) acutest_test_data_);
+    free(acutest_name_index_);
+    free(acutest_word_index_);
+    free(acutest_words_);
+    free(acutest_word_tests_);
+    free(acutest_baseline_tests_);
+    free(acutest_baseline_benches_);
+}
+
+static void ACUTEST_ATTRIBUTE_(noreturn)
+acutest_exit_(int exit_code)
+{
+    acutest_out_flush_();
+    acutest_cleanup_();
+    exit(exit_code);
+}
+
+
+#if defined ACUTEST_WIN_
+    typedef LARGE_INTEGER acutest_timer_type_;
+    static LARGE_INTEGER acutest_timer_freq_;
+    static ACUTEST_THREAD_LOCAL_ acutest_timer_type_ acutest_timer_start_;
+    static ACUTEST_THREAD_LOCAL_ acutest_timer_type_ acutest_timer_end_;
+
+    static void
+    acutest_timer_init_(void)
+    {
+        QueryPerformanceFrequency(&acutest_timer_freq_);
+    }
+
+    static void
+    acutest_timer_get_time_(LARGE_INTEGER* ts)
+    {
+        QueryPerformanceCounter(ts);
+    }
+
+    static double
+    acutest_timer_diff_(LARGE_INTEGER start, LARGE_INTEGER end)
+    {
+        double duration = (double)(end.QuadPart - start.QuadPart);
+        duration /= (double)acutest_timer_freq_.QuadPart;
+        return duration;
+    }
+
+    static void
+    acutest_timer_print_diff_(void)
+    {
+        acutest_out_printf_("%.6lf secs", acutest_timer_diff_(acutest_timer_start_, acutest_timer_end_));
+    }
+#elif defined ACUTEST_HAS_POSIX_TIMER_
+    static clockid_t acutest_timer_id_;
     typedef struct timespec acutest_timer_type_;
-    static acutest_timer_type_ acutest_timer_start_;
-    static acutest_timer_type_ acutest_timer_end_;
+    static ACUTEST_THREAD_LOCAL_ acutest_timer_type_ acutest_timer_start_;
+    static ACUTEST_THREAD_LOCAL_ acutest_timer_type_ acutest_timer_end_;
 
     static void
     acutest_timer_init_(void)
     {
-        if(acutest_timer_ == 1)
-            acutest_timer_id_ = CLOCK_MONOTONIC;
-        else if(acutest_timer_ == 2)
+        if(acutest_timer_ == 2)
             acutest_timer_id_ = CLOCK_PROCESS_CPUTIME_ID;
+        else
+            acutest_timer_id_ = CLOCK_MONOTONIC;
     }
 
     static void
@@ -535,13 +1491,13 @@ acutest_exit_(int exit_code)
     static void
     acutest_timer_print_diff_(void)
     {
-        printf("%.6lf secs",
+        acutest_out_printf_("%.6lf secs",
             acutest_timer_diff_(acutest_timer_start_, acutest_timer_end_));
     }
 #else
     typedef int acutest_timer_type_;
-    static acutest_timer_type_ acutest_timer_start_;
-    static acutest_timer_type_ acutest_timer_end_;
+    static ACUTEST_THREAD_LOCAL_ acutest_timer_type_ acutest_timer_start_;
+    static ACUTEST_THREAD_LOCAL_ acutest_timer_type_ acutest_timer_end_;
 
     void
     acutest_timer_init_(void)
@@ -566,6 +1522,206 @@ acutest_exit_(int exit_code)
     {}
 #endif
 
+
+static void
+acutest_buffer_append_(struct acutest_buffer_* buf, const void* data, size_t size)
+{
+    if(buf->size + size > buf->alloc) {
+        size_t new_alloc = (buf->alloc > 0 ? buf->alloc * 2 : 4096);
+        char* new_data;
+
+        while(new_alloc < buf->size + size)
+            new_alloc *= 2;
+        new_data = (char*) realloc(buf->data, new_alloc);
+        if(new_data == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            acutest_exit_(2);
+        }
+        buf->data = new_data;
+        buf->alloc = new_alloc;
+    }
+
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+static void
+acutest_buffer_free_(struct acutest_buffer_* buf)
+{
+    free(buf->data);
+    buf->data = NULL;
+    buf->size = 0;
+    buf->alloc = 0;
+}
+
+/* Events of --format=jsonl. Each one is a JSON object on a line of its own,
+ * composed here field by field and sent out by acutest_event_end_(). */
+static ACUTEST_THREAD_LOCAL_ struct acutest_buffer_ acutest_event_;
+
+/* Length of the valid UTF-8 sequence at s, or 0 if it is not valid. */
+static size_t
+acutest_utf8_len_(const unsigned char* s, size_t n)
+{
+    size_t len, i;
+
+    if(s[0] < 0x80)
+        return 1;
+    else if(s[0] >= 0xc2  &&  s[0] <= 0xdf)
+        len = 2;
+    else if((s[0] & 0xf0) == 0xe0)
+        len = 3;
+    else if(s[0] >= 0xf0  &&  s[0] <= 0xf4)
+        len = 4;
+    else
+        return 0;
+
+    if(len > n)
+        return 0;
+    for(i = 1; i < len; i++) {
+        if((s[i] & 0xc0) != 0x80)
+            return 0;
+    }
+    return len;
+}
+
+/* Append the data as a JSON string. Bytes which do not form valid UTF-8
+ * (the test output may be anything) are taken as Latin-1. */
+static void
+acutest_json_mem_(struct acutest_buffer_* buf, const char* data, size_t size)
+{
+    static const char xdigits[] = "0123456789abcdef";
+    const unsigned char* s = (const unsigned char*) data;
+    const unsigned char* end = s + size;
+
+    acutest_buffer_append_(buf, "\"", 1);
+    while(s < end) {
+        const unsigned char* run = s;
+        size_t len;
+
+        while(s < end  &&  *s >= 0x20  &&  *s != '"'  &&  *s != '\\'  &&
+              (len = acutest_utf8_len_(s, (size_t) (end - s))) > 0)
+            s += len;
+        if(s > run)
+            acutest_buffer_append_(buf, (const char*) run, (size_t) (s - run));
+        if(s >= end)
+            break;
+
+        switch(*s) {
+            case '"':   acutest_buffer_append_(buf, "\\\"", 2); break;
+            case '\\':  acutest_buffer_append_(buf, "\\\\", 2); break;
+            case '\n':  acutest_buffer_append_(buf, "\\n", 2); break;
+            case '\r':  acutest_buffer_append_(buf, "\\r", 2); break;
+            case '\t':  acutest_buffer_append_(buf, "\\t", 2); break;
+            default:
+            {
+                char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+                esc[4] = xdigits[*s >> 4];
+                esc[5] = xdigits[*s & 0xf];
+                acutest_buffer_append_(buf, esc, 6);
+                break;
+            }
+        }
+        s++;
+    }
+    acutest_buffer_append_(buf, "\"", 1);
+}
+
+static void
+acutest_json_str_(struct acutest_buffer_* buf, const char* str)
+{
+    acutest_json_mem_(buf, str, strlen(str));
+}
+
+static void
+acutest_json_printf_(struct acutest_buffer_* buf, const char* fmt, ...)
+{
+    char tmp[64];
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(tmp, sizeof(tmp), fmt, args);
+    va_end(args);
+    if(n > 0)
+        acutest_buffer_append_(buf, tmp, ((size_t) n < sizeof(tmp)) ? (size_t) n : sizeof(tmp) - 1);
+}
+
+static void
+acutest_event_key_(const char* key)
+{
+    acutest_buffer_append_(&acutest_event_, ",", 1);
+    acutest_json_str_(&acutest_event_, key);
+    acutest_buffer_append_(&acutest_event_, ":", 1);
+}
+
+static void
+acutest_event_str_(const char* key, const char* val)
+{
+    acutest_event_key_(key);
+    acutest_json_str_(&acutest_event_, val);
+}
+
+static void
+acutest_event_int_(const char* key, long val)
+{
+    acutest_event_key_(key);
+    acutest_json_printf_(&acutest_event_, "%ld", val);
+}
+
+static void
+acutest_event_num_(const char* key, double val)
+{
+    acutest_event_key_(key);
+    acutest_json_printf_(&acutest_event_, "%.9g", val);
+}
+
+static void
+acutest_event_bool_(const char* key, int val)
+{
+    acutest_event_key_(key);
+    acutest_buffer_append_(&acutest_event_, val ? "true" : "false", val ? 4 : 5);
+}
+
+/* Start a new event. The test name may be NULL for events of the whole run. */
+static void
+acutest_event_begin_(const char* event, const char* test_name)
+{
+    acutest_event_.size = 0;
+    acutest_buffer_append_(&acutest_event_, "{\"event\":", 9);
+    acutest_json_str_(&acutest_event_, event);
+    if(test_name != NULL)
+        acutest_event_str_("test", test_name);
+    if(acutest_thread_no_ > 1)
+        acutest_event_int_("thread", acutest_thread_no_);
+}
+
+static void acutest_event_end_(void);
+
+/* CPU time consumed by the current process so far, in seconds. */
+static double
+acutest_cpu_time_(void)
+{
+#if defined ACUTEST_WIN_
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    ULARGE_INTEGER k, u;
+
+    if(!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+        return 0.0;
+    k.LowPart = kernel_time.dwLowDateTime;
+    k.HighPart = kernel_time.dwHighDateTime;
+    u.LowPart = user_time.dwLowDateTime;
+    u.HighPart = user_time.dwHighDateTime;
+    return (double)(k.QuadPart + u.QuadPart) / 1e7;
+#elif defined ACUTEST_HAS_POSIX_TIMER_
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#else
+    return (double) clock() / (double) CLOCKS_PER_SEC;
+#endif
+}
+
 #define ACUTEST_COLOR_DEFAULT_              0
 #define ACUTEST_COLOR_RED_                  1
 #define ACUTEST_COLOR_GREEN_                2
@@ -575,46 +1731,48 @@ acutest_exit_(int exit_code)
 #define ACUTEST_COLOR_GREEN_INTENSIVE_      12
 #define ACUTEST_COLOR_YELLOW_INTENSIVE_     13
 
-static int ACUTEST_ATTRIBUTE_(format (printf, 2, 3))
-acutest_colored_printf_(int color, const char* fmt, ...)
-{
-    va_list args;
-    char buffer[256];
-    int n;
-
-    va_start(args, fmt);
-    vsnprintf(buffer, sizeof(buffer), fmt, args);
-    va_end(args);
-    buffer[sizeof(buffer)-1] = '\0';
+/* ANSI escape sequences of the colors (indexed by ACUTEST_COLOR_xxx_). */
+#if defined ACUTEST_UNIX_
+static const struct {
+    const char* str;
+    size_t len;
+} acutest_color_str_[] = {
+    { "\033[0m", 4 },       /* ACUTEST_COLOR_DEFAULT_ */
+    { "\033[0;31m", 7 },    /* ACUTEST_COLOR_RED_ */
+    { "\033[0;32m", 7 },    /* ACUTEST_COLOR_GREEN_ */
+    { "\033[0;33m", 7 },    /* ACUTEST_COLOR_YELLOW_ */
+    { NULL, 0 }, { NULL, 0 }, { NULL, 0 }, { NULL, 0 }, { NULL, 0 }, { NULL, 0 },
+    { "\033[1m", 4 },       /* ACUTEST_COLOR_DEFAULT_INTENSIVE_ */
+    { "\033[1;31m", 7 },    /* ACUTEST_COLOR_RED_INTENSIVE_ */
+    { "\033[1;32m", 7 },    /* ACUTEST_COLOR_GREEN_INTENSIVE_ */
+    { "\033[1;33m", 7 }     /* ACUTEST_COLOR_YELLOW_INTENSIVE_ */
+};
+#endif
 
-    if(!acutest_colorize_) {
-        return printf("%s", buffer);
+/* Write the string in the given color. */
+static void
+acutest_colored_write_(int color, const char* str, size_t n)
+{
+    if(!acutest_colorize_  ||  acutest_out_muted_) {
+        acutest_out_write_(str, n);
+        return;
     }
 
 #if defined ACUTEST_UNIX_
-    {
-        const char* col_str;
-        switch(color) {
-            case ACUTEST_COLOR_RED_:                col_str = "\033[0;31m"; break;
-            case ACUTEST_COLOR_GREEN_:              col_str = "\033[0;32m"; break;
-            case ACUTEST_COLOR_YELLOW_:             col_str = "\033[0;33m"; break;
-            case ACUTEST_COLOR_RED_INTENSIVE_:      col_str = "\033[1;31m"; break;
-            case ACUTEST_COLOR_GREEN_INTENSIVE_:    col_str = "\033[1;32m"; break;
-            case ACUTEST_COLOR_YELLOW_INTENSIVE_:   col_str = "\033[1;33m"; break;
-            case ACUTEST_COLOR_DEFAULT_INTENSIVE_:  col_str = "\033[1m"; break;
-            default:                                col_str = "\033[0m"; break;
-        }
-        printf("%s", col_str);
-        n = printf("%s", buffer);
-        printf("\033[0m");
-        return n;
-    }
+    acutest_out_write_(acutest_color_str_[color].str, acutest_color_str_[color].len);
+    acutest_out_write_(str, n);
+    acutest_out_write_(acutest_color_str_[ACUTEST_COLOR_DEFAULT_].str, acutest_color_str_[ACUTEST_COLOR_DEFAULT_].len);
 #elif defined ACUTEST_WIN_
     {
         HANDLE h;
         CONSOLE_SCREEN_BUFFER_INFO info;
         WORD attr;
 
+        /* The console attributes apply to what is written after setting
+         * them, so we cannot keep anything pending. */
+        acutest_out_flush_();
+        fflush(stdout);
+
         h = GetStdHandle(STD_OUTPUT_HANDLE);
         GetConsoleScreenBufferInfo(h, &info);
 
@@ -630,16 +1788,36 @@ acutest_colored_printf_(int color, const char* fmt, ...)
         }
         if(attr != 0)
             SetConsoleTextAttribute(h, attr);
-        n = printf("%s", buffer);
+        fwrite(str, 1, n, stdout);
+        fflush(stdout);
         SetConsoleTextAttribute(h, info.wAttributes);
-        return n;
     }
 #else
-    n = printf("%s", buffer);
-    return n;
+    (void) color;
+    acutest_out_write_(str, n);
 #endif
 }
 
+static int ACUTEST_ATTRIBUTE_(format (printf, 2, 3))
+acutest_colored_printf_(int color, const char* fmt, ...)
+{
+    va_list args;
+    char buffer[256];
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    buffer[sizeof(buffer)-1] = '\0';
+    if(n < 0)
+        return n;
+    if(n >= (int) sizeof(buffer))
+        n = (int) sizeof(buffer) - 1;
+
+    acutest_colored_write_(color, buffer, (size_t) n);
+    return n;
+}
+
 static const char*
 acutest_basename_(const char* path)
 {
@@ -675,7 +1853,7 @@ acutest_begin_test_line_(const struct acutest_test_* test)
     if(!acutest_tap_) {
         if(acutest_verbose_level_ >= 3) {
             acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Test %s:\n", test->name);
-            acutest_test_already_logged_++;
+            acutest_current_->already_logged++;
         } else if(acutest_verbose_level_ >= 1) {
             int n;
             char spaces[48];
@@ -683,9 +1861,9 @@ acutest_begin_test_line_(const struct acutest_test_* test)
             n = acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Test %s... ", test->name);
             memset(spaces, ' ', sizeof(spaces));
             if(n < (int) sizeof(spaces))
-                printf("%.*s", (int) sizeof(spaces) - n, spaces);
+                acutest_out_printf_("%.*s", (int) sizeof(spaces) - n, spaces);
         } else {
-            acutest_test_already_logged_ = 1;
+            acutest_current_->already_logged = 1;
         }
     }
 }
@@ -694,16 +1872,17 @@ static void
 acutest_finish_test_line_(enum acutest_state_ state)
 {
     if(acutest_tap_) {
-        printf("%s %d - %s%s\n",
+        acutest_out_printf_("%s %d - %s%s\n",
                 (state == ACUTEST_STATE_SUCCESS || state == ACUTEST_STATE_SKIPPED) ? "ok" : "not ok",
-                acutest_current_index_ + 1,
-                acutest_current_test_->name,
-                (state == ACUTEST_STATE_SKIPPED) ? " # SKIP" : "");
+                acutest_current_->index + 1,
+                acutest_current_->test->name,
+                (state == ACUTEST_STATE_SKIPPED) ? " # SKIP" :
+                (state == ACUTEST_STATE_TIMEOUT) ? " # TIMEOUT" : "");
 
         if(state == ACUTEST_STATE_SUCCESS  &&  acutest_timer_) {
-            printf("# Duration: ");
+            acutest_out_printf_("# Duration: ");
             acutest_timer_print_diff_();
-            printf("\n");
+            acutest_out_printf_("\n");
         }
     } else {
         int color;
@@ -712,23 +1891,42 @@ acutest_finish_test_line_(enum acutest_state_ state)
         switch(state) {
             case ACUTEST_STATE_SUCCESS: color = ACUTEST_COLOR_GREEN_INTENSIVE_; str = "OK"; break;
             case ACUTEST_STATE_SKIPPED: color = ACUTEST_COLOR_YELLOW_INTENSIVE_; str = "SKIPPED"; break;
+            case ACUTEST_STATE_TIMEOUT: color = ACUTEST_COLOR_RED_INTENSIVE_; str = "TIMEOUT"; break;
             case ACUTEST_STATE_FAILED:  /* Fall through. */
             default:                    color = ACUTEST_COLOR_RED_INTENSIVE_; str = "FAILED"; break;
         }
 
-        printf("[ ");
+        acutest_out_printf_("[ ");
         acutest_colored_printf_(color, "%s", str);
-        printf(" ]");
+        acutest_out_printf_(" ]");
 
         if(state == ACUTEST_STATE_SUCCESS  &&  acutest_timer_) {
-            printf("  ");
+            acutest_out_printf_("  ");
             acutest_timer_print_diff_();
         }
 
-        printf("\n");
+        acutest_out_printf_("\n");
     }
 }
 
+static void
+acutest_lock_(void)
+{
+    if(acutest_thread_no_ == 0)
+        acutest_thread_no_ = (int) ACUTEST_ATOMIC_INC_(acutest_thread_count_);
+    if(acutest_lock_depth_++ > 0)
+        return;
+    while(ACUTEST_ATOMIC_XCHG_(acutest_lock_word_, 1) != 0)
+        ACUTEST_YIELD_();
+}
+
+static void
+acutest_unlock_(void)
+{
+    if(--acutest_lock_depth_ == 0)
+        ACUTEST_ATOMIC_RELEASE_(acutest_lock_word_);
+}
+
 static void
 acutest_line_indent_(int level)
 {
@@ -737,14 +1935,17 @@ acutest_line_indent_(int level)
 
     if(acutest_tap_  &&  n > 0) {
         n--;
-        printf("#");
+        acutest_out_write_("#", 1);
     }
 
     while(n > 16) {
-        printf("%s", spaces);
+        acutest_out_write_(spaces, 16);
         n -= 16;
     }
-    printf("%.*s", n, spaces);
+    acutest_out_write_(spaces, (size_t) n);
+
+    if(acutest_thread_no_ > 1  &&  level > 0)
+        acutest_out_printf_("[thread %d] ", acutest_thread_no_);
 }
 
 void ACUTEST_ATTRIBUTE_(format (printf, 3, 4))
@@ -753,6 +1954,10 @@ acutest_skip_(const char* file, int line, const char* fmt, ...)
     va_list args;
     size_t reason_len;
 
+    if(acutest_warmup_running_)
+        return;     /* See --warmup. */
+
+    acutest_lock_();
     va_start(args, fmt);
     vsnprintf(acutest_test_skip_reason_, sizeof(acutest_test_skip_reason_), fmt, args);
     va_end(args);
@@ -765,33 +1970,48 @@ acutest_skip_(const char* file, int line, const char* fmt, ...)
 
     if(acutest_test_check_count_ > 0) {
         acutest_check_(0, file, line, "Cannot skip, already performed some checks");
+        acutest_unlock_();
         return;
     }
 
+    if(acutest_jsonl_) {
+        acutest_event_begin_("skip", (acutest_current_->test != NULL) ? acutest_current_->test->name : NULL);
+        if(file != NULL) {
+            acutest_event_str_("file", acutest_basename_(file));
+            acutest_event_int_("line", line);
+        }
+        acutest_event_str_("reason", acutest_test_skip_reason_);
+        acutest_event_end_();
+    }
+
     if(acutest_verbose_level_ >= 2) {
         const char *result_str = "skipped";
         int result_color = ACUTEST_COLOR_YELLOW_;
 
-        if(!acutest_test_already_logged_  &&  acutest_current_test_ != NULL)
+        if(!acutest_current_->already_logged  &&  acutest_current_->test != NULL)
             acutest_finish_test_line_(ACUTEST_STATE_SKIPPED);
-        acutest_test_already_logged_++;
+        acutest_current_->already_logged++;
 
         acutest_line_indent_(1);
 
         if(file != NULL) {
             file = acutest_basename_(file);
-            printf("%s:%d: ", file, line);
+            acutest_out_printf_("%s:%d: ", file, line);
         }
 
-        printf("%s... ", acutest_test_skip_reason_);
+        acutest_out_printf_("%s... ", acutest_test_skip_reason_);
         acutest_colored_printf_(result_color, "%s", result_str);
-        printf("\n");
-        acutest_test_already_logged_++;
+        acutest_out_printf_("\n");
+        acutest_current_->already_logged++;
     }
 
     acutest_test_skip_count_++;
+    acutest_check_fast_ = 0;
+    acutest_unlock_();
 }
 
+static void acutest_test_log_(const char* text, size_t size);
+
 int ACUTEST_ATTRIBUTE_(format (printf, 4, 5))
 acutest_check_(int cond, const char* file, int line, const char* fmt, ...)
 {
@@ -799,6 +2019,21 @@ acutest_check_(int cond, const char* file, int line, const char* fmt, ...)
     int result_color;
     int verbose_level;
 
+    if(acutest_warmup_running_) {
+        /* See --warmup. */
+        acutest_cond_failed_ = 0;
+        return cond;
+    }
+
+    if(acutest_thread_no_ != 1  &&  cond  &&  acutest_verbose_level_ < 3  &&  !acutest_jsonl_) {
+        /* Another thread of the test, nothing to print. */
+        ACUTEST_ATOMIC_INC_(acutest_thread_checks_);
+        acutest_cond_failed_ = 0;
+        return 1;
+    }
+
+    acutest_lock_();
+
     if(acutest_test_skip_count_) {
         /* We've skipped the test. We shouldn't be here: The test implementation
          * should have already return before. So lets suppress the following
@@ -807,16 +2042,59 @@ acutest_check_(int cond, const char* file, int line, const char* fmt, ...)
         goto skip_check;
     }
 
+    if(acutest_jsonl_) {
+        char buffer[TEST_MSG_MAXSIZE];
+        va_list args;
+
+        va_start(args, fmt);
+        vsnprintf(buffer, sizeof(buffer), fmt, args);
+        va_end(args);
+        buffer[sizeof(buffer)-1] = '\0';
+
+        acutest_event_begin_("check", (acutest_current_->test != NULL) ? acutest_current_->test->name : NULL);
+        if(acutest_case_name_[0])
+            acutest_event_str_("case", acutest_case_name_);
+        if(file != NULL) {
+            acutest_event_str_("file", acutest_basename_(file));
+            acutest_event_int_("line", line);
+        }
+        acutest_event_bool_("ok", cond);
+        acutest_event_str_("message", buffer);
+        acutest_event_end_();
+    }
+
     if(cond) {
         result_str = "ok";
         result_color = ACUTEST_COLOR_GREEN_;
         verbose_level = 3;
     } else {
-        if(!acutest_test_already_logged_  &&  acutest_current_test_ != NULL)
+        if(!acutest_current_->already_logged  &&  acutest_current_->test != NULL)
             acutest_finish_test_line_(ACUTEST_STATE_FAILED);
 
-        acutest_test_failures_++;
-        acutest_test_already_logged_++;
+        if(acutest_thread_no_ == 1)
+            acutest_test_failures_++;
+        else
+            ACUTEST_ATOMIC_INC_(acutest_thread_failures_);
+        acutest_current_->already_logged++;
+
+        if(acutest_test_log_on_) {
+            char buffer[TEST_MSG_MAXSIZE];
+            va_list args;
+            int n = 0;
+
+            if(acutest_thread_no_ > 1)
+                n = snprintf(buffer, sizeof(buffer), "[thread %d] ", acutest_thread_no_);
+            if(file != NULL)
+                n += snprintf(buffer + n, sizeof(buffer) - (size_t) n, "%s:%d: ", acutest_basename_(file), line);
+            if(n >= 0  &&  (size_t) n < sizeof(buffer)) {
+                va_start(args, fmt);
+                vsnprintf(buffer + n, sizeof(buffer) - (size_t) n, fmt, args);
+                va_end(args);
+            }
+            buffer[sizeof(buffer)-2] = '\0';
+            strcat(buffer, "\n");
+            acutest_test_log_(buffer, strlen(buffer));
+        }
 
         result_str = "failed";
         result_color = ACUTEST_COLOR_RED_;
@@ -829,30 +2107,39 @@ acutest_check_(int cond, const char* file, int line, const char* fmt, ...)
         if(!acutest_case_already_logged_  &&  acutest_case_name_[0]) {
             acutest_line_indent_(1);
             acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Case %s:\n", acutest_case_name_);
-            acutest_test_already_logged_++;
+            acutest_current_->already_logged++;
             acutest_case_already_logged_++;
         }
 
         acutest_line_indent_(acutest_case_name_[0] ? 2 : 1);
         if(file != NULL) {
             file = acutest_basename_(file);
-            printf("%s:%d: ", file, line);
+            acutest_out_write_(file, strlen(file));
+            acutest_out_write_(":", 1);
+            acutest_out_int_(line);
+            acutest_out_write_(": ", 2);
         }
 
         va_start(args, fmt);
-        vprintf(fmt, args);
+        acutest_out_vprintf_(fmt, args);
         va_end(args);
 
-        printf("... ");
-        acutest_colored_printf_(result_color, "%s", result_str);
-        printf("\n");
-        acutest_test_already_logged_++;
+        acutest_out_write_("... ", 4);
+        acutest_colored_write_(result_color, result_str, strlen(result_str));
+        acutest_out_write_("\n", 1);
+        acutest_current_->already_logged++;
+        if(!cond)
+            acutest_out_flush_failure_();
     }
 
-    acutest_test_check_count_++;
+    if(acutest_thread_no_ == 1)
+        acutest_test_check_count_++;
+    else
+        ACUTEST_ATOMIC_INC_(acutest_thread_checks_);
 
 skip_check:
     acutest_cond_failed_ = (cond == 0);
+    acutest_unlock_();
     return !acutest_cond_failed_;
 }
 
@@ -861,28 +2148,43 @@ acutest_case_(const char* fmt, ...)
 {
     va_list args;
 
-    if(acutest_verbose_level_ < 2)
+    if((acutest_verbose_level_ < 2  &&  !acutest_jsonl_)  ||  acutest_warmup_running_)
         return;
 
+    acutest_lock_();
     if(acutest_case_name_[0]) {
+        if(acutest_jsonl_  &&  acutest_verbose_level_ >= 3) {
+            acutest_event_begin_("case_end", (acutest_current_->test != NULL) ? acutest_current_->test->name : NULL);
+            acutest_event_str_("case", acutest_case_name_);
+            acutest_event_end_();
+        }
         acutest_case_already_logged_ = 0;
         acutest_case_name_[0] = '\0';
     }
 
-    if(fmt == NULL)
+    if(fmt == NULL) {
+        acutest_unlock_();
         return;
+    }
 
     va_start(args, fmt);
     vsnprintf(acutest_case_name_, sizeof(acutest_case_name_) - 1, fmt, args);
     va_end(args);
     acutest_case_name_[sizeof(acutest_case_name_) - 1] = '\0';
 
+    if(acutest_jsonl_  &&  acutest_verbose_level_ >= 3) {
+        acutest_event_begin_("case_begin", (acutest_current_->test != NULL) ? acutest_current_->test->name : NULL);
+        acutest_event_str_("case", acutest_case_name_);
+        acutest_event_end_();
+    }
+
     if(acutest_verbose_level_ >= 3) {
         acutest_line_indent_(1);
         acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Case %s:\n", acutest_case_name_);
-        acutest_test_already_logged_++;
+        acutest_current_->already_logged++;
         acutest_case_already_logged_++;
     }
+    acutest_unlock_();
 }
 
 void ACUTEST_ATTRIBUTE_(format (printf, 1, 2))
@@ -893,12 +2195,12 @@ acutest_message_(const char* fmt, ...)
     char* line_end;
     va_list args;
 
-    if(acutest_verbose_level_ < 2)
+    if(acutest_verbose_level_ < 2  &&  !acutest_test_log_on_  &&  !acutest_jsonl_)
         return;
 
     /* We allow extra message only when something is already wrong in the
      * current test. */
-    if(acutest_current_test_ == NULL  ||  !acutest_cond_failed_)
+    if(acutest_current_->test == NULL  ||  !acutest_cond_failed_)
         return;
 
     va_start(args, fmt);
@@ -906,19 +2208,112 @@ acutest_message_(const char* fmt, ...)
     va_end(args);
     buffer[TEST_MSG_MAXSIZE-1] = '\0';
 
+    acutest_lock_();
+    if(acutest_test_log_on_) {
+        line_beg = buffer;
+        while(line_beg[0] != '\0') {
+            line_end = strchr(line_beg, '\n');
+            if(line_end == NULL)
+                line_end = line_beg + strlen(line_beg);
+            acutest_test_log_("  ", 2);
+            acutest_test_log_(line_beg, (size_t) (line_end - line_beg));
+            acutest_test_log_("\n", 1);
+            line_beg = (*line_end != '\0') ? line_end + 1 : line_end;
+        }
+    }
+    if(acutest_jsonl_) {
+        acutest_event_begin_("message", acutest_current_->test->name);
+        if(acutest_case_name_[0])
+            acutest_event_str_("case", acutest_case_name_);
+        acutest_event_str_("text", buffer);
+        acutest_event_end_();
+    }
+    if(acutest_verbose_level_ < 2) {
+        acutest_unlock_();
+        return;
+    }
+
     line_beg = buffer;
     while(1) {
         line_end = strchr(line_beg, '\n');
         if(line_end == NULL)
             break;
         acutest_line_indent_(acutest_case_name_[0] ? 3 : 2);
-        printf("%.*s\n", (int)(line_end - line_beg), line_beg);
+        acutest_out_printf_("%.*s\n", (int)(line_end - line_beg), line_beg);
         line_beg = line_end + 1;
     }
     if(line_beg[0] != '\0') {
         acutest_line_indent_(acutest_case_name_[0] ? 3 : 2);
-        printf("%s\n", line_beg);
+        acutest_out_printf_("%s\n", line_beg);
     }
+    acutest_out_flush_failure_();
+    acutest_unlock_();
+}
+
+/* Writes hexadecimal and then printable form of bytes data[beg, end) of a
+ * (part of) line which is `width` bytes wide. If `other` is not NULL, bytes
+ * which differ from it are highlighted. If `pad`, the printable form is padded
+ * to the full width too. If `to` is not NULL, the (uncolored) text is appended
+ * there instead of being written out. */
+static void
+acutest_dump_bytes_(const unsigned char* data, const unsigned char* other,
+                    size_t beg, size_t end, size_t width, int pad, struct acutest_buffer_* to)
+{
+    static const char xdigits[] = "0123456789abcdef";
+    char buf[3 * 64 + 2 + 64];
+    size_t n = 0;
+    size_t off;
+
+    if(width > 64)
+        width = 64;
+
+    for(off = beg; off < beg + width; off++) {
+        if(off >= end) {
+            memcpy(buf + n, "   ", 3);
+            n += 3;
+        } else if(other != NULL  &&  data[off] != other[off]) {
+            char hex[3];
+
+            hex[0] = '*';
+            hex[1] = xdigits[data[off] >> 4];
+            hex[2] = xdigits[data[off] & 0xf];
+            if(acutest_colorize_  &&  to == NULL) {
+                acutest_out_write_(buf, n);
+                acutest_out_write_(hex, 1);
+                acutest_colored_write_(ACUTEST_COLOR_RED_INTENSIVE_, hex + 1, 2);
+                n = 0;
+            } else {
+                memcpy(buf + n, hex, 3);
+                n += 3;
+            }
+        } else {
+            buf[n++] = ' ';
+            buf[n++] = xdigits[data[off] >> 4];
+            buf[n++] = xdigits[data[off] & 0xf];
+        }
+    }
+
+    buf[n++] = ' ';
+    buf[n++] = ' ';
+    for(off = beg; off < beg + width; off++) {
+        if(off < end) {
+            /* (In the side-by-side diff, keep the columns aligned even if
+             * the terminal would compose the non-ASCII bytes.) */
+            if(iscntrl(data[off])  ||  (other != NULL  &&  data[off] >= 0x7f))
+                buf[n++] = '.';
+            else
+                buf[n++] = (char) data[off];
+        }
+        else if(pad)
+            buf[n++] = ' ';
+        else
+            break;
+    }
+
+    if(to != NULL)
+        acutest_buffer_append_(to, buf, n);
+    else
+        acutest_out_write_(buf, n);
 }
 
 void
@@ -933,7 +2328,7 @@ acutest_dump_(const char* title, const void* addr, size_t size)
 
     /* We allow extra message only when something is already wrong in the
      * current test. */
-    if(acutest_current_test_ == NULL  ||  !acutest_cond_failed_)
+    if(acutest_current_->test == NULL  ||  !acutest_cond_failed_)
         return;
 
     if(size > TEST_DUMP_MAXSIZE) {
@@ -941,398 +2336,7190 @@ acutest_dump_(const char* title, const void* addr, size_t size)
         size = TEST_DUMP_MAXSIZE;
     }
 
+    acutest_lock_();
     acutest_line_indent_(acutest_case_name_[0] ? 3 : 2);
-    printf((title[strlen(title)-1] == ':') ? "%s\n" : "%s:\n", title);
+    acutest_out_printf_((title[strlen(title)-1] == ':') ? "%s\n" : "%s:\n", title);
 
     for(line_beg = 0; line_beg < size; line_beg += BYTES_PER_LINE) {
-        size_t line_end = line_beg + BYTES_PER_LINE;
-        size_t off;
+        acutest_line_indent_(acutest_case_name_[0] ? 4 : 3);
+        acutest_out_printf_("%08lx: ", (unsigned long)line_beg);
+        acutest_dump_bytes_((const unsigned char*) addr, NULL, line_beg, size, BYTES_PER_LINE, 0, NULL);
+        acutest_out_write_("\n", 1);
+    }
 
+    if(truncate > 0) {
         acutest_line_indent_(acutest_case_name_[0] ? 4 : 3);
-        printf("%08lx: ", (unsigned long)line_beg);
-        for(off = line_beg; off < line_end; off++) {
-            if(off < size)
-                printf(" %02x", ((const unsigned char*)addr)[off]);
-            else
-                printf("   ");
+        acutest_out_printf_("           ... (and more %u bytes)\n", (unsigned) truncate);
+    }
+    acutest_unlock_();
+}
+
+/* Returns offset of the first byte in [off, size) where the blocks a and b
+ * differ, or size if there is none. */
+static size_t
+acutest_mem_mismatch_(const unsigned char* a, const unsigned char* b, size_t off, size_t size)
+{
+    /* Compare 64 bytes per iteration while we can. When a mismatch is
+     * somewhere in the block, the scalar loop below finds where exactly. */
+#if defined ACUTEST_HAS_AVX2_
+    while(off + 64 <= size) {
+        __m256i eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + off)),
+                                        _mm256_loadu_si256((const __m256i*)(b + off)));
+        __m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + off + 32)),
+                                        _mm256_loadu_si256((const __m256i*)(b + off + 32)));
+        if(_mm256_movemask_epi8(_mm256_and_si256(eq0, eq1)) != -1)
+            break;
+        off += 64;
+    }
+#elif defined ACUTEST_HAS_SSE2_
+    while(off + 64 <= size) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + off)),
+                                     _mm_loadu_si128((const __m128i*)(b + off)));
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + off + 16)),
+                                     _mm_loadu_si128((const __m128i*)(b + off + 16)));
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + off + 32)),
+                                     _mm_loadu_si128((const __m128i*)(b + off + 32)));
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + off + 48)),
+                                     _mm_loadu_si128((const __m128i*)(b + off + 48)));
+        eq0 = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if(_mm_movemask_epi8(eq0) != 0xffff)
+            break;
+        off += 64;
+    }
+#elif defined ACUTEST_HAS_NEON_
+    while(off + 64 <= size) {
+        uint8x16_t eq0 = vceqq_u8(vld1q_u8(a + off), vld1q_u8(b + off));
+        uint8x16_t eq1 = vceqq_u8(vld1q_u8(a + off + 16), vld1q_u8(b + off + 16));
+        uint8x16_t eq2 = vceqq_u8(vld1q_u8(a + off + 32), vld1q_u8(b + off + 32));
+        uint8x16_t eq3 = vceqq_u8(vld1q_u8(a + off + 48), vld1q_u8(b + off + 48));
+        uint8x8_t eq;
+        eq0 = vandq_u8(vandq_u8(eq0, eq1), vandq_u8(eq2, eq3));
+        eq = vand_u8(vget_low_u8(eq0), vget_high_u8(eq0));
+        if(vget_lane_u32(vreinterpret_u32_u8(eq), 0) != 0xffffffffU  ||
+           vget_lane_u32(vreinterpret_u32_u8(eq), 1) != 0xffffffffU)
+            break;
+        off += 64;
+    }
+#else
+    /* memcmp() is typically well optimized; use it to skip equal blocks. */
+    while(off + 256 <= size  &&  memcmp(a + off, b + off, 256) == 0)
+        off += 256;
+#endif
+
+    while(off < size  &&  a[off] == b[off])
+        off++;
+    return off;
+}
+
+/* Finds end of the differing range starting at beg, merging in subsequent
+ * ranges which are too close to be shown separately. */
+static size_t
+acutest_mem_range_end_(const unsigned char* a, const unsigned char* b, size_t beg,
+                       size_t size, size_t* n_bytes)
+{
+    size_t end = beg;
+
+    while(1) {
+        while(end < size  &&  a[end] != b[end]) {
+            (*n_bytes)++;
+            end++;
         }
 
-        printf("  ");
-        for(off = line_beg; off < line_end; off++) {
-            unsigned char byte = ((const unsigned char*)addr)[off];
-            if(off < size)
-                printf("%c", (iscntrl(byte) ? '.' : byte));
-            else
-                break;
+        beg = acutest_mem_mismatch_(a, b, end, size);
+        if(beg >= size  ||  beg - end >= 2 * TEST_MEM_CONTEXT)
+            return end;
+        end = beg;
+    }
+}
+
+int
+acutest_check_mem_(const char* file, int line, const char* a_str, const char* b_str,
+                   const void* a, const void* b, size_t size)
+{
+    static const size_t BYTES_PER_LINE = 8;
+    const unsigned char* a_bytes = (const unsigned char*) a;
+    const unsigned char* b_bytes = (const unsigned char*) b;
+    size_t beg;
+    size_t end;
+    size_t n_bytes = 0;
+    size_t n_ranges = 0;
+    size_t ranges[TEST_MEM_MAXDIFFS][2];
+    size_t i;
+
+    beg = acutest_mem_mismatch_(a_bytes, b_bytes, 0, size);
+    if(beg >= size) {
+        if(acutest_check_fast_) {
+            acutest_test_check_count_++;
+            acutest_cond_failed_ = 0;
+            return 1;
+        }
+        return acutest_check_(1, file, line, "%s == %s (%lu bytes)", a_str, b_str, (unsigned long) size);
+    }
+
+    /* Collect the differing ranges. (We count them all, but remember only
+     * those we are going to show.) */
+    while(beg < size) {
+        end = acutest_mem_range_end_(a_bytes, b_bytes, beg, size, &n_bytes);
+        if(n_ranges < TEST_MEM_MAXDIFFS) {
+            ranges[n_ranges][0] = beg;
+            ranges[n_ranges][1] = end;
         }
+        n_ranges++;
+        beg = acutest_mem_mismatch_(a_bytes, b_bytes, end, size);
+    }
 
-        printf("\n");
+    if(acutest_check_(0, file, line, "%s == %s (%lu bytes)", a_str, b_str, (unsigned long) size))
+        return 1;   /* The test has been skipped. */
+    if(acutest_verbose_level_ < 2  &&  !acutest_test_log_on_)
+        return 0;
+
+    acutest_lock_();
+    if(n_ranges == 1) {
+        acutest_message_("%lu %s at offset 0x%lx.", (unsigned long) n_bytes,
+                         (n_bytes == 1) ? "byte differs" : "bytes differ", (unsigned long) ranges[0][0]);
+    } else {
+        acutest_message_("%lu bytes differ in %lu ranges, the first one at offset 0x%lx.",
+                         (unsigned long) n_bytes, (unsigned long) n_ranges, (unsigned long) ranges[0][0]);
     }
 
-    if(truncate > 0) {
-        acutest_line_indent_(acutest_case_name_[0] ? 4 : 3);
-        printf("           ... (and more %u bytes)\n", (unsigned) truncate);
+    for(i = 0; i < n_ranges  &&  i < TEST_MEM_MAXDIFFS; i++) {
+        size_t line_beg;
+        size_t win_beg = ranges[i][0];
+        size_t win_end = ranges[i][1] + TEST_MEM_CONTEXT;
+
+        win_beg = (win_beg > TEST_MEM_CONTEXT) ? win_beg - TEST_MEM_CONTEXT : 0;
+        win_beg -= win_beg % BYTES_PER_LINE;
+        win_end += BYTES_PER_LINE - 1 - (win_end - 1) % BYTES_PER_LINE;
+        if(win_end > size)
+            win_end = size;
+
+        /* The XUnit report gets the first window too (but not the others, to
+         * keep it short). */
+        if(i == 0  &&  acutest_test_log_on_) {
+            struct acutest_buffer_ log = { NULL, 0, 0 };
+            char tmp[64];
+
+            acutest_buffer_append_(&log, "  Bytes ", 8);
+            snprintf(tmp, sizeof(tmp), "0x%lx - 0x%lx (", (unsigned long) ranges[0][0], (unsigned long) ranges[0][1] - 1);
+            acutest_buffer_append_(&log, tmp, strlen(tmp));
+            acutest_buffer_append_(&log, a_str, strlen(a_str));
+            acutest_buffer_append_(&log, " | ", 3);
+            acutest_buffer_append_(&log, b_str, strlen(b_str));
+            acutest_buffer_append_(&log, "):\n", 3);
+            for(line_beg = win_beg; line_beg < win_end; line_beg += BYTES_PER_LINE) {
+                snprintf(tmp, sizeof(tmp), "    %08lx: ", (unsigned long) line_beg);
+                acutest_buffer_append_(&log, tmp, strlen(tmp));
+                acutest_dump_bytes_(a_bytes, b_bytes, line_beg, win_end, BYTES_PER_LINE, 1, &log);
+                acutest_buffer_append_(&log, "  |", 3);
+                acutest_dump_bytes_(b_bytes, a_bytes, line_beg, win_end, BYTES_PER_LINE, 0, &log);
+                acutest_buffer_append_(&log, "\n", 1);
+            }
+            acutest_test_log_(log.data, log.size);
+            acutest_buffer_free_(&log);
+        }
+
+        if(acutest_verbose_level_ < 2)
+            break;
+
+        acutest_line_indent_(acutest_case_name_[0] ? 3 : 2);
+        acutest_out_printf_("Bytes 0x%lx - 0x%lx (%s | %s):\n", (unsigned long) ranges[i][0],
+                            (unsigned long) ranges[i][1] - 1, a_str, b_str);
+        for(line_beg = win_beg; line_beg < win_end; line_beg += BYTES_PER_LINE) {
+            acutest_line_indent_(acutest_case_name_[0] ? 4 : 3);
+            acutest_out_printf_("%08lx: ", (unsigned long) line_beg);
+            acutest_dump_bytes_(a_bytes, b_bytes, line_beg, win_end, BYTES_PER_LINE, 1, NULL);
+            acutest_out_write_("  |", 3);
+            acutest_dump_bytes_(b_bytes, a_bytes, line_beg, win_end, BYTES_PER_LINE, 0, NULL);
+            acutest_out_write_("\n", 1);
+        }
+    }
+
+    if(n_ranges > TEST_MEM_MAXDIFFS  &&  acutest_verbose_level_ >= 2) {
+        acutest_line_indent_(acutest_case_name_[0] ? 3 : 2);
+        acutest_out_printf_("... (and %lu more %s)\n", (unsigned long) (n_ranges - TEST_MEM_MAXDIFFS),
+                            (n_ranges - TEST_MEM_MAXDIFFS == 1) ? "range" : "ranges");
     }
+    acutest_out_flush_failure_();
+    acutest_unlock_();
+
+    return 0;
 }
 
-/* This is called just before each test */
-static void
-acutest_init_(const char *test_name)
+/* Benchmarks (TEST_BENCH).
+ *
+ * Results of all benchmarks of the current test are collected in the process
+ * running the test and printed when the test ends (or, with --verbose=3,
+ * immediately). The main process gets them into acutest_test_data_[] either
+ * directly (--no-exec), or through the report pipe. */
+static ACUTEST_THREAD_LOCAL_ struct acutest_bench_result_* acutest_bench_results_ = NULL;
+static ACUTEST_THREAD_LOCAL_ int acutest_bench_n_results_ = 0;
+static ACUTEST_THREAD_LOCAL_ int acutest_bench_alloc_results_ = 0;
+
+static ACUTEST_THREAD_LOCAL_ char acutest_bench_name_[TEST_BENCH_NAME_MAXSIZE] = "";
+static ACUTEST_THREAD_LOCAL_ double* acutest_bench_sample_times_ = NULL;
+static ACUTEST_THREAD_LOCAL_ int acutest_bench_n_samples_ = 0;
+static ACUTEST_THREAD_LOCAL_ int acutest_bench_sampling_ = 0;
+static ACUTEST_THREAD_LOCAL_ size_t acutest_bench_batch_ = 0;
+static ACUTEST_THREAD_LOCAL_ double acutest_bench_start_ = 0.0;
+static ACUTEST_THREAD_LOCAL_ double acutest_bench_sampling_start_ = 0.0;
+static ACUTEST_THREAD_LOCAL_ double acutest_bench_items_next_ = 0.0;
+static ACUTEST_THREAD_LOCAL_ double acutest_bench_bytes_next_ = 0.0;
+static ACUTEST_THREAD_LOCAL_ double acutest_bench_items_cur_ = 0.0;
+static ACUTEST_THREAD_LOCAL_ double acutest_bench_bytes_cur_ = 0.0;
+
+/* State of TEST_BENCH_RANGE. */
+static ACUTEST_THREAD_LOCAL_ const char* acutest_bench_range_var_ = NULL;  /* NULL if none running. */
+static ACUTEST_THREAD_LOCAL_ int acutest_bench_range_started_ = 0;
+static ACUTEST_THREAD_LOCAL_ size_t acutest_bench_range_cur_ = 0;
+static ACUTEST_THREAD_LOCAL_ size_t acutest_bench_range_hi_ = 0;
+static ACUTEST_THREAD_LOCAL_ size_t acutest_bench_range_mult_ = 0;
+static ACUTEST_THREAD_LOCAL_ size_t acutest_bench_range_step_ = 0;
+static ACUTEST_THREAD_LOCAL_ int acutest_bench_range_first_ = 0;    /* First result of the sweep. */
+static ACUTEST_THREAD_LOCAL_ int acutest_bench_n_series_ = 0;
+static ACUTEST_THREAD_LOCAL_ int acutest_bench_series_cur_ = 0;
+
+static const void* volatile acutest_do_not_optimize_sink_;
+
+void
+acutest_do_not_optimize_(const void* ptr)
 {
-#ifdef TEST_INIT
-    TEST_INIT
-    ; /* Allow for a single unterminated function call */
+    acutest_do_not_optimize_sink_ = ptr;
+}
+
+/* Monotonic clock (independent on --time), in seconds. */
+static double
+acutest_clock_monotonic_(void)
+{
+#if defined ACUTEST_WIN_
+    LARGE_INTEGER freq, ts;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&ts);
+    return (double) ts.QuadPart / (double) freq.QuadPart;
+#elif defined ACUTEST_HAS_POSIX_TIMER_
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#else
+    return (double) clock() / (double) CLOCKS_PER_SEC;
 #endif
+}
 
-    /* Suppress any warnings about unused variable. */
-    (void) test_name;
+static void
+acutest_bench_format_time_(char* buffer, size_t size, double ns)
+{
+    if(ns < 1e3)
+        snprintf(buffer, size, "%.2f ns", ns);
+    else if(ns < 1e6)
+        snprintf(buffer, size, "%.2f us", ns / 1e3);
+    else if(ns < 1e9)
+        snprintf(buffer, size, "%.2f ms", ns / 1e6);
+    else
+        snprintf(buffer, size, "%.2f s", ns / 1e9);
 }
 
-/* This is called after each test */
+/* Throughput, with a decimal prefix (unit is "B" or "items"). */
 static void
-acutest_fini_(const char *test_name)
+acutest_bench_format_rate_(char* buffer, size_t size, double per_second, const char* unit)
 {
-#ifdef TEST_FINI
-    TEST_FINI
-    ; /* Allow for a single unterminated function call */
-#endif
+    static const char prefixes[] = "kMGTPE";
+    int i = -1;
 
-    /* Suppress any warnings about unused variable. */
-    (void) test_name;
+    while(per_second >= 1000.0  &&  i < (int) sizeof(prefixes) - 2) {
+        per_second /= 1000.0;
+        i++;
+    }
+
+    if(i < 0)
+        snprintf(buffer, size, "%.2f %s/s", per_second, unit);
+    else
+        snprintf(buffer, size, "%.2f %c%s%s/s", per_second, prefixes[i],
+                 (unit[0] == 'B') ? "" : " ", unit);
 }
 
-void
-acutest_abort_(void)
+/* Bytes and items processed per second, or -1 if unknown. */
+static double
+acutest_bench_bytes_per_second_(const struct acutest_bench_result_* res)
 {
-    if(acutest_abort_has_jmp_buf_) {
-        longjmp(acutest_abort_jmp_buf_, 1);
-    } else {
-        if(acutest_current_test_ != NULL)
-            acutest_fini_(acutest_current_test_->name);
-        fflush(stdout);
-        fflush(stderr);
-        acutest_exit_(ACUTEST_STATE_FAILED);
+    return (res->bytes > 0.0  &&  res->median > 0.0) ? res->bytes * 1e9 / res->median : -1.0;
+}
+
+static double
+acutest_bench_items_per_second_(const struct acutest_bench_result_* res)
+{
+    return (res->items > 0.0  &&  res->median > 0.0) ? res->items * 1e9 / res->median : -1.0;
+}
+
+static void
+acutest_bench_print_(const struct acutest_bench_result_* res)
+{
+    char median[32], min[32], p99[32], stddev[32];
+    char bytes[32] = "", items[32] = "";
+
+    acutest_bench_format_time_(median, sizeof(median), res->median);
+    acutest_bench_format_time_(min, sizeof(min), res->min);
+    acutest_bench_format_time_(p99, sizeof(p99), res->p99);
+    acutest_bench_format_time_(stddev, sizeof(stddev), res->stddev);
+    if(acutest_bench_bytes_per_second_(res) >= 0.0) {
+        bytes[0] = ',';
+        bytes[1] = ' ';
+        acutest_bench_format_rate_(bytes + 2, sizeof(bytes) - 2, acutest_bench_bytes_per_second_(res), "B");
+    }
+    if(acutest_bench_items_per_second_(res) >= 0.0) {
+        items[0] = ',';
+        items[1] = ' ';
+        acutest_bench_format_rate_(items + 2, sizeof(items) - 2, acutest_bench_items_per_second_(res), "items");
+    }
+
+    acutest_line_indent_(acutest_case_name_[0] ? 2 : 1);
+    acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Benchmark %s:", res->name);
+    acutest_out_printf_(" %s/op%s%s (min %s, p99 %s, stddev %s; %d samples of %.0f iterations)\n",
+           median, bytes, items, min, p99, stddev, res->samples, res->iterations);
+}
+
+/* (Avoid sqrt() so that users do not need to link with libm.) */
+static double
+acutest_sqrt_(double x)
+{
+    double r = (x > 1.0) ? x : 1.0;
+    int i;
+
+    if(x <= 0.0)
+        return 0.0;
+    for(i = 0; i < 64; i++)
+        r = (r + x / r) / 2.0;
+    return r;
+}
+
+/* (Avoid log() for the same reason.) */
+static double
+acutest_log2_(double x)
+{
+    double e = 0.0;
+    double y, y2, term, sum;
+    int i;
+
+    if(x <= 0.0)
+        return 0.0;
+    while(x >= 2.0) {
+        x /= 2.0;
+        e += 1.0;
+    }
+    while(x < 1.0) {
+        x *= 2.0;
+        e -= 1.0;
+    }
+
+    /* ln(x) = 2 * atanh((x-1) / (x+1)), which converges fast for x in [1, 2). */
+    y = (x - 1.0) / (x + 1.0);
+    y2 = y * y;
+    term = y;
+    sum = 0.0;
+    for(i = 1; i < 40; i += 2) {
+        sum += term / i;
+        term *= y2;
+    }
+    return e + 2.0 * sum / 0.69314718055994530942;
+}
+
+/* Complexity classes TEST_BENCH_RANGE curves are fitted with. */
+static const char* const acutest_bench_complexity_names_[] = {
+    "O(1)", "O(log n)", "O(n)", "O(n log n)", "O(n^2)"
+};
+static const char* const acutest_bench_complexity_terms_[] = {
+    "1", "log n", "n", "n log n", "n^2"
+};
+
+static double
+acutest_bench_complexity_(int complexity, double n)
+{
+    switch(complexity) {
+        case 0:     return 1.0;
+        case 1:     return acutest_log2_(n);
+        case 2:     return n;
+        case 3:     return n * acutest_log2_(n);
+        default:    return n * n;
+    }
+}
+
+/* Estimate the complexity of the curve (the results with the given series
+ * id): For each complexity class f(n), fit the times per iteration t(n) with
+ * coef * f(n) by the least squares method, and choose the class where the
+ * RMS error (relative to the mean time) is the smallest. Returns index into
+ * acutest_bench_complexity_names_[], or -1 if the curve has less than three
+ * points. */
+static int
+acutest_bench_fit_(const struct acutest_bench_result_* res, int n, int series,
+                   double* p_coef, double* p_rms)
+{
+    int best = -1;
+    int complexity;
+    int i;
+
+    for(complexity = 0; complexity < 5; complexity++) {
+        double sum_tf = 0.0, sum_ff = 0.0, sum_t = 0.0, sum_err = 0.0;
+        double coef, rms;
+        int count = 0;
+
+        for(i = 0; i < n; i++) {
+            double f;
+
+            if(res[i].series != series)
+                continue;
+            f = acutest_bench_complexity_(complexity, res[i].arg);
+            sum_tf += res[i].median * f;
+            sum_ff += f * f;
+            sum_t += res[i].median;
+            count++;
+        }
+        if(count < 3  ||  sum_ff <= 0.0  ||  sum_t <= 0.0)
+            continue;
+        coef = sum_tf / sum_ff;
+
+        for(i = 0; i < n; i++) {
+            double err;
+
+            if(res[i].series != series)
+                continue;
+            err = res[i].median - coef * acutest_bench_complexity_(complexity, res[i].arg);
+            sum_err += err * err;
+        }
+        rms = acutest_sqrt_(sum_err / count) / (sum_t / count);
+
+        /* (On a tie, prefer the simpler class.) */
+        if(best < 0  ||  rms < *p_rms) {
+            best = complexity;
+            *p_coef = coef;
+            *p_rms = rms;
+        }
     }
+
+    return best;
+}
+
+/* Name of the curve: "NAME/var" out of "NAME/var=VALUE". */
+static int
+acutest_bench_series_name_len_(const struct acutest_bench_result_* res)
+{
+    const char* eq = strrchr(res->name, '=');
+    return (eq != NULL) ? (int) (eq - res->name) : (int) strlen(res->name);
 }
 
+/* Print the complexity of each curve among the given results. */
 static void
-acutest_list_names_(void)
+acutest_bench_print_fits_(const struct acutest_bench_result_* res, int n)
 {
-    const struct acutest_test_* test;
+    int i, j;
 
-    printf("Unit tests:\n");
-    for(test = &acutest_list_[0]; test->func != NULL; test++)
-        printf("  %s\n", test->name);
+    for(i = 0; i < n; i++) {
+        char coef_str[32];
+        double coef, rms;
+        int complexity;
+
+        if(res[i].series == 0)
+            continue;
+        for(j = 0; j < i; j++) {
+            if(res[j].series == res[i].series)
+                break;
+        }
+        if(j < i)
+            continue;   /* Already done. */
+
+        complexity = acutest_bench_fit_(res, n, res[i].series, &coef, &rms);
+        if(complexity < 0)
+            continue;
+
+        /* (The coefficient may be tiny, so not acutest_bench_format_time_().) */
+        snprintf(coef_str, sizeof(coef_str), "%.3g ns", coef);
+        acutest_line_indent_(acutest_case_name_[0] ? 2 : 1);
+        acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Complexity %.*s:",
+                acutest_bench_series_name_len_(&res[i]), res[i].name);
+        acutest_out_printf_(" %s (%s * %s; RMS error %.1f %%)\n",
+                acutest_bench_complexity_names_[complexity], coef_str,
+                acutest_bench_complexity_terms_[complexity],
+                rms * 100.0);
+    }
 }
 
 static int
-acutest_name_contains_word_(const char* name, const char* pattern)
+acutest_cmp_double_(const void* a, const void* b)
 {
-    static const char word_delim[] = " \t-_/.,:;";
-    const char* substr;
-    size_t pattern_len;
+    double da = *(const double*) a;
+    double db = *(const double*) b;
+    return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
 
-    pattern_len = strlen(pattern);
+static void
+acutest_bench_finish_(void)
+{
+    struct acutest_bench_result_* res;
+    double* t = acutest_bench_sample_times_;
+    int n = acutest_bench_n_samples_;
+    double sum = 0.0;
+    double var = 0.0;
+    int i;
 
-    substr = strstr(name, pattern);
-    while(substr != NULL) {
-        int starts_on_word_boundary = (substr == name || strchr(word_delim, substr[-1]) != NULL);
-        int ends_on_word_boundary = (substr[pattern_len] == '\0' || strchr(word_delim, substr[pattern_len]) != NULL);
+    if(acutest_bench_n_results_ >= acutest_bench_alloc_results_) {
+        int new_alloc = (acutest_bench_alloc_results_ > 0 ? acutest_bench_alloc_results_ * 2 : 4);
+        struct acutest_bench_result_* new_results;
 
-        if(starts_on_word_boundary && ends_on_word_boundary)
-            return 1;
+        new_results = (struct acutest_bench_result_*) realloc(acutest_bench_results_,
+                    (size_t) new_alloc * sizeof(struct acutest_bench_result_));
+        if(new_results == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            acutest_exit_(2);
+        }
+        acutest_bench_results_ = new_results;
+        acutest_bench_alloc_results_ = new_alloc;
+    }
+    res = &acutest_bench_results_[acutest_bench_n_results_++];
+
+    qsort(t, (size_t) n, sizeof(double), acutest_cmp_double_);
+    for(i = 0; i < n; i++)
+        sum += t[i];
+    for(i = 0; i < n; i++)
+        var += (t[i] - sum / n) * (t[i] - sum / n);
+
+    memcpy(res->name, acutest_bench_name_, sizeof(res->name));
+    res->samples = n;
+    res->iterations = (double) acutest_bench_batch_;
+    res->min = t[0];
+    res->median = (n % 2) ? t[n/2] : (t[n/2 - 1] + t[n/2]) / 2.0;
+    res->p99 = t[(99 * n + 99) / 100 - 1];      /* nearest rank */
+    res->mean = sum / n;
+    res->stddev = (n > 1) ? acutest_sqrt_(var / (n - 1)) : 0.0;
+    res->items = acutest_bench_items_cur_;
+    res->bytes = acutest_bench_bytes_cur_;
+    res->arg = (acutest_bench_range_var_ != NULL) ? (double) acutest_bench_range_cur_ : -1.0;
+    res->series = (acutest_bench_range_var_ != NULL) ? acutest_bench_series_cur_ : 0;
+
+    if(acutest_verbose_level_ >= 3) {
+        acutest_bench_print_(res);
+        acutest_current_->already_logged++;
+    }
+
+    free(acutest_bench_sample_times_);
+    acutest_bench_sample_times_ = NULL;
+    acutest_bench_batch_ = 0;
+}
+
+void
+acutest_bench_begin_(const char* name)
+{
+    if(acutest_bench_range_var_ != NULL) {
+        int len;
+        int i;
+
+        len = snprintf(acutest_bench_name_, sizeof(acutest_bench_name_), "%s/%s=",
+                       name, acutest_bench_range_var_);
+        if(len >= (int) sizeof(acutest_bench_name_))
+            len = (int) sizeof(acutest_bench_name_) - 1;
+
+        /* Points measured by the same TEST_BENCH of the sweep form one
+         * curve. */
+        acutest_bench_series_cur_ = ++acutest_bench_n_series_;
+        for(i = acutest_bench_range_first_; i < acutest_bench_n_results_; i++) {
+            if(acutest_bench_results_[i].series != 0  &&
+               strncmp(acutest_bench_results_[i].name, acutest_bench_name_, (size_t) len) == 0)
+            {
+                acutest_bench_series_cur_ = acutest_bench_results_[i].series;
+                acutest_bench_n_series_--;
+                break;
+            }
+        }
+
+        snprintf(acutest_bench_name_ + len, sizeof(acutest_bench_name_) - (size_t) len,
+                 "%lu", (unsigned long) acutest_bench_range_cur_);
+    } else {
+        snprintf(acutest_bench_name_, sizeof(acutest_bench_name_), "%s", name);
+    }
+    acutest_bench_items_cur_ = acutest_bench_items_next_;
+    acutest_bench_bytes_cur_ = acutest_bench_bytes_next_;
+    acutest_bench_items_next_ = 0.0;
+    acutest_bench_bytes_next_ = 0.0;
+    acutest_bench_n_samples_ = 0;
+    acutest_bench_sampling_ = 0;
+    acutest_bench_batch_ = 0;
+
+    free(acutest_bench_sample_times_);
+    acutest_bench_sample_times_ = (double*) malloc(sizeof(double) * (size_t) acutest_bench_samples_);
+    if(acutest_bench_sample_times_ == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+}
+
+size_t
+acutest_bench_iterations_(void)
+{
+    return acutest_bench_batch_;
+}
+
+/* Called before each batch of iterations. Returns zero when the benchmark is
+ * complete. */
+int
+acutest_bench_next_(void)
+{
+    double now = acutest_clock_monotonic_();
+    double target = acutest_bench_time_ / acutest_bench_samples_;
+
+    if(acutest_warmup_running_)
+        return 0;   /* (The calibration is a warm-up on its own.) */
+
+    if(acutest_bench_batch_ == 0) {
+        /* The very first batch. */
+        acutest_bench_batch_ = 1;
+    } else if(!acutest_bench_sampling_) {
+        /* Calibration: Grow the batch until it takes the target time. (The
+         * calibration batches then also serve as a warm-up.) */
+        double elapsed = now - acutest_bench_start_;
+
+        if(elapsed >= target  ||  acutest_bench_batch_ >= ((size_t) 1 << 40)) {
+            acutest_bench_sampling_ = 1;
+            acutest_bench_sampling_start_ = now;
+        } else {
+            double mult = (elapsed > 0.0) ? (target * 1.05 / elapsed) : 10.0;
+
+            if(mult > 10.0)
+                mult = 10.0;
+            if(mult < 1.2)
+                mult = 1.2;
+            acutest_bench_batch_ = (size_t)((double) acutest_bench_batch_ * mult) + 1;
+        }
+    } else {
+        double elapsed = now - acutest_bench_start_;
+
+        acutest_bench_sample_times_[acutest_bench_n_samples_++] =
+                    elapsed * 1e9 / (double) acutest_bench_batch_;
+
+        /* Done if we have all the samples, or if the code is so slow that
+         * already few samples take much longer than what was budgeted. */
+        if(acutest_bench_n_samples_ >= acutest_bench_samples_  ||
+           (acutest_bench_n_samples_ >= 3  &&  now - acutest_bench_sampling_start_ > 3.0 * acutest_bench_time_))
+        {
+            acutest_bench_finish_();
+            return 0;
+        }
+    }
+
+    acutest_bench_start_ = acutest_clock_monotonic_();
+    return 1;
+}
+
+void
+acutest_bench_items_(double n)
+{
+    acutest_bench_items_next_ = n;
+}
+
+void
+acutest_bench_bytes_(double n)
+{
+    acutest_bench_bytes_next_ = n;
+}
+
+void
+acutest_bench_range_begin_(const char* var, size_t lo, size_t hi, size_t mult, size_t step)
+{
+    acutest_bench_range_var_ = var;
+    acutest_bench_range_started_ = 0;
+    acutest_bench_range_cur_ = lo;
+    acutest_bench_range_hi_ = hi;
+    acutest_bench_range_mult_ = mult;
+    acutest_bench_range_step_ = (mult < 2  &&  step == 0) ? 1 : step;
+    acutest_bench_range_first_ = acutest_bench_n_results_;
+}
+
+/* Called before each pass of the sweep. Returns zero when it is complete. */
+int
+acutest_bench_range_next_(void)
+{
+    size_t cur = acutest_bench_range_cur_;
+    size_t hi = acutest_bench_range_hi_;
+    int done;
+
+    if(!acutest_bench_range_started_) {
+        acutest_bench_range_started_ = 1;
+        done = (cur > hi);
+    } else if(acutest_bench_range_mult_ >= 2) {
+        done = (cur > hi / acutest_bench_range_mult_);
+        acutest_bench_range_cur_ = (cur > 0) ? cur * acutest_bench_range_mult_ : 1;
+    } else {
+        done = (hi - cur < acutest_bench_range_step_);
+        acutest_bench_range_cur_ = cur + acutest_bench_range_step_;
+    }
+
+    if(done) {
+        if(acutest_verbose_level_ >= 3) {
+            acutest_bench_print_fits_(acutest_bench_results_ + acutest_bench_range_first_,
+                    acutest_bench_n_results_ - acutest_bench_range_first_);
+        }
+        acutest_bench_range_var_ = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+size_t
+acutest_bench_range_arg_(void)
+{
+    return acutest_bench_range_cur_;
+}
+
+/* Keep (a copy of) the benchmark results in the main process. */
+static void
+acutest_bench_store_(int master_index, const struct acutest_bench_result_* res, int n)
+{
+    struct acutest_test_data_* data = &acutest_test_data_[master_index];
+    struct acutest_bench_result_* benches;
+
+    benches = (struct acutest_bench_result_*) realloc(data->benches,
+                (size_t)(data->n_benches + n) * sizeof(struct acutest_bench_result_));
+    if(benches == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+    memcpy(benches + data->n_benches, res, (size_t) n * sizeof(struct acutest_bench_result_));
+    data->benches = benches;
+    data->n_benches += n;
+}
+
+/* Hardware performance counters (--perf-counters=LIST), measured around the
+ * test function in the process running the test.
+ *
+ * On Linux, they are read with perf_event_open(). Where that is not possible
+ * (other systems, or the kernel does not allow it, e.g. due to
+ * /proc/sys/kernel/perf_event_paranoid or in a virtual machine without
+ * a virtualized PMU), "cycles" fall back to the time-stamp counter of the
+ * CPU (if any) and the other counters are just not reported. */
+static const struct {
+    const char* name;
+#ifdef ACUTEST_HAS_PERF_EVENT_
+    unsigned long long config;
+#endif
+} acutest_perf_counters_[ACUTEST_PERF_MAX_] = {
+#ifdef ACUTEST_HAS_PERF_EVENT_
+    { "cycles",             PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",       PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache-references",   PERF_COUNT_HW_CACHE_REFERENCES },
+    { "cache-misses",       PERF_COUNT_HW_CACHE_MISSES },
+    { "branches",           PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "branch-misses",      PERF_COUNT_HW_BRANCH_MISSES }
+#else
+    { "cycles" }, { "instructions" }, { "cache-references" },
+    { "cache-misses" }, { "branches" }, { "branch-misses" }
+#endif
+};
+
+#define ACUTEST_PERF_CYCLES_        0
+#define ACUTEST_PERF_INSTRUCTIONS_  1
+
+static ACUTEST_THREAD_LOCAL_ int acutest_perf_fds_[ACUTEST_PERF_MAX_];
+static ACUTEST_THREAD_LOCAL_ int acutest_perf_running_ = 0;
+static ACUTEST_THREAD_LOCAL_ int acutest_perf_use_tsc_ = 0;
+static ACUTEST_THREAD_LOCAL_ unsigned long long acutest_perf_tsc_start_;
+
+#ifdef ACUTEST_HAS_RDTSC_
+static unsigned long long
+acutest_rdtsc_(void)
+{
+#ifdef _MSC_VER
+    return (unsigned long long) __rdtsc();
+#else
+    unsigned lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long) hi << 32) | lo;
+#endif
+}
+#endif
+
+/* Returns file descriptor of the counter, or -1. */
+static int
+acutest_perf_open_(int i)
+{
+#ifdef ACUTEST_HAS_PERF_EVENT_
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = acutest_perf_counters_[i].config;
+    attr.disabled = 1;
+    attr.inherit = 1;           /* Count also threads started by the test. */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void) i;
+    return -1;
+#endif
+}
+
+static void
+acutest_perf_start_(void)
+{
+    int i;
+
+    acutest_perf_use_tsc_ = 0;
+    for(i = 0; i < ACUTEST_PERF_MAX_; i++) {
+        acutest_perf_values_[i] = -1.0;
+        acutest_perf_fds_[i] = -1;
+        if(!(acutest_perf_mask_ & (1u << i)))
+            continue;
+
+        acutest_perf_fds_[i] = acutest_perf_open_(i);
+#ifdef ACUTEST_HAS_RDTSC_
+        if(acutest_perf_fds_[i] < 0  &&  i == ACUTEST_PERF_CYCLES_)
+            acutest_perf_use_tsc_ = 1;
+#endif
+    }
+
+#ifdef ACUTEST_HAS_PERF_EVENT_
+    for(i = 0; i < ACUTEST_PERF_MAX_; i++) {
+        if(acutest_perf_fds_[i] >= 0) {
+            ioctl(acutest_perf_fds_[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(acutest_perf_fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+#ifdef ACUTEST_HAS_RDTSC_
+    if(acutest_perf_use_tsc_)
+        acutest_perf_tsc_start_ = acutest_rdtsc_();
+#endif
+
+    acutest_perf_running_ = (acutest_perf_mask_ != 0);
+}
+
+static void
+acutest_perf_stop_(void)
+{
+    int i;
+
+    if(!acutest_perf_running_)
+        return;
+    acutest_perf_running_ = 0;
+
+#ifdef ACUTEST_HAS_RDTSC_
+    if(acutest_perf_use_tsc_)
+        acutest_perf_values_[ACUTEST_PERF_CYCLES_] = (double) (acutest_rdtsc_() - acutest_perf_tsc_start_);
+#endif
+
+#ifdef ACUTEST_HAS_PERF_EVENT_
+    for(i = 0; i < ACUTEST_PERF_MAX_; i++) {
+        if(acutest_perf_fds_[i] >= 0)
+            ioctl(acutest_perf_fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for(i = 0; i < ACUTEST_PERF_MAX_; i++) {
+        unsigned long long count;
+
+        if(acutest_perf_fds_[i] < 0)
+            continue;
+        if(read(acutest_perf_fds_[i], &count, sizeof(count)) == (ssize_t) sizeof(count))
+            acutest_perf_values_[i] = (double) count;
+        close(acutest_perf_fds_[i]);
+        acutest_perf_fds_[i] = -1;
+    }
+#else
+    (void) i;
+#endif
+}
+
+/* Check the counters can be used at all, and warn (once, in the main process)
+ * about those which cannot. */
+static void
+acutest_perf_probe_(void)
+{
+    const char* fallback = "";
+    int n_missing = 0;
+    int i;
+
+    for(i = 0; i < ACUTEST_PERF_MAX_; i++) {
+        int fd;
+
+        if(!(acutest_perf_mask_ & (1u << i)))
+            continue;
+
+        fd = acutest_perf_open_(i);
+        if(fd >= 0) {
+            close(fd);
+            continue;
+        }
+#ifdef ACUTEST_HAS_RDTSC_
+        if(i == ACUTEST_PERF_CYCLES_) {
+            fallback = " (cycles are counted by the time-stamp counter instead)";
+            continue;
+        }
+#endif
+        n_missing++;
+    }
+
+    if(n_missing > 0  ||  fallback[0] != '\0') {
+        fprintf(stderr, "%s: Warning: Some performance counters are not available%s.\n",
+                acutest_argv0_, fallback);
+    }
+}
+
+static void
+acutest_perf_print_(const double* values)
+{
+    int i, n = 0;
+
+    for(i = 0; i < ACUTEST_PERF_MAX_; i++) {
+        if(values[i] < 0.0)
+            continue;
+        if(n == 0) {
+            acutest_line_indent_(1);
+            acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Perf counters:");
+        }
+        acutest_out_printf_("%s %.0f %s", (n > 0 ? "," : ""), values[i], acutest_perf_counters_[i].name);
+        n++;
+    }
+
+    if(values[ACUTEST_PERF_CYCLES_] > 0.0  &&  values[ACUTEST_PERF_INSTRUCTIONS_] >= 0.0)
+        acutest_out_printf_(" (%.2f IPC)", values[ACUTEST_PERF_INSTRUCTIONS_] / values[ACUTEST_PERF_CYCLES_]);
+    if(n > 0)
+        acutest_out_printf_("\n");
+}
+
+/* Sampling profiler (--profile=DIR): While the test function runs, SIGPROF
+ * comes every millisecond of CPU time (of the process) and its handler
+ * records the call stack. When the test is over, the stacks are symbolized
+ * and written into DIR/<test name>.folded in the folded format (one line per
+ * distinct stack, "root;...;leaf count"), as expected by the flame graph
+ * tools.
+ *
+ * The names come from backtrace_symbols(), so only the functions known to the
+ * dynamic linker (link with -rdynamic) are named; the rest are given as
+ * "module+0xOFFSET" (to be resolved e.g. with addr2line). */
+#if defined ACUTEST_HAS_PROFILE_
+
+#define ACUTEST_PROFILE_INTERVAL_US_    1000
+#define ACUTEST_PROFILE_DEPTH_          64
+#define ACUTEST_PROFILE_MAX_SAMPLES_    20000
+
+static const char* acutest_profile_dir_ = NULL;
+static void** acutest_profile_frames_ = NULL;   /* ACUTEST_PROFILE_DEPTH_ per sample */
+static int* acutest_profile_depths_ = NULL;
+static volatile int acutest_profile_n_samples_ = 0;
+static volatile int acutest_profile_n_dropped_ = 0;
+static int acutest_profile_outer_depth_ = 0;    /* Frames of ours below the test function. */
+static int acutest_profile_running_ = 0;
+static struct sigaction acutest_profile_old_action_;
+
+static void
+acutest_profile_handler_(int signum)
+{
+    int n = acutest_profile_n_samples_;
+    int saved_errno = errno;
+
+    (void) signum;
+    if(n < ACUTEST_PROFILE_MAX_SAMPLES_) {
+        acutest_profile_depths_[n] = backtrace(acutest_profile_frames_ + (size_t) n * ACUTEST_PROFILE_DEPTH_,
+                                               ACUTEST_PROFILE_DEPTH_);
+        acutest_profile_n_samples_ = n + 1;
+    } else {
+        acutest_profile_n_dropped_++;
+    }
+    errno = saved_errno;
+}
+
+/* (Not inlined, so that its caller is on the stack as it is for the test
+ * function.) */
+static void ACUTEST_ATTRIBUTE_(noinline)
+acutest_profile_start_(void)
+{
+    void* frames[ACUTEST_PROFILE_DEPTH_];
+    struct sigaction action;
+    struct itimerval timer;
+
+    if(acutest_profile_dir_ == NULL)
+        return;
+
+    if(acutest_profile_frames_ == NULL) {
+        acutest_profile_frames_ = (void**) malloc((size_t) ACUTEST_PROFILE_MAX_SAMPLES_ *
+                                                  ACUTEST_PROFILE_DEPTH_ * sizeof(void*));
+        acutest_profile_depths_ = (int*) malloc(ACUTEST_PROFILE_MAX_SAMPLES_ * sizeof(int));
+        if(acutest_profile_frames_ == NULL  ||  acutest_profile_depths_ == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            acutest_exit_(2);
+        }
+    }
+
+    /* This also makes sure backtrace() has loaded whatever it needs, as that
+     * is not safe to do in the signal handler. (Minus one for this frame.) */
+    acutest_profile_outer_depth_ = backtrace(frames, ACUTEST_PROFILE_DEPTH_) - 1;
+    acutest_profile_n_samples_ = 0;
+    acutest_profile_n_dropped_ = 0;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = acutest_profile_handler_;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &acutest_profile_old_action_);
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = ACUTEST_PROFILE_INTERVAL_US_;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+    acutest_profile_running_ = 1;
+}
+
+static void
+acutest_profile_stop_(void)
+{
+    struct itimerval timer;
+
+    if(!acutest_profile_running_)
+        return;
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &acutest_profile_old_action_, NULL);
+    acutest_profile_running_ = 0;
+}
+
+static int
+acutest_cmp_ptr_(const void* a, const void* b)
+{
+    const char* pa = *(const char* const*) a;
+    const char* pb = *(const char* const*) b;
+    return (pa < pb) ? -1 : (pa > pb) ? 1 : 0;
+}
+
+static int
+acutest_cmp_str_(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+/* Append the frame name, as extracted from the string of backtrace_symbols(),
+ * either "/path/module(symbol+0x1a) [0x...]" (glibc, BSD) or
+ * "3   module   0x...  symbol + 26" (macOS). */
+static void
+acutest_profile_frame_name_(struct acutest_buffer_* buf, const char* sym)
+{
+    const char* beg = NULL;
+    const char* end = NULL;
+    const char* paren = strchr(sym, '(');
+    char tmp[256];
+    size_t i, n;
+
+    if(paren != NULL) {
+        const char* plus = strchr(paren, '+');
+        const char* slash;
+
+        if(plus != NULL  &&  plus > paren + 1) {
+            beg = paren + 1;
+            end = plus;
+        } else {
+            /* No symbol: "module+0xOFFSET". */
+            for(slash = paren; slash > sym  &&  slash[-1] != '/'; slash--)
+                ;
+            snprintf(tmp, sizeof(tmp), "%.*s%.*s", (int) (paren - slash), slash,
+                     (int) strcspn(paren + 1, ")"), paren + 1);
+            beg = tmp;
+            end = tmp + strlen(tmp);
+        }
+    } else {
+        /* The fourth word. */
+        const char* p = sym;
+
+        for(i = 0; i < 4  &&  *p != '\0'; i++) {
+            p += strspn(p, " \t");
+            beg = p;
+            p += strcspn(p, " \t");
+            end = p;
+        }
+        if(i < 4) {
+            beg = sym;
+            end = sym + strlen(sym);
+        }
+    }
+
+    /* Keep the separators of the format out of the names. */
+    n = (size_t) (end - beg);
+    for(i = 0; i < n; i++) {
+        char c = (beg[i] == ';'  ||  beg[i] == ' '  ||  beg[i] == '\n') ? '_' : beg[i];
+        acutest_buffer_append_(buf, &c, 1);
+    }
+}
+
+static void
+acutest_profile_write_(const char* test_name)
+{
+    struct acutest_buffer_ names = { NULL, 0, 0 };
+    struct acutest_buffer_ path = { NULL, 0, 0 };
+    void** addrs = NULL;
+    char** syms = NULL;
+    size_t* name_offs = NULL;
+    char** stacks = NULL;
+    size_t* stack_offs = NULL;
+    struct acutest_buffer_ all = { NULL, 0, 0 };
+    int n_samples = acutest_profile_n_samples_;
+    int n_addrs = 0, n_uniq = 0;
+    int i, j, k;
+    FILE* f;
+
+    if(acutest_profile_dir_ == NULL)
+        return;
+
+    /* The frames of the test function and deeper, with the return addresses
+     * moved into the call instruction. (Skip the handler and the signal
+     * trampoline.) */
+    addrs = (void**) malloc(((size_t) n_samples * ACUTEST_PROFILE_DEPTH_ + 1) * sizeof(void*));
+    stack_offs = (size_t*) malloc(((size_t) n_samples + 1) * sizeof(size_t));
+    stacks = (char**) malloc(((size_t) n_samples + 1) * sizeof(char*));
+    if(addrs == NULL  ||  stack_offs == NULL  ||  stacks == NULL)
+        goto out;
+    for(i = 0; i < n_samples; i++) {
+        void** frames = acutest_profile_frames_ + (size_t) i * ACUTEST_PROFILE_DEPTH_;
+        int depth = acutest_profile_depths_[i] - acutest_profile_outer_depth_;
+
+        if(depth <= 2)
+            continue;
+        for(j = depth - 1; j >= 2; j--) {
+            frames[j] = (j > 2) ? (void*) ((char*) frames[j] - 1) : frames[j];
+            addrs[n_addrs++] = frames[j];
+        }
+    }
+
+    /* Symbolize each distinct address just once. */
+    qsort(addrs, (size_t) n_addrs, sizeof(void*), acutest_cmp_ptr_);
+    for(i = 0; i < n_addrs; i++) {
+        if(n_uniq == 0  ||  addrs[n_uniq-1] != addrs[i])
+            addrs[n_uniq++] = addrs[i];
+    }
+    name_offs = (size_t*) malloc(((size_t) n_uniq + 1) * sizeof(size_t));
+    syms = (n_uniq > 0) ? backtrace_symbols(addrs, n_uniq) : NULL;
+    if(name_offs == NULL  ||  (n_uniq > 0  &&  syms == NULL))
+        goto out;
+    for(i = 0; i < n_uniq; i++) {
+        name_offs[i] = names.size;
+        acutest_profile_frame_name_(&names, syms[i]);
+        acutest_buffer_append_(&names, "", 1);
+    }
+
+    /* Compose the stacks, root first, and count the same ones. */
+    for(i = 0, k = 0; i < n_samples; i++) {
+        void** frames = acutest_profile_frames_ + (size_t) i * ACUTEST_PROFILE_DEPTH_;
+        int depth = acutest_profile_depths_[i] - acutest_profile_outer_depth_;
+
+        if(depth <= 2)
+            continue;
+        stack_offs[k++] = all.size;
+        for(j = depth - 1; j >= 2; j--) {
+            void** found = (void**) bsearch(&frames[j], addrs, (size_t) n_uniq, sizeof(void*), acutest_cmp_ptr_);
+            const char* name = names.data + name_offs[found - addrs];
+
+            if(j < depth - 1)
+                acutest_buffer_append_(&all, ";", 1);
+            acutest_buffer_append_(&all, name, strlen(name));
+        }
+        acutest_buffer_append_(&all, "", 1);
+    }
+    for(i = 0; i < k; i++)
+        stacks[i] = all.data + stack_offs[i];
+    qsort(stacks, (size_t) k, sizeof(char*), acutest_cmp_str_);
+
+    /* The file name is the test name, with anything else than [A-Za-z0-9._-]
+     * (e.g. the '/' of a parameterized test) replaced with '_'. */
+    acutest_buffer_append_(&path, acutest_profile_dir_, strlen(acutest_profile_dir_));
+    acutest_buffer_append_(&path, "/", 1);
+    for(i = 0; test_name[i] != '\0'; i++) {
+        char c = test_name[i];
+        if(!isalnum((unsigned char) c)  &&  c != '.'  &&  c != '_'  &&  c != '-')
+            c = '_';
+        acutest_buffer_append_(&path, &c, 1);
+    }
+    acutest_buffer_append_(&path, ".folded", 8);
+
+    f = fopen(path.data, "w");
+    if(f == NULL) {
+        fprintf(stderr, "%s: Cannot write the profile '%s'. %s [%d]\n",
+                acutest_argv0_, path.data, strerror(errno), errno);
+        goto out;
+    }
+    for(i = 0; i < k; i = j) {
+        for(j = i + 1; j < k  &&  strcmp(stacks[i], stacks[j]) == 0; j++)
+            ;
+        fprintf(f, "%s %d\n", stacks[i], j - i);
+    }
+    fclose(f);
+
+    if(acutest_profile_n_dropped_ > 0  &&  acutest_verbose_level_ >= 2) {
+        acutest_line_indent_(1);
+        acutest_out_printf_("Profile: %d samples dropped (the limit is %d)\n",
+                            acutest_profile_n_dropped_, ACUTEST_PROFILE_MAX_SAMPLES_);
+    }
+
+out:
+    free(syms);
+    free(name_offs);
+    free(stacks);
+    free(stack_offs);
+    free(addrs);
+    acutest_buffer_free_(&all);
+    acutest_buffer_free_(&names);
+    acutest_buffer_free_(&path);
+}
+
+#else   /* #if defined ACUTEST_HAS_PROFILE_ */
+
+#define acutest_profile_start_()        do {} while(0)
+#define acutest_profile_stop_()         do {} while(0)
+#define acutest_profile_write_(name)    do {} while(0)
+
+#endif  /* #if defined ACUTEST_HAS_PROFILE_ */
+
+/* Resource usage of the test (peak memory, page faults, context switches).
+ *
+ * When each test runs in its own child process, the main process collects
+ * the usage of the whole child when reaping it (wait4() on Unix, if available, or
+ * GetProcessMemoryInfo() on Windows), so it is known even for tests which
+ * crash. Otherwise (persistent workers, --no-exec), the process running the
+ * test measures the difference over the test function, but only if anything
+ * uses it. The peak memory is then the peak of the whole process, unless
+ * --max-rss needs the peak of the test and the system is able to reset it
+ * (Linux, through /proc/self/clear_refs). */
+static ACUTEST_THREAD_LOCAL_ struct acutest_rusage_ acutest_rusage_start_;
+
+static void
+acutest_rusage_reset_(struct acutest_rusage_* ru)
+{
+    ru->max_rss = -1;
+    ru->minor_faults = -1;
+    ru->major_faults = -1;
+    ru->vol_csw = -1;
+    ru->invol_csw = -1;
+}
+
+#if defined ACUTEST_UNIX_
+static void
+acutest_rusage_from_rusage_(struct acutest_rusage_* ru, const struct rusage* usage)
+{
+    ru->max_rss = (long) usage->ru_maxrss;
+#ifdef ACUTEST_MACOS_
+    ru->max_rss /= 1024;    /* macOS reports bytes, not kilobytes. */
+#endif
+    ru->minor_faults = (long) usage->ru_minflt;
+    ru->major_faults = (long) usage->ru_majflt;
+    ru->vol_csw = (long) usage->ru_nvcsw;
+    ru->invol_csw = (long) usage->ru_nivcsw;
+}
+
+/* Reap the child like waitpid(), and get its resource usage. Where wait4() is
+ * not available, the usage is computed as the growth of the usage of all the
+ * reaped children (which works as only the main thread reaps them), except
+ * for the peak memory, which is then the peak of all the children so far. */
+static pid_t
+acutest_wait_child_(pid_t pid, int* exit_code, int options, struct rusage* usage)
+{
+#if defined ACUTEST_HAS_BSD_API_
+    return wait4(pid, exit_code, options, usage);
+#else
+    static struct rusage reaped;
+    struct rusage now;
+    pid_t ret;
+
+    ret = waitpid(pid, exit_code, options);
+    if(ret > 0) {
+        getrusage(RUSAGE_CHILDREN, &now);
+        *usage = now;
+        usage->ru_minflt -= reaped.ru_minflt;
+        usage->ru_majflt -= reaped.ru_majflt;
+        usage->ru_nvcsw -= reaped.ru_nvcsw;
+        usage->ru_nivcsw -= reaped.ru_nivcsw;
+        reaped = now;
+    }
+    return ret;
+#endif
+}
+#elif defined ACUTEST_WIN_
+static void
+acutest_rusage_from_process_(struct acutest_rusage_* ru, HANDLE process)
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+
+    acutest_rusage_reset_(ru);
+    if(GetProcessMemoryInfo(process, &pmc, sizeof(pmc))) {
+        ru->max_rss = (long) (pmc.PeakWorkingSetSize / 1024);
+        ru->minor_faults = (long) pmc.PageFaultCount;
+    }
+}
+#endif
+
+/* Whether anything reads more about the tests than how they have ended (the
+ * counts of checks, CPU time, results of benchmarks, performance counters or
+ * the details of failures). If not, the child processes running the tests do
+ * not need to report anything but their exit code. (A child which has a report
+ * pipe does not know what the parent is after, so it measures all it can.) */
+static int
+acutest_details_wanted_(void)
+{
+    return (acutest_report_fd_ >= 0  ||  acutest_xml_output_ != NULL  ||  acutest_test_log_on_  ||
+            acutest_jsonl_  ||  acutest_timing_db_file_ != NULL  ||  acutest_agent_ != NULL  ||
+            acutest_perf_mask_ != 0  ||  acutest_baseline_file_ != NULL  ||  acutest_bench_report_file_ != NULL);
+}
+
+/* Whether anything reads the resource usage of the tests. Measuring it is not
+ * free, so it is done only if so. */
+static int
+acutest_rusage_wanted_(void)
+{
+    return (acutest_report_fd_ >= 0  ||  acutest_max_rss_ > 0  ||  acutest_xml_output_ != NULL  ||
+            acutest_jsonl_  ||  acutest_timing_db_file_ != NULL  ||  acutest_agent_ != NULL  ||
+            acutest_verbose_level_ >= 3);
+}
+
+static int
+acutest_rusage_measured_here_(void)
+{
+    if(acutest_threads_ > 1  ||  !acutest_rusage_wanted_())
+        return 0;
+
+    /* If we are a child process running just this one test, the main process
+     * can see it better. (But --max-rss has to be checked here, before the
+     * test line is finished.) */
+    return (!acutest_worker_  ||  acutest_persistent_  ||  acutest_max_rss_ > 0);
+}
+
+static void
+acutest_rusage_begin_(void)
+{
+    acutest_rusage_reset_(&acutest_test_rusage_);
+    if(!acutest_rusage_measured_here_())
+        return;
+
+#if defined ACUTEST_UNIX_
+    {
+        struct rusage usage;
+
+#ifdef ACUTEST_LINUX_
+        /* Reset the peak RSS (VmHWM) of the process. (Only for --max-rss,
+         * otherwise the peak of the process is good enough.) */
+        if(acutest_max_rss_ > 0) {
+            int fd = open("/proc/self/clear_refs", O_WRONLY);
+            if(fd >= 0) {
+                ssize_t n = write(fd, "5", 1);
+                (void) n;   /* If it fails, VmHWM is just not reset. */
+                close(fd);
+            }
+        }
+#endif
+        getrusage(RUSAGE_SELF, &usage);
+        acutest_rusage_from_rusage_(&acutest_rusage_start_, &usage);
+    }
+#elif defined ACUTEST_WIN_
+    acutest_rusage_from_process_(&acutest_rusage_start_, GetCurrentProcess());
+#endif
+}
+
+static void
+acutest_rusage_end_(void)
+{
+    struct acutest_rusage_ ru;
+
+    if(!acutest_rusage_measured_here_())
+        return;
+
+#if defined ACUTEST_UNIX_
+    {
+        struct rusage usage;
+
+        getrusage(RUSAGE_SELF, &usage);
+        acutest_rusage_from_rusage_(&ru, &usage);
+    }
+#ifdef ACUTEST_LINUX_
+    if(acutest_max_rss_ > 0) {
+        FILE* f = fopen("/proc/self/status", "r");
+        char line[128];
+
+        if(f != NULL) {
+            while(fgets(line, sizeof(line), f) != NULL) {
+                if(strncmp(line, "VmHWM:", 6) == 0) {
+                    ru.max_rss = strtol(line + 6, NULL, 10);
+                    break;
+                }
+            }
+            fclose(f);
+        }
+    }
+#endif
+#elif defined ACUTEST_WIN_
+    acutest_rusage_from_process_(&ru, GetCurrentProcess());
+#else
+    acutest_rusage_reset_(&ru);
+#endif
+
+    acutest_test_rusage_.max_rss = ru.max_rss;
+    if(ru.minor_faults >= 0)
+        acutest_test_rusage_.minor_faults = ru.minor_faults - acutest_rusage_start_.minor_faults;
+    if(ru.major_faults >= 0)
+        acutest_test_rusage_.major_faults = ru.major_faults - acutest_rusage_start_.major_faults;
+    if(ru.vol_csw >= 0)
+        acutest_test_rusage_.vol_csw = ru.vol_csw - acutest_rusage_start_.vol_csw;
+    if(ru.invol_csw >= 0)
+        acutest_test_rusage_.invol_csw = ru.invol_csw - acutest_rusage_start_.invol_csw;
+}
+
+/* CPU pinning (--pin-cpus[=LIST], --numa-node=N): Each process running the
+ * tests (or each thread, see --threads) is pinned to a single CPU, the K-th
+ * slot of the pool (see --jobs) to the K-th CPU of acutest_pin_cpus_[]
+ * (modulo its size). That list is ordered so that the first hardware threads
+ * of all physical cores come before their SMT siblings, so the jobs take the
+ * whole cores as long as there are enough of them. */
+#define ACUTEST_MAX_CPUS_       1024
+
+static int acutest_pin_cpus_[ACUTEST_MAX_CPUS_];
+static int acutest_n_pin_cpus_ = 0;     /* 0 if not pinning. */
+
+#if defined ACUTEST_HAS_AFFINITY_
+static int acutest_pin_requested_ = 0;
+static const char* acutest_pin_cpus_arg_ = NULL;    /* NULL for all the CPUs available. */
+static int acutest_numa_node_ = -1;
+
+/* Parse a list of CPUs like "0-3,8,10-11" (as also used in the sysfs) into
+ * the set. Returns -1 if the list is malformed. */
+static int
+acutest_cpu_list_parse_(const char* str, unsigned char* set)
+{
+    while(*str != '\0'  &&  *str != '\n') {
+        char* end;
+        long lo, hi;
+
+        lo = strtol(str, &end, 10);
+        if(end == str  ||  lo < 0)
+            return -1;
+        hi = lo;
+        if(*end == '-') {
+            str = end + 1;
+            hi = strtol(str, &end, 10);
+            if(end == str  ||  hi < lo)
+                return -1;
+        }
+        if(hi >= ACUTEST_MAX_CPUS_)
+            return -1;
+        while(lo <= hi)
+            set[lo++] = 1;
+
+        str = end;
+        if(*str == ',')
+            str++;
+        else if(*str != '\0'  &&  *str != '\n')
+            return -1;
+    }
+    return 0;
+}
+
+#if defined ACUTEST_LINUX_
+/* Read the CPU list from the sysfs file. Returns -1 if there is no such. */
+static int
+acutest_cpu_list_read_(const char* path, unsigned char* set)
+{
+    char buffer[1024];
+    FILE* f;
+    int ret = -1;
+
+    f = fopen(path, "r");
+    if(f == NULL)
+        return -1;
+    if(fgets(buffer, sizeof(buffer), f) != NULL)
+        ret = acutest_cpu_list_parse_(buffer, set);
+    fclose(f);
+    return ret;
+}
+#endif
+
+/* The CPUs the process is allowed to run on. */
+static void
+acutest_cpus_available_(unsigned char* set)
+{
+#if defined ACUTEST_WIN_
+    DWORD_PTR proc_mask, sys_mask;
+    int i;
+
+    if(GetProcessAffinityMask(GetCurrentProcess(), &proc_mask, &sys_mask)) {
+        for(i = 0; i < (int) (8 * sizeof(DWORD_PTR)); i++) {
+            if(proc_mask & ((DWORD_PTR) 1 << i))
+                set[i] = 1;
+        }
+    }
+#else
+    unsigned long mask[ACUTEST_MAX_CPUS_ / (8 * sizeof(unsigned long))];
+    long n;
+    int i;
+
+    memset(mask, 0, sizeof(mask));
+    n = syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask);
+    for(i = 0; i < ACUTEST_MAX_CPUS_  &&  i < 8 * n; i++) {
+        if(mask[i / (8 * sizeof(unsigned long))] & (1UL << (i % (8 * sizeof(unsigned long)))))
+            set[i] = 1;
+    }
+#endif
+}
+
+/* The CPUs of the NUMA node. Returns -1 if there is no such node. */
+static int
+acutest_cpus_of_node_(int node, unsigned char* set)
+{
+#if defined ACUTEST_WIN_
+    ULONGLONG mask;
+    int i;
+
+    if(node > 255  ||  !GetNumaNodeProcessorMask((UCHAR) node, &mask)  ||  mask == 0)
+        return -1;
+    for(i = 0; i < 64; i++) {
+        if(mask & ((ULONGLONG) 1 << i))
+            set[i] = 1;
+    }
+    return 0;
+#else
+    char path[64];
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    return acutest_cpu_list_read_(path, set);
+#endif
+}
+
+/* Which hardware thread of its physical core the CPU is (0 for the first). */
+static int
+acutest_cpu_smt_rank_(int cpu)
+{
+    int rank = 0;
+#if defined ACUTEST_WIN_
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION* info;
+    DWORD size = 0;
+    DWORD i;
+    int j;
+
+    GetLogicalProcessorInformation(NULL, &size);
+    info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION*) malloc(size);
+    if(info != NULL  &&  GetLogicalProcessorInformation(info, &size)) {
+        for(i = 0; i < size / sizeof(*info); i++) {
+            if(info[i].Relationship == RelationProcessorCore  &&
+               (info[i].ProcessorMask & ((ULONG_PTR) 1 << cpu))) {
+                for(j = 0; j < cpu; j++) {
+                    if(info[i].ProcessorMask & ((ULONG_PTR) 1 << j))
+                        rank++;
+                }
+            }
+        }
+    }
+    free(info);
+#else
+    static unsigned char siblings[ACUTEST_MAX_CPUS_];
+    char path[96];
+    int j;
+
+    memset(siblings, 0, sizeof(siblings));
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    if(acutest_cpu_list_read_(path, siblings) == 0) {
+        for(j = 0; j < cpu; j++)
+            rank += siblings[j];
+    }
+#endif
+    return rank;
+}
+
+/* Build acutest_pin_cpus_[] out of the CPUs available, as restricted by
+ * --pin-cpus=LIST and --numa-node=N. */
+static void
+acutest_pin_setup_(const char* list, int node)
+{
+    static unsigned char set[ACUTEST_MAX_CPUS_];
+    static unsigned char restrict_set[ACUTEST_MAX_CPUS_];
+    static int ranks[ACUTEST_MAX_CPUS_];
+    int rank, max_rank = 0;
+    int i;
+
+    acutest_cpus_available_(set);
+
+    if(list != NULL) {
+        memset(restrict_set, 0, sizeof(restrict_set));
+        acutest_cpu_list_parse_(list, restrict_set);    /* (Validated already.) */
+        for(i = 0; i < ACUTEST_MAX_CPUS_; i++)
+            set[i] &= restrict_set[i];
+    }
+
+    if(node >= 0) {
+        memset(restrict_set, 0, sizeof(restrict_set));
+        if(acutest_cpus_of_node_(node, restrict_set) != 0) {
+            fprintf(stderr, "%s: There is no NUMA node %d.\n", acutest_argv0_, node);
+            acutest_exit_(2);
+        }
+        for(i = 0; i < ACUTEST_MAX_CPUS_; i++)
+            set[i] &= restrict_set[i];
+
+#if defined ACUTEST_LINUX_  &&  defined SYS_set_mempolicy
+        /* Allocate the memory on the node too. (The forked processes and the
+         * threads inherit the policy.) */
+        if(node < (int) (8 * sizeof(unsigned long))) {
+            unsigned long nodemask = 1UL << node;
+            syscall(SYS_set_mempolicy, 2 /* MPOL_BIND */, &nodemask, 8 * sizeof(unsigned long));
+        }
+#endif
+    }
+
+    for(i = 0; i < ACUTEST_MAX_CPUS_; i++) {
+        if(set[i]) {
+            ranks[i] = acutest_cpu_smt_rank_(i);
+            if(ranks[i] > max_rank)
+                max_rank = ranks[i];
+        }
+    }
+    for(rank = 0; rank <= max_rank; rank++) {
+        for(i = 0; i < ACUTEST_MAX_CPUS_; i++) {
+            if(set[i]  &&  ranks[i] == rank)
+                acutest_pin_cpus_[acutest_n_pin_cpus_++] = i;
+        }
+    }
+
+    if(acutest_n_pin_cpus_ == 0) {
+        fprintf(stderr, "%s: None of the CPUs to pin to is available.\n", acutest_argv0_);
+        acutest_exit_(2);
+    }
+}
+
+/* Pin the calling thread (the process, if single-threaded), as the K-th slot. */
+static void
+acutest_pin_(int k)
+{
+    int cpu;
+
+    if(acutest_n_pin_cpus_ == 0)
+        return;
+    cpu = acutest_pin_cpus_[k % acutest_n_pin_cpus_];
+
+#if defined ACUTEST_WIN_
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu);
+#else
+    {
+        unsigned long mask[ACUTEST_MAX_CPUS_ / (8 * sizeof(unsigned long))];
+
+        memset(mask, 0, sizeof(mask));
+        mask[cpu / (8 * sizeof(unsigned long))] = 1UL << (cpu % (8 * sizeof(unsigned long)));
+        syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask);
+    }
+#endif
+}
+
+#if defined ACUTEST_WIN_
+static void
+acutest_pin_process_(HANDLE process, int k)
+{
+    if(acutest_n_pin_cpus_ > 0)
+        SetProcessAffinityMask(process, (DWORD_PTR) 1 << acutest_pin_cpus_[k % acutest_n_pin_cpus_]);
+}
+#endif
+#endif  /* ACUTEST_HAS_AFFINITY_ */
+
+/* Environment report (see --env-report, and the XUnit and JSONL outputs):
+ * The state of the machine which affects how stable the measured times are,
+ * so that noisy results can be told apart. */
+struct acutest_env_ {
+    char governor[32];      /* CPU frequency governor, or "". */
+    int turbo;              /* Turbo boost: 1 if enabled, 0 if disabled, -1 if unknown. */
+    int smt;                /* Simultaneous multithreading: dtto. */
+    double load[3];         /* Load average (1, 5, 15 minutes), or -1. */
+};
+
+static struct acutest_env_ acutest_env_info_;
+
+#if defined ACUTEST_LINUX_
+/* Read the first line of the file (without the new line). Returns -1 on a
+ * failure. */
+static int
+acutest_read_line_(const char* path, char* buffer, size_t size)
+{
+    FILE* f;
+    int ret = -1;
+
+    f = fopen(path, "r");
+    if(f == NULL)
+        return -1;
+    if(fgets(buffer, (int) size, f) != NULL) {
+        buffer[strcspn(buffer, "\n")] = '\0';
+        ret = 0;
+    }
+    fclose(f);
+    return ret;
+}
+#endif
+
+static void
+acutest_env_collect_(void)
+{
+    struct acutest_env_* env = &acutest_env_info_;
+#if defined ACUTEST_LINUX_
+    char buffer[64];
+#endif
+
+    env->governor[0] = '\0';
+    env->turbo = -1;
+    env->smt = -1;
+    env->load[0] = env->load[1] = env->load[2] = -1.0;
+
+#if defined ACUTEST_LINUX_
+    acutest_read_line_("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor",
+                       env->governor, sizeof(env->governor));
+    if(acutest_read_line_("/sys/devices/system/cpu/intel_pstate/no_turbo", buffer, sizeof(buffer)) == 0)
+        env->turbo = (atoi(buffer) == 0);
+    else if(acutest_read_line_("/sys/devices/system/cpu/cpufreq/boost", buffer, sizeof(buffer)) == 0)
+        env->turbo = (atoi(buffer) != 0);
+    if(acutest_read_line_("/sys/devices/system/cpu/smt/active", buffer, sizeof(buffer)) == 0)
+        env->smt = (atoi(buffer) != 0);
+    if(acutest_read_line_("/proc/loadavg", buffer, sizeof(buffer)) == 0) {
+        if(sscanf(buffer, "%lf %lf %lf", &env->load[0], &env->load[1], &env->load[2]) != 3)
+            env->load[0] = env->load[1] = env->load[2] = -1.0;
+    }
+#elif defined ACUTEST_MACOS_
+    if(getloadavg(env->load, 3) != 3)
+        env->load[0] = env->load[1] = env->load[2] = -1.0;
+#endif
+}
+
+static const char*
+acutest_env_flag_str_(int flag)
+{
+    return (flag < 0) ? "unknown" : (flag ? "on" : "off");
+}
+
+/* Format the list of the CPUs to pin to, compressing the ranges. */
+static void
+acutest_env_cpus_str_(char* buffer, size_t size)
+{
+    size_t n = 0;
+    int i = 0;
+
+    buffer[0] = '\0';
+    while(i < acutest_n_pin_cpus_  &&  n < size) {
+        int j = i;
+
+        while(j + 1 < acutest_n_pin_cpus_  &&  acutest_pin_cpus_[j+1] == acutest_pin_cpus_[j] + 1)
+            j++;
+        if(j > i)
+            n += (size_t) snprintf(buffer + n, size - n, "%s%d-%d", (i > 0) ? "," : "",
+                                   acutest_pin_cpus_[i], acutest_pin_cpus_[j]);
+        else
+            n += (size_t) snprintf(buffer + n, size - n, "%s%d", (i > 0) ? "," : "", acutest_pin_cpus_[i]);
+        i = j + 1;
+    }
+}
+
+static void
+acutest_env_print_(void)
+{
+    const struct acutest_env_* env = &acutest_env_info_;
+    const char* prefix = acutest_tap_ ? "# " : "";
+    char cpus[256];
+
+    acutest_out_printf_("%s", prefix);
+    acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Environment:\n");
+    acutest_out_printf_("%s  CPU governor:   %s\n", prefix, env->governor[0] ? env->governor : "unknown");
+    acutest_out_printf_("%s  Turbo boost:    %s\n", prefix, acutest_env_flag_str_(env->turbo));
+    acutest_out_printf_("%s  SMT:            %s\n", prefix, acutest_env_flag_str_(env->smt));
+    if(env->load[0] >= 0.0)
+        acutest_out_printf_("%s  Load average:   %.2f %.2f %.2f\n", prefix, env->load[0], env->load[1], env->load[2]);
+    else
+        acutest_out_printf_("%s  Load average:   unknown\n", prefix);
+    if(acutest_n_pin_cpus_ > 0) {
+        acutest_env_cpus_str_(cpus, sizeof(cpus));
+        acutest_out_printf_("%s  Pinned to CPUs: %s\n", prefix, cpus);
+    }
+    if(acutest_warmup_ > 0)
+        acutest_out_printf_("%s  Warm-up runs:   %d\n", prefix, acutest_warmup_);
+    acutest_out_printf_("\n");
+}
+
+/* Add the report to the current JSONL event. */
+static void
+acutest_env_event_(void)
+{
+    const struct acutest_env_* env = &acutest_env_info_;
+    char cpus[256];
+
+    if(env->governor[0])
+        acutest_event_str_("cpu_governor", env->governor);
+    if(env->turbo >= 0)
+        acutest_event_bool_("turbo", env->turbo);
+    if(env->smt >= 0)
+        acutest_event_bool_("smt", env->smt);
+    if(env->load[0] >= 0.0) {
+        acutest_event_key_("load_average");
+        acutest_json_printf_(&acutest_event_, "[%.2f,%.2f,%.2f]", env->load[0], env->load[1], env->load[2]);
+    }
+    if(acutest_n_pin_cpus_ > 0) {
+        acutest_env_cpus_str_(cpus, sizeof(cpus));
+        acutest_event_str_("pinned_cpus", cpus);
+    }
+    if(acutest_warmup_ > 0)
+        acutest_event_int_("warmup", acutest_warmup_);
+}
+
+/* Warm-up runs of the test (--warmup=N) before the measured one, to get the
+ * caches, the branch predictors and the CPU clock up to speed. Their outcome
+ * is discarded: The checks are neither counted nor printed, and an aborted
+ * (or throwing) run just ends the warm-up. The benchmarks are left out. */
+static void
+acutest_warmup_run_(const struct acutest_test_* test)
+{
+    volatile int i;
+
+    acutest_warmup_running_ = 1;
+    acutest_abort_has_jmp_buf_ = 1;
+    if(setjmp(acutest_abort_jmp_buf_) == 0) {
+        for(i = 0; i < acutest_warmup_; i++) {
+#ifdef __cplusplus
+#ifndef TEST_NO_EXCEPTIONS
+            try {
+#endif
+#endif
+                test->func();
+#ifdef __cplusplus
+#ifndef TEST_NO_EXCEPTIONS
+            } catch(...) {
+                break;
+            }
+#endif
+#endif
+        }
+    }
+    acutest_abort_has_jmp_buf_ = 0;
+    acutest_warmup_running_ = 0;
+
+    /* (With --threads, other tests may be counting there too.) */
+    if(acutest_threads_ <= 1) {
+        ACUTEST_ATOMIC_XCHG_(acutest_thread_checks_, 0);
+        ACUTEST_ATOMIC_XCHG_(acutest_thread_failures_, 0);
+    }
+    acutest_test_failures_ = 0;
+    acutest_test_check_count_ = 0;
+    acutest_test_skip_count_ = 0;
+    acutest_cond_failed_ = 0;
+    acutest_bench_n_results_ = 0;
+    acutest_bench_n_series_ = 0;
+    acutest_bench_range_var_ = NULL;
+    acutest_bench_items_next_ = 0.0;
+    acutest_bench_bytes_next_ = 0.0;
+}
+
+/* This is called just before each test */
+static void
+acutest_init_(const char *test_name)
+{
+#ifdef TEST_INIT
+    TEST_INIT
+    ; /* Allow for a single unterminated function call */
+#endif
+
+    /* Suppress any warnings about unused variable. */
+    (void) test_name;
+}
+
+/* This is called after each test */
+static void
+acutest_fini_(const char *test_name)
+{
+#ifdef TEST_FINI
+    TEST_FINI
+    ; /* Allow for a single unterminated function call */
+#endif
+
+    /* Suppress any warnings about unused variable. */
+    (void) test_name;
+}
+
+static void acutest_report_result_(int master_index, enum acutest_state_ state, int retire);
+static int acutest_worker_master_index_ = -1;
+
+void
+acutest_abort_(void)
+{
+    /* Only the thread running the test can jump back. If another one aborts,
+     * the whole process has to. */
+    if(acutest_abort_has_jmp_buf_  &&  acutest_thread_no_ == 1) {
+        longjmp(acutest_abort_jmp_buf_, 1);
+    } else {
+        if(acutest_current_->test != NULL)
+            acutest_fini_(acutest_current_->test->name);
+        acutest_out_flush_all_();
+        if(acutest_worker_master_index_ >= 0)
+            acutest_report_result_(acutest_worker_master_index_, ACUTEST_STATE_FAILED, 1);
+        acutest_exit_(ACUTEST_STATE_FAILED);
+    }
+}
+
+/* Registered tests (see TEST_REGISTER): Append them to those of TEST_LIST. */
+#if defined ACUTEST_REGISTRY_SECTION_
+    #if defined __APPLE__
+        extern const struct acutest_test_* const acutest_registry_begin_[]
+                __asm("section$start$__DATA$acutest_tests");
+        extern const struct acutest_test_* const acutest_registry_end_[]
+                __asm("section$end$__DATA$acutest_tests");
+    #else
+        /* (Provided by the linker; weak, as there is no section if nothing
+         * has been registered.) */
+        extern const struct acutest_test_* const __start_acutest_tests[] __attribute__((weak));
+        extern const struct acutest_test_* const __stop_acutest_tests[] __attribute__((weak));
+        #define acutest_registry_begin_     __start_acutest_tests
+        #define acutest_registry_end_       __stop_acutest_tests
+    #endif
+#endif
+
+static void
+acutest_registry_merge_(void)
+{
+#if defined ACUTEST_REGISTRY_SECTION_
+    const struct acutest_test_* const* reg;
+#elif defined __cplusplus
+    const acutest_registrar_* reg;
+#endif
+    size_t n_list = 0;
+    size_t n_reg = 0;
+    size_t i;
+
+#if defined ACUTEST_REGISTRY_SECTION_
+    for(reg = acutest_registry_begin_; reg < acutest_registry_end_; reg++)
+        n_reg++;
+#elif defined __cplusplus
+    for(reg = acutest_registrar_::head(); reg != NULL; reg = reg->next)
+        n_reg++;
+#endif
+    if(n_reg == 0)
+        return;
+
+    while(acutest_test_list_[n_list].func != NULL)
+        n_list++;
+    acutest_registered_list_ = (struct acutest_test_*) calloc(n_list + n_reg + 1, sizeof(struct acutest_test_));
+    if(acutest_registered_list_ == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+    for(i = 0; i < n_list; i++)
+        acutest_registered_list_[i] = acutest_test_list_[i];
+
+#if defined ACUTEST_REGISTRY_SECTION_
+    for(reg = acutest_registry_begin_; reg < acutest_registry_end_; reg++)
+        acutest_registered_list_[i++] = **reg;
+#elif defined __cplusplus
+    /* (The list is in the reverse order of the construction.) */
+    i = n_list + n_reg;
+    for(reg = acutest_registrar_::head(); reg != NULL; reg = reg->next)
+        acutest_registered_list_[--i] = *reg->test;
+#endif
+
+    acutest_list_ = acutest_registered_list_;
+}
+
+/* Parameterized tests (see TEST_PARAMS): Replace each of them in the list with
+ * a test per its parameter set. */
+static size_t
+acutest_params_count_(const struct acutest_test_* test)
+{
+    size_t n = 0;
+
+    if(test->param_gen == NULL)
+        return test->n_params;
+    while(test->param_gen(n) != NULL)
+        n++;
+    return n;
+}
+
+static void
+acutest_params_expand_(void)
+{
+    const struct acutest_test_* list = acutest_list_;
+    size_t n_tests = 0;
+    size_t names_size = 0;
+    size_t i, j, k, n, off;
+    int has_params = 0;
+
+    for(i = 0; list[i].func != NULL; i++) {
+        if(list[i].params != NULL  ||  list[i].param_gen != NULL) {
+            has_params = 1;
+            n = acutest_params_count_(&list[i]);
+            n_tests += n;
+            names_size += n * (strlen(list[i].name) + 22);    /* "/" + index + '\0' */
+        } else {
+            n_tests++;
+        }
+    }
+    if(!has_params)
+        return;
+
+    acutest_expanded_list_ = (struct acutest_test_*) calloc(n_tests + 1, sizeof(struct acutest_test_));
+    acutest_expanded_names_ = (char*) malloc(names_size + 1);
+    if(acutest_expanded_list_ == NULL  ||  acutest_expanded_names_ == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+
+    for(i = 0, j = 0, off = 0; list[i].func != NULL; i++) {
+        if(list[i].params == NULL  &&  list[i].param_gen == NULL) {
+            acutest_expanded_list_[j++] = list[i];
+            continue;
+        }
+
+        n = acutest_params_count_(&list[i]);
+        for(k = 0; k < n; k++) {
+            struct acutest_test_* test = &acutest_expanded_list_[j++];
+
+            *test = list[i];
+            test->name = acutest_expanded_names_ + off;
+            off += (size_t) sprintf(acutest_expanded_names_ + off, "%s/%lu", list[i].name, (unsigned long) k) + 1;
+            if(list[i].param_gen != NULL)
+                test->params = list[i].param_gen(k);
+            else
+                test->params = (const char*) list[i].params + k * list[i].param_size;
+            test->n_params = 0;
+            test->param_gen = NULL;
+        }
+    }
+
+    acutest_list_ = acutest_expanded_list_;
+}
+
+static void
+acutest_list_names_(void)
+{
+    int i;
+
+    acutest_out_printf_("Unit tests:\n");
+    for(i = 0; acutest_list_[i].func != NULL; i++) {
+        if(acutest_shard_count_ > 0)
+            acutest_out_printf_("  %-40s [shard %d/%d]\n", acutest_list_[i].name,
+                   acutest_test_data_[i].shard, acutest_shard_count_);
+        else
+            acutest_out_printf_("  %s\n", acutest_list_[i].name);
+    }
+}
+
+/* FNV-1a */
+static unsigned
+acutest_hash_(const char* str)
+{
+    unsigned h = 2166136261u;
+
+    while(*str != '\0') {
+        h ^= (unsigned char) *str++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/* Find index of the test of the given name, or -1. The hash table used for
+ * that is built on the first call. */
+static int
+acutest_lookup_(const char* name)
+{
+    unsigned h;
+    int i;
+
+    if(acutest_name_index_ == NULL) {
+        unsigned size = 16;
+
+        while(size < 2 * (unsigned) acutest_list_size_)
+            size *= 2;
+        acutest_name_index_ = (int*) malloc(size * sizeof(int));
+        if(acutest_name_index_ == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            acutest_exit_(2);
+        }
+        acutest_name_index_mask_ = size - 1;
+        memset(acutest_name_index_, 0xff, size * sizeof(int));
+
+        for(i = 0; i < acutest_list_size_; i++) {
+            h = acutest_hash_(acutest_list_[i].name) & acutest_name_index_mask_;
+            while(acutest_name_index_[h] >= 0) {
+                if(strcmp(acutest_list_[acutest_name_index_[h]].name, acutest_list_[i].name) == 0)
+                    break;
+                h = (h + 1) & acutest_name_index_mask_;
+            }
+            if(acutest_name_index_[h] < 0)
+                acutest_name_index_[h] = i;
+        }
+    }
+
+    h = acutest_hash_(name) & acutest_name_index_mask_;
+    while(acutest_name_index_[h] >= 0) {
+        if(strcmp(acutest_list_[acutest_name_index_[h]].name, name) == 0)
+            return acutest_name_index_[h];
+        h = (h + 1) & acutest_name_index_mask_;
+    }
+
+    return -1;
+}
+
+static const char acutest_word_delim_[] = " \t-_/.,:;";
+
+static int
+acutest_name_contains_word_(const char* name, const char* pattern)
+{
+    const char* substr;
+    size_t pattern_len;
+
+    pattern_len = strlen(pattern);
+
+    substr = strstr(name, pattern);
+    while(substr != NULL) {
+        int starts_on_word_boundary = (substr == name || strchr(acutest_word_delim_, substr[-1]) != NULL);
+        int ends_on_word_boundary = (substr[pattern_len] == '\0' || strchr(acutest_word_delim_, substr[pattern_len]) != NULL);
+
+        if(starts_on_word_boundary && ends_on_word_boundary)
+            return 1;
+
+        substr = strstr(substr+1, pattern);
+    }
+
+    return 0;
+}
+
+/* FNV-1a of a string which is not zero-terminated. */
+static unsigned
+acutest_hash_mem_(const char* str, size_t len)
+{
+    unsigned h = 2166136261u;
+
+    while(len-- > 0) {
+        h ^= (unsigned char) *str++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/* Build a hash table of all distinct words (as delimited by acutest_word_delim_)
+ * of all the test names, each with the list of the tests containing it. */
+static void
+acutest_word_index_build_(void)
+{
+    unsigned n_words = 0;
+    unsigned size = 16;
+    int n_distinct = 0;
+    int n_tests = 0;
+    int i;
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        const char* p = acutest_list_[i].name;
+
+        p += strspn(p, acutest_word_delim_);
+        while(*p != '\0') {
+            n_words++;
+            p += strcspn(p, acutest_word_delim_);
+            p += strspn(p, acutest_word_delim_);
+        }
+    }
+
+    while(size < 2 * n_words)
+        size *= 2;
+    acutest_word_index_ = (int*) malloc(size * sizeof(int));
+    acutest_words_ = (struct acutest_word_*) malloc((n_words + 1) * sizeof(struct acutest_word_));
+    acutest_word_tests_ = (struct acutest_word_test_*) malloc((n_words + 1) * sizeof(struct acutest_word_test_));
+    if(acutest_word_index_ == NULL  ||  acutest_words_ == NULL  ||  acutest_word_tests_ == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+    acutest_word_index_mask_ = size - 1;
+    memset(acutest_word_index_, 0xff, size * sizeof(int));
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        const char* name = acutest_list_[i].name;
+        const char* p = name + strspn(name, acutest_word_delim_);
+
+        while(*p != '\0') {
+            size_t len = strcspn(p, acutest_word_delim_);
+            unsigned h = acutest_hash_mem_(p, len) & acutest_word_index_mask_;
+            struct acutest_word_* w = NULL;
+
+            while(acutest_word_index_[h] >= 0) {
+                w = &acutest_words_[acutest_word_index_[h]];
+                if(w->len == (int) len  &&  memcmp(acutest_list_[w->test].name + w->off, p, len) == 0)
+                    break;
+                w = NULL;
+                h = (h + 1) & acutest_word_index_mask_;
+            }
+            if(w == NULL) {
+                acutest_word_index_[h] = n_distinct;
+                w = &acutest_words_[n_distinct++];
+                w->test = i;
+                w->off = (int) (p - name);
+                w->len = (int) len;
+                w->first = -1;
+            }
+
+            /* The tests are added in order, so the same word repeated in the
+             * name of the same test would be at the head. */
+            if(w->first < 0  ||  acutest_word_tests_[w->first].test != i) {
+                acutest_word_tests_[n_tests].test = i;
+                acutest_word_tests_[n_tests].next = w->first;
+                w->first = n_tests++;
+            }
+
+            p += len;
+            p += strspn(p, acutest_word_delim_);
+        }
+    }
+}
+
+/* Selects the tests whose names contain the pattern as a whole word (or as
+ * a sequence of whole words). It is equivalent to calling
+ * acutest_name_contains_word_() for all the tests, but it only has to examine
+ * those containing the first word of the pattern. Returns -1 if the pattern
+ * does not start with a word, so that the index cannot be used. */
+static int
+acutest_select_words_(const char* pattern)
+{
+    size_t len = strcspn(pattern, acutest_word_delim_);
+    const struct acutest_word_* w = NULL;
+    unsigned h;
+    int t;
+    int n = 0;
+
+    if(len == 0)
+        return -1;
+
+    if(acutest_word_index_ == NULL)
+        acutest_word_index_build_();
+
+    h = acutest_hash_mem_(pattern, len) & acutest_word_index_mask_;
+    while(acutest_word_index_[h] >= 0) {
+        w = &acutest_words_[acutest_word_index_[h]];
+        if(w->len == (int) len  &&  memcmp(acutest_list_[w->test].name + w->off, pattern, len) == 0)
+            break;
+        w = NULL;
+        h = (h + 1) & acutest_word_index_mask_;
+    }
+    if(w == NULL)
+        return 0;
+
+    for(t = w->first; t >= 0; t = acutest_word_tests_[t].next) {
+        int i = acutest_word_tests_[t].test;
+
+        /* A single word is matched already. */
+        if(pattern[len] == '\0'  ||  acutest_name_contains_word_(acutest_list_[i].name, pattern)) {
+            acutest_test_data_[i].state = ACUTEST_STATE_SELECTED;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/* Shell-like wildcard matching: '*' matches any string, '?' any character,
+ * and '[...]' any character of the set (or, as '[!...]', not of the set). */
+static int
+acutest_glob_match_(const char* pattern, const char* str)
+{
+    const char* star_pattern = NULL;
+    const char* star_str = NULL;
+
+    while(*str != '\0') {
+        int matched = 0;
+        const char* next = pattern + 1;
+
+        if(*pattern == '*') {
+            star_pattern = pattern++;
+            star_str = str;
+            continue;
+        } else if(*pattern == '?') {
+            matched = 1;
+        } else if(*pattern == '[') {
+            const char* p = pattern + 1;
+            int negate = 0;
+
+            if(*p == '!'  ||  *p == '^') {
+                negate = 1;
+                p++;
+            }
+            do {
+                if(p[1] == '-'  &&  p[2] != ']'  &&  p[2] != '\0') {
+                    if((unsigned char) p[0] <= (unsigned char) *str  &&
+                       (unsigned char) *str <= (unsigned char) p[2])
+                        matched = 1;
+                    p += 3;
+                } else {
+                    if(*p == *str)
+                        matched = 1;
+                    p++;
+                }
+            } while(*p != ']'  &&  *p != '\0');
+
+            if(*p == ']') {
+                matched = (matched != negate);
+                next = p + 1;
+            } else {
+                /* Unterminated set. Treat the '[' literally. */
+                matched = (*str == '[');
+            }
+        } else {
+            matched = (*pattern == *str);
+        }
+
+        if(matched) {
+            pattern = next;
+            str++;
+        } else if(star_pattern != NULL) {
+            /* Let the last '*' eat one more character and retry. */
+            pattern = star_pattern + 1;
+            str = ++star_str;
+        } else {
+            return 0;
+        }
+    }
+
+    while(*pattern == '*')
+        pattern++;
+    return (*pattern == '\0');
+}
+
+/* Selects tests matching the pattern (as given on the command line). Tried in
+ * this order, the first kind of match selecting anything wins:
+ *   -- exact match of the name;
+ *   -- regular expression, if the pattern is in the form "/REGEX/";
+ *   -- wildcard match, if the pattern contains any of '*', '?', '[';
+ *   -- match of whole words;
+ *   -- match of any substring.
+ * Returns count of the selected tests. */
+static int
+acutest_select_(const char* pattern)
+{
+    size_t len = strlen(pattern);
+    int i;
+    int n = 0;
+
+    /* Try exact match. */
+    i = acutest_lookup_(pattern);
+    if(i >= 0) {
+        acutest_test_data_[i].state = ACUTEST_STATE_SELECTED;
+        return 1;
+    }
+
+#if defined ACUTEST_UNIX_
+    /* Try regular expression. */
+    if(len > 2  &&  pattern[0] == '/'  &&  pattern[len-1] == '/') {
+        char* expr;
+        regex_t re;
+        int err;
+
+        expr = (char*) malloc(len - 1);
+        if(expr == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            acutest_exit_(2);
+        }
+        memcpy(expr, pattern + 1, len - 2);
+        expr[len - 2] = '\0';
+        err = regcomp(&re, expr, REG_EXTENDED | REG_NOSUB);
+        free(expr);
+        if(err != 0) {
+            char buffer[256];
+
+            regerror(err, &re, buffer, sizeof(buffer));
+            fprintf(stderr, "%s: Bad regular expression '%s': %s\n", acutest_argv0_, pattern, buffer);
+            acutest_exit_(2);
+        }
+
+        for(i = 0; i < acutest_list_size_; i++) {
+            if(regexec(&re, acutest_list_[i].name, 0, NULL, 0) == 0) {
+                acutest_test_data_[i].state = ACUTEST_STATE_SELECTED;
+                n++;
+            }
+        }
+        regfree(&re);
+        if(n > 0)
+            return n;
+    }
+#endif
+
+    /* Try wildcard match. */
+    if(strpbrk(pattern, "*?[") != NULL) {
+        for(i = 0; i < acutest_list_size_; i++) {
+            if(acutest_glob_match_(pattern, acutest_list_[i].name)) {
+                acutest_test_data_[i].state = ACUTEST_STATE_SELECTED;
+                n++;
+            }
+        }
+        if(n > 0)
+            return n;
+    }
+
+    /* Try word match. */
+    n = acutest_select_words_(pattern);
+    if(n < 0) {
+        n = 0;
+        for(i = 0; i < acutest_list_size_; i++) {
+            if(acutest_name_contains_word_(acutest_list_[i].name, pattern)) {
+                acutest_test_data_[i].state = ACUTEST_STATE_SELECTED;
+                n++;
+            }
+        }
+    }
+    if(n > 0)
+        return n;
+
+    /* Try relaxed match. */
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(strstr(acutest_list_[i].name, pattern) != NULL) {
+            acutest_test_data_[i].state = ACUTEST_STATE_SELECTED;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/* --tests-from=FILE: Select tests as if each line of the file was given on
+ * the command line. Empty lines and lines starting with '#' are ignored. */
+static void
+acutest_select_from_file_(const char* path)
+{
+    FILE* f;
+    char line[1024];
+    int line_no = 0;
+
+    if(strcmp(path, "-") == 0) {
+        f = stdin;
+    } else {
+        f = fopen(path, "r");
+        if(f == NULL) {
+            fprintf(stderr, "Unable to open '%s': %s\n", path, strerror(errno));
+            acutest_exit_(2);
+        }
+    }
+
+    while(fgets(line, sizeof(line), f) != NULL) {
+        size_t len = strlen(line);
+        char* pattern = line;
+
+        line_no++;
+        if(len > 0  &&  line[len-1] != '\n'  &&  !feof(f)) {
+            fprintf(stderr, "%s:%d: Line too long.\n", path, line_no);
+            acutest_exit_(2);
+        }
+
+        while(len > 0  &&  isspace((unsigned char) line[len-1]))
+            line[--len] = '\0';
+        while(isspace((unsigned char) *pattern))
+            pattern++;
+        if(*pattern == '\0'  ||  *pattern == '#')
+            continue;
+
+        if(acutest_select_(pattern) == 0) {
+            fprintf(stderr, "%s:%d: Unrecognized unit test '%s'\n", path, line_no, pattern);
+            fprintf(stderr, "Try '%s --list' for list of unit tests.\n", acutest_argv0_);
+            acutest_exit_(2);
+        }
+    }
+
+    if(f != stdin)
+        fclose(f);
+}
+
+
+static const char*
+acutest_state_name_(enum acutest_state_ state)
+{
+    switch(state) {
+        case ACUTEST_STATE_SUCCESS:     return "success";
+        case ACUTEST_STATE_FAILED:      return "failed";
+        case ACUTEST_STATE_SKIPPED:     return "skipped";
+        case ACUTEST_STATE_TIMEOUT:     return "timeout";
+        case ACUTEST_STATE_FLAKY:       return "flaky";
+        case ACUTEST_STATE_EXCLUDED:    return "excluded";
+        default:                        return "unknown";
+    }
+}
+
+/* Last-run state (--rerun-failed=FILE): A text file with one line per unit
+ * test, in the form "<outcome> <test name>". If it says some of the tests to
+ * run have failed (or timed out) last time, only those are run. It is then
+ * rewritten with the new outcomes (keeping the old ones of the tests which
+ * have not run), so once all of them pass, the next run runs all the tests
+ * again. */
+static void
+acutest_rerun_load_(void)
+{
+    static const enum acutest_state_ states[] = {
+        ACUTEST_STATE_SUCCESS, ACUTEST_STATE_FAILED, ACUTEST_STATE_SKIPPED, ACUTEST_STATE_TIMEOUT,
+        ACUTEST_STATE_FLAKY
+    };
+    FILE* f;
+    char line[1024];
+
+    f = fopen(acutest_rerun_file_, "r");
+    if(f == NULL)
+        return;     /* No previous run. */
+
+    while(fgets(line, sizeof(line), f) != NULL) {
+        size_t len = strlen(line);
+        char* name;
+        int i, j;
+
+        if(len > 0  &&  line[len-1] != '\n'  &&  !feof(f)) {
+            /* Too long line. Skip rest of it. */
+            int c;
+            do {
+                c = fgetc(f);
+            } while(c != EOF  &&  c != '\n');
+            continue;
+        }
+
+        while(len > 0  &&  (line[len-1] == '\n'  ||  line[len-1] == '\r'))
+            line[--len] = '\0';
+
+        name = strchr(line, ' ');
+        if(name == NULL)
+            continue;
+        *name++ = '\0';
+
+        i = acutest_lookup_(name);
+        if(i < 0)
+            continue;
+        for(j = 0; j < (int) (sizeof(states) / sizeof(states[0])); j++) {
+            if(strcmp(line, acutest_state_name_(states[j])) == 0)
+                acutest_test_data_[i].last_state = states[j];
+        }
+    }
+
+    fclose(f);
+}
+
+static int
+acutest_rerun_wanted_(int master_index)
+{
+    enum acutest_state_ last_state = acutest_test_data_[master_index].last_state;
+
+    return (last_state == ACUTEST_STATE_FAILED  ||  last_state == ACUTEST_STATE_TIMEOUT  ||
+            last_state == ACUTEST_STATE_FLAKY);
+}
+
+/* Leave out all the tests to run which have not failed last time (if any
+ * has). */
+static void
+acutest_rerun_apply_(void)
+{
+    int n_failed = 0;
+    int i;
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN  &&  acutest_rerun_wanted_(i))
+            n_failed++;
+    }
+
+    if(n_failed == 0)
+        return;
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN  &&  !acutest_rerun_wanted_(i))
+            acutest_test_data_[i].state = ACUTEST_STATE_EXCLUDED;
+    }
+}
+
+static void
+acutest_rerun_save_(void)
+{
+    size_t len = strlen(acutest_rerun_file_);
+    char* tmp_path;
+    FILE* f;
+    int i;
+
+    tmp_path = (char*) malloc(len + 5);
+    if(tmp_path == NULL)
+        return;
+    memcpy(tmp_path, acutest_rerun_file_, len);
+    memcpy(tmp_path + len, ".tmp", 5);
+
+    f = fopen(tmp_path, "w");
+    if(f == NULL) {
+        fprintf(stderr, "Unable to open '%s': %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return;
+    }
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        enum acutest_state_ state = acutest_test_data_[i].state;
+
+        if(state < ACUTEST_STATE_SUCCESS)
+            state = acutest_test_data_[i].last_state;
+        if(state >= ACUTEST_STATE_SUCCESS)
+            fprintf(f, "%s %s\n", acutest_state_name_(state), acutest_list_[i].name);
+    }
+
+    if(fclose(f) == 0) {
+#ifdef ACUTEST_WIN_
+        remove(acutest_rerun_file_);
+#endif
+        if(rename(tmp_path, acutest_rerun_file_) != 0)
+            fprintf(stderr, "Unable to write '%s': %s\n", acutest_rerun_file_, strerror(errno));
+    } else {
+        remove(tmp_path);
+    }
+
+    free(tmp_path);
+}
+
+/* Order of the tests in watch mode (see below); lower runs earlier. */
+static int
+acutest_watch_priority_(int master_index)
+{
+    if(!acutest_watch_)
+        return 0;
+    if(acutest_rerun_wanted_(master_index))
+        return 0;
+    if(acutest_test_data_[master_index].estimate < 0.0)
+        return 1;
+    return 2;
+}
+
+#if defined ACUTEST_UNIX_
+/* Watch mode (--watch): Once all the tests have run, we wait for the binary
+ * to be rebuilt and then re-execute it with the same command line. The names
+ * of the tests which have failed are handed over to the new process in an
+ * environment variable, and those run first; then the tests without any
+ * known duration (as these are likely the new ones), and only then the rest
+ * of them. */
+#define ACUTEST_WATCH_ENV_      "ACUTEST_WATCH_FAILED"
+#define ACUTEST_WATCH_POLL_MS_  200
+
+/* Absolute path of the binary. It is resolved at start-up, as argv[0] may be
+ * relative to the working directory (which a test may change), or just a name
+ * found through $PATH. (If it cannot be resolved, argv[0] is used as it is.) */
+static char* acutest_watch_exe_ = NULL;
+
+static char*
+acutest_watch_exe_resolve_(const char* argv0)
+{
+#if defined ACUTEST_HAS_POSIX_API_
+    char buffer[4096];
+    const char* path;
+    const char* end;
+
+#if defined ACUTEST_LINUX_
+    {
+        char* exe = realpath("/proc/self/exe", NULL);
+        if(exe != NULL)
+            return exe;
+    }
+#elif defined ACUTEST_MACOS_
+    {
+        uint32_t size = sizeof(buffer);
+        if(_NSGetExecutablePath(buffer, &size) == 0)
+            return realpath(buffer, NULL);
+    }
+#endif
+
+    if(strchr(argv0, '/') != NULL)
+        return realpath(argv0, NULL);
+
+    /* Found through $PATH, the same way as the shell has done it. */
+    path = getenv("PATH");
+    while(path != NULL  &&  *path != '\0') {
+        end = strchr(path, ':');
+        if(end == NULL)
+            end = path + strlen(path);
+        /* (An empty entry means the current directory.) */
+        snprintf(buffer, sizeof(buffer), "%.*s/%s", (end > path) ? (int) (end - path) : 1,
+                 (end > path) ? path : ".", argv0);
+        if(access(buffer, X_OK) == 0)
+            return realpath(buffer, NULL);
+        path = (*end != '\0') ? end + 1 : end;
+    }
+#else
+    (void) argv0;
+#endif
+    return NULL;
+}
+
+static void
+acutest_watch_load_(void)
+{
+    const char* names = getenv(ACUTEST_WATCH_ENV_);
+    const char* end;
+    char name[256];
+    int i;
+
+    acutest_watch_exe_ = acutest_watch_exe_resolve_(acutest_argv0_);
+
+    while(names != NULL  &&  *names != '\0') {
+        size_t len;
+
+        end = strchr(names, '\n');
+        if(end == NULL)
+            end = names + strlen(names);
+        len = (size_t) (end - names);
+        if(len < sizeof(name)) {
+            memcpy(name, names, len);
+            name[len] = '\0';
+            i = acutest_lookup_(name);
+            if(i >= 0)
+                acutest_test_data_[i].last_state = ACUTEST_STATE_FAILED;
+        }
+        names = (*end != '\0') ? end + 1 : end;
+    }
+}
+
+static int
+acutest_watch_same_(const struct stat* a, const struct stat* b)
+{
+    return (a->st_ino == b->st_ino  &&  a->st_size == b->st_size  &&  a->st_mtime == b->st_mtime);
+}
+
+/* Wait until the binary changes (and the linker is done with it) and
+ * re-execute it. Returns only if the binary cannot be watched. */
+static void
+acutest_watch_wait_(char** argv)
+{
+    struct acutest_buffer_ names = { NULL, 0, 0 };
+    const char* exe = (acutest_watch_exe_ != NULL) ? acutest_watch_exe_ : argv[0];
+    struct stat st0, st;
+    int changed = 0;
+    int i;
+
+    if(stat(exe, &st0) != 0) {
+        fprintf(stderr, "%s: Cannot watch '%s'. %s [%d]\n", acutest_argv0_, exe, strerror(errno), errno);
+        free(acutest_watch_exe_);
+        acutest_watch_exe_ = NULL;
+        return;
+    }
+
+    /* Still failing are the tests which have failed now, and the ones which
+     * have failed before and have not run now (e.g. because of --fail-fast). */
+    for(i = 0; i < acutest_list_size_; i++) {
+        enum acutest_state_ state = acutest_test_data_[i].state;
+
+        if(state == ACUTEST_STATE_FAILED  ||  state == ACUTEST_STATE_TIMEOUT  ||
+           state == ACUTEST_STATE_FLAKY  ||
+           (state < ACUTEST_STATE_SUCCESS  &&  acutest_rerun_wanted_(i))) {
+            if(names.size > 0)
+                acutest_buffer_append_(&names, "\n", 1);
+            acutest_buffer_append_(&names, acutest_list_[i].name, strlen(acutest_list_[i].name));
+        }
+    }
+    acutest_buffer_append_(&names, "", 1);
+    setenv(ACUTEST_WATCH_ENV_, names.data, 1);
+    acutest_buffer_free_(&names);
+
+    if(acutest_verbose_level_ >= 1  &&  !acutest_tap_  &&  !acutest_jsonl_)
+        acutest_out_printf_("Waiting for %s to be rebuilt (press Ctrl+C to quit)...\n", exe);
+    acutest_out_flush_all_();
+
+    while(1) {
+        /* (Unlike nanosleep(), poll() is there even in strict ISO C mode.) */
+        poll(NULL, 0, ACUTEST_WATCH_POLL_MS_);
+
+        /* (It may be missing for a moment while being replaced.) */
+        if(stat(exe, &st) != 0)
+            continue;
+
+        if(!acutest_watch_same_(&st, &st0)) {
+            /* Give the linker the time to finish it. */
+            st0 = st;
+            changed = 1;
+            continue;
+        }
+
+        if(changed  &&  access(exe, X_OK) == 0) {
+            execv(exe, argv);
+            fprintf(stderr, "%s: Cannot execute '%s'. %s [%d]\n", acutest_argv0_, exe, strerror(errno), errno);
+            changed = 0;
+        }
+    }
+}
+#endif  /* defined ACUTEST_UNIX_ */
+
+/* Timing database (--timing-db=FILE): A CSV file, shared by any number of
+ * test suites, which gets one record appended for each unit test run:
+ *
+ *   binary,test,outcome,wall,cpu,checks,failures,timestamp,median,stddev,samples
+ *
+ * Records are only ever appended, each with a single write, and the file is
+ * synced to disk at the end of the run. Hence an interrupted run can damage
+ * only the very last line, and such lines are ignored when reading (as is
+ * anything else we do not understand). Before appending to a file whose last
+ * line is cut short, a line break is added, so that the next record does not
+ * merge with it. When reading, the most recent record of each test of this
+ * suite wins.
+ *
+ * So that the file (read whole at each start-up) does not grow forever, it is
+ * compacted at start-up once it has grown big enough: Only the last
+ * ACUTEST_TIMING_DB_KEEP_ records of each binary, test and outcome are kept
+ * (so --baseline still has the last few successful runs of each test).
+ *
+ * The last three fields are empty in the records of the tests. Instead, each
+ * benchmark (see TEST_BENCH) gets its own record, with the outcome
+ * "bench:NAME", the median time per iteration, its standard deviation and
+ * the count of samples in them, and with the fields of the test empty.
+ * Similarly, each performance counter (see --perf-counters) gets a record
+ * with the outcome "perf:NAME" and the count as the median. */
+#define ACUTEST_TIMING_DB_FIELDS_   11
+#define ACUTEST_TIMING_DB_HEADER_   "binary,test,outcome,wall,cpu,checks,failures,timestamp,median,stddev,samples\n"
+
+static void
+acutest_csv_append_field_(struct acutest_buffer_* buf, const char* str)
+{
+    if(strpbrk(str, ",\"\r\n") == NULL) {
+        acutest_buffer_append_(buf, str, strlen(str));
+        return;
+    }
+
+    acutest_buffer_append_(buf, "\"", 1);
+    while(*str != '\0') {
+        if(*str == '"')
+            acutest_buffer_append_(buf, "\"", 1);
+        acutest_buffer_append_(buf, str, 1);
+        str++;
+    }
+    acutest_buffer_append_(buf, "\"", 1);
+}
+
+/* Split the CSV line in place. Returns count of fields, or -1 if the line is
+ * malformed. */
+static int
+acutest_csv_split_(char* line, char** fields, int max_fields)
+{
+    char* in = line;
+    int n = 0;
+
+    while(1) {
+        char* out;
+
+        if(n >= max_fields)
+            return -1;
+        fields[n++] = in;
+        out = in;
+
+        if(*in == '"') {
+            in++;
+            while(1) {
+                if(*in == '\0')
+                    return -1;
+                if(*in == '"') {
+                    if(in[1] != '"')
+                        break;
+                    in++;
+                }
+                *out++ = *in++;
+            }
+            in++;
+        } else {
+            while(*in != ','  &&  *in != '\0')
+                *out++ = *in++;
+        }
+
+        if(*in == '\0') {
+            *out = '\0';
+            return n;
+        }
+        if(*in != ',')
+            return -1;
+        in++;
+        *out = '\0';
+    }
+}
+
+/* Call the callback for each valid record of this suite in the database (as
+ * read whole into the buffer). */
+static void
+acutest_timing_db_parse_(const struct acutest_buffer_* db, void (*callback)(int /*master_index*/, char** /*fields*/))
+{
+    const char* binary = acutest_basename_(acutest_argv0_);
+    struct acutest_buffer_ line = { NULL, 0, 0 };
+    const char* beg = db->data;
+    const char* end = db->data + db->size;
+    const char* eol;
+
+    /* Only complete lines are of any interest. */
+    while(beg < end  &&  (eol = (const char*) memchr(beg, '\n', (size_t) (end - beg))) != NULL) {
+        char* fields[ACUTEST_TIMING_DB_FIELDS_];
+        char* num_end;
+        double value;
+        size_t len = (size_t) (eol - beg);
+        int i;
+        int n;
+
+        if(len > 0  &&  beg[len-1] == '\r')
+            len--;
+        line.size = 0;
+        acutest_buffer_append_(&line, beg, len);
+        acutest_buffer_append_(&line, "", 1);
+        beg = eol + 1;
+
+        if(acutest_csv_split_(line.data, fields, ACUTEST_TIMING_DB_FIELDS_) == ACUTEST_TIMING_DB_FIELDS_  &&
+           strcmp(fields[0], binary) == 0)
+        {
+            /* Validate the duration and the check count of a test, or
+             * the median and the sample count of the others. */
+            int first = (strchr(fields[2], ':') == NULL ? 3 : 8);
+
+            i = acutest_lookup_(fields[1]);
+            value = strtod(fields[first], &num_end);
+            if(i >= 0  &&  num_end != fields[first]  &&  *num_end == '\0'  &&  value >= 0.0) {
+                n = (int) strtol(fields[first+2], &num_end, 10);
+                if(num_end != fields[first+2]  &&  *num_end == '\0'  &&  n >= 0)
+                    callback(i, fields);
+            }
+        }
+    }
+
+    acutest_buffer_free_(&line);
+}
+
+/* Read the whole file into the buffer. Returns non-zero if it cannot be
+ * opened. */
+static int
+acutest_file_read_(const char* path, struct acutest_buffer_* buf)
+{
+    char block[16 * 1024];
+    size_t n;
+    FILE* f;
+
+    f = fopen(path, "rb");
+    if(f == NULL)
+        return -1;
+    while((n = fread(block, 1, sizeof(block), f)) > 0)
+        acutest_buffer_append_(buf, block, n);
+    fclose(f);
+    return 0;
+}
+
+static void
+acutest_timing_db_read_(const char* path, void (*callback)(int /*master_index*/, char** /*fields*/))
+{
+    struct acutest_buffer_ db = { NULL, 0, 0 };
+
+    if(acutest_file_read_(path, &db) == 0)
+        acutest_timing_db_parse_(&db, callback);
+    acutest_buffer_free_(&db);
+}
+
+/* Compaction of the timing database. The records are sorted by their key
+ * (the binary, the test and the outcome, as written in the line), and then by
+ * their position in the file, so the last ones of each key are easy to see. */
+#define ACUTEST_TIMING_DB_KEEP_             8
+#define ACUTEST_TIMING_DB_COMPACT_LINES_    1000
+
+struct acutest_timing_db_rec_ {
+    const char* line;
+    size_t key_len;
+    size_t len;         /* Including the '\n'. */
+    int pos;
+    int keep;
+};
+
+static int
+acutest_cmp_timing_db_rec_(const void* a, const void* b)
+{
+    const struct acutest_timing_db_rec_* ra = (const struct acutest_timing_db_rec_*) a;
+    const struct acutest_timing_db_rec_* rb = (const struct acutest_timing_db_rec_*) b;
+    int cmp = memcmp(ra->line, rb->line, (ra->key_len < rb->key_len) ? ra->key_len : rb->key_len);
+
+    if(cmp != 0)
+        return cmp;
+    if(ra->key_len != rb->key_len)
+        return (ra->key_len < rb->key_len) ? -1 : +1;
+    return ra->pos - rb->pos;
+}
+
+static int
+acutest_cmp_timing_db_pos_(const void* a, const void* b)
+{
+    return ((const struct acutest_timing_db_rec_*) a)->pos - ((const struct acutest_timing_db_rec_*) b)->pos;
+}
+
+/* Length of the key (the first three fields) of the line, or 0 if it has none. */
+static size_t
+acutest_timing_db_key_len_(const char* line, size_t len)
+{
+    int quoted = 0;
+    int n_commas = 0;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        if(line[i] == '"')
+            quoted = !quoted;
+        else if(line[i] == ','  &&  !quoted  &&  ++n_commas == 3)
+            return i;
+    }
+    return 0;
+}
+
+static void
+acutest_timing_db_compact_(const struct acutest_buffer_* db)
+{
+    struct acutest_timing_db_rec_* recs;
+    const char* beg = db->data;
+    const char* end = db->data + db->size;
+    const char* eol;
+    size_t len = strlen(acutest_timing_db_file_);
+    char* tmp_path;
+    FILE* f;
+    int n = 0;
+    int n_keep = 0;
+    int i;
+
+    /* Most of the time, there is nothing to do. */
+    for(eol = beg; eol < end  &&  (eol = (const char*) memchr(eol, '\n', (size_t) (end - eol))) != NULL; eol++)
+        n++;
+    if(n <= ACUTEST_TIMING_DB_COMPACT_LINES_)
+        return;
+
+    recs = (struct acutest_timing_db_rec_*) malloc((size_t) n * sizeof(struct acutest_timing_db_rec_));
+    tmp_path = (char*) malloc(len + 5);
+    if(recs == NULL  ||  tmp_path == NULL) {
+        free(recs);
+        free(tmp_path);
+        return;
+    }
+
+    n = 0;
+    while(beg < end  &&  (eol = (const char*) memchr(beg, '\n', (size_t) (end - beg))) != NULL) {
+        size_t key_len = acutest_timing_db_key_len_(beg, (size_t) (eol - beg));
+
+        /* (The header, and anything we do not understand, is dropped.) */
+        if(key_len > 0  &&  strncmp(beg, "binary,", 7) != 0) {
+            recs[n].line = beg;
+            recs[n].key_len = key_len;
+            recs[n].len = (size_t) (eol - beg) + 1;
+            recs[n].pos = n;
+            n++;
+        }
+        beg = eol + 1;
+    }
+
+    qsort(recs, (size_t) n, sizeof(struct acutest_timing_db_rec_), acutest_cmp_timing_db_rec_);
+    for(i = 0; i < n; i++) {
+        /* Keep it unless there are enough newer records of the same key. */
+        const struct acutest_timing_db_rec_* newer = &recs[i + ACUTEST_TIMING_DB_KEEP_];
+
+        recs[i].keep = (i + ACUTEST_TIMING_DB_KEEP_ >= n  ||  newer->key_len != recs[i].key_len  ||
+                        memcmp(newer->line, recs[i].line, recs[i].key_len) != 0);
+        if(recs[i].keep)
+            n_keep++;
+    }
+
+    /* Only rewrite the file if it gets much smaller. */
+    if(n_keep > n / 2) {
+        free(recs);
+        free(tmp_path);
+        return;
+    }
+    qsort(recs, (size_t) n, sizeof(struct acutest_timing_db_rec_), acutest_cmp_timing_db_pos_);
+
+    /* Write into a temporary file and rename it, so that an interrupted run
+     * never leaves a truncated database behind. (Records appended by another
+     * suite in the meantime are lost. Those are only durations.) */
+    memcpy(tmp_path, acutest_timing_db_file_, len);
+    memcpy(tmp_path + len, ".tmp", 5);
+    f = fopen(tmp_path, "wb");
+    if(f != NULL) {
+        fputs(ACUTEST_TIMING_DB_HEADER_, f);
+        for(i = 0; i < n; i++) {
+            if(recs[i].keep)
+                fwrite(recs[i].line, 1, recs[i].len, f);
+        }
+        if(fclose(f) == 0) {
+#ifdef ACUTEST_WIN_
+            remove(acutest_timing_db_file_);
+#endif
+            if(rename(tmp_path, acutest_timing_db_file_) != 0)
+                remove(tmp_path);
+        } else {
+            remove(tmp_path);
+        }
+    }
+
+    free(recs);
+    free(tmp_path);
+}
+
+static void
+acutest_timing_db_estimate_cb_(int master_index, char** fields)
+{
+    if(strchr(fields[2], ':') == NULL)
+        acutest_test_data_[master_index].estimate = strtod(fields[3], NULL);
+}
+
+static void
+acutest_timing_db_load_(void)
+{
+    struct acutest_buffer_ db = { NULL, 0, 0 };
+
+    if(acutest_file_read_(acutest_timing_db_file_, &db) == 0) {
+        acutest_timing_db_parse_(&db, acutest_timing_db_estimate_cb_);
+        acutest_timing_db_compact_(&db);
+    }
+    acutest_buffer_free_(&db);
+}
+
+static void
+acutest_timing_db_open_(void)
+{
+    long size;
+
+    /* (Reading is allowed, writing always appends.) */
+    acutest_timing_db_ = fopen(acutest_timing_db_file_, "a+b");
+    if(acutest_timing_db_ == NULL) {
+        fprintf(stderr, "Unable to open '%s': %s\n", acutest_timing_db_file_, strerror(errno));
+        acutest_exit_(2);
+    }
+
+    fseek(acutest_timing_db_, 0, SEEK_END);
+    size = ftell(acutest_timing_db_);
+    if(size == 0) {
+        fputs(ACUTEST_TIMING_DB_HEADER_, acutest_timing_db_);
+        fflush(acutest_timing_db_);
+    } else if(size > 0) {
+        /* Do not merge the first record with a line cut short. */
+        int c;
+
+        fseek(acutest_timing_db_, -1, SEEK_END);
+        c = fgetc(acutest_timing_db_);
+        fseek(acutest_timing_db_, 0, SEEK_END);
+        if(c != '\n') {
+            fputc('\n', acutest_timing_db_);
+            fflush(acutest_timing_db_);
+        }
+    }
+}
+
+static void
+acutest_timing_db_append_(int master_index)
+{
+    const struct acutest_test_data_* data = &acutest_test_data_[master_index];
+    struct acutest_buffer_ rec = { NULL, 0, 0 };
+    char tmp[128];
+    int i;
+
+    acutest_csv_append_field_(&rec, acutest_basename_(acutest_argv0_));
+    acutest_buffer_append_(&rec, ",", 1);
+    acutest_csv_append_field_(&rec, acutest_list_[master_index].name);
+    snprintf(tmp, sizeof(tmp), ",%s,%.6f,%.6f,%d,%d,%lu,,,\n",
+             acutest_state_name_(data->state), data->duration,
+             (data->cpu_time >= 0.0 ? data->cpu_time : 0.0),
+             data->check_count, data->failure_count, (unsigned long) time(NULL));
+    acutest_buffer_append_(&rec, tmp, strlen(tmp));
+
+    /* Write the whole record at once. */
+    fwrite(rec.data, 1, rec.size, acutest_timing_db_);
+    fflush(acutest_timing_db_);
+
+    for(i = 0; i < ACUTEST_PERF_MAX_; i++) {
+        if(data->perf[i] < 0.0)
+            continue;
+
+        rec.size = 0;
+        acutest_csv_append_field_(&rec, acutest_basename_(acutest_argv0_));
+        acutest_buffer_append_(&rec, ",", 1);
+        acutest_csv_append_field_(&rec, acutest_list_[master_index].name);
+        snprintf(tmp, sizeof(tmp), ",perf:%s,,,,,%lu,%.0f,0,1\n",
+                 acutest_perf_counters_[i].name, (unsigned long) time(NULL), data->perf[i]);
+        acutest_buffer_append_(&rec, tmp, strlen(tmp));
+
+        fwrite(rec.data, 1, rec.size, acutest_timing_db_);
+        fflush(acutest_timing_db_);
+    }
+
+    for(i = 0; i < data->n_benches; i++) {
+        const struct acutest_bench_result_* res = &data->benches[i];
+
+        rec.size = 0;
+        acutest_csv_append_field_(&rec, acutest_basename_(acutest_argv0_));
+        acutest_buffer_append_(&rec, ",", 1);
+        acutest_csv_append_field_(&rec, acutest_list_[master_index].name);
+        acutest_buffer_append_(&rec, ",", 1);
+        snprintf(tmp, sizeof(tmp), "bench:%s", res->name);
+        acutest_csv_append_field_(&rec, tmp);
+        snprintf(tmp, sizeof(tmp), ",,,,,%lu,%.9g,%.9g,%d\n",
+                 (unsigned long) time(NULL), res->median / 1e9, res->stddev / 1e9, res->samples);
+        acutest_buffer_append_(&rec, tmp, strlen(tmp));
+
+        fwrite(rec.data, 1, rec.size, acutest_timing_db_);
+        fflush(acutest_timing_db_);
+    }
+
+    acutest_buffer_free_(&rec);
+}
+
+static void
+acutest_timing_db_close_(void)
+{
+    fflush(acutest_timing_db_);
+#if defined ACUTEST_UNIX_  &&  defined ACUTEST_HAS_POSIX_API_
+    fsync(fileno(acutest_timing_db_));
+#elif defined ACUTEST_WIN_
+    _commit(_fileno(acutest_timing_db_));
+#endif
+    fclose(acutest_timing_db_);
+    acutest_timing_db_ = NULL;
+}
+
+/* Benchmark report (--bench-report=FILE): All the benchmark results of the
+ * run (i.e. also all the points of the TEST_BENCH_RANGE curves), written at
+ * the end as CSV with one record per benchmark and the complexity estimated
+ * for its curve (if any) in the last field, or as JSON if FILE ends with
+ * ".json", with the curves listed separately. */
+static void
+acutest_bench_report_write_(void)
+{
+    struct acutest_buffer_ buf = { NULL, 0, 0 };
+    size_t len = strlen(acutest_bench_report_file_);
+    int json = (len >= 5  &&  strcmp(acutest_bench_report_file_ + len - 5, ".json") == 0);
+    int n_written = 0;
+    char tmp[256];
+    FILE* f;
+    int i, j, k;
+
+    if(json) {
+        acutest_buffer_append_(&buf, "{\"binary\":", 10);
+        acutest_json_str_(&buf, acutest_basename_(acutest_argv0_));
+        acutest_buffer_append_(&buf, ",\"benches\":[", 12);
+    } else {
+        const char* header = "test,bench,arg,median_ns,min_ns,p99_ns,stddev_ns,samples,iterations,"
+                             "items_per_second,bytes_per_second,complexity\n";
+        acutest_buffer_append_(&buf, header, strlen(header));
+    }
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        const struct acutest_test_data_* data = &acutest_test_data_[i];
+
+        for(j = 0; j < data->n_benches; j++) {
+            const struct acutest_bench_result_* res = &data->benches[j];
+            double items = acutest_bench_items_per_second_(res);
+            double bytes = acutest_bench_bytes_per_second_(res);
+
+            if(json) {
+                acutest_buffer_append_(&buf, (n_written > 0) ? ",\n" : "\n", (n_written > 0) ? 2 : 1);
+                acutest_buffer_append_(&buf, "{\"test\":", 8);
+                n_written++;
+                acutest_json_str_(&buf, acutest_list_[i].name);
+                acutest_buffer_append_(&buf, ",\"name\":", 8);
+                acutest_json_str_(&buf, res->name);
+                if(res->arg >= 0.0)
+                    acutest_json_printf_(&buf, ",\"arg\":%.0f", res->arg);
+                acutest_json_printf_(&buf, ",\"median_ns\":%.3f", res->median);
+                acutest_json_printf_(&buf, ",\"min_ns\":%.3f", res->min);
+                acutest_json_printf_(&buf, ",\"p99_ns\":%.3f", res->p99);
+                acutest_json_printf_(&buf, ",\"stddev_ns\":%.3f", res->stddev);
+                acutest_json_printf_(&buf, ",\"samples\":%d", res->samples);
+                acutest_json_printf_(&buf, ",\"iterations\":%.0f", res->iterations);
+                if(items >= 0.0)
+                    acutest_json_printf_(&buf, ",\"items_per_second\":%.6g", items);
+                if(bytes >= 0.0)
+                    acutest_json_printf_(&buf, ",\"bytes_per_second\":%.6g", bytes);
+                acutest_buffer_append_(&buf, "}", 1);
+            } else {
+                double coef, rms;
+                int complexity = -1;
+
+                if(res->series != 0)
+                    complexity = acutest_bench_fit_(data->benches, data->n_benches, res->series, &coef, &rms);
+
+                acutest_csv_append_field_(&buf, acutest_list_[i].name);
+                acutest_buffer_append_(&buf, ",", 1);
+                acutest_csv_append_field_(&buf, res->name);
+                if(res->arg >= 0.0)
+                    snprintf(tmp, sizeof(tmp), ",%.0f", res->arg);
+                else
+                    snprintf(tmp, sizeof(tmp), ",");
+                acutest_buffer_append_(&buf, tmp, strlen(tmp));
+                snprintf(tmp, sizeof(tmp), ",%.3f,%.3f,%.3f,%.3f,%d,%.0f,",
+                         res->median, res->min, res->p99, res->stddev, res->samples, res->iterations);
+                acutest_buffer_append_(&buf, tmp, strlen(tmp));
+                if(items >= 0.0) {
+                    snprintf(tmp, sizeof(tmp), "%.6g", items);
+                    acutest_buffer_append_(&buf, tmp, strlen(tmp));
+                }
+                acutest_buffer_append_(&buf, ",", 1);
+                if(bytes >= 0.0) {
+                    snprintf(tmp, sizeof(tmp), "%.6g", bytes);
+                    acutest_buffer_append_(&buf, tmp, strlen(tmp));
+                }
+                acutest_buffer_append_(&buf, ",", 1);
+                if(complexity >= 0)
+                    acutest_csv_append_field_(&buf, acutest_bench_complexity_names_[complexity]);
+                acutest_buffer_append_(&buf, "\n", 1);
+            }
+        }
+    }
+
+    if(json) {
+        acutest_buffer_append_(&buf, "],\"curves\":[", 12);
+        n_written = 0;
+
+        for(i = 0; i < acutest_list_size_; i++) {
+            const struct acutest_test_data_* data = &acutest_test_data_[i];
+
+            for(j = 0; j < data->n_benches; j++) {
+                const struct acutest_bench_result_* res = &data->benches[j];
+                double coef, rms;
+                int complexity;
+
+                if(res->series == 0)
+                    continue;
+                for(k = 0; k < j; k++) {
+                    if(data->benches[k].series == res->series)
+                        break;
+                }
+                if(k < j)
+                    continue;   /* Already done. */
+                complexity = acutest_bench_fit_(data->benches, data->n_benches, res->series, &coef, &rms);
+                if(complexity < 0)
+                    continue;
+
+                acutest_buffer_append_(&buf, (n_written > 0) ? ",\n" : "\n", (n_written > 0) ? 2 : 1);
+                acutest_buffer_append_(&buf, "{\"test\":", 8);
+                n_written++;
+                acutest_json_str_(&buf, acutest_list_[i].name);
+                acutest_buffer_append_(&buf, ",\"name\":", 8);
+                acutest_json_mem_(&buf, res->name, (size_t) acutest_bench_series_name_len_(res));
+                acutest_buffer_append_(&buf, ",\"complexity\":", 14);
+                acutest_json_str_(&buf, acutest_bench_complexity_names_[complexity]);
+                acutest_json_printf_(&buf, ",\"coefficient_ns\":%.6g", coef);
+                acutest_json_printf_(&buf, ",\"rms\":%.4f}", rms);
+            }
+        }
+        acutest_buffer_append_(&buf, "]}\n", 3);
+    }
+
+    f = fopen(acutest_bench_report_file_, "w");
+    if(f == NULL  ||  fwrite(buf.data, 1, buf.size, f) != buf.size  ||  fclose(f) != 0) {
+        fprintf(stderr, "Unable to write '%s': %s\n", acutest_bench_report_file_, strerror(errno));
+        acutest_buffer_free_(&buf);
+        acutest_exit_(2);
+    }
+    acutest_buffer_free_(&buf);
+}
+
+/* Performance baseline (--baseline=FILE): A timing database (typically one
+ * produced by --timing-db on a known good build) to compare the durations
+ * of the tests and benchmarks against. A successful test whose duration, or
+ * a median time of any of its benchmarks, is slower than the baseline by
+ * more than --max-regression percent is marked as failed.
+ *
+ * To not flake on noise, the comparison is between the confidence intervals
+ * (mean +/- 2 standard errors) rather than the plain values: The lower bound
+ * of the current measurement has to exceed the upper bound of the baseline
+ * (plus the allowed regression). For a test, the baseline are the last few
+ * successful runs and the current measurement is the single run. For a
+ * benchmark, both are the median and the standard deviation over the
+ * samples.
+ *
+ * A single run (or sample) tells nothing about its noise, so no standard
+ * error is taken as smaller than ACUTEST_BASELINE_NOISE_ of the value. And a
+ * test is only checked if the baseline has at least ACUTEST_BASELINE_MIN_RUNS_
+ * successful runs of it (we warn about those with fewer). Tests faster than
+ * ACUTEST_BASELINE_MIN_TIME_ are not checked at all as their durations are
+ * dominated by the process start-up. */
+static void
+acutest_baseline_cb_(int master_index, char** fields)
+{
+    if(strncmp(fields[2], "bench:", 6) == 0) {
+        const char* name = fields[2] + 6;
+        struct acutest_baseline_bench_* b = NULL;
+        int i;
+
+        /* The latest record wins. */
+        for(i = 0; i < acutest_baseline_n_benches_; i++) {
+            if(acutest_baseline_benches_[i].master_index == master_index  &&
+               strncmp(acutest_baseline_benches_[i].name, name, TEST_BENCH_NAME_MAXSIZE-1) == 0)
+            {
+                b = &acutest_baseline_benches_[i];
+                break;
+            }
+        }
+        if(b == NULL) {
+            struct acutest_baseline_bench_* benches;
+
+            benches = (struct acutest_baseline_bench_*) realloc(acutest_baseline_benches_,
+                        (size_t)(acutest_baseline_n_benches_ + 1) * sizeof(struct acutest_baseline_bench_));
+            if(benches == NULL) {
+                fprintf(stderr, "Out of memory.\n");
+                acutest_exit_(2);
+            }
+            acutest_baseline_benches_ = benches;
+            b = &benches[acutest_baseline_n_benches_++];
+            b->master_index = master_index;
+            snprintf(b->name, sizeof(b->name), "%s", name);
+        }
+        b->median = strtod(fields[8], NULL);
+        b->stddev = strtod(fields[9], NULL);
+        b->samples = atoi(fields[10]);
+    } else if(strcmp(fields[2], acutest_state_name_(ACUTEST_STATE_SUCCESS)) == 0) {
+        struct acutest_baseline_test_* t = &acutest_baseline_tests_[master_index];
+
+        t->wall[t->n % ACUTEST_BASELINE_RUNS_] = strtod(fields[3], NULL);
+        t->n++;
+    }
+}
+
+static void
+acutest_baseline_load_(void)
+{
+    FILE* f;
+    int i;
+    int n_few = 0;
+
+    /* Unlike the timing database, missing baseline is most likely a mistake. */
+    f = fopen(acutest_baseline_file_, "r");
+    if(f == NULL) {
+        fprintf(stderr, "Unable to open '%s': %s\n", acutest_baseline_file_, strerror(errno));
+        acutest_exit_(2);
+    }
+    fclose(f);
+
+    acutest_baseline_tests_ = (struct acutest_baseline_test_*)
+            calloc((size_t) acutest_list_size_, sizeof(struct acutest_baseline_test_));
+    if(acutest_baseline_tests_ == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+
+    acutest_timing_db_read_(acutest_baseline_file_, acutest_baseline_cb_);
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(acutest_baseline_tests_[i].n > 0  &&  acutest_baseline_tests_[i].n < ACUTEST_BASELINE_MIN_RUNS_)
+            n_few++;
+    }
+    if(n_few > 0) {
+        fprintf(stderr, "Warning: %d %s fewer than %d successful runs in '%s'; %s not checked "
+                        "against the baseline.\n", n_few, (n_few == 1) ? "test has" : "tests have",
+                        ACUTEST_BASELINE_MIN_RUNS_, acutest_baseline_file_, (n_few == 1) ? "it is" : "they are");
+    }
+}
+
+/* Returns non-zero if the current value is a regression against the baseline.
+ * Both are given as a mean and its standard error. */
+static int
+acutest_baseline_regressed_(double cur, double cur_se, double base, double base_se)
+{
+    if(cur_se < cur * ACUTEST_BASELINE_NOISE_)
+        cur_se = cur * ACUTEST_BASELINE_NOISE_;
+    if(base_se < base * ACUTEST_BASELINE_NOISE_)
+        base_se = base * ACUTEST_BASELINE_NOISE_;
+    return (cur - 2.0 * cur_se > (base + 2.0 * base_se) * (1.0 + acutest_max_regression_ / 100.0));
+}
+
+/* Check the just finished test against the baseline. On a regression, mark
+ * the test as failed and describe the (worst) regression in the buffer. */
+static int
+acutest_baseline_check_(int master_index, char* msg, size_t msg_size)
+{
+    struct acutest_test_data_* data = &acutest_test_data_[master_index];
+    double worst = 0.0;
+    int i, j;
+
+    msg[0] = '\0';
+    if(acutest_baseline_tests_ == NULL  ||  data->state != ACUTEST_STATE_SUCCESS)
+        return 0;
+
+    if(acutest_baseline_tests_[master_index].n >= ACUTEST_BASELINE_MIN_RUNS_) {
+        const struct acutest_baseline_test_* t = &acutest_baseline_tests_[master_index];
+        int n = (t->n < ACUTEST_BASELINE_RUNS_ ? t->n : ACUTEST_BASELINE_RUNS_);
+        double sum = 0.0;
+        double var = 0.0;
+        double mean, se;
+
+        for(i = 0; i < n; i++)
+            sum += t->wall[i];
+        mean = sum / n;
+        for(i = 0; i < n; i++)
+            var += (t->wall[i] - mean) * (t->wall[i] - mean);
+        se = (n > 1) ? acutest_sqrt_(var / (n - 1) / n) : 0.0;
+
+        if(mean >= ACUTEST_BASELINE_MIN_TIME_  &&  data->duration >= ACUTEST_BASELINE_MIN_TIME_  &&
+           acutest_baseline_regressed_(data->duration, 0.0, mean, se))
+        {
+            worst = data->duration / mean;
+            snprintf(msg, msg_size, "perf regression: %.2fx slower (%.3f s, baseline %.3f s)",
+                     worst, data->duration, mean);
+        }
+    }
+
+    for(i = 0; i < data->n_benches; i++) {
+        const struct acutest_bench_result_* res = &data->benches[i];
+
+        for(j = 0; j < acutest_baseline_n_benches_; j++) {
+            const struct acutest_baseline_bench_* b = &acutest_baseline_benches_[j];
+            double base, base_se, cur_se;
+
+            if(b->master_index != master_index  ||  strcmp(b->name, res->name) != 0)
+                continue;
+
+            base = b->median * 1e9;
+            base_se = (b->samples > 0) ? b->stddev * 1e9 / acutest_sqrt_((double) b->samples) : 0.0;
+            cur_se = res->stddev / acutest_sqrt_((double) res->samples);
+            if(base > 0.0  &&  acutest_baseline_regressed_(res->median, cur_se, base, base_se)  &&
+               res->median / base > worst)
+            {
+                char cur_str[32], base_str[32];
+
+                worst = res->median / base;
+                acutest_bench_format_time_(cur_str, sizeof(cur_str), res->median);
+                acutest_bench_format_time_(base_str, sizeof(base_str), base);
+                snprintf(msg, msg_size, "perf regression: %s %.2fx slower (%s/op, baseline %s/op)",
+                         res->name, worst, cur_str, base_str);
+            }
+            break;
+        }
+    }
+
+    if(msg[0] == '\0')
+        return 0;
+
+    data->state = ACUTEST_STATE_FAILED;
+    return 1;
+}
+
+/* Checks the main process does on each test when it is over (no matter where
+ * it has run). If the test fails any of them, it is marked as failed and the
+ * reason is written into the buffer. */
+static int
+acutest_late_checks_(int master_index, char* msg, size_t msg_size)
+{
+    msg[0] = '\0';
+    if(acutest_baseline_check_(master_index, msg, msg_size))
+        return 1;
+    return 0;
+}
+
+/* Print the message of acutest_late_checks_() in the way of the test result
+ * line. */
+static void
+acutest_late_error_print_(const char* msg)
+{
+    if(acutest_verbose_level_ == 0)
+        return;
+
+    if(acutest_tap_) {
+        acutest_out_printf_("# %s\n", msg);
+    } else {
+        int n;
+        char spaces[48];
+
+        acutest_line_indent_(1);
+        n = 2 + acutest_out_printf_("%s ", msg);
+        memset(spaces, ' ', sizeof(spaces));
+        if(n < (int) sizeof(spaces))
+            acutest_out_printf_("%.*s", (int) sizeof(spaces) - n, spaces);
+        acutest_out_printf_("[ ");
+        acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "FAILED");
+        acutest_out_printf_(" ]\n");
+    }
+}
+
+/* Timeout of the given test (in seconds), or 0 if it has none. */
+static double
+acutest_test_timeout_(int master_index)
+{
+    return (acutest_list_[master_index].timeout > 0.0 ? acutest_list_[master_index].timeout : acutest_timeout_);
+}
+
+/* Finish the test line of a test which has been killed for running out of
+ * time. (Its process has started the line but it never got to finish it.) */
+static void
+acutest_timeout_print_(int master_index, int index)
+{
+    acutest_current_->test = &acutest_list_[master_index];
+    acutest_current_->index = index;
+    if(acutest_tap_  ||  (acutest_verbose_level_ >= 1  &&  acutest_verbose_level_ < 3))
+        acutest_finish_test_line_(ACUTEST_STATE_TIMEOUT);
+    acutest_current_->test = NULL;
+}
+
+/* Main process: Add a line (e.g. a message about a crash) to the details
+ * about a failure of the test. */
+static void
+acutest_test_log_line_(int master_index, const char* line)
+{
+    struct acutest_buffer_* log = &acutest_test_data_[master_index].log;
+
+    if(!acutest_test_log_on_  ||  line[0] == '\0')
+        return;
+
+    acutest_buffer_append_(log, line, strlen(line));
+    acutest_buffer_append_(log, "\n", 1);
+}
+
+
+/* Repeated runs (--repeat=N, --until-fail): The selected tests are run in
+ * rounds, each round the same way as a normal run (so in parallel with
+ * --jobs). After each round, the results of its runs are folded into the
+ * aggregate of each test, and when all rounds are done, the aggregate
+ * decides the outcome of the test: Mixed results make it FLAKY. */
+static int
+acutest_repeating_(void)
+{
+    return (acutest_repeat_ > 1  ||  acutest_until_fail_);
+}
+
+/* Statistics of the durations of the runs (in seconds). */
+static void
+acutest_repeat_stats_(const struct acutest_test_data_* data,
+                      double* min, double* median, double* max, double* stddev)
+{
+    double* t;
+    double sum = 0.0, sum2 = 0.0, mean;
+    int n = data->repeat_runs;
+    int i;
+
+    *min = *median = *max = *stddev = 0.0;
+    if(n == 0)
+        return;
+
+    t = (double*) malloc((size_t) n * sizeof(double));
+    if(t == NULL)
+        return;
+    memcpy(t, data->repeat_durations, (size_t) n * sizeof(double));
+    qsort(t, (size_t) n, sizeof(double), acutest_cmp_double_);
+
+    for(i = 0; i < n; i++)
+        sum += t[i];
+    mean = sum / n;
+    for(i = 0; i < n; i++)
+        sum2 += (t[i] - mean) * (t[i] - mean);
+
+    *min = t[0];
+    *max = t[n-1];
+    *median = (n % 2) ? t[n/2] : (t[n/2 - 1] + t[n/2]) / 2.0;
+    *stddev = (n > 1) ? acutest_sqrt_(sum2 / (n - 1)) : 0.0;
+    free(t);
+}
+
+
+/* XUnit output (--xml-output=FILE).
+ *
+ * If the file is seekable, each <testcase> is written as soon as the test
+ * ends, followed by the closing </testsuite>, and the counts in the header
+ * are updated in place. So the file is complete and valid after each test,
+ * even if the suite never gets to its end (e.g. because it is killed by CI
+ * running out of time). Otherwise, the whole report is written at the end. */
+static void
+acutest_xml_escaped_(const char* str, size_t size, int attr)
+{
+    FILE* f = acutest_xml_output_;
+    size_t i, len;
+
+    for(i = 0; i < size; i++) {
+        unsigned char ch = (unsigned char) str[i];
+
+        if(ch >= 0x80) {
+            /* The document is declared as UTF-8. Bytes which do not form
+             * valid UTF-8 are taken as Latin-1, as in acutest_json_mem_(). */
+            len = acutest_utf8_len_((const unsigned char*) str + i, size - i);
+            if(len > 0) {
+                fwrite(str + i, 1, len, f);
+                i += len - 1;
+            } else {
+                fprintf(f, "&#x%02x;", (unsigned) ch);
+            }
+            continue;
+        }
+
+        switch(ch) {
+            case '&':   fputs("&amp;", f); break;
+            case '<':   fputs("&lt;", f); break;
+            case '>':   fputs("&gt;", f); break;
+            case '"':   fputs("&quot;", f); break;
+            case '\'':  fputs("&apos;", f); break;
+            case '\n':  if(attr) fputs("&#10;", f); else fputc(ch, f); break;
+            case '\t':  fputc(ch, f); break;
+            default:
+                /* Control characters are not allowed in XML 1.0 at all. */
+                fputc((ch < 0x20) ? '?' : ch, f);
+                break;
+        }
+    }
+}
+
+static void
+acutest_xml_counts_write_(void)
+{
+    char buffer[128];
+    int n;
+
+    /* The counts part is padded to a constant length so that it can be
+     * rewritten in place. */
+    n = snprintf(buffer, sizeof(buffer), " tests=\"%d\" errors=\"%d\" failures=\"%d\" skip=\"%d\"",
+            acutest_xml_counts_[0], acutest_xml_counts_[1], acutest_xml_counts_[2], acutest_xml_counts_[3]);
+    fprintf(acutest_xml_output_, "%s%*s>\n", buffer, 80 - n, "");
+}
+
+static void
+acutest_xml_testcase_(int master_index)
+{
+    FILE* f = acutest_xml_output_;
+    struct acutest_test_data_ *details = &acutest_test_data_[master_index];
+    const char* name = acutest_list_[master_index].name;
+    const char* element = NULL;
+    const char* message = NULL;
+    size_t message_len = 0;
+    char flaky_message[64];
+
+    fputs("  <testcase name=\"", f);
+    acutest_xml_escaped_(name, strlen(name), 1);
+    fprintf(f, "\" time=\"%.2f\">\n", details->duration);
+
+    switch(details->state) {
+        case ACUTEST_STATE_SUCCESS:
+            break;
+        case ACUTEST_STATE_EXCLUDED:    /* Fall through. */
+        case ACUTEST_STATE_SKIPPED:
+            fputs("    <skipped />\n", f);
+            break;
+        case ACUTEST_STATE_TIMEOUT:
+            element = "error";
+            message = "Timeout";
+            message_len = strlen(message);
+            break;
+        case ACUTEST_STATE_FLAKY:
+            element = "failure";
+            snprintf(flaky_message, sizeof(flaky_message), "Flaky: %d of %d runs passed",
+                     details->repeat_passed, details->repeat_runs - details->repeat_skipped);
+            message = flaky_message;
+            message_len = strlen(message);
+            break;
+        case ACUTEST_STATE_FAILED:      /* Fall through. */
+        default:
+            element = "failure";
+            if(details->log.size > 0) {
+                /* The first line of the details. */
+                const char* eol = (const char*) memchr(details->log.data, '\n', details->log.size);
+                message = details->log.data;
+                message_len = (eol != NULL) ? (size_t) (eol - message) : details->log.size;
+            }
+            break;
+    }
+
+    if(element != NULL) {
+        fprintf(f, "    <%s", element);
+        if(message != NULL) {
+            fputs(" message=\"", f);
+            acutest_xml_escaped_(message, message_len, 1);
+            fputs("\"", f);
+        }
+        if(details->log.size > 0) {
+            fputs(">", f);
+            acutest_xml_escaped_(details->log.data, details->log.size, 0);
+            fprintf(f, "</%s>\n", element);
+        } else {
+            fputs(" />\n", f);
+        }
+    }
+
+    if(details->n_benches > 0  ||  acutest_perf_mask_ != 0  ||  details->rusage.max_rss >= 0  ||
+       details->repeat_runs > 0) {
+        const struct acutest_rusage_* ru = &details->rusage;
+        int j;
+
+        fprintf(f, "    <properties>\n");
+        if(details->repeat_runs > 0) {
+            double min, median, max, stddev;
+
+            acutest_repeat_stats_(details, &min, &median, &max, &stddev);
+            fprintf(f, "      <property name=\"repeat.runs\" value=\"%d\" />\n", details->repeat_runs);
+            fprintf(f, "      <property name=\"repeat.passed\" value=\"%d\" />\n", details->repeat_passed);
+            fprintf(f, "      <property name=\"repeat.failed\" value=\"%d\" />\n",
+                    details->repeat_runs - details->repeat_passed - details->repeat_skipped);
+            fprintf(f, "      <property name=\"repeat.duration_min\" value=\"%.6f\" />\n", min);
+            fprintf(f, "      <property name=\"repeat.duration_median\" value=\"%.6f\" />\n", median);
+            fprintf(f, "      <property name=\"repeat.duration_max\" value=\"%.6f\" />\n", max);
+            fprintf(f, "      <property name=\"repeat.duration_stddev\" value=\"%.6f\" />\n", stddev);
+        }
+        if(ru->max_rss >= 0)
+            fprintf(f, "      <property name=\"rusage.max_rss_kb\" value=\"%ld\" />\n", ru->max_rss);
+        if(ru->minor_faults >= 0)
+            fprintf(f, "      <property name=\"rusage.minor_faults\" value=\"%ld\" />\n", ru->minor_faults);
+        if(ru->major_faults >= 0)
+            fprintf(f, "      <property name=\"rusage.major_faults\" value=\"%ld\" />\n", ru->major_faults);
+        if(ru->vol_csw >= 0)
+            fprintf(f, "      <property name=\"rusage.voluntary_csw\" value=\"%ld\" />\n", ru->vol_csw);
+        if(ru->invol_csw >= 0)
+            fprintf(f, "      <property name=\"rusage.involuntary_csw\" value=\"%ld\" />\n", ru->invol_csw);
+        for(j = 0; j < ACUTEST_PERF_MAX_; j++) {
+            if(details->perf[j] >= 0.0)
+                fprintf(f, "      <property name=\"perf.%s\" value=\"%.0f\" />\n", acutest_perf_counters_[j].name, details->perf[j]);
+        }
+        for(j = 0; j < details->n_benches; j++) {
+            const struct acutest_bench_result_* res = &details->benches[j];
+
+            fputs("      <property name=\"bench.", f);
+            acutest_xml_escaped_(res->name, strlen(res->name), 1);
+            fprintf(f, ".median_ns\" value=\"%.3f\" />\n", res->median);
+            fputs("      <property name=\"bench.", f);
+            acutest_xml_escaped_(res->name, strlen(res->name), 1);
+            fprintf(f, ".min_ns\" value=\"%.3f\" />\n", res->min);
+            fputs("      <property name=\"bench.", f);
+            acutest_xml_escaped_(res->name, strlen(res->name), 1);
+            fprintf(f, ".p99_ns\" value=\"%.3f\" />\n", res->p99);
+            fputs("      <property name=\"bench.", f);
+            acutest_xml_escaped_(res->name, strlen(res->name), 1);
+            fprintf(f, ".stddev_ns\" value=\"%.3f\" />\n", res->stddev);
+            fputs("      <property name=\"bench.", f);
+            acutest_xml_escaped_(res->name, strlen(res->name), 1);
+            fprintf(f, ".samples\" value=\"%d\" />\n", res->samples);
+            fputs("      <property name=\"bench.", f);
+            acutest_xml_escaped_(res->name, strlen(res->name), 1);
+            fprintf(f, ".iterations\" value=\"%.0f\" />\n", res->iterations);
+            if(acutest_bench_items_per_second_(res) >= 0.0) {
+                fputs("      <property name=\"bench.", f);
+                acutest_xml_escaped_(res->name, strlen(res->name), 1);
+                fprintf(f, ".items_per_second\" value=\"%.6g\" />\n", acutest_bench_items_per_second_(res));
+            }
+            if(acutest_bench_bytes_per_second_(res) >= 0.0) {
+                fputs("      <property name=\"bench.", f);
+                acutest_xml_escaped_(res->name, strlen(res->name), 1);
+                fprintf(f, ".bytes_per_second\" value=\"%.6g\" />\n", acutest_bench_bytes_per_second_(res));
+            }
+        }
+        fprintf(f, "    </properties>\n");
+    }
+    fprintf(f, "  </testcase>\n");
+
+    details->xml_written = 1;
+}
+
+static void
+acutest_xml_count_(int master_index)
+{
+    acutest_xml_counts_[0]++;
+    switch(acutest_test_data_[master_index].state) {
+        case ACUTEST_STATE_SUCCESS:     break;
+        case ACUTEST_STATE_EXCLUDED:    /* Fall through. */
+        case ACUTEST_STATE_SKIPPED:     acutest_xml_counts_[3]++; break;
+        case ACUTEST_STATE_TIMEOUT:     acutest_xml_counts_[1]++; break;
+        case ACUTEST_STATE_FAILED:      /* Fall through. */
+        default:                        acutest_xml_counts_[2]++; break;
+    }
+}
+
+static void
+acutest_xml_header_(const char* suite_name)
+{
+    FILE* f = acutest_xml_output_;
+
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fputs("<testsuite name=\"", f);
+    acutest_xml_escaped_(suite_name, strlen(suite_name), 1);
+    fputs("\"", f);
+}
+
+/* The environment report, as properties of the test suite. */
+static void
+acutest_xml_env_write_(void)
+{
+    FILE* f = acutest_xml_output_;
+    const struct acutest_env_* env = &acutest_env_info_;
+    char cpus[256];
+
+    fputs("  <properties>\n", f);
+    if(env->governor[0]) {
+        fputs("    <property name=\"env.cpu_governor\" value=\"", f);
+        acutest_xml_escaped_(env->governor, strlen(env->governor), 1);
+        fputs("\" />\n", f);
+    }
+    if(env->turbo >= 0)
+        fprintf(f, "    <property name=\"env.turbo\" value=\"%s\" />\n", acutest_env_flag_str_(env->turbo));
+    if(env->smt >= 0)
+        fprintf(f, "    <property name=\"env.smt\" value=\"%s\" />\n", acutest_env_flag_str_(env->smt));
+    if(env->load[0] >= 0.0) {
+        fprintf(f, "    <property name=\"env.load_average\" value=\"%.2f %.2f %.2f\" />\n",
+                env->load[0], env->load[1], env->load[2]);
+    }
+    if(acutest_n_pin_cpus_ > 0) {
+        acutest_env_cpus_str_(cpus, sizeof(cpus));
+        fprintf(f, "    <property name=\"env.pinned_cpus\" value=\"%s\" />\n", cpus);
+    }
+    if(acutest_warmup_ > 0)
+        fprintf(f, "    <property name=\"env.warmup\" value=\"%d\" />\n", acutest_warmup_);
+    fputs("  </properties>\n", f);
+}
+
+static void
+acutest_xml_begin_(const char* suite_name)
+{
+    FILE* f = acutest_xml_output_;
+
+    acutest_xml_suite_name_ = suite_name;
+    if(fseek(f, 0, SEEK_CUR) != 0  ||  ftell(f) < 0)
+        return;     /* Not seekable. Everything is written at the end. */
+
+    acutest_xml_header_(suite_name);
+    acutest_xml_counts_pos_ = ftell(f);
+    acutest_xml_counts_write_();
+    acutest_xml_env_write_();
+    acutest_xml_tail_pos_ = ftell(f);
+    fputs("</testsuite>\n", f);
+    fflush(f);
+}
+
+/* Write down the <testcase> of the test which has just ended. */
+static void
+acutest_xml_append_(int master_index)
+{
+    FILE* f = acutest_xml_output_;
+
+    if(acutest_xml_counts_pos_ < 0)
+        return;
+
+    acutest_xml_count_(master_index);
+    fseek(f, acutest_xml_tail_pos_, SEEK_SET);
+    acutest_xml_testcase_(master_index);
+    acutest_xml_tail_pos_ = ftell(f);
+    fputs("</testsuite>\n", f);
+    fseek(f, acutest_xml_counts_pos_, SEEK_SET);
+    acutest_xml_counts_write_();
+    fflush(f);
+}
+
+static void
+acutest_xml_end_(void)
+{
+    int i;
+
+    if(acutest_xml_counts_pos_ >= 0) {
+        /* Add whatever has not been run (i.e. the excluded tests). */
+        for(i = 0; i < acutest_list_size_; i++) {
+            if(acutest_shard_count_ > 0  &&  acutest_test_data_[i].shard != acutest_shard_)
+                continue;   /* Reported by the node running the other shard. */
+            if(!acutest_test_data_[i].xml_written)
+                acutest_xml_append_(i);
+        }
+    } else {
+        for(i = 0; i < acutest_list_size_; i++) {
+            if(acutest_shard_count_ == 0  ||  acutest_test_data_[i].shard == acutest_shard_)
+                acutest_xml_count_(i);
+        }
+        acutest_xml_header_(acutest_xml_suite_name_);
+        acutest_xml_counts_write_();
+        acutest_xml_env_write_();
+        for(i = 0; i < acutest_list_size_; i++) {
+            if(acutest_shard_count_ == 0  ||  acutest_test_data_[i].shard == acutest_shard_)
+                acutest_xml_testcase_(i);
+        }
+        fputs("</testsuite>\n", acutest_xml_output_);
+    }
+
+    fclose(acutest_xml_output_);
+    acutest_xml_output_ = NULL;
+}
+
+/* Called in the main process whenever a result of a test lands in the
+ * acutest_test_data_[]. */
+static void
+acutest_test_done_(int master_index)
+{
+    if(acutest_test_data_[master_index].state == ACUTEST_STATE_FAILED  ||
+       acutest_test_data_[master_index].state == ACUTEST_STATE_TIMEOUT)
+        acutest_n_failed_++;
+
+    if(acutest_timing_db_ != NULL)
+        acutest_timing_db_append_(master_index);
+    /* (With repeated runs, only the aggregate gets written, in the end.) */
+    if(acutest_xml_output_ != NULL  &&  !acutest_repeating_())
+        acutest_xml_append_(master_index);
+}
+
+
+/* Whether --fail-fast says no more tests should be run. */
+static int
+acutest_fail_fast_reached_(void)
+{
+    return (acutest_fail_fast_ > 0  &&  acutest_n_failed_ >= acutest_fail_fast_);
+}
+
+/* Fold the runs of the round which has just ended into the aggregates.
+ * Returns count of the runs which have failed. */
+static int
+acutest_repeat_collect_(void)
+{
+    int n_failed = 0;
+    int i;
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        struct acutest_test_data_* data = &acutest_test_data_[i];
+        double* durations;
+
+        if(data->state < ACUTEST_STATE_SUCCESS)
+            continue;   /* Not run in this round. */
+
+        durations = (double*) realloc(data->repeat_durations, (size_t) (data->repeat_runs + 1) * sizeof(double));
+        if(durations == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            acutest_exit_(2);
+        }
+        data->repeat_durations = durations;
+        data->repeat_durations[data->repeat_runs++] = data->duration;
+
+        if(data->state == ACUTEST_STATE_SUCCESS) {
+            data->repeat_passed++;
+        } else if(data->state == ACUTEST_STATE_SKIPPED) {
+            data->repeat_skipped++;
+        } else {
+            n_failed++;
+            /* Keep the details of the first failed run only. */
+            if(data->repeat_fail_state < ACUTEST_STATE_SUCCESS)
+                data->repeat_log_size = data->log.size;
+            data->repeat_fail_state = data->state;
+        }
+        data->log.size = data->repeat_log_size;
+    }
+
+    return n_failed;
+}
+
+/* Make the tests of the round which has just ended ready for the next one. */
+static void
+acutest_repeat_reset_(void)
+{
+    int i;
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(acutest_test_data_[i].state >= ACUTEST_STATE_SUCCESS) {
+            acutest_test_data_[i].state = ACUTEST_STATE_NEEDTORUN;
+            acutest_test_data_[i].n_benches = 0;
+        }
+    }
+}
+
+/* Decide the outcome of each test from its aggregate. */
+static void
+acutest_repeat_finish_(void)
+{
+    int i;
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        struct acutest_test_data_* data = &acutest_test_data_[i];
+        int n_failed = data->repeat_runs - data->repeat_passed - data->repeat_skipped;
+        double min, max, stddev;
+
+        if(data->repeat_runs == 0)
+            continue;
+
+        if(n_failed == 0)
+            data->state = (data->repeat_passed > 0) ? ACUTEST_STATE_SUCCESS : ACUTEST_STATE_SKIPPED;
+        else if(data->repeat_passed == 0)
+            data->state = data->repeat_fail_state;
+        else
+            data->state = ACUTEST_STATE_FLAKY;
+
+        acutest_repeat_stats_(data, &min, &data->duration, &max, &stddev);
+
+        if(acutest_jsonl_) {
+            acutest_event_begin_("test_summary", acutest_list_[i].name);
+            acutest_event_str_("result", acutest_state_name_(data->state));
+            acutest_event_int_("runs", data->repeat_runs);
+            acutest_event_int_("passed", data->repeat_passed);
+            acutest_event_int_("failed", n_failed);
+            acutest_event_int_("skipped", data->repeat_skipped);
+            acutest_event_num_("duration_min", min);
+            acutest_event_num_("duration_median", data->duration);
+            acutest_event_num_("duration_max", max);
+            acutest_event_num_("duration_stddev", stddev);
+            acutest_event_end_();
+        }
+    }
+}
+
+/* Print the aggregates of the tests into the summary. (On lower verbose
+ * levels, only of those which have not always passed.) */
+static void
+acutest_repeat_print_(void)
+{
+    int header_printed = 0;
+    int i;
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        const struct acutest_test_data_* data = &acutest_test_data_[i];
+        double min, median, max, stddev;
+        char s_min[32], s_median[32], s_max[32], s_stddev[32];
+        const char* str;
+        int color;
+
+        if(data->repeat_runs == 0)
+            continue;
+
+        switch(data->state) {
+            case ACUTEST_STATE_SUCCESS: str = "OK"; color = ACUTEST_COLOR_GREEN_INTENSIVE_; break;
+            case ACUTEST_STATE_SKIPPED: str = "SKIPPED"; color = ACUTEST_COLOR_YELLOW_INTENSIVE_; break;
+            case ACUTEST_STATE_FLAKY:   str = "FLAKY"; color = ACUTEST_COLOR_YELLOW_INTENSIVE_; break;
+            default:                    str = "FAILED"; color = ACUTEST_COLOR_RED_INTENSIVE_; break;
+        }
+        if(acutest_verbose_level_ < 3  &&
+           (data->state == ACUTEST_STATE_SUCCESS  ||  data->state == ACUTEST_STATE_SKIPPED))
+            continue;
+
+        if(!header_printed) {
+            acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Repeated runs:\n");
+            header_printed = 1;
+        }
+
+        acutest_repeat_stats_(data, &min, &median, &max, &stddev);
+        acutest_bench_format_time_(s_min, sizeof(s_min), min * 1e9);
+        acutest_bench_format_time_(s_median, sizeof(s_median), median * 1e9);
+        acutest_bench_format_time_(s_max, sizeof(s_max), max * 1e9);
+        acutest_bench_format_time_(s_stddev, sizeof(s_stddev), stddev * 1e9);
+
+        acutest_line_indent_(1);
+        acutest_colored_printf_(color, "%s", str);
+        acutest_out_printf_(" %s: %d of %d runs passed; duration %s (min %s, max %s, stddev %s)\n",
+                acutest_list_[i].name, data->repeat_passed, data->repeat_runs - data->repeat_skipped,
+                s_median, s_min, s_max, s_stddev);
+    }
+
+    if(header_printed  &&  acutest_verbose_level_ >= 3)
+        acutest_out_printf_("\n");
+}
+
+
+/* Sharding (--shard=K/N): Split the suite into N disjoint parts so that
+ * multiple machines can run it, each its own part, without any coordination.
+ * The partition is computed over the whole test list (regardless of what is
+ * selected), so that it only depends on the list itself and, for the
+ * duration-balanced partitioning, on the durations in --timing-db,
+ * so every node gets the same result. */
+static double* acutest_shard_weights_ = NULL;
+
+static int
+acutest_cmp_shard_duration_(const void* a, const void* b)
+{
+    int ia = *(const int*) a;
+    int ib = *(const int*) b;
+    double ea = acutest_shard_weights_[ia];
+    double eb = acutest_shard_weights_[ib];
+
+    if(ea > eb)
+        return -1;
+    if(ea < eb)
+        return 1;
+    return ia - ib;
+}
+
+static void
+acutest_shard_assign_(void)
+{
+    int i;
+
+    if(!acutest_shard_by_duration_) {
+        /* Stable hash of the name. (The extra mixing makes also the low
+         * bits of the hash depend on all the input bits.) */
+        for(i = 0; i < acutest_list_size_; i++) {
+            unsigned h = acutest_hash_(acutest_list_[i].name);
+
+            h ^= h >> 16;
+            h *= 0x85ebca6bu;
+            h ^= h >> 13;
+            h *= 0xc2b2ae35u;
+            h ^= h >> 16;
+            acutest_test_data_[i].shard = (int)(h % (unsigned) acutest_shard_count_) + 1;
+        }
+    } else {
+        /* Greedy balancing: Assign the tests, the longest first, always to
+         * the shard with the least total duration so far. Tests without
+         * a known duration count as the average one. */
+        int* order;
+        double* load;
+        double sum = 0.0;
+        int n_known = 0;
+        int j;
+
+        order = (int*) malloc(sizeof(int) * ((size_t) acutest_list_size_ + 1));
+        load = (double*) calloc((size_t) acutest_shard_count_, sizeof(double));
+        acutest_shard_weights_ = (double*) malloc(sizeof(double) * ((size_t) acutest_list_size_ + 1));
+        if(order == NULL  ||  load == NULL  ||  acutest_shard_weights_ == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            acutest_exit_(2);
+        }
+
+        for(i = 0; i < acutest_list_size_; i++) {
+            if(acutest_test_data_[i].estimate >= 0.0) {
+                sum += acutest_test_data_[i].estimate;
+                n_known++;
+            }
+        }
+        for(i = 0; i < acutest_list_size_; i++) {
+            acutest_shard_weights_[i] = acutest_test_data_[i].estimate;
+            if(acutest_shard_weights_[i] < 0.0)
+                acutest_shard_weights_[i] = (n_known > 0 ? sum / n_known : 1.0);
+            order[i] = i;
+        }
+        qsort(order, (size_t) acutest_list_size_, sizeof(int), acutest_cmp_shard_duration_);
+
+        for(i = 0; i < acutest_list_size_; i++) {
+            int best = 0;
+
+            for(j = 1; j < acutest_shard_count_; j++) {
+                if(load[j] < load[best])
+                    best = j;
+            }
+            load[best] += acutest_shard_weights_[order[i]];
+            acutest_test_data_[order[i]].shard = best + 1;
+        }
+
+        free(acutest_shard_weights_);
+        acutest_shard_weights_ = NULL;
+        free(load);
+        free(order);
+    }
+}
+
+
+/* Called if anything goes bad in Acutest, or if the unit test ends in other
+ * way then by normal returning from its function (e.g. exception or some
+ * abnormal child process termination). */
+static void ACUTEST_ATTRIBUTE_(format (printf, 1, 2))
+acutest_error_(const char* fmt, ...)
+{
+    if(acutest_test_log_on_) {
+        char buffer[256];
+        va_list args;
+
+        va_start(args, fmt);
+        vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
+        va_end(args);
+        buffer[sizeof(buffer)-2] = '\0';
+        strcat(buffer, "\n");
+        acutest_test_log_(buffer, strlen(buffer));
+    }
+
+    if(acutest_jsonl_) {
+        char buffer[256];
+        va_list args;
+
+        va_start(args, fmt);
+        vsnprintf(buffer, sizeof(buffer), fmt, args);
+        va_end(args);
+        buffer[sizeof(buffer)-1] = '\0';
+
+        acutest_event_begin_("error", (acutest_current_->test != NULL) ? acutest_current_->test->name : NULL);
+        acutest_event_str_("message", buffer);
+        acutest_event_end_();
+    }
+
+    if(acutest_verbose_level_ == 0)
+        return;
+
+    if(acutest_verbose_level_ >= 2) {
+        va_list args;
+
+        acutest_line_indent_(1);
+        if(acutest_verbose_level_ >= 3)
+            acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "ERROR: ");
+        va_start(args, fmt);
+        acutest_out_vprintf_(fmt, args);
+        va_end(args);
+        acutest_out_printf_("\n");
+    }
+
+    if(acutest_verbose_level_ >= 3) {
+        acutest_out_printf_("\n");
+    }
+}
+
+/* Whether the fixture applies to the test of the given name, i.e. whether the
+ * name begins with the whole words of the fixture prefix. */
+static int
+acutest_fixture_covers_(const struct acutest_fixture_* fixture, const char* name)
+{
+    size_t len = strlen(fixture->prefix);
+
+    if(len == 0)
+        return 1;
+    if(strncmp(name, fixture->prefix, len) != 0)
+        return 0;
+    return (name[len] == '\0'  ||  strchr(acutest_word_delim_, name[len]) != NULL  ||
+            strchr(acutest_word_delim_, fixture->prefix[len-1]) != NULL);
+}
+
+/* Set up all fixtures any of the tests to run needs. */
+static void
+acutest_fixtures_setup_(void)
+{
+    int i, j;
+
+    for(i = 0; acutest_fixtures_[i].prefix != NULL; i++) {
+        const struct acutest_fixture_* fixture = &acutest_fixtures_[i];
+
+        for(j = 0; j < acutest_list_size_; j++) {
+            if(acutest_test_data_[j].state == ACUTEST_STATE_NEEDTORUN  &&
+               acutest_fixture_covers_(fixture, acutest_list_[j].name))
+                break;
+        }
+        if(j >= acutest_list_size_)
+            continue;
+
+        if(fixture->setup == NULL  ||  fixture->setup() == 0) {
+            acutest_fixture_state_[i] = 1;
+        } else {
+            acutest_fixture_state_[i] = -1;
+            acutest_error_("Set-up of the fixture '%s' has failed.", fixture->prefix);
+        }
+        fflush(stdout);
+        fflush(stderr);
+    }
+}
+
+static void
+acutest_fixtures_teardown_(void)
+{
+    int i = (int) (sizeof(acutest_fixtures_) / sizeof(acutest_fixtures_[0])) - 1;
+
+    while(--i >= 0) {
+        if(acutest_fixture_state_[i] == 1  &&  acutest_fixtures_[i].teardown != NULL)
+            acutest_fixtures_[i].teardown();
+        acutest_fixture_state_[i] = 0;
+    }
+}
+
+/* Returns prefix of a fixture of the test whose set-up has failed, or NULL. */
+static const char*
+acutest_fixture_failed_(const struct acutest_test_* test)
+{
+    int i;
+
+    for(i = 0; acutest_fixtures_[i].prefix != NULL; i++) {
+        if(acutest_fixture_state_[i] < 0  &&  acutest_fixture_covers_(&acutest_fixtures_[i], test->name))
+            return acutest_fixtures_[i].prefix;
+    }
+    return NULL;
+}
+
+/* Add the checks made by other threads of the test to its results. */
+static void
+acutest_thread_results_collect_(void)
+{
+    /* (Most tests have no other threads. Do not make them pay for the atomic
+     * exchanges.) */
+    if(acutest_thread_checks_ == 0  &&  acutest_thread_failures_ == 0)
+        return;
+
+    acutest_test_check_count_ += (int) ACUTEST_ATOMIC_XCHG_(acutest_thread_checks_, 0);
+    acutest_test_failures_ += (int) ACUTEST_ATOMIC_XCHG_(acutest_thread_failures_, 0);
+}
+
+/* Check the peak memory of the test against --max-rss. If over the limit, a
+ * passing test fails, so the test line has to be still unfinished. */
+static void
+acutest_max_rss_check_(void)
+{
+    if(acutest_max_rss_ <= 0  ||  acutest_test_rusage_.max_rss <= acutest_max_rss_  ||
+       acutest_test_failures_ > 0  ||  acutest_test_skip_count_ > 0)
+        return;
+
+    if(!acutest_current_->already_logged)
+        acutest_finish_test_line_(ACUTEST_STATE_FAILED);
+    acutest_current_->already_logged++;
+    acutest_test_failures_++;
+    acutest_error_("Peak RSS %.1f MB exceeds --max-rss=%ld MB.",
+                   (double) acutest_test_rusage_.max_rss / 1024.0, acutest_max_rss_ / 1024);
+}
+
+/* Call directly the given test unit function. */
+static enum acutest_state_
+acutest_do_run_(const struct acutest_test_* test, int index)
+{
+    enum acutest_state_ state = ACUTEST_STATE_FAILED;
+    const char* failed_fixture;
+    int i;
+
+    acutest_thread_no_ = 1;
+    acutest_current_->test = test;
+    acutest_current_->index = index;
+    acutest_param_ = test->params;
+    failed_fixture = acutest_fixture_failed_(test);
+    acutest_test_failures_ = 0;
+    acutest_current_->already_logged = 0;
+    acutest_test_check_count_ = 0;
+    acutest_test_skip_count_ = 0;
+    acutest_current_->log_buf.size = 0;
+    acutest_current_->log_total = 0;
+    /* Passed checks are printed only on the most verbose level (but each of
+     * them is an event of --format=jsonl). */
+    acutest_check_fast_ = (acutest_verbose_level_ < 3  &&  !acutest_jsonl_);
+    acutest_test_cpu_time_ = -1.0;
+    acutest_bench_n_results_ = 0;
+    acutest_bench_n_series_ = 0;
+    acutest_bench_range_var_ = NULL;
+    acutest_bench_items_next_ = 0.0;
+    acutest_bench_bytes_next_ = 0.0;
+    acutest_perf_running_ = 0;
+    for(i = 0; i < ACUTEST_PERF_MAX_; i++)
+        acutest_perf_values_[i] = -1.0;
+    acutest_rusage_reset_(&acutest_test_rusage_);
+    acutest_cond_failed_ = 0;
+
+    if(acutest_jsonl_) {
+        acutest_event_begin_("test_start", test->name);
+        acutest_event_int_("index", index);
+        acutest_event_end_();
+    }
+
+#ifdef __cplusplus
+#ifndef TEST_NO_EXCEPTIONS
+    try {
+#endif
+#endif
+        acutest_init_(test->name);
+        acutest_begin_test_line_(test);
+
+        /* This is good to do in case the test unit crashes. */
+        acutest_out_flush_all_();
+
+        if(acutest_warmup_ > 0  &&  failed_fixture == NULL)
+            acutest_warmup_run_(test);
+
+        if(!acutest_worker_  ||  acutest_persistent_) {
+            acutest_abort_has_jmp_buf_ = 1;
+            if(setjmp(acutest_abort_jmp_buf_) != 0)
+                goto aborted;
+        }
+
+        if(acutest_details_wanted_())
+            acutest_test_cpu_start_ = acutest_cpu_time_();
+        acutest_timer_get_time_(&acutest_timer_start_);
+        acutest_rusage_begin_();
+        acutest_perf_start_();
+        acutest_profile_start_();
+        if(failed_fixture == NULL)
+            test->func();
+        else
+            acutest_check_(0, NULL, 0, "Set-up of the fixture '%s'", failed_fixture);
+
+aborted:
+        acutest_profile_stop_();
+        acutest_perf_stop_();
+        acutest_rusage_end_();
+        acutest_abort_has_jmp_buf_ = 0;
+        acutest_timer_get_time_(&acutest_timer_end_);
+        if(acutest_details_wanted_())
+            acutest_test_cpu_time_ = acutest_cpu_time_() - acutest_test_cpu_start_;
+        acutest_thread_results_collect_();
+        acutest_max_rss_check_();
+
+        if(acutest_test_failures_ > 0)
+            state = ACUTEST_STATE_FAILED;
+        else if(acutest_test_skip_count_ > 0)
+            state = ACUTEST_STATE_SKIPPED;
+        else
+            state = ACUTEST_STATE_SUCCESS;
+
+        if(!acutest_current_->already_logged)
+            acutest_finish_test_line_(state);
+
+        if(acutest_verbose_level_ == 2) {
+            /* (With --verbose=3, these have been printed already.) */
+            for(i = 0; i < acutest_bench_n_results_; i++)
+                acutest_bench_print_(&acutest_bench_results_[i]);
+            acutest_bench_print_fits_(acutest_bench_results_, acutest_bench_n_results_);
+        }
+        if(acutest_verbose_level_ >= 2)
+            acutest_perf_print_(acutest_perf_values_);
+        acutest_profile_write_(test->name);
+
+        if(acutest_verbose_level_ >= 3) {
+            acutest_line_indent_(1);
+            switch(state) {
+                case ACUTEST_STATE_SUCCESS:
+                    acutest_colored_printf_(ACUTEST_COLOR_GREEN_INTENSIVE_, "SUCCESS: ");
+                    acutest_out_printf_("All conditions have passed.\n");
+
+                    if(acutest_timer_) {
+                        acutest_line_indent_(1);
+                        acutest_out_printf_("Duration: ");
+                        acutest_timer_print_diff_();
+                        acutest_out_printf_("\n");
+                    }
+                    break;
+
+                case ACUTEST_STATE_SKIPPED:
+                    acutest_colored_printf_(ACUTEST_COLOR_YELLOW_INTENSIVE_, "SKIPPED: ");
+                    acutest_out_printf_("%s.\n", acutest_test_skip_reason_);
+                    break;
+
+                default:
+                    acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "FAILED: ");
+                    acutest_out_printf_("%d condition%s %s failed.\n",
+                            acutest_test_failures_,
+                            (acutest_test_failures_ == 1) ? "" : "s",
+                            (acutest_test_failures_ == 1) ? "has" : "have");
+                    break;
+            }
+            acutest_out_printf_("\n");
+        }
+
+#ifdef __cplusplus
+#ifndef TEST_NO_EXCEPTIONS
+    } catch(std::exception& e) {
+        const char* what = e.what();
+        acutest_check_(0, NULL, 0, "Threw std::exception");
+        if(what != NULL)
+            acutest_message_("std::exception::what(): %s", what);
+
+        if(acutest_verbose_level_ >= 3) {
+            acutest_line_indent_(1);
+            acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "FAILED: ");
+            acutest_out_printf_("C++ exception.\n\n");
+        }
+    } catch(...) {
+        acutest_check_(0, NULL, 0, "Threw an exception");
+
+        if(acutest_verbose_level_ >= 3) {
+            acutest_line_indent_(1);
+            acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "FAILED: ");
+            acutest_out_printf_("C++ exception.\n\n");
+        }
+    }
+#endif
+#endif
+
+    acutest_profile_stop_();    /* (If not yet, because of an exception.) */
+    acutest_thread_results_collect_();
+    acutest_fini_(test->name);
+    acutest_case_(NULL);
+    acutest_current_->test = NULL;
+    acutest_param_ = NULL;
+
+    /* Test boundary: Let the output out. */
+    acutest_out_flush_all_();
+
+    return state;
+}
+
+#if defined(ACUTEST_UNIX_)
+/* Translate the status of a terminated child process (as reported by
+ * waitpid()) into the test state. If the child has not ended normally,
+ * a description of what happened is written into the error buffer. */
+static enum acutest_state_
+acutest_child_state_(int exit_code, char* error, size_t error_size)
+{
+    enum acutest_state_ state = ACUTEST_STATE_FAILED;
+
+    error[0] = '\0';
+    if(WIFEXITED(exit_code)) {
+        state = (enum acutest_state_) WEXITSTATUS(exit_code);
+    } else if(WIFSIGNALED(exit_code)) {
+        char tmp[32];
+        const char* signame;
+        switch(WTERMSIG(exit_code)) {
+            case SIGINT:  signame = "SIGINT"; break;
+            case SIGHUP:  signame = "SIGHUP"; break;
+            case SIGQUIT: signame = "SIGQUIT"; break;
+            case SIGABRT: signame = "SIGABRT"; break;
+            case SIGKILL: signame = "SIGKILL"; break;
+            case SIGSEGV: signame = "SIGSEGV"; break;
+            case SIGILL:  signame = "SIGILL"; break;
+            case SIGTERM: signame = "SIGTERM"; break;
+            default:      snprintf(tmp, sizeof(tmp), "signal %d", WTERMSIG(exit_code)); signame = tmp; break;
+        }
+        snprintf(error, error_size, "Test interrupted by %s.", signame);
+    } else {
+        snprintf(error, error_size, "Test ended in an unexpected way [%d].", exit_code);
+    }
+
+    return state;
+}
+#endif
+
+/* Write the event concluding the test. The error is a message about an
+ * abnormal termination of its child process, the late error the one of
+ * acutest_late_checks_(); either may be NULL. */
+static void
+acutest_event_test_end_(int master_index, const char* error, const char* late_error)
+{
+    const struct acutest_test_data_* data = &acutest_test_data_[master_index];
+    const struct acutest_rusage_* ru = &data->rusage;
+    const char* result;
+    int n, j;
+
+    switch(data->state) {
+        case ACUTEST_STATE_SUCCESS:     result = "success"; break;
+        case ACUTEST_STATE_SKIPPED:     result = "skipped"; break;
+        case ACUTEST_STATE_TIMEOUT:     result = "timeout"; break;
+        default:                        result = "failed"; break;
+    }
+
+    acutest_event_begin_("test_end", acutest_list_[master_index].name);
+    acutest_event_str_("result", result);
+    acutest_event_num_("duration", data->duration);
+    if(data->cpu_time >= 0.0)
+        acutest_event_num_("cpu_time", data->cpu_time);
+    acutest_event_int_("checks", data->check_count);
+    acutest_event_int_("failures", data->failure_count);
+    if(ru->max_rss >= 0)
+        acutest_event_int_("max_rss_kb", ru->max_rss);
+    if(ru->minor_faults >= 0)
+        acutest_event_int_("minor_faults", ru->minor_faults);
+    if(ru->major_faults >= 0)
+        acutest_event_int_("major_faults", ru->major_faults);
+    if(ru->vol_csw >= 0)
+        acutest_event_int_("voluntary_csw", ru->vol_csw);
+    if(ru->invol_csw >= 0)
+        acutest_event_int_("involuntary_csw", ru->invol_csw);
+
+    for(j = 0, n = 0; j < ACUTEST_PERF_MAX_; j++) {
+        if(data->perf[j] < 0.0)
+            continue;
+        if(n++ == 0)
+            acutest_event_key_("perf");
+        acutest_buffer_append_(&acutest_event_, (n == 1) ? "{" : ",", 1);
+        acutest_json_str_(&acutest_event_, acutest_perf_counters_[j].name);
+        acutest_json_printf_(&acutest_event_, ":%.0f", data->perf[j]);
+    }
+    if(n > 0)
+        acutest_buffer_append_(&acutest_event_, "}", 1);
+
+    if(data->n_benches > 0) {
+        acutest_event_key_("benches");
+        for(j = 0; j < data->n_benches; j++) {
+            const struct acutest_bench_result_* res = &data->benches[j];
+
+            acutest_buffer_append_(&acutest_event_, (j == 0) ? "[{\"name\":" : ",{\"name\":", 9);
+            acutest_json_str_(&acutest_event_, res->name);
+            acutest_json_printf_(&acutest_event_, ",\"median_ns\":%.3f", res->median);
+            acutest_json_printf_(&acutest_event_, ",\"min_ns\":%.3f", res->min);
+            acutest_json_printf_(&acutest_event_, ",\"p99_ns\":%.3f", res->p99);
+            acutest_json_printf_(&acutest_event_, ",\"stddev_ns\":%.3f", res->stddev);
+            acutest_json_printf_(&acutest_event_, ",\"samples\":%d", res->samples);
+            acutest_json_printf_(&acutest_event_, ",\"iterations\":%.0f", res->iterations);
+            if(res->arg >= 0.0)
+                acutest_json_printf_(&acutest_event_, ",\"arg\":%.0f", res->arg);
+            if(acutest_bench_items_per_second_(res) >= 0.0)
+                acutest_json_printf_(&acutest_event_, ",\"items_per_second\":%.6g", acutest_bench_items_per_second_(res));
+            if(acutest_bench_bytes_per_second_(res) >= 0.0)
+                acutest_json_printf_(&acutest_event_, ",\"bytes_per_second\":%.6g", acutest_bench_bytes_per_second_(res));
+            acutest_buffer_append_(&acutest_event_, "}", 1);
+        }
+        acutest_buffer_append_(&acutest_event_, "]", 1);
+    }
+
+    if(error != NULL  &&  error[0] != '\0')
+        acutest_event_str_("error", error);
+    if(late_error != NULL  &&  late_error[0] != '\0')
+        acutest_event_str_("late_error", late_error);
+    acutest_event_end_();
+}
+
+/* Records a child process sends to its parent through the report pipe, about
+ * the test it runs. (On Unix, see acutest_run_pool_(). On Windows, the child
+ * of acutest_run_() gets the pipe when anything more than its exit code is of
+ * interest.) */
+#define ACUTEST_REPORT_RESULT_      1
+#define ACUTEST_REPORT_BENCH_       2       /* struct acutest_bench_result_ */
+#define ACUTEST_REPORT_LOG_         3       /* text to append to the test's log */
+#define ACUTEST_REPORT_EVENT_       4       /* line of --format=jsonl */
+
+struct acutest_report_header_ {
+    int type;
+    int size;               /* Size of the payload following the header. */
+};
+
+struct acutest_report_result_ {
+    int master_index;
+    int state;
+    int retire;             /* Non-zero if the worker exits after this one. */
+    int check_count;
+    int failure_count;
+    double cpu_time;
+    double perf[ACUTEST_PERF_MAX_];
+    struct acutest_rusage_ rusage;
+};
+
+/* Child: Write all the data into the report pipe. */
+static void
+acutest_report_write_(const void* data, size_t size)
+{
+#if defined ACUTEST_WIN_
+    const char* ptr = (const char*) data;
+
+    while(size > 0) {
+        int n = _write(acutest_report_fd_, ptr, (unsigned) ((size < 0x4000) ? size : 0x4000));
+        if(n <= 0)
+            return;
+        ptr += n;
+        size -= (size_t) n;
+    }
+#elif defined ACUTEST_UNIX_
+    ssize_t n;
+    const char* ptr = (const char*) data;
+
+    while(size > 0) {
+        n = write(acutest_report_fd_, ptr, size);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        ptr += n;
+        size -= (size_t) n;
+    }
+#else
+    (void) data;
+    (void) size;
+#endif
+}
+
+/* Child: Send a record to the parent (if there is any listening). */
+static void
+acutest_report_(int type, const void* payload, size_t size)
+{
+    char buffer[512];
+    struct acutest_report_header_ header;
+
+    if(acutest_report_fd_ < 0)
+        return;
+
+    header.type = type;
+    header.size = (int) size;
+    if(sizeof(header) + size > sizeof(buffer)) {
+        /* Only we write into the pipe, so it is fine in two pieces. */
+        acutest_report_write_(&header, sizeof(header));
+        acutest_report_write_(payload, size);
+        return;
+    }
+
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), payload, size);
+    acutest_report_write_(buffer, sizeof(header) + size);
+}
+
+/* Child: Tell the parent how the test has ended. */
+static void
+acutest_report_result_(int master_index, enum acutest_state_ state, int retire)
+{
+    struct acutest_report_result_ result;
+    int i;
+
+    if(acutest_report_fd_ < 0)
+        return;
+
+    acutest_perf_stop_();
+    if(acutest_test_cpu_time_ < 0.0)
+        acutest_test_cpu_time_ = acutest_cpu_time_() - acutest_test_cpu_start_;
+
+    for(i = 0; i < acutest_bench_n_results_; i++)
+        acutest_report_(ACUTEST_REPORT_BENCH_, &acutest_bench_results_[i], sizeof(struct acutest_bench_result_));
+
+    memset(&result, 0, sizeof(result));
+    result.master_index = master_index;
+    result.state = (int) state;
+    result.retire = retire;
+    result.check_count = acutest_test_check_count_;
+    result.failure_count = acutest_test_failures_;
+    result.cpu_time = acutest_test_cpu_time_;
+    memcpy(result.perf, acutest_perf_values_, sizeof(result.perf));
+    result.rusage = acutest_test_rusage_;
+
+    /* The output has to be in the pipe before the parent learns the test is
+     * over. */
+    acutest_out_flush_all_();
+    acutest_report_(ACUTEST_REPORT_RESULT_, &result, sizeof(result));
+}
+
+/* Parent: Take what the record of the child tells about the test. (The
+ * events and the state of the test are up to the caller.) */
+static void
+acutest_report_store_(int master_index, const struct acutest_report_header_* header, const char* payload)
+{
+    if(header->type == ACUTEST_REPORT_BENCH_) {
+        struct acutest_bench_result_ bench;
+
+        memcpy(&bench, payload, sizeof(bench));
+        acutest_bench_store_(master_index, &bench, 1);
+    } else if(header->type == ACUTEST_REPORT_LOG_) {
+        acutest_buffer_append_(&acutest_test_data_[master_index].log, payload, (size_t) header->size);
+    } else if(header->type == ACUTEST_REPORT_RESULT_) {
+        struct acutest_report_result_ result;
+        struct acutest_test_data_* data = &acutest_test_data_[master_index];
+
+        memcpy(&result, payload, sizeof(result));
+        data->check_count = result.check_count;
+        data->failure_count = result.failure_count;
+        data->cpu_time = result.cpu_time;
+        memcpy(data->perf, result.perf, sizeof(data->perf));
+        data->rusage = result.rusage;
+    }
+}
+
+#if defined(ACUTEST_UNIX_)  ||  defined(ACUTEST_WIN_)
+static int
+acutest_read_all_(int fd, void* data, size_t size)
+{
+    char* ptr = (char*) data;
+
+    while(size > 0) {
+#if defined ACUTEST_WIN_
+        int n = _read(fd, ptr, (unsigned) size);
+        if(n <= 0)
+            return -1;
+#else
+        ssize_t n = read(fd, ptr, size);
+        if(n <= 0) {
+            if(n < 0  &&  errno == EINTR)
+                continue;
+            return -1;
+        }
+#endif
+        ptr += n;
+        size -= (size_t) n;
+    }
+
+    return 0;
+}
+
+static int
+acutest_worker_should_retire_(int n_done)
+{
+    if(acutest_persistent_max_tests_ > 0  &&  n_done >= acutest_persistent_max_tests_)
+        return 1;
+
+    if(acutest_persistent_max_rss_ > 0) {
+        long max_rss = 0;
+#if defined ACUTEST_WIN_
+        PROCESS_MEMORY_COUNTERS pmc;
+
+        if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+            max_rss = (long) (pmc.PeakWorkingSetSize / 1024);
+#else
+        struct rusage usage;
+
+        getrusage(RUSAGE_SELF, &usage);
+        max_rss = (long) usage.ru_maxrss;
+#ifdef ACUTEST_MACOS_
+        max_rss /= 1024;    /* macOS reports bytes, not kilobytes. */
+#endif
+#endif
+        if(max_rss >= acutest_persistent_max_rss_)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Child: Main loop of a persistent worker. It runs the tests it is told to
+ * through the command pipe, until the pipe is closed or until it retires. */
+static void
+acutest_worker_loop_(int cmd_fd)
+{
+    int n_done = 0;
+
+    while(1) {
+        int cmd[2];     /* master_index, index */
+        enum acutest_state_ state;
+        int retire;
+
+        if(acutest_read_all_(cmd_fd, cmd, sizeof(cmd)) != 0)
+            return;
+
+        acutest_worker_master_index_ = cmd[0];
+        state = acutest_do_run_(&acutest_list_[cmd[0]], cmd[1]);
+        retire = acutest_worker_should_retire_(++n_done);
+        acutest_report_result_(cmd[0], state, retire);
+
+        if(retire)
+            return;
+    }
+}
+#endif
+
+#if defined(ACUTEST_WIN_)
+/* Parent: Take in the complete records in the buffer (as read from the report
+ * pipe of a child) and drop them from it. If result is not NULL, it stops
+ * after the result of the test and returns non-zero. */
+static int
+acutest_win_reports_(struct acutest_buffer_* rep, int master_index, struct acutest_report_result_* result)
+{
+    struct acutest_report_header_ header;
+    size_t off = 0;
+    int done = 0;
+
+    while(!done  &&  rep->size - off >= sizeof(header)) {
+        memcpy(&header, rep->data + off, sizeof(header));
+        if(rep->size - off - sizeof(header) < (size_t) header.size)
+            break;
+        acutest_report_store_(master_index, &header, rep->data + off + sizeof(header));
+        if(result != NULL  &&  header.type == ACUTEST_REPORT_RESULT_) {
+            memcpy(result, rep->data + off + sizeof(header), sizeof(*result));
+            done = 1;
+        }
+        off += sizeof(header) + (size_t) header.size;
+    }
+    if(off > 0) {
+        memmove(rep->data, rep->data + off, rep->size - off);
+        rep->size -= off;
+    }
+
+    return done;
+}
+
+/* Parent: Wait until the child ends, but at most for timeout_ms. Meanwhile,
+ * take in the records it sends through the report pipe (if there is any),
+ * so that it never gets stuck on a full pipe. Returns non-zero on timeout. */
+static int
+acutest_win_wait_(HANDLE process, HANDLE rep_read, struct acutest_buffer_* rep,
+                  int master_index, DWORD timeout_ms)
+{
+    DWORD start = GetTickCount();
+    DWORD elapsed, slice, avail, n;
+    DWORD res;
+    char buffer[4096];
+
+    if(rep_read == NULL)
+        return (WaitForSingleObject(process, timeout_ms) == WAIT_TIMEOUT);
+
+    while(1) {
+        slice = 20;
+        if(timeout_ms != INFINITE) {
+            elapsed = GetTickCount() - start;
+            slice = (elapsed >= timeout_ms) ? 0 : timeout_ms - elapsed;
+            if(slice > 20)
+                slice = 20;
+        }
+        res = WaitForSingleObject(process, slice);
+
+        /* (Once the child has ended, all it has sent is in the pipe.) */
+        while(PeekNamedPipe(rep_read, NULL, 0, NULL, &avail, NULL)  &&  avail > 0) {
+            if(!ReadFile(rep_read, buffer, (avail < sizeof(buffer)) ? avail : (DWORD) sizeof(buffer), &n, NULL)  ||  n == 0)
+                break;
+            acutest_buffer_append_(rep, buffer, (size_t) n);
+        }
+        acutest_win_reports_(rep, master_index, NULL);
+
+        if(res != WAIT_TIMEOUT)
+            break;
+        if(timeout_ms != INFINITE  &&  GetTickCount() - start >= timeout_ms)
+            break;
+    }
+
+    return (res == WAIT_TIMEOUT);
+}
+
+/* Parent: Translate the exit code of a child which has not reported the
+ * result of its test. */
+static enum acutest_state_
+acutest_win_child_state_(DWORD exit_code)
+{
+    switch(exit_code) {
+        case 0:             return ACUTEST_STATE_SUCCESS;
+        case 1:             return ACUTEST_STATE_FAILED;
+        case 2:             return ACUTEST_STATE_SKIPPED;
+        case 3:             acutest_error_("Aborted."); break;
+        case 0xC0000005:    acutest_error_("Access violation."); break;
+        default:            acutest_error_("Test ended in an unexpected way [%lu].", exit_code); break;
+    }
+    return ACUTEST_STATE_FAILED;
+}
+
+/* Parent: Compose the command line of a child. Windows has no fork(). So we
+ * propagate all info into the child through a command line arguments. */
+static void
+acutest_win_cmdline_(char* buffer, size_t size, const char* worker, const char* tail)
+{
+    char warmup[32] = {0};
+    char max_rss[32] = {0};
+
+    if(acutest_warmup_ > 0)
+        snprintf(warmup, sizeof(warmup), "--warmup=%d", acutest_warmup_);
+    if(acutest_max_rss_ > 0)
+        snprintf(max_rss, sizeof(max_rss), "--max-rss=%ld", acutest_max_rss_ / 1024);
+    snprintf(buffer, size,
+             "%s %s %s --no-exec --no-summary %s%s --verbose=%d --color=%s "
+             "--bench-time=%g --bench-samples=%d %s%s %s %s %s",
+             acutest_argv0_, worker, acutest_timer_ ? "--time" : "",
+             acutest_tap_ ? "--tap" : "", acutest_jsonl_ ? "--format=jsonl" : "",
+             acutest_verbose_level_,
+             acutest_colorize_ ? "always" : "never",
+             acutest_bench_time_, acutest_bench_samples_,
+             acutest_perf_mask_ ? "--perf-counters=" : "",
+             acutest_perf_mask_ ? acutest_perf_counters_arg_ : "",
+             warmup, max_rss, tail);
+}
+
+/* The persistent worker (see --persistent). It is the binary started once
+ * more, which then runs whatever tests it gets through its command pipe (see
+ * acutest_worker_loop_()) and reports each of them through its report pipe,
+ * until it retires or until the parent closes the command pipe. */
+struct acutest_win_worker_ {
+    HANDLE process;
+    HANDLE cmd_write;
+    HANDLE rep_read;
+    struct acutest_buffer_ rep;
+    volatile LONG timed_out;
+};
+
+static struct acutest_win_worker_ acutest_win_worker_ = { NULL, NULL, NULL, { NULL, 0, 0 }, 0 };
+static int acutest_worker_cmd_fd_ = -1;     /* In the worker, the read end of the command pipe. */
+
+/* Parent: Let the worker end (once it has torn its fixtures down). */
+static void
+acutest_win_worker_close_(void)
+{
+    struct acutest_win_worker_* w = &acutest_win_worker_;
+
+    if(w->process == NULL)
+        return;
+
+    CloseHandle(w->cmd_write);
+    WaitForSingleObject(w->process, INFINITE);
+    CloseHandle(w->rep_read);
+    CloseHandle(w->process);
+    acutest_buffer_free_(&w->rep);
+    w->process = NULL;
+    w->cmd_write = NULL;
+    w->rep_read = NULL;
+}
+
+static int
+acutest_win_worker_spawn_(void)
+{
+    struct acutest_win_worker_* w = &acutest_win_worker_;
+    char buffer[1024];
+    char worker[192];
+    HANDLE cmd_read, cmd_write, rep_read, rep_write;
+    STARTUPINFOA startupInfo;
+    PROCESS_INFORMATION processInfo;
+    BOOL created;
+    DWORD err;
+
+    if(!CreatePipe(&cmd_read, &cmd_write, NULL, 0)) {
+        acutest_error_("Cannot create a pipe [%ld].", GetLastError());
+        return -1;
+    }
+    if(!CreatePipe(&rep_read, &rep_write, NULL, 0)) {
+        acutest_error_("Cannot create a pipe [%ld].", GetLastError());
+        CloseHandle(cmd_read);
+        CloseHandle(cmd_write);
+        return -1;
+    }
+
+    snprintf(worker, sizeof(worker),
+             "--worker=0 --worker-commands=%lu --worker-report=%lu %s --persistent=%d --worker-max-rss=%ld",
+             (unsigned long) (ULONG_PTR) cmd_read, (unsigned long) (ULONG_PTR) rep_write,
+             acutest_test_log_on_ ? "--worker-log" : "",
+             acutest_persistent_max_tests_, acutest_persistent_max_rss_ / 1024);
+    acutest_win_cmdline_(buffer, sizeof(buffer), worker, "");
+    memset(&startupInfo, 0, sizeof(startupInfo));
+    startupInfo.cb = sizeof(STARTUPINFO);
+
+    /* Our ends of the pipes are inheritable only while the worker is being
+     * created (see acutest_run_()). */
+    acutest_lock_();
+    SetHandleInformation(cmd_read, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+    SetHandleInformation(rep_write, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+    created = CreateProcessA(NULL, buffer, NULL, NULL, TRUE, CREATE_SUSPENDED, NULL, NULL, &startupInfo, &processInfo);
+    err = GetLastError();
+    SetHandleInformation(cmd_read, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(rep_write, HANDLE_FLAG_INHERIT, 0);
+    acutest_unlock_();
+    CloseHandle(cmd_read);
+    CloseHandle(rep_write);
+
+    if(!created) {
+        acutest_error_("Cannot create unit test subprocess [%ld].", err);
+        CloseHandle(cmd_write);
+        CloseHandle(rep_read);
+        return -1;
+    }
+
+    /* (Suspended, so that it is pinned before it starts.) */
+    acutest_pin_process_(processInfo.hProcess, 0);
+    ResumeThread(processInfo.hThread);
+    CloseHandle(processInfo.hThread);
+
+    w->process = processInfo.hProcess;
+    w->cmd_write = cmd_write;
+    w->rep_read = rep_read;
+    return 0;
+}
+
+static VOID CALLBACK
+acutest_win_worker_timeout_(PVOID param, BOOLEAN fired)
+{
+    struct acutest_win_worker_* w = (struct acutest_win_worker_*) param;
+
+    (void) fired;
+    InterlockedExchange(&w->timed_out, 1);
+    TerminateProcess(w->process, 0xffffffff);
+}
+
+/* Parent: Run the test in the persistent worker (starting one if there is
+ * none) and wait for its result. */
+static enum acutest_state_
+acutest_win_worker_run_(const struct acutest_test_* test, int index, int master_index)
+{
+    struct acutest_win_worker_* w = &acutest_win_worker_;
+    struct acutest_report_result_ result;
+    double timeout = acutest_test_timeout_(master_index);
+    enum acutest_state_ state;
+    HANDLE timer = NULL;
+    int cmd[2];
+    int done = 0;
+    DWORD n, exit_code;
+    char buffer[4096];
+
+    if(w->process == NULL  &&  acutest_win_worker_spawn_() != 0)
+        return ACUTEST_STATE_FAILED;
+
+    /* Our output so far has to precede that of the test. */
+    acutest_out_flush_all_();
+
+    cmd[0] = master_index;
+    cmd[1] = index;
+    if(!WriteFile(w->cmd_write, cmd, sizeof(cmd), &n, NULL)) {
+        acutest_error_("Cannot start the unit test in the subprocess [%ld].", GetLastError());
+        TerminateProcess(w->process, 0xffffffff);
+        acutest_win_worker_close_();
+        return ACUTEST_STATE_FAILED;
+    }
+
+    /* On timeout, the worker is killed. That breaks the report pipe, as does
+     * any other way the worker may end amid the test. */
+    w->timed_out = 0;
+    if(timeout > 0.0  &&  !CreateTimerQueueTimer(&timer, NULL, acutest_win_worker_timeout_, w,
+                                                 (DWORD) (timeout * 1000.0), 0, WT_EXECUTEONLYONCE))
+        timer = NULL;
+    while(!done) {
+        if(!ReadFile(w->rep_read, buffer, (DWORD) sizeof(buffer), &n, NULL)  ||  n == 0)
+            break;
+        acutest_buffer_append_(&w->rep, buffer, (size_t) n);
+        done = acutest_win_reports_(&w->rep, master_index, &result);
+    }
+    if(timer != NULL)
+        DeleteTimerQueueTimer(NULL, timer, INVALID_HANDLE_VALUE);
+
+    if(done) {
+        state = (enum acutest_state_) result.state;
+        acutest_test_cpu_time_ = result.cpu_time;
+        if(result.retire  ||  w->timed_out)
+            acutest_win_worker_close_();
+        return state;
+    }
+
+    WaitForSingleObject(w->process, INFINITE);
+    GetExitCodeProcess(w->process, &exit_code);
+    acutest_win_worker_close_();
+    if(w->timed_out) {
+        acutest_timeout_print_(master_index, index);
+        acutest_current_->test = test;
+        acutest_error_("Test timed out after %g seconds.", timeout);
+        return ACUTEST_STATE_TIMEOUT;
+    }
+    return acutest_win_child_state_(exit_code);
+}
+#endif
+
+/* Trigger the unit test. If possible (and not suppressed) it starts a child
+ * process who calls acutest_do_run_(), otherwise it calls acutest_do_run_()
+ * directly.
+ *
+ * (On Unix, child processes are managed by acutest_run_pool_() instead,
+ * unless it is not needed, see acutest_pool_needed_().) */
+static void
+acutest_run_(const struct acutest_test_* test, int index, int master_index)
+{
+    enum acutest_state_ state = ACUTEST_STATE_FAILED;
+    acutest_timer_type_ start, end;
+    char msg[256];
+
+    acutest_current_->test = test;
+    acutest_current_->already_logged = 0;
+    acutest_test_cpu_time_ = -1.0;
+    acutest_current_->log_buf.size = 0;
+    acutest_current_->log_total = 0;
+    acutest_timer_get_time_(&start);
+
+    if(!acutest_no_exec_) {
+
+#if defined(ACUTEST_WIN_)
+
+        char buffer[1024] = {0};
+        char worker[96] = {0};
+        char tail[512] = {0};
+        STARTUPINFOA startupInfo;
+        PROCESS_INFORMATION processInfo;
+        HANDLE rep_read = NULL;
+        HANDLE rep_write = NULL;
+        struct acutest_buffer_ rep = { NULL, 0, 0 };
+        BOOL created;
+        DWORD exitCode;
+
+        if(acutest_persistent_) {
+            state = acutest_win_worker_run_(test, index, master_index);
+        } else {
+            /* If more than the exit code is of interest, the child reports the
+             * rest through a pipe, as on Unix (see acutest_report_()). */
+            if(acutest_details_wanted_()  &&  CreatePipe(&rep_read, &rep_write, NULL, 0)) {
+                snprintf(worker, sizeof(worker), "--worker=%d --worker-report=%lu %s", index,
+                         (unsigned long) (ULONG_PTR) rep_write, acutest_test_log_on_ ? "--worker-log" : "");
+            } else {
+                snprintf(worker, sizeof(worker), "--worker=%d", index);
+            }
+            snprintf(tail, sizeof(tail), "-- \"%s\"", test->name);
+            acutest_win_cmdline_(buffer, sizeof(buffer), worker, tail);
+            memset(&startupInfo, 0, sizeof(startupInfo));
+            startupInfo.cb = sizeof(STARTUPINFO);
+            if(rep_write != NULL) {
+                /* The write end is inheritable only while this child is being
+                 * created, so that no other child (see --threads) gets it too and
+                 * we see the end of the pipe once this one exits. */
+                acutest_lock_();
+                SetHandleInformation(rep_write, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+                created = CreateProcessA(NULL, buffer, NULL, NULL, TRUE, CREATE_SUSPENDED, NULL, NULL, &startupInfo, &processInfo);
+                SetHandleInformation(rep_write, HANDLE_FLAG_INHERIT, 0);
+                acutest_unlock_();
+                CloseHandle(rep_write);
+            } else {
+                created = CreateProcessA(NULL, buffer, NULL, NULL, FALSE, CREATE_SUSPENDED, NULL, NULL, &startupInfo, &processInfo);
+            }
+            if(created) {
+                FILETIME creation_time, exit_time, kernel_time, user_time;
+                double timeout = acutest_test_timeout_(master_index);
+                int timed_out = 0;
+
+                /* (Suspended, so that it is pinned before it starts.) */
+                acutest_pin_process_(processInfo.hProcess, 0);
+                ResumeThread(processInfo.hThread);
+
+                if(acutest_win_wait_(processInfo.hProcess, rep_read, &rep, master_index,
+                        (timeout > 0.0 ? (DWORD) (timeout * 1000.0) : INFINITE)) != 0) {
+                    TerminateProcess(processInfo.hProcess, 0xffffffff);
+                    acutest_win_wait_(processInfo.hProcess, rep_read, &rep, master_index, INFINITE);
+                    timed_out = 1;
+                }
+                GetExitCodeProcess(processInfo.hProcess, &exitCode);
+                acutest_rusage_from_process_(&acutest_test_data_[master_index].rusage, processInfo.hProcess);
+                if(GetProcessTimes(processInfo.hProcess, &creation_time, &exit_time, &kernel_time, &user_time)) {
+                    ULARGE_INTEGER k, u;
+                    k.LowPart = kernel_time.dwLowDateTime;
+                    k.HighPart = kernel_time.dwHighDateTime;
+                    u.LowPart = user_time.dwLowDateTime;
+                    u.HighPart = user_time.dwHighDateTime;
+                    acutest_test_cpu_time_ = (double)(k.QuadPart + u.QuadPart) / 1e7;
+                }
+                CloseHandle(processInfo.hThread);
+                CloseHandle(processInfo.hProcess);
+                if(timed_out) {
+                    state = ACUTEST_STATE_TIMEOUT;
+                    acutest_timeout_print_(master_index, index);
+                    acutest_current_->test = test;
+                    acutest_error_("Test timed out after %g seconds.", timeout);
+                } else {
+                    state = acutest_win_child_state_(exitCode);
+                }
+            } else {
+                acutest_error_("Cannot create unit test subprocess [%ld].", GetLastError());
+            }
+            if(rep_read != NULL)
+                CloseHandle(rep_read);
+            acutest_buffer_free_(&rep);
+        }
+
+#elif defined(ACUTEST_UNIX_)
+
+        pid_t pid;
+        int exit_code;
+        struct rusage usage;
+
+        /* Make sure the child starts with empty I/O buffers. */
+        acutest_out_flush_all_();
+
+        pid = fork();
+        if(pid == (pid_t)-1) {
+            acutest_error_("Cannot fork. %s [%d]", strerror(errno), errno);
+        } else if(pid == 0) {
+            /* Child: Do the test. */
+            acutest_worker_ = 1;
+#if defined ACUTEST_HAS_AFFINITY_
+            acutest_pin_(0);
+#endif
+            state = acutest_do_run_(test, index);
+            acutest_exit_((int) state);
+        } else {
+            /* Parent: Wait until child terminates and analyze its exit code. */
+            acutest_wait_child_(pid, &exit_code, 0, &usage);
+            acutest_rusage_from_rusage_(&acutest_test_data_[master_index].rusage, &usage);
+            state = acutest_child_state_(exit_code, msg, sizeof(msg));
+            if(msg[0] != '\0')
+                acutest_error_("%s", msg);
+        }
+
+#else
+
+        /* A platform where we don't know how to run child process. */
+        state = acutest_do_run_(test, index);
+        acutest_test_data_[master_index].check_count = acutest_test_check_count_;
+        acutest_test_data_[master_index].failure_count = acutest_test_failures_;
+        if(acutest_bench_n_results_ > 0)
+            acutest_bench_store_(master_index, acutest_bench_results_, acutest_bench_n_results_);
+        memcpy(acutest_test_data_[master_index].perf, acutest_perf_values_, sizeof(acutest_perf_values_));
+        acutest_test_data_[master_index].rusage = acutest_test_rusage_;
+
+#endif
+
+    } else {
+        /* Child processes suppressed through --no-exec. (Or we are the child
+         * of acutest_run_() on Windows, with the report pipe to report to.) */
+        if(acutest_report_fd_ >= 0)
+            acutest_worker_master_index_ = master_index;
+        state = acutest_do_run_(test, index);
+        acutest_report_result_(master_index, state, 1);
+        acutest_worker_master_index_ = -1;
+        acutest_test_data_[master_index].check_count = acutest_test_check_count_;
+        acutest_test_data_[master_index].failure_count = acutest_test_failures_;
+        if(acutest_bench_n_results_ > 0)
+            acutest_bench_store_(master_index, acutest_bench_results_, acutest_bench_n_results_);
+        memcpy(acutest_test_data_[master_index].perf, acutest_perf_values_, sizeof(acutest_perf_values_));
+        acutest_test_data_[master_index].rusage = acutest_test_rusage_;
+    }
+    acutest_timer_get_time_(&end);
+
+    acutest_current_->test = NULL;
+
+    /* (Other tests may be finishing in other threads, see --threads.) */
+    acutest_lock_();
+    acutest_test_data_[master_index].state = state;
+    acutest_test_data_[master_index].duration = acutest_timer_diff_(start, end);
+    acutest_test_data_[master_index].cpu_time = acutest_test_cpu_time_;
+    if(acutest_current_->log_buf.size > 0)
+        acutest_buffer_append_(&acutest_test_data_[master_index].log, acutest_current_->log_buf.data, acutest_current_->log_buf.size);
+    if(acutest_late_checks_(master_index, msg, sizeof(msg))) {
+        fflush(stderr);
+        acutest_late_error_print_(msg);
+        acutest_test_log_line_(master_index, msg);
+    }
+    acutest_test_done_(master_index);
+    if(acutest_jsonl_  &&  !acutest_worker_)
+        acutest_event_test_end_(master_index, NULL, msg);
+    acutest_unlock_();
+}
+
+#if defined ACUTEST_HAS_THREADS_
+/* In-process thread pool (--threads=N) for the tests marked TEST_THREAD_SAFE.
+ *
+ * The tests to run are split into contiguous parts, one per thread, each kept
+ * in a deque. A thread takes the tests from the front of its own deque and,
+ * once that is empty, steals from the back of the others. So a thread which
+ * gets stuck on a longer test hands the rest of its part over to the others.
+ *
+ * All the state of the running test is thread-local (each thread has its own
+ * acutest_current_). The output of each test is collected in the thread and
+ * written out as a whole once the test ends, so the tests appear in the order
+ * they complete. At the end, each thread frees its copy of the per-test
+ * buffers. */
+struct acutest_deque_ {
+    volatile long lock;
+    int beg;
+    int end;
+};
+
+static struct acutest_deque_* acutest_deques_ = NULL;
+static int acutest_n_deques_ = 0;
+static int* acutest_threads_queue_ = NULL;  /* Master indexes of the tests to run. */
+static int acutest_threads_index_ = 0;      /* Index of acutest_threads_queue_[0]. */
+
+/* Take a position in acutest_threads_queue_ from the deque, or -1 if empty. */
+static int
+acutest_deque_take_(struct acutest_deque_* dq, int from_back)
+{
+    int pos = -1;
+
+    while(ACUTEST_ATOMIC_XCHG_(dq->lock, 1) != 0)
+        ACUTEST_YIELD_();
+    if(dq->beg < dq->end)
+        pos = (from_back ? --dq->end : dq->beg++);
+    ACUTEST_ATOMIC_RELEASE_(dq->lock);
+    return pos;
+}
+
+static void
+acutest_threads_worker_(struct acutest_deque_* own)
+{
+    struct acutest_buffer_ output = { NULL, 0, 0 };
+    struct acutest_current_ current = { NULL, 0, 0, { NULL, 0, 0 }, 0 };
+    int self = (int) (own - acutest_deques_);
+    int pos, i, stop;
+
+    acutest_thread_no_ = 1;
+    acutest_current_ = &current;
+    acutest_out_capture_ = &output;
+#if defined ACUTEST_HAS_AFFINITY_
+    acutest_pin_(self);
+#endif
+
+    while(1) {
+        acutest_lock_();
+        stop = acutest_fail_fast_reached_();
+        acutest_unlock_();
+        if(stop)
+            break;
+
+        pos = acutest_deque_take_(own, 0);
+        for(i = 1; pos < 0  &&  i < acutest_n_deques_; i++)
+            pos = acutest_deque_take_(&acutest_deques_[(self + i) % acutest_n_deques_], 1);
+        if(pos < 0)
+            break;
+
+        acutest_run_(&acutest_list_[acutest_threads_queue_[pos]],
+                     acutest_threads_index_ + pos, acutest_threads_queue_[pos]);
+
+        acutest_out_flush_();
+        acutest_lock_();
+        fwrite(output.data, 1, output.size, stdout);
+        fflush(stdout);
+        acutest_unlock_();
+        output.size = 0;
+    }
+
+    acutest_out_capture_ = NULL;
+    acutest_current_ = &acutest_process_current_;
+    acutest_buffer_free_(&output);
+    acutest_buffer_free_(&current.log_buf);
+    acutest_buffer_free_(&acutest_event_);
+    free(acutest_bench_results_);
+    acutest_bench_results_ = NULL;
+    acutest_bench_alloc_results_ = 0;
+}
+
+#if defined ACUTEST_WIN_
+static DWORD WINAPI
+acutest_threads_main_(LPVOID arg)
+{
+    acutest_threads_worker_((struct acutest_deque_*) arg);
+    return 0;
+}
+#else
+static void*
+acutest_threads_main_(void* arg)
+{
+    acutest_threads_worker_((struct acutest_deque_*) arg);
+    return NULL;
+}
+#endif
+
+/* Run all the TEST_THREAD_SAFE tests which need to run, in the thread pool.
+ * Returns the index of the next test. */
+static int
+acutest_run_threads_(int index)
+{
+#if defined ACUTEST_WIN_
+    HANDLE* threads;
+#else
+    pthread_t* threads;
+#endif
+    int* started;
+    int n = 0;
+    int i;
+
+    acutest_threads_queue_ = (int*) malloc((size_t) acutest_list_size_ * sizeof(int));
+    if(acutest_threads_queue_ == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN  &&
+           (acutest_list_[i].flags & TEST_THREAD_SAFE))
+            acutest_threads_queue_[n++] = i;
+    }
+    if(n == 0) {
+        free(acutest_threads_queue_);
+        acutest_threads_queue_ = NULL;
+        return index;
+    }
+
+    acutest_threads_index_ = index;
+    acutest_n_deques_ = (acutest_threads_ < n) ? acutest_threads_ : n;
+    acutest_deques_ = (struct acutest_deque_*) calloc((size_t) acutest_n_deques_, sizeof(struct acutest_deque_));
+#if defined ACUTEST_WIN_
+    threads = (HANDLE*) calloc((size_t) acutest_n_deques_, sizeof(HANDLE));
+#else
+    threads = (pthread_t*) calloc((size_t) acutest_n_deques_, sizeof(pthread_t));
+#endif
+    started = (int*) calloc((size_t) acutest_n_deques_, sizeof(int));
+    if(acutest_deques_ == NULL  ||  threads == NULL  ||  started == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+    for(i = 0; i < acutest_n_deques_; i++) {
+        acutest_deques_[i].beg = (int) ((long) n * i / acutest_n_deques_);
+        acutest_deques_[i].end = (int) ((long) n * (i+1) / acutest_n_deques_);
+    }
+
+    /* Nothing of ours may be sitting in the buffers while the threads write. */
+    acutest_out_flush_all_();
+
+    /* We take part as the thread 0. (If any other cannot be started, the rest
+     * just steal its part.) */
+    for(i = 1; i < acutest_n_deques_; i++) {
+#if defined ACUTEST_WIN_
+        threads[i] = CreateThread(NULL, 0, acutest_threads_main_, &acutest_deques_[i], 0, NULL);
+        started[i] = (threads[i] != NULL);
+#else
+        started[i] = (pthread_create(&threads[i], NULL, acutest_threads_main_, &acutest_deques_[i]) == 0);
+#endif
+    }
+    acutest_threads_worker_(&acutest_deques_[0]);
+    for(i = 1; i < acutest_n_deques_; i++) {
+        if(!started[i])
+            continue;
+#if defined ACUTEST_WIN_
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+
+    free(started);
+    free(threads);
+    free(acutest_deques_);
+    acutest_deques_ = NULL;
+    free(acutest_threads_queue_);
+    acutest_threads_queue_ = NULL;
+    return index + n;
+}
+#endif  /* defined ACUTEST_HAS_THREADS_ */
+
+#if defined(ACUTEST_UNIX_)
+/* Pool of child processes, used for parallel execution (--jobs=N) and for
+ * persistent workers (--persistent).
+ *
+ * In the default mode, each child runs exactly one test, the same way as
+ * acutest_run_() does, so the per-test isolation is the same. Persistent
+ * workers instead stay alive and receive indexes of tests to run through a
+ * command pipe, one at a time, reporting results back through a report pipe.
+ * A worker is only replaced when it crashes, or when it retires on its own
+ * after running the configured count of tests or after its peak RSS crosses
+ * the configured limit.
+ *
+ * Output of the children (both stdout and stderr) is captured through a pipe
+ * so it does not interleave. The parent collects it with non-blocking reads
+ * and replays the whole block of each test at once, either in the order of
+ * the test list (default) or in the order the tests complete. */
+
+struct acutest_slot_ {
+    pid_t pid;              /* 0 if the slot is free. */
+    int master_index;       /* -1 if the (persistent) worker is idle. */
+    int out_fd;             /* Read end of the output pipe, or -1. */
+    int rep_fd;             /* Read end of the report pipe, or -1. */
+    int cmd_fd;             /* Write end of the command pipe (persistent worker only), or -1. */
+    int retiring;
+    int timed_out;          /* Non-zero if killed for running out of time. */
+    int reported_state;     /* State the child has reported for the test, or -1. */
+    int cancelled;          /* Non-zero if killed because of --fail-fast. */
+    double deadline;        /* When to kill the test (see --timeout), or 0. */
+    char error[64];         /* Message about an abnormal child termination. */
+    char late_error[256];   /* Message from acutest_late_checks_(). */
+    struct acutest_buffer_ rep;
+    acutest_timer_type_ start;
+};
+
+/* (There is one for each test, so it is kept small. The messages of the slot
+ * are only copied in here if there are any.) */
+struct acutest_output_ {
+    struct acutest_buffer_ text;
+    struct acutest_buffer_ events;  /* (--format=jsonl) */
+    struct acutest_buffer_ error;       /* As the slot's error, or empty. */
+    struct acutest_buffer_ late_error;  /* As the slot's late_error, or empty. */
+    int index;              /* Index of the test (as used for TAP). */
+    unsigned scheduled : 1;
+    unsigned done : 1;
+};
+
+/* State of the pool. (An agent keeps a single one for all the tests it runs,
+ * see acutest_agent_main_().) */
+struct acutest_pool_ {
+    struct acutest_slot_* slots;
+    struct acutest_output_* outputs;    /* By master index. */
+    struct pollfd* pollfds;
+    int* pollslots;
+    int* queue;             /* Master indexes of the tests to run, in the order to run them. */
+    int n_queue;
+    int next;               /* Position of the next test to start in the queue. */
+    int n_running;
+    int next_replay;        /* Master index of the next test to replay (in the list order). */
+    void (*on_done)(int master_index);  /* Called when a test has finished, or NULL. */
+};
+
+static int acutest_output_order_completion_ = -1;    /* -1 until decided. */
+
+/* Read whatever is available in the (non-blocking) pipe. If buf is NULL, the
+ * data are discarded. Returns non-zero on EOF. */
+static int
+acutest_pipe_drain_(int fd, struct acutest_buffer_* buf)
+{
+    char buffer[4096];
+    ssize_t n;
+
+    while(1) {
+        n = read(fd, buffer, sizeof(buffer));
+        if(n > 0) {
+            if(buf != NULL)
+                acutest_buffer_append_(buf, buffer, (size_t) n);
+        } else if(n == 0) {
+            return 1;
+        } else if(errno == EINTR) {
+            continue;
+        } else if(errno == EAGAIN  ||  errno == EWOULDBLOCK) {
+            return 0;
+        } else {
+            return 1;
+        }
+    }
+}
+
+static int
+acutest_write_all_(int fd, const void* data, size_t size)
+{
+    const char* ptr = (const char*) data;
+
+    while(size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        ptr += n;
+        size -= (size_t) n;
+    }
+
+    return 0;
+}
+
+static void
+acutest_slot_close_(struct acutest_slot_* slot)
+{
+    if(slot->out_fd >= 0)
+        close(slot->out_fd);
+    if(slot->rep_fd >= 0)
+        close(slot->rep_fd);
+    if(slot->cmd_fd >= 0)
+        close(slot->cmd_fd);
+    slot->out_fd = -1;
+    slot->rep_fd = -1;
+    slot->cmd_fd = -1;
+    acutest_buffer_free_(&slot->rep);
+}
+
+/* Fork a new child for the slot. If master_index is not negative, the child
+ * runs just that test, otherwise it becomes a persistent worker. Returns 0 on
+ * success. */
+static int
+acutest_slot_spawn_(struct acutest_slot_* slots, int slot_index,
+                    int master_index, int index, char* error, size_t error_size)
+{
+    struct acutest_slot_* slot = &slots[slot_index];
+    int out_fds[2] = { -1, -1 };
+    int rep_fds[2] = { -1, -1 };
+    int cmd_fds[2] = { -1, -1 };
+    pid_t pid;
+    int i;
+
+    /* With a single job there is nothing to interleave with, so we let the
+     * child write directly to our stdout. (Unless the output has to become
+     * an event, or has to be sent to the coordinator.) A child running just
+     * one test needs no report pipe either, if only its exit code matters
+     * and it has no timeout to catch in time (see acutest_run_pool_()). */
+    if(((acutest_jobs_ > 1  ||  acutest_jsonl_  ||  acutest_agent_ != NULL)  &&  pipe(out_fds) != 0)  ||
+       ((master_index < 0  ||  acutest_details_wanted_()  ||  acutest_test_timeout_(master_index) > 0.0)  &&
+                pipe(rep_fds) != 0)  ||
+       (master_index < 0  &&  pipe(cmd_fds) != 0)) {
+        snprintf(error, error_size, "Cannot create a pipe. %s [%d]", strerror(errno), errno);
+        goto err;
+    }
+
+    /* Make sure the child starts with empty I/O buffers. */
+    acutest_out_flush_all_();
+
+    pid = fork();
+    if(pid == (pid_t)-1) {
+        snprintf(error, error_size, "Cannot fork. %s [%d]", strerror(errno), errno);
+        goto err;
+    }
+
+    if(pid == 0) {
+        /* Child: Redirect the output into the pipe and close everything which
+         * belongs to the other slots. */
+        signal(SIGPIPE, SIG_DFL);
+        if(out_fds[1] >= 0) {
+            dup2(out_fds[1], STDOUT_FILENO);
+            dup2(out_fds[1], STDERR_FILENO);
+            close(out_fds[0]);
+            close(out_fds[1]);
+            acutest_out_capture_ = NULL;    /* (As set by an agent in the parent.) */
+        }
+        if(rep_fds[0] >= 0)
+            close(rep_fds[0]);
+        if(cmd_fds[1] >= 0)
+            close(cmd_fds[1]);
+        for(i = 0; i < acutest_jobs_; i++) {
+            if(i != slot_index  &&  slots[i].pid != 0)
+                acutest_slot_close_(&slots[i]);
+        }
+
+        acutest_worker_ = 1;
+        acutest_report_fd_ = rep_fds[1];
+#if defined ACUTEST_HAS_AFFINITY_
+        acutest_pin_(slot_index);
+#endif
+
+        if(master_index < 0) {
+            acutest_worker_loop_(cmd_fds[0]);
+            acutest_exit_(0);
+        } else {
+            enum acutest_state_ state;
+
+            acutest_worker_master_index_ = master_index;
+            state = acutest_do_run_(&acutest_list_[master_index], index);
+            acutest_report_result_(master_index, state, 1);
+            acutest_exit_((int) state);
+        }
+    }
+
+    /* Parent. */
+    if(out_fds[1] >= 0) {
+        close(out_fds[1]);
+        fcntl(out_fds[0], F_SETFL, fcntl(out_fds[0], F_GETFL) | O_NONBLOCK);
+    }
+    if(rep_fds[1] >= 0) {
+        close(rep_fds[1]);
+        fcntl(rep_fds[0], F_SETFL, fcntl(rep_fds[0], F_GETFL) | O_NONBLOCK);
+    }
+    if(cmd_fds[0] >= 0)
+        close(cmd_fds[0]);
+
+    slot->pid = pid;
+    slot->master_index = master_index;
+    slot->out_fd = out_fds[0];
+    slot->rep_fd = rep_fds[0];
+    slot->cmd_fd = cmd_fds[1];
+    slot->retiring = 0;
+    slot->reported_state = -1;
+    slot->cancelled = 0;
+    return 0;
+
+err:
+    for(i = 0; i < 2; i++) {
+        if(out_fds[i] >= 0)
+            close(out_fds[i]);
+        if(rep_fds[i] >= 0)
+            close(rep_fds[i]);
+        if(cmd_fds[i] >= 0)
+            close(cmd_fds[i]);
+    }
+    return -1;
+}
+
+/* Keep the message (if any) in the buffer, as a string. */
+static void
+acutest_output_keep_(struct acutest_buffer_* buf, const char* msg)
+{
+    if(msg[0] != '\0')
+        acutest_buffer_append_(buf, msg, strlen(msg) + 1);
+}
+
+static void
+acutest_output_free_(struct acutest_output_* out)
+{
+    acutest_buffer_free_(&out->text);
+    acutest_buffer_free_(&out->events);
+    acutest_buffer_free_(&out->error);
+    acutest_buffer_free_(&out->late_error);
+}
+
+static void
+acutest_output_replay_(struct acutest_output_* outputs, int master_index)
+{
+    struct acutest_output_* out = &outputs[master_index];
+
+    acutest_out_flush_all_();
+    if(acutest_jsonl_) {
+        if(out->events.size > 0)
+            acutest_out_put_(out->events.data, out->events.size);
+        if(out->text.size > 0) {
+            acutest_event_begin_("output", acutest_list_[master_index].name);
+            acutest_event_key_("text");
+            acutest_json_mem_(&acutest_event_, out->text.data, out->text.size);
+            acutest_event_end_();
+        }
+        acutest_event_test_end_(master_index, out->error.data, out->late_error.data);
+        acutest_out_flush_all_();
+
+        acutest_output_free_(out);
+        return;
+    }
+
+    if(out->text.size > 0)
+        acutest_out_emit_(out->text.data, out->text.size);
+    if(acutest_test_data_[master_index].state == ACUTEST_STATE_TIMEOUT)
+        acutest_timeout_print_(master_index, out->index);
+    if(out->error.size > 0)
+        acutest_error_("%s", out->error.data);
+    if(out->late_error.size > 0)
+        acutest_late_error_print_(out->late_error.data);
+    acutest_out_flush_all_();
+
+    acutest_output_free_(out);
+}
+
+/* Replay output of all finished tests which are due. */
+static void
+acutest_output_replay_due_(struct acutest_output_* outputs, int* next_replay)
+{
+    if(acutest_output_order_completion_)
+        return;
+
+    while(*next_replay < acutest_list_size_) {
+        if(outputs[*next_replay].scheduled) {
+            if(!outputs[*next_replay].done)
+                break;
+            acutest_output_replay_(outputs, *next_replay);
+        }
+        (*next_replay)++;
+    }
+}
+
+/* The test has finished, and its results are recorded. */
+static void
+acutest_pool_test_done_(struct acutest_pool_* pool, int master_index)
+{
+    acutest_test_done_(master_index);
+    pool->outputs[master_index].done = 1;
+
+    if(acutest_output_order_completion_)
+        acutest_output_replay_(pool->outputs, master_index);
+    if(pool->on_done != NULL)
+        pool->on_done(master_index);
+}
+
+static void
+acutest_slot_finish_test_(struct acutest_pool_* pool, struct acutest_slot_* slot,
+                          enum acutest_state_ state)
+{
+    int master_index = slot->master_index;
+    struct acutest_output_* out = &pool->outputs[master_index];
+    acutest_timer_type_ end;
+
+    acutest_timer_get_time_(&end);
+
+    acutest_test_data_[master_index].state = state;
+    acutest_test_data_[master_index].duration = acutest_timer_diff_(slot->start, end);
+    acutest_late_checks_(master_index, slot->late_error, sizeof(slot->late_error));
+    acutest_test_log_line_(master_index, slot->error);
+    acutest_test_log_line_(master_index, slot->late_error);
+    acutest_output_keep_(&out->error, slot->error);
+    acutest_output_keep_(&out->late_error, slot->late_error);
+    slot->master_index = -1;
+
+    acutest_pool_test_done_(pool, master_index);
+}
+
+/* Handle all complete records received from the child. Returns count of tests
+ * finished by them. */
+static int
+acutest_slot_process_reports_(struct acutest_pool_* pool, struct acutest_slot_* slot)
+{
+    struct acutest_report_header_ header;
+    size_t off = 0;
+    int n_finished = 0;
+
+    while(slot->rep.size - off >= sizeof(header)) {
+        const char* payload;
+
+        memcpy(&header, slot->rep.data + off, sizeof(header));
+        if(slot->rep.size - off - sizeof(header) < (size_t) header.size)
+            break;
+        payload = slot->rep.data + off + sizeof(header);
+
+        if(header.type == ACUTEST_REPORT_EVENT_) {
+            if(slot->master_index >= 0)
+                acutest_buffer_append_(&pool->outputs[slot->master_index].events, payload, (size_t) header.size);
+        } else if(header.type != ACUTEST_REPORT_RESULT_) {
+            if(slot->master_index >= 0)
+                acutest_report_store_(slot->master_index, &header, payload);
+        } else {
+            struct acutest_report_result_ result;
+
+            memcpy(&result, payload, sizeof(result));
+            if(slot->master_index == result.master_index) {
+                acutest_report_store_(result.master_index, &header, payload);
+                slot->reported_state = result.state;
+            }
+            if(slot->cmd_fd >= 0  &&  slot->master_index == result.master_index) {
+                /* Persistent worker: The test is over, but the worker lives
+                 * on (unless it tells us otherwise). */
+                acutest_pipe_drain_(slot->out_fd, &pool->outputs[slot->master_index].text);
+                acutest_slot_finish_test_(pool, slot, (enum acutest_state_) result.state);
+                slot->retiring = result.retire;
+                n_finished++;
+            }
+        }
+
+        off += sizeof(header) + (size_t) header.size;
+    }
+
+    if(off > 0) {
+        memmove(slot->rep.data, slot->rep.data + off, slot->rep.size - off);
+        slot->rep.size -= off;
+    }
+
+    return n_finished;
+}
+
+/* The child of the slot has terminated. Returns count of tests finished. */
+static int
+acutest_slot_terminated_(struct acutest_pool_* pool, struct acutest_slot_* slot, int exit_code,
+                         const struct rusage* usage)
+{
+    int n_finished = 0;
+
+    if(slot->rep_fd >= 0) {
+        acutest_pipe_drain_(slot->rep_fd, &slot->rep);
+        n_finished += acutest_slot_process_reports_(pool, slot);
+    }
+
+    if(slot->master_index >= 0  &&  slot->cancelled) {
+        /* Killed because of --fail-fast: As if the test has never started. */
+        pool->outputs[slot->master_index].scheduled = 0;
+        slot->master_index = -1;
+        n_finished++;
+    } else if(slot->master_index >= 0) {
+        struct acutest_output_* out = &pool->outputs[slot->master_index];
+        enum acutest_state_ state;
+
+        if(slot->out_fd >= 0)
+            acutest_pipe_drain_(slot->out_fd, &out->text);
+        if(!acutest_persistent_)
+            acutest_rusage_from_rusage_(&acutest_test_data_[slot->master_index].rusage, usage);
+        if(slot->timed_out) {
+            state = ACUTEST_STATE_TIMEOUT;
+            snprintf(slot->error, sizeof(slot->error), "Test timed out after %g seconds.",
+                     acutest_test_timeout_(slot->master_index));
+        } else {
+            state = acutest_child_state_(exit_code, slot->error, sizeof(slot->error));
+            /* If the child has ended normally, the state it has reported
+             * is authoritative: The exit code may have been changed by
+             * anything running at exit. */
+            if(WIFEXITED(exit_code)  &&  slot->reported_state >= 0)
+                state = (enum acutest_state_) slot->reported_state;
+        }
+        acutest_slot_finish_test_(pool, slot, state);
+        n_finished++;
+    } else if(slot->out_fd >= 0) {
+        acutest_pipe_drain_(slot->out_fd, NULL);
+    }
+
+    acutest_slot_close_(slot);
+    slot->pid = 0;
+    return n_finished;
+}
+
+/* Order the tests to run so that the longest ones (according to the timing
+ * database) start first, as that gives the best balance of the parallel
+ * workers in the end (so called LPT scheduling). The workers then all pull
+ * the tests from the head of this single queue as they get idle. Tests with
+ * no known duration are assumed to take the average time of those with one. */
+static double acutest_default_estimate_ = 0.0;
+
+static double
+acutest_estimate_(int master_index)
+{
+    double estimate = acutest_test_data_[master_index].estimate;
+    return (estimate >= 0.0 ? estimate : acutest_default_estimate_);
+}
+
+static int
+acutest_cmp_estimate_(const void* a, const void* b)
+{
+    int ia = *(const int*) a;
+    int ib = *(const int*) b;
+    double ea = acutest_estimate_(ia);
+    double eb = acutest_estimate_(ib);
+    int pa = acutest_watch_priority_(ia);
+    int pb = acutest_watch_priority_(ib);
+
+    if(pa != pb)
+        return pa - pb;
+    if(ea > eb)
+        return -1;
+    if(ea < eb)
+        return 1;
+    return ia - ib;     /* Keep the list order for ties. */
+}
+
+static void
+acutest_schedule_(int* queue, int n)
+{
+    double sum = 0.0;
+    int n_known = 0;
+    int i;
+
+    for(i = 0; i < n; i++) {
+        if(acutest_test_data_[queue[i]].estimate >= 0.0) {
+            sum += acutest_test_data_[queue[i]].estimate;
+            n_known++;
+        }
+    }
+
+    if(n_known == 0  &&  !acutest_watch_)
+        return;
+
+    acutest_default_estimate_ = (n_known > 0) ? sum / n_known : 0.0;
+    qsort(queue, (size_t) n, sizeof(int), acutest_cmp_estimate_);
+}
+
+/* Whether the tests to run need the pool. If each of them can simply run in
+ * its own child process, one after another, with only its exit code being of
+ * any interest (and no timeout to watch for), acutest_run_() does that with
+ * less overhead per test. */
+static int
+acutest_pool_needed_(void)
+{
+    int i;
+
+    if(acutest_jobs_ > 1  ||  acutest_persistent_  ||  acutest_details_wanted_())
+        return 1;
+
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN  &&  acutest_test_timeout_(i) > 0.0)
+            return 1;
+    }
+    return 0;
+}
+
+static void
+acutest_pool_open_(struct acutest_pool_* pool)
+{
+    int i;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->slots = (struct acutest_slot_*) calloc((size_t) acutest_jobs_, sizeof(struct acutest_slot_));
+    pool->pollfds = (struct pollfd*) calloc((size_t) acutest_jobs_ * 2 + 1, sizeof(struct pollfd));
+    pool->pollslots = (int*) calloc((size_t) acutest_jobs_ * 2 + 1, sizeof(int));
+    pool->outputs = (struct acutest_output_*) calloc((size_t) acutest_list_size_, sizeof(struct acutest_output_));
+    pool->queue = (int*) calloc((size_t) acutest_list_size_ + 1, sizeof(int));
+    if(pool->slots == NULL  ||  pool->pollfds == NULL  ||  pool->pollslots == NULL  ||
+       pool->outputs == NULL  ||  pool->queue == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+
+    for(i = 0; i < acutest_jobs_; i++) {
+        pool->slots[i].master_index = -1;
+        pool->slots[i].out_fd = -1;
+        pool->slots[i].rep_fd = -1;
+        pool->slots[i].cmd_fd = -1;
+    }
+
+    /* A persistent worker may die anytime. We rather want to see EPIPE when
+     * writing to it than to be killed. */
+    signal(SIGPIPE, SIG_IGN);
+}
+
+/* Queue the test to run. (A test may be queued only once at a time.) */
+static void
+acutest_pool_add_(struct acutest_pool_* pool, int master_index, int index)
+{
+    struct acutest_output_* out = &pool->outputs[master_index];
+
+    /* Forget the tests which have already been started. */
+    if(pool->next > 0) {
+        memmove(pool->queue, pool->queue + pool->next, (size_t) (pool->n_queue - pool->next) * sizeof(int));
+        pool->n_queue -= pool->next;
+        pool->next = 0;
+    }
+
+    out->index = index;
+    out->scheduled = 1;
+    out->done = 0;
+    pool->queue[pool->n_queue++] = master_index;
+}
+
+/* Run the queued tests until all of them are done. If fd is not negative,
+ * return (with non-zero) also as soon as the fd gets readable, and keep
+ * waiting for that even when there is no test to run. */
+static int
+acutest_pool_run_(struct acutest_pool_* pool, int fd)
+{
+    struct acutest_slot_* slots = pool->slots;
+    struct pollfd* pollfds = pool->pollfds;
+    int* pollslots = pool->pollslots;
+    int i;
+
+    while(1) {
+        int exit_code;
+        struct rusage usage;
+        int n_pollfds;
+        int poll_timeout;
+        int fd_ready = 0;
+        double now;
+
+        if(acutest_fail_fast_reached_()) {
+            /* Start nothing more and cancel the tests still running. */
+            while(pool->next < pool->n_queue)
+                pool->outputs[pool->queue[pool->next++]].scheduled = 0;
+            for(i = 0; i < acutest_jobs_; i++) {
+                if(slots[i].pid != 0  &&  slots[i].master_index >= 0  &&  !slots[i].cancelled) {
+                    kill(slots[i].pid, SIGKILL);
+                    slots[i].cancelled = 1;
+                }
+            }
+        }
+
+        acutest_output_replay_due_(pool->outputs, &pool->next_replay);
+
+        /* Fill all free slots with tests still waiting to be run. */
+        while(pool->next < pool->n_queue) {
+            struct acutest_slot_* slot = NULL;
+            int master_index = pool->queue[pool->next];
+            int index = pool->outputs[master_index].index;
+
+            /* Prefer an idle persistent worker; otherwise a free slot. */
+            for(i = 0; i < acutest_jobs_; i++) {
+                if(slots[i].pid != 0  &&  slots[i].cmd_fd >= 0  &&
+                   slots[i].master_index < 0  &&  !slots[i].retiring) {
+                    slot = &slots[i];
+                    break;
+                }
+            }
+            if(slot == NULL) {
+                for(i = 0; i < acutest_jobs_; i++) {
+                    if(slots[i].pid == 0) {
+                        slot = &slots[i];
+                        break;
+                    }
+                }
+            }
+            if(slot == NULL)
+                break;
+
+            pool->next++;
+            if(slot->pid == 0) {
+                if(acutest_slot_spawn_(slots, (int)(slot - slots), (acutest_persistent_ ? -1 : master_index),
+                            index, slot->error, sizeof(slot->error)) != 0) {
+                    acutest_test_data_[master_index].state = ACUTEST_STATE_FAILED;
+                    acutest_test_log_line_(master_index, slot->error);
+                    acutest_output_keep_(&pool->outputs[master_index].error, slot->error);
+                    acutest_pool_test_done_(pool, master_index);
+                    continue;
+                }
+            }
+
+            acutest_timer_get_time_(&slot->start);
+            slot->master_index = master_index;
+            slot->timed_out = 0;
+            slot->error[0] = '\0';
+            slot->deadline = 0.0;
+            if(acutest_test_timeout_(master_index) > 0.0)
+                slot->deadline = acutest_clock_monotonic_() + acutest_test_timeout_(master_index);
+            if(slot->cmd_fd >= 0) {
+                int cmd[2];
+
+                cmd[0] = master_index;
+                cmd[1] = index;
+                if(acutest_write_all_(slot->cmd_fd, cmd, sizeof(cmd)) != 0) {
+                    /* The worker is dead. Let the termination handling below
+                     * take care of it (and the test). */
+                    close(slot->cmd_fd);
+                    slot->cmd_fd = -1;
+                }
+            }
+            pool->n_running++;
+        }
+
+        acutest_output_replay_due_(pool->outputs, &pool->next_replay);
+        /* (If tests are still waiting, all the slots are taken by workers
+         * which are retiring; they are to be waited for.) */
+        if(pool->n_running == 0  &&  pool->next >= pool->n_queue  &&  fd < 0)
+            return 0;
+
+        /* Wait for some output, a report, or for a child to terminate. */
+        n_pollfds = 0;
+        for(i = 0; i < acutest_jobs_; i++) {
+            if(slots[i].pid == 0)
+                continue;
+            if(slots[i].out_fd >= 0) {
+                pollfds[n_pollfds].fd = slots[i].out_fd;
+                pollfds[n_pollfds].events = POLLIN;
+                pollfds[n_pollfds].revents = 0;
+                pollslots[n_pollfds] = i;
+                n_pollfds++;
+            }
+            if(slots[i].rep_fd >= 0) {
+                pollfds[n_pollfds].fd = slots[i].rep_fd;
+                pollfds[n_pollfds].events = POLLIN;
+                pollfds[n_pollfds].revents = 0;
+                pollslots[n_pollfds] = i;
+                n_pollfds++;
+            }
+        }
+
+        if(n_pollfds == 0  &&  fd < 0) {
+            /* No pipe to watch (a single job which only reports its exit
+             * code), so just wait for the child. */
+            for(i = 0; i < acutest_jobs_; i++) {
+                if(slots[i].pid != 0  &&  acutest_wait_child_(slots[i].pid, &exit_code, 0, &usage) == slots[i].pid)
+                    pool->n_running -= acutest_slot_terminated_(pool, &slots[i], exit_code, &usage);
+            }
+            continue;
+        }
+
+        if(fd >= 0) {
+            pollfds[n_pollfds].fd = fd;
+            pollfds[n_pollfds].events = POLLIN;
+            pollfds[n_pollfds].revents = 0;
+            pollslots[n_pollfds] = -1;
+            n_pollfds++;
+        }
+
+        /* The timeout is there to catch children which terminated without
+         * us seeing EOF on their pipes (e.g. because they have spawned some
+         * grandchild which still holds the pipes open), and to kill tests
+         * which run out of their time. (With nothing running, there is only
+         * the fd to wait for.) */
+        poll_timeout = (pool->n_running > 0) ? 100 : -1;
+        now = acutest_clock_monotonic_();
+        for(i = 0; i < acutest_jobs_; i++) {
+            if(slots[i].pid != 0  &&  slots[i].master_index >= 0  &&  slots[i].deadline > 0.0  &&
+               !slots[i].timed_out  &&  (slots[i].deadline - now) * 1000.0 < poll_timeout)
+            {
+                poll_timeout = (slots[i].deadline > now) ? (int) ((slots[i].deadline - now) * 1000.0) + 1 : 0;
+            }
+        }
+        if(poll(pollfds, (nfds_t) n_pollfds, poll_timeout) < 0  &&  errno != EINTR) {
+            acutest_error_("Cannot poll. %s [%d]", strerror(errno), errno);
+            return 0;
+        }
+
+        for(i = 0; i < n_pollfds; i++) {
+            struct acutest_slot_* slot;
+
+            if(pollfds[i].revents == 0)
+                continue;
+            if(pollslots[i] < 0) {
+                fd_ready = 1;
+                continue;
+            }
+            slot = &slots[pollslots[i]];
+            if(slot->pid == 0)
+                continue;
+
+            if(pollfds[i].fd == slot->out_fd) {
+                struct acutest_buffer_* buf = (slot->master_index >= 0)
+                            ? &pool->outputs[slot->master_index].text : NULL;
+                if(acutest_pipe_drain_(slot->out_fd, buf)) {
+                    close(slot->out_fd);
+                    slot->out_fd = -1;
+                    /* EOF: Without a report pipe, the child is exiting. */
+                    if(slot->rep_fd < 0  &&  acutest_wait_child_(slot->pid, &exit_code, 0, &usage) == slot->pid)
+                        pool->n_running -= acutest_slot_terminated_(pool, slot, exit_code, &usage);
+                }
+            } else if(pollfds[i].fd == slot->rep_fd) {
+                if(acutest_pipe_drain_(slot->rep_fd, &slot->rep)) {
+                    /* EOF: The child is exiting. */
+                    if(acutest_wait_child_(slot->pid, &exit_code, 0, &usage) == slot->pid)
+                        pool->n_running -= acutest_slot_terminated_(pool, slot, exit_code, &usage);
+                } else {
+                    pool->n_running -= acutest_slot_process_reports_(pool, slot);
+                }
+            }
+        }
+
+        /* Reap any other terminated children. */
+        for(i = 0; i < acutest_jobs_; i++) {
+            if(slots[i].pid != 0  &&  acutest_wait_child_(slots[i].pid, &exit_code, WNOHANG, &usage) == slots[i].pid)
+                pool->n_running -= acutest_slot_terminated_(pool, &slots[i], exit_code, &usage);
+        }
+
+        /* Kill tests which have run out of time. (They get reaped as any
+         * other terminated child.) */
+        now = acutest_clock_monotonic_();
+        for(i = 0; i < acutest_jobs_; i++) {
+            if(slots[i].pid != 0  &&  slots[i].master_index >= 0  &&  slots[i].deadline > 0.0  &&
+               !slots[i].timed_out  &&  now >= slots[i].deadline)
+            {
+                kill(slots[i].pid, SIGKILL);
+                slots[i].timed_out = 1;
+            }
+        }
+
+        if(fd_ready)
+            return 1;
+    }
+}
+
+static void
+acutest_pool_close_(struct acutest_pool_* pool)
+{
+    int i;
+
+    /* Shut down all the remaining persistent workers. */
+    for(i = 0; i < acutest_jobs_; i++) {
+        if(pool->slots[i].pid != 0) {
+            pid_t pid = pool->slots[i].pid;
+            acutest_slot_close_(&pool->slots[i]);
+            waitpid(pid, NULL, 0);
+            pool->slots[i].pid = 0;
+        }
+    }
+
+    signal(SIGPIPE, SIG_DFL);
+
+    for(i = 0; i < acutest_list_size_; i++)
+        acutest_output_free_(&pool->outputs[i]);
+    free(pool->queue);
+    free(pool->outputs);
+    free(pool->pollslots);
+    free(pool->pollfds);
+    free(pool->slots);
+}
+
+/* Run all the tests to run, numbering them (as used for TAP) from the given
+ * index. Returns the index following the last one. */
+static int
+acutest_run_pool_(int index)
+{
+    struct acutest_pool_ pool;
+    int n = 0;
+    int i;
+
+    acutest_pool_open_(&pool);
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN)
+            acutest_pool_add_(&pool, i, index + n++);
+    }
+    acutest_schedule_(pool.queue, pool.n_queue);
+
+    acutest_pool_run_(&pool, -1);
+
+    acutest_pool_close_(&pool);
+    return index + n;
+}
+#endif
+
+#if defined ACUTEST_HAS_NET_
+/* Distributed execution (--coordinator, --agent).
+ *
+ * The coordinator listens for agents, i.e. instances of the same test suite
+ * (possibly on other machines) started with --agent=HOST:PORT, and hands the
+ * tests out to them one at a time, as their slots become free. (An agent has
+ * as many slots as it runs tests in parallel, see --jobs.) So the agents which
+ * get the longer tests just run fewer of them.
+ *
+ * The protocol reuses the JSON Lines of --format=jsonl, in both directions:
+ *
+ *   agent:        {"event":"agent","suite":...,"tests":N,"hash":H,"slots":S}
+ *   coordinator:  {"event":"config","verbose":V,"tap":0|1,"jsonl":0|1,...}
+ *   coordinator:  {"event":"run","index":MASTER_INDEX,"number":INDEX}
+ *   agent:        {"event":"result","index":MASTER_INDEX} once the test has
+ *                 ended; then {"event":"log",...} with the details for the
+ *                 XUnit output (if any); all the events of the test with
+ *                 --format=jsonl, or else just an "output" event with its
+ *                 text output; and "test_end".
+ *   coordinator:  {"event":"quit"}
+ *
+ * The agent runs the test just as it would run it on its own (in a child
+ * process, unless --no-exec), so its results end up in the coordinator's
+ * acutest_test_data_[] as if it has run the test itself. (Except benchmarks
+ * and performance counters, which are only reported in the output.) It sends
+ * all the lines about a test at once, so they never interleave with those
+ * about its other tests. */
+
+/* Find the value of the top-level member in our own JSON line. (Any quote
+ * inside of a string value is escaped, so it cannot be mistaken for a name.) */
+static const char*
+acutest_json_find_(const char* line, const char* key)
+{
+    size_t len = strlen(key);
+    const char* p = line;
+
+    while((p = strchr(p, '"')) != NULL) {
+        if(p > line  &&  (p[-1] == '{'  ||  p[-1] == ',')  &&
+           strncmp(p+1, key, len) == 0  &&  p[len+1] == '"'  &&  p[len+2] == ':')
+            return p + len + 3;
+        p++;
+    }
+    return NULL;
+}
+
+static double
+acutest_json_num_(const char* line, const char* key, double dflt)
+{
+    const char* val = acutest_json_find_(line, key);
+    return (val != NULL  &&  *val != '"') ? strtod(val, NULL) : dflt;
+}
+
+/* Append the string member, unescaped, to the buffer. Returns 0 if found. */
+static int
+acutest_json_get_str_(const char* line, const char* key, struct acutest_buffer_* buf)
+{
+    const char* val = acutest_json_find_(line, key);
+
+    if(val == NULL  ||  *val != '"')
+        return -1;
+
+    val++;
+    while(*val != '\0'  &&  *val != '"') {
+        const char* run = val;
+        char c;
+
+        while(*val != '\0'  &&  *val != '"'  &&  *val != '\\')
+            val++;
+        if(val > run)
+            acutest_buffer_append_(buf, run, (size_t) (val - run));
+        if(*val != '\\')
+            break;
+
+        val++;
+        switch(*val) {
+            case 'n':   c = '\n'; break;
+            case 'r':   c = '\r'; break;
+            case 't':   c = '\t'; break;
+            case 'b':   c = '\b'; break;
+            case 'f':   c = '\f'; break;
+            case 'u':
+            {
+                char hex[5] = { 0 };
+                unsigned long u;
+
+                strncpy(hex, val+1, 4);
+                u = strtoul(hex, NULL, 16);
+                val += strlen(hex);
+                if(u < 0x100) {
+                    /* (We use it also for bytes of invalid UTF-8.) */
+                    c = (char) u;
+                } else {
+                    char utf8[3];
+                    if(u < 0x800) {
+                        utf8[0] = (char) (0xc0 | (u >> 6));
+                        utf8[1] = (char) (0x80 | (u & 0x3f));
+                        acutest_buffer_append_(buf, utf8, 2);
+                    } else {
+                        utf8[0] = (char) (0xe0 | (u >> 12));
+                        utf8[1] = (char) (0x80 | ((u >> 6) & 0x3f));
+                        utf8[2] = (char) (0x80 | (u & 0x3f));
+                        acutest_buffer_append_(buf, utf8, 3);
+                    }
+                    val++;
+                    continue;
+                }
+                break;
+            }
+            case '\0':  return 0;
+            default:    c = *val; break;    /* '"', '\\', '/' */
+        }
+        acutest_buffer_append_(buf, &c, 1);
+        val++;
+    }
+    return 0;
+}
+
+/* Hash of the test list, so that the coordinator and the agents can make
+ * sure they agree on the master indexes. */
+static unsigned
+acutest_list_hash_(void)
+{
+    unsigned h = 0;
+    int i;
+
+    for(i = 0; i < acutest_list_size_; i++)
+        h = h * 31 + acutest_hash_(acutest_list_[i].name);
+    return h;
+}
+
+/* Open the TCP socket: As a server listening on "[HOST:]PORT", or as a client
+ * connected to "HOST:PORT". Returns the file descriptor, or -1.
+ *
+ * There is no authentication, so without HOST, the server listens only on the
+ * loopback interface. The HOST "*" stands for all the interfaces. (An IPv6
+ * address may be in brackets, e.g. "[::1]:7700".) */
+static int
+acutest_net_open_(const char* addr, int listening)
+{
+    struct addrinfo hints;
+    struct addrinfo* res;
+    struct addrinfo* ai;
+    char host[256] = "";
+    const char* port = addr;
+    const char* colon = strrchr(addr, ':');
+    int any_host = 0;
+    int pass;
+    int fd = -1;
+
+    if(colon != NULL) {
+        size_t len = (size_t) (colon - addr);
+        if(len >= 2  &&  addr[0] == '['  &&  addr[len-1] == ']') {
+            addr++;
+            len -= 2;
+        }
+        if(len >= sizeof(host))
+            len = sizeof(host) - 1;
+        memcpy(host, addr, len);
+        host[len] = '\0';
+        port = colon + 1;
+    }
+    if(strcmp(host, "*") == 0) {
+        host[0] = '\0';
+        any_host = 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    /* (Without AI_PASSIVE, no host means the loopback.) */
+    hints.ai_flags = (listening  &&  any_host) ? AI_PASSIVE : 0;
+    if(getaddrinfo((host[0] != '\0') ? host : NULL, port, &hints, &res) != 0)
+        return -1;
+
+    /* When listening, IPv4 goes first (in the first pass): The agents may
+     * e.g. connect to "localhost", which need not be the IPv6 loopback. */
+    for(pass = 0; pass < (listening ? 2 : 1)  &&  fd < 0; pass++) {
+        for(ai = res; ai != NULL; ai = ai->ai_next) {
+            if(listening  &&  (ai->ai_family == AF_INET) != (pass == 0))
+                continue;
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if(fd < 0)
+                continue;
+            if(listening) {
+                int one = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                if(bind(fd, ai->ai_addr, ai->ai_addrlen) == 0  &&  listen(fd, 64) == 0)
+                    break;
+            } else {
+                if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                    break;
+            }
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int
+acutest_net_send_(int fd, const char* data, size_t size)
+{
+    while(size > 0) {
+        ssize_t n = write(fd, data, size);
+        if(n < 0  &&  errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        data += n;
+        size -= (size_t) n;
+    }
+    return 0;
+}
+
+/* Send the event which has been just built in acutest_event_. */
+static int
+acutest_net_send_event_(int fd)
+{
+    acutest_buffer_append_(&acutest_event_, "}\n", 2);
+    return acutest_net_send_(fd, acutest_event_.data, acutest_event_.size);
+}
+
+/* Read whatever is available from the socket into the buffer. Returns -1 on
+ * end of the connection. */
+static int
+acutest_net_recv_(int fd, struct acutest_buffer_* buf)
+{
+    char tmp[4096];
+    ssize_t n;
+
+    do {
+        n = read(fd, tmp, sizeof(tmp));
+    } while(n < 0  &&  errno == EINTR);
+    if(n <= 0)
+        return -1;
+    acutest_buffer_append_(buf, tmp, (size_t) n);
+    return 0;
+}
+
+/* Take the first complete line (zero-terminated in place, without the '\n')
+ * out of the buffer. Returns its length, or -1 if there is none. The caller
+ * then has to call acutest_net_line_done_(). */
+static int
+acutest_net_line_(struct acutest_buffer_* buf)
+{
+    char* eol = (buf->size > 0) ? (char*) memchr(buf->data, '\n', buf->size) : NULL;
+
+    if(eol == NULL)
+        return -1;
+    *eol = '\0';
+    return (int) (eol - buf->data);
+}
+
+static void
+acutest_net_line_done_(struct acutest_buffer_* buf, int len)
+{
+    buf->size -= (size_t) len + 1;
+    memmove(buf->data, buf->data + len + 1, buf->size);
+}
+
+static int
+acutest_event_is_(const char* line, const char* event)
+{
+    size_t len = strlen(event);
+    const char* val = acutest_json_find_(line, "event");
+
+    return (val != NULL  &&  val[0] == '"'  &&  strncmp(val+1, event, len) == 0  &&  val[len+1] == '"');
+}
+
+static int acutest_agent_fd_ = -1;
+static int acutest_agent_lost_ = 0;
+static struct acutest_buffer_ acutest_agent_text_ = { NULL, 0, 0 };    /* Output of the tests. */
+
+/* Send all about the test which has just ended (its output has been written
+ * into acutest_agent_text_) to the coordinator. */
+static void
+acutest_agent_test_done_(int master_index)
+{
+    struct acutest_test_data_* data = &acutest_test_data_[master_index];
+    struct acutest_buffer_ out = { NULL, 0, 0 };
+
+    acutest_out_flush_();
+    acutest_out_capture_ = &out;
+    acutest_event_begin_("result", NULL);
+    acutest_event_int_("index", master_index);
+    acutest_event_end_();
+    if(data->log.size > 0) {
+        acutest_event_begin_("log", acutest_list_[master_index].name);
+        acutest_event_key_("text");
+        acutest_json_mem_(&acutest_event_, data->log.data, data->log.size);
+        acutest_event_end_();
+    }
+    if(acutest_jsonl_) {
+        /* The events (including test_end) are there already. */
+        acutest_buffer_append_(&out, acutest_agent_text_.data, acutest_agent_text_.size);
+    } else {
+        if(acutest_agent_text_.size > 0) {
+            acutest_event_begin_("output", acutest_list_[master_index].name);
+            acutest_event_key_("text");
+            acutest_json_mem_(&acutest_event_, acutest_agent_text_.data, acutest_agent_text_.size);
+            acutest_event_end_();
+        }
+        acutest_event_test_end_(master_index, NULL, NULL);
+    }
+    acutest_out_flush_();
+    acutest_out_capture_ = &acutest_agent_text_;
+
+    if(acutest_net_send_(acutest_agent_fd_, out.data, out.size) != 0)
+        acutest_agent_lost_ = 1;
+    acutest_agent_text_.size = 0;
+    acutest_buffer_free_(&out);
+}
+
+/* Serve the coordinator until it says there is nothing more to run. The tests
+ * run in a single pool (unless --no-exec), with as many of them at once as
+ * there are its slots (see --jobs). */
+static void
+acutest_agent_main_(void)
+{
+    struct acutest_pool_ pool;
+    struct acutest_buffer_ in = { NULL, 0, 0 };
+    int configured = 0;
+    int len;
+    int i;
+
+    /* Let the lost coordinator be just an error of write(). */
+    signal(SIGPIPE, SIG_IGN);
+
+    acutest_agent_fd_ = acutest_net_open_(acutest_agent_, 0);
+    if(acutest_agent_fd_ < 0) {
+        fprintf(stderr, "%s: Cannot connect to the coordinator '%s'.\n", acutest_argv0_, acutest_agent_);
+        acutest_exit_(2);
+    }
+
+    /* We only run what we are told to. (And it is the coordinator who decides
+     * when to stop.) */
+    for(i = 0; i < acutest_list_size_; i++)
+        acutest_test_data_[i].state = ACUTEST_STATE_EXCLUDED;
+    acutest_fail_fast_ = 0;
+
+    acutest_event_begin_("agent", NULL);
+    acutest_event_str_("suite", acutest_basename_(acutest_argv0_));
+    acutest_event_int_("tests", acutest_list_size_);
+    acutest_event_int_("hash", (long) acutest_list_hash_());
+    acutest_event_int_("slots", acutest_no_exec_ ? 1 : acutest_jobs_);
+    if(acutest_net_send_event_(acutest_agent_fd_) != 0)
+        goto out;
+
+    /* Each test is sent to the coordinator as soon as it ends. */
+    if(!acutest_no_exec_) {
+        acutest_output_order_completion_ = 1;
+        acutest_pool_open_(&pool);
+        pool.on_done = acutest_agent_test_done_;
+    }
+    acutest_out_capture_ = &acutest_agent_text_;
+
+    while(!acutest_agent_lost_) {
+        char* line;
+
+        len = acutest_net_line_(&in);
+        if(len < 0) {
+            if(!acutest_no_exec_)
+                acutest_pool_run_(&pool, acutest_agent_fd_);
+            if(acutest_net_recv_(acutest_agent_fd_, &in) != 0)
+                break;
+            continue;
+        }
+        line = in.data;
+
+        if(acutest_event_is_(line, "config")) {
+            acutest_verbose_level_ = (int) acutest_json_num_(line, "verbose", 2);
+            acutest_tap_ = (int) acutest_json_num_(line, "tap", 0);
+            acutest_jsonl_ = (int) acutest_json_num_(line, "jsonl", 0);
+            acutest_out_muted_ = acutest_jsonl_;
+            acutest_colorize_ = (int) acutest_json_num_(line, "color", 0);
+            acutest_timer_ = (int) acutest_json_num_(line, "time", 0);
+            acutest_test_log_on_ = (int) acutest_json_num_(line, "log", 0);
+            acutest_max_rss_ = (long) acutest_json_num_(line, "max_rss_kb", 0);
+            acutest_timer_init_();
+            configured = 1;
+        } else if(acutest_event_is_(line, "run")) {
+            int master_index = (int) acutest_json_num_(line, "index", -1);
+            int index = (int) acutest_json_num_(line, "number", 0);
+            struct acutest_test_data_* data;
+
+            if(master_index < 0  ||  master_index >= acutest_list_size_  ||
+               acutest_test_data_[master_index].state == ACUTEST_STATE_NEEDTORUN)
+                break;
+            data = &acutest_test_data_[master_index];
+            data->state = ACUTEST_STATE_NEEDTORUN;
+            data->log.size = 0;
+
+            if(!acutest_no_exec_) {
+                acutest_pool_add_(&pool, master_index, index);
+            } else {
+                acutest_run_(&acutest_list_[master_index], index, master_index);
+                acutest_agent_test_done_(master_index);
+            }
+        } else if(acutest_event_is_(line, "quit")) {
+            break;
+        }
+
+        acutest_net_line_done_(&in, len);
+    }
+
+    acutest_out_flush_();
+    acutest_out_capture_ = NULL;
+    if(!acutest_no_exec_)
+        acutest_pool_close_(&pool);
+
+out:
+    close(acutest_agent_fd_);
+    acutest_agent_fd_ = -1;
+    acutest_buffer_free_(&in);
+    acutest_buffer_free_(&acutest_agent_text_);
+
+    if(!configured) {
+        fprintf(stderr, "%s: The coordinator '%s' has refused us.\n", acutest_argv0_, acutest_agent_);
+        acutest_exit_(2);
+    }
+}
+
+struct acutest_agent_conn_ {
+    int fd;
+    int ready;                      /* Has introduced itself. */
+    int n_slots;                    /* Count of tests it may run at once. */
+    int n_running;
+    int* running;                   /* Master indexes of the tests it runs. */
+    int* indexes;                   /* And their indexes (as used for TAP). */
+    int current;                    /* Master index of the test being reported, or -1. */
+    struct acutest_buffer_ in;
+    struct acutest_buffer_ text;    /* Output of the current test so far. */
+};
 
-        substr = strstr(substr+1, pattern);
-    }
+static int acutest_coordinator_fd_ = -1;
+static struct acutest_agent_conn_* acutest_conns_ = NULL;
+static int acutest_n_conns_ = 0;
 
-    return 0;
+static void
+acutest_conn_close_(struct acutest_agent_conn_* conn)
+{
+    close(conn->fd);
+    conn->fd = -1;
+    conn->n_running = 0;
+    free(conn->running);
+    free(conn->indexes);
+    conn->running = NULL;
+    conn->indexes = NULL;
+    acutest_buffer_free_(&conn->in);
+    acutest_buffer_free_(&conn->text);
 }
 
+/* Position of the test among those the agent runs, or -1. */
 static int
-acutest_select_(const char* pattern)
+acutest_conn_find_(const struct acutest_agent_conn_* conn, int master_index)
 {
-    int i;
-    int n = 0;
+    int pos;
 
-    /* Try exact match. */
-    for(i = 0; i < acutest_list_size_; i++) {
-        if(strcmp(acutest_list_[i].name, pattern) == 0) {
-            acutest_test_data_[i].state = ACUTEST_STATE_SELECTED;
-            n++;
-            break;
-        }
+    for(pos = 0; pos < conn->n_running; pos++) {
+        if(conn->running[pos] == master_index)
+            return pos;
     }
-    if(n > 0)
-        return n;
+    return -1;
+}
 
-    /* Try word match. */
-    for(i = 0; i < acutest_list_size_; i++) {
-        if(acutest_name_contains_word_(acutest_list_[i].name, pattern)) {
-            acutest_test_data_[i].state = ACUTEST_STATE_SELECTED;
-            n++;
-        }
+/* Write out the output of the finished test and record its results. */
+static void
+acutest_conn_test_done_(struct acutest_agent_conn_* conn, int pos, const char* line, const char* error)
+{
+    int master_index = conn->running[pos];
+    struct acutest_test_data_* data = &acutest_test_data_[master_index];
+    struct acutest_buffer_ result = { NULL, 0, 0 };
+
+    if(line != NULL) {
+        acutest_json_get_str_(line, "result", &result);
+        acutest_buffer_append_(&result, "", 1);
+        if(strcmp(result.data, "success") == 0)
+            data->state = ACUTEST_STATE_SUCCESS;
+        else if(strcmp(result.data, "skipped") == 0)
+            data->state = ACUTEST_STATE_SKIPPED;
+        else if(strcmp(result.data, "timeout") == 0)
+            data->state = ACUTEST_STATE_TIMEOUT;
+        else
+            data->state = ACUTEST_STATE_FAILED;
+        acutest_buffer_free_(&result);
+
+        data->duration = acutest_json_num_(line, "duration", 0.0);
+        data->cpu_time = acutest_json_num_(line, "cpu_time", -1.0);
+        data->check_count = (int) acutest_json_num_(line, "checks", 0);
+        data->failure_count = (int) acutest_json_num_(line, "failures", 0);
+        data->rusage.max_rss = (long) acutest_json_num_(line, "max_rss_kb", -1);
+        data->rusage.minor_faults = (long) acutest_json_num_(line, "minor_faults", -1);
+        data->rusage.major_faults = (long) acutest_json_num_(line, "major_faults", -1);
+        data->rusage.vol_csw = (long) acutest_json_num_(line, "voluntary_csw", -1);
+        data->rusage.invol_csw = (long) acutest_json_num_(line, "involuntary_csw", -1);
+    } else {
+        data->state = ACUTEST_STATE_FAILED;
     }
-    if(n > 0)
-        return n;
 
-    /* Try relaxed match. */
-    for(i = 0; i < acutest_list_size_; i++) {
-        if(strstr(acutest_list_[i].name, pattern) != NULL) {
-            acutest_test_data_[i].state = ACUTEST_STATE_SELECTED;
-            n++;
+    acutest_out_flush_all_();
+    if(acutest_jsonl_) {
+        if(error == NULL)
+            acutest_out_put_(conn->text.data, conn->text.size);
+        else
+            acutest_event_test_end_(master_index, error, NULL);
+    } else {
+        if(error == NULL) {
+            acutest_out_emit_(conn->text.data, conn->text.size);
+        } else {
+            /* We have got nothing from the agent, so not even the test line. */
+            acutest_current_->test = &acutest_list_[master_index];
+            acutest_current_->index = conn->indexes[pos];
+            acutest_begin_test_line_(acutest_current_->test);
+            if(acutest_tap_  ||  (acutest_verbose_level_ >= 1  &&  acutest_verbose_level_ < 3))
+                acutest_finish_test_line_(ACUTEST_STATE_FAILED);
+            acutest_error_("%s", error);
+            acutest_current_->test = NULL;
         }
     }
-
-    return n;
+    if(error != NULL)
+        acutest_test_log_line_(master_index, error);
+    acutest_out_flush_all_();
+
+    acutest_test_done_(master_index);
+    if(conn->current == master_index) {
+        conn->text.size = 0;
+        conn->current = -1;
+    }
+    conn->n_running--;
+    conn->running[pos] = conn->running[conn->n_running];
+    conn->indexes[pos] = conn->indexes[conn->n_running];
 }
 
+/* The agent is gone (or has to be dropped): All its tests have failed. */
+static void
+acutest_conn_lost_(struct acutest_agent_conn_* conn)
+{
+    while(conn->n_running > 0)
+        acutest_conn_test_done_(conn, conn->n_running - 1, NULL, "Connection to the agent running the test has been lost.");
+    acutest_conn_close_(conn);
+}
 
-/* Called if anything goes bad in Acutest, or if the unit test ends in other
- * way then by normal returning from its function (e.g. exception or some
- * abnormal child process termination). */
-static void ACUTEST_ATTRIBUTE_(format (printf, 1, 2))
-acutest_error_(const char* fmt, ...)
+/* Process the line received from the agent. Returns -1 if the agent has to
+ * be dropped. */
+static int
+acutest_conn_line_(struct acutest_agent_conn_* conn, const char* line, int len)
 {
-    if(acutest_verbose_level_ == 0)
-        return;
+    int pos;
+
+    if(!conn->ready) {
+        if(!acutest_event_is_(line, "agent"))
+            return -1;
+        if((int) acutest_json_num_(line, "tests", -1) != acutest_list_size_  ||
+           (long) acutest_json_num_(line, "hash", -1) != (long) acutest_list_hash_()) {
+            fprintf(stderr, "%s: Rejecting an agent with different unit tests.\n", acutest_argv0_);
+            return -1;
+        }
 
-    if(acutest_verbose_level_ >= 2) {
-        va_list args;
+        conn->n_slots = (int) acutest_json_num_(line, "slots", 1);
+        if(conn->n_slots > acutest_list_size_)
+            conn->n_slots = acutest_list_size_;
+        if(conn->n_slots < 1)
+            conn->n_slots = 1;
+        conn->running = (int*) calloc((size_t) conn->n_slots, sizeof(int));
+        conn->indexes = (int*) calloc((size_t) conn->n_slots, sizeof(int));
+        if(conn->running == NULL  ||  conn->indexes == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            acutest_exit_(2);
+        }
 
-        acutest_line_indent_(1);
-        if(acutest_verbose_level_ >= 3)
-            acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "ERROR: ");
-        va_start(args, fmt);
-        vprintf(fmt, args);
-        va_end(args);
-        printf("\n");
+        acutest_event_begin_("config", NULL);
+        acutest_event_int_("verbose", acutest_verbose_level_);
+        acutest_event_int_("tap", acutest_tap_);
+        acutest_event_int_("jsonl", acutest_jsonl_);
+        acutest_event_int_("color", acutest_colorize_);
+        acutest_event_int_("time", acutest_timer_);
+        acutest_event_int_("log", acutest_test_log_on_);
+        acutest_event_int_("max_rss_kb", acutest_max_rss_);
+        if(acutest_net_send_event_(conn->fd) != 0)
+            return -1;
+        conn->ready = 1;
+        return 0;
     }
 
-    if(acutest_verbose_level_ >= 3) {
-        printf("\n");
+    if(acutest_event_is_(line, "result")) {
+        /* The lines about the test follow, up to its test_end. */
+        conn->current = (int) acutest_json_num_(line, "index", -1);
+        conn->text.size = 0;
+        return (acutest_conn_find_(conn, conn->current) >= 0) ? 0 : -1;
     }
-}
 
-/* Call directly the given test unit function. */
-static enum acutest_state_
-acutest_do_run_(const struct acutest_test_* test, int index)
-{
-    enum acutest_state_ state = ACUTEST_STATE_FAILED;
+    pos = acutest_conn_find_(conn, conn->current);
+    if(pos < 0)
+        return 0;
 
-    acutest_current_test_ = test;
-    acutest_current_index_ = index;
-    acutest_test_failures_ = 0;
-    acutest_test_already_logged_ = 0;
-    acutest_test_check_count_ = 0;
-    acutest_test_skip_count_ = 0;
-    acutest_cond_failed_ = 0;
+    if(acutest_event_is_(line, "log")) {
+        acutest_json_get_str_(line, "text", &acutest_test_data_[conn->current].log);
+        return 0;
+    }
 
-#ifdef __cplusplus
-#ifndef TEST_NO_EXCEPTIONS
-    try {
-#endif
-#endif
-        acutest_init_(test->name);
-        acutest_begin_test_line_(test);
+    if(acutest_jsonl_) {
+        acutest_buffer_append_(&conn->text, line, (size_t) len);
+        acutest_buffer_append_(&conn->text, "\n", 1);
+    } else if(acutest_event_is_(line, "output")) {
+        acutest_json_get_str_(line, "text", &conn->text);
+    }
 
-        /* This is good to do in case the test unit crashes. */
-        fflush(stdout);
-        fflush(stderr);
+    if(acutest_event_is_(line, "test_end"))
+        acutest_conn_test_done_(conn, pos, line, NULL);
+    return 0;
+}
 
-        if(!acutest_worker_) {
-            acutest_abort_has_jmp_buf_ = 1;
-            if(setjmp(acutest_abort_jmp_buf_) != 0)
-                goto aborted;
-        }
+/* Run all the tests which need to run on the agents. Returns the index of the
+ * next test. */
+static int
+acutest_coordinate_(int index)
+{
+    struct pollfd* pollfds = NULL;
+    int* queue;
+    int n_queue = 0;
+    int n_running;
+    int next = 0;
+    int i;
 
-        acutest_timer_get_time_(&acutest_timer_start_);
-        test->func();
+    if(acutest_coordinator_fd_ < 0) {
+        acutest_coordinator_fd_ = acutest_net_open_(acutest_coordinator_, 1);
+        if(acutest_coordinator_fd_ < 0) {
+            fprintf(stderr, "%s: Cannot listen on '%s'. %s [%d]\n", acutest_argv0_,
+                    acutest_coordinator_, strerror(errno), errno);
+            acutest_exit_(2);
+        }
+    }
 
-aborted:
-        acutest_abort_has_jmp_buf_ = 0;
-        acutest_timer_get_time_(&acutest_timer_end_);
+    queue = (int*) calloc((size_t) acutest_list_size_ + 1, sizeof(int));
+    if(queue == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        acutest_exit_(2);
+    }
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN)
+            queue[n_queue++] = i;
+    }
+    acutest_schedule_(queue, n_queue);
 
-        if(acutest_test_failures_ > 0)
-            state = ACUTEST_STATE_FAILED;
-        else if(acutest_test_skip_count_ > 0)
-            state = ACUTEST_STATE_SKIPPED;
-        else
-            state = ACUTEST_STATE_SUCCESS;
+    /* An agent may disappear anytime. */
+    signal(SIGPIPE, SIG_IGN);
 
-        if(!acutest_test_already_logged_)
-            acutest_finish_test_line_(state);
+    while(1) {
+        struct pollfd* new_pollfds;
+
+        /* Fill the free slots of all the agents. */
+        n_running = 0;
+        for(i = 0; i < acutest_n_conns_; i++) {
+            struct acutest_agent_conn_* conn = &acutest_conns_[i];
+
+            while(conn->fd >= 0  &&  conn->ready  &&  conn->n_running < conn->n_slots  &&
+                  next < n_queue  &&  !acutest_fail_fast_reached_())
+            {
+                acutest_event_begin_("run", NULL);
+                acutest_event_int_("index", queue[next]);
+                acutest_event_int_("number", index + next);
+                if(acutest_net_send_event_(conn->fd) != 0) {
+                    acutest_conn_lost_(conn);
+                    break;
+                }
+                conn->running[conn->n_running] = queue[next];
+                conn->indexes[conn->n_running] = index + next;
+                conn->n_running++;
+                next++;
+            }
+            n_running += conn->n_running;
+        }
+        if((next >= n_queue  ||  acutest_fail_fast_reached_())  &&  n_running == 0)
+            break;
 
-        if(acutest_verbose_level_ >= 3) {
-            acutest_line_indent_(1);
-            switch(state) {
-                case ACUTEST_STATE_SUCCESS:
-                    acutest_colored_printf_(ACUTEST_COLOR_GREEN_INTENSIVE_, "SUCCESS: ");
-                    printf("All conditions have passed.\n");
+        new_pollfds = (struct pollfd*) realloc(pollfds, (size_t) (acutest_n_conns_ + 1) * sizeof(struct pollfd));
+        if(new_pollfds == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            acutest_exit_(2);
+        }
+        pollfds = new_pollfds;
+        pollfds[0].fd = acutest_coordinator_fd_;
+        pollfds[0].events = POLLIN;
+        for(i = 0; i < acutest_n_conns_; i++) {
+            pollfds[i+1].fd = acutest_conns_[i].fd;     /* (Negative ones are ignored.) */
+            pollfds[i+1].events = POLLIN;
+        }
+        if(poll(pollfds, (nfds_t) acutest_n_conns_ + 1, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
 
-                    if(acutest_timer_) {
-                        acutest_line_indent_(1);
-                        printf("Duration: ");
-                        acutest_timer_print_diff_();
-                        printf("\n");
-                    }
-                    break;
+        for(i = 0; i < acutest_n_conns_; i++) {
+            struct acutest_agent_conn_* conn = &acutest_conns_[i];
+            int len;
 
-                case ACUTEST_STATE_SKIPPED:
-                    acutest_colored_printf_(ACUTEST_COLOR_YELLOW_INTENSIVE_, "SKIPPED: ");
-                    printf("%s.\n", acutest_test_skip_reason_);
-                    break;
+            if(conn->fd < 0  ||  !(pollfds[i+1].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
 
-                default:
-                    acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "FAILED: ");
-                    printf("%d condition%s %s failed.\n",
-                            acutest_test_failures_,
-                            (acutest_test_failures_ == 1) ? "" : "s",
-                            (acutest_test_failures_ == 1) ? "has" : "have");
-                    break;
+            if(acutest_net_recv_(conn->fd, &conn->in) == 0) {
+                while((len = acutest_net_line_(&conn->in)) >= 0) {
+                    int err = acutest_conn_line_(conn, conn->in.data, len);
+                    acutest_net_line_done_(&conn->in, len);
+                    if(err != 0)
+                        break;
+                }
+                if(len < 0)
+                    continue;
             }
-            printf("\n");
+
+            /* The connection is lost, or the agent misbehaves. */
+            acutest_conn_lost_(conn);
         }
 
-#ifdef __cplusplus
-#ifndef TEST_NO_EXCEPTIONS
-    } catch(std::exception& e) {
-        const char* what = e.what();
-        acutest_check_(0, NULL, 0, "Threw std::exception");
-        if(what != NULL)
-            acutest_message_("std::exception::what(): %s", what);
+        if(pollfds[0].revents & POLLIN) {
+            int fd = accept(acutest_coordinator_fd_, NULL, NULL);
 
-        if(acutest_verbose_level_ >= 3) {
-            acutest_line_indent_(1);
-            acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "FAILED: ");
-            printf("C++ exception.\n\n");
-        }
-    } catch(...) {
-        acutest_check_(0, NULL, 0, "Threw an exception");
+            if(fd >= 0) {
+                struct acutest_agent_conn_* conns;
 
-        if(acutest_verbose_level_ >= 3) {
-            acutest_line_indent_(1);
-            acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "FAILED: ");
-            printf("C++ exception.\n\n");
+                conns = (struct acutest_agent_conn_*) realloc(acutest_conns_,
+                            (size_t) (acutest_n_conns_ + 1) * sizeof(struct acutest_agent_conn_));
+                if(conns == NULL) {
+                    fprintf(stderr, "Out of memory.\n");
+                    acutest_exit_(2);
+                }
+                acutest_conns_ = conns;
+                memset(&acutest_conns_[acutest_n_conns_], 0, sizeof(struct acutest_agent_conn_));
+                acutest_conns_[acutest_n_conns_].fd = fd;
+                acutest_conns_[acutest_n_conns_].current = -1;
+                acutest_n_conns_++;
+            }
         }
     }
-#endif
-#endif
-
-    acutest_fini_(test->name);
-    acutest_case_(NULL);
-    acutest_current_test_ = NULL;
 
-    return state;
+    signal(SIGPIPE, SIG_DFL);
+    free(pollfds);
+    free(queue);
+    return index + n_queue;
 }
 
-/* Trigger the unit test. If possible (and not suppressed) it starts a child
- * process who calls acutest_do_run_(), otherwise it calls acutest_do_run_()
- * directly. */
+/* Tell all the agents there is nothing more to do. */
 static void
-acutest_run_(const struct acutest_test_* test, int index, int master_index)
+acutest_coordinator_close_(void)
 {
-    enum acutest_state_ state = ACUTEST_STATE_FAILED;
-    acutest_timer_type_ start, end;
-
-    acutest_current_test_ = test;
-    acutest_test_already_logged_ = 0;
-    acutest_timer_get_time_(&start);
-
-    if(!acutest_no_exec_) {
-
-#if defined(ACUTEST_UNIX_)
-
-        pid_t pid;
-        int exit_code;
-
-        /* Make sure the child starts with empty I/O buffers. */
-        fflush(stdout);
-        fflush(stderr);
+    int i;
 
-        pid = fork();
-        if(pid == (pid_t)-1) {
-            acutest_error_("Cannot fork. %s [%d]", strerror(errno), errno);
-        } else if(pid == 0) {
-            /* Child: Do the test. */
-            acutest_worker_ = 1;
-            state = acutest_do_run_(test, index);
-            acutest_exit_((int) state);
-        } else {
-            /* Parent: Wait until child terminates and analyze its exit code. */
-            waitpid(pid, &exit_code, 0);
-            if(WIFEXITED(exit_code)) {
-                state = (enum acutest_state_) WEXITSTATUS(exit_code);
-            } else if(WIFSIGNALED(exit_code)) {
-                char tmp[32];
-                const char* signame;
-                switch(WTERMSIG(exit_code)) {
-                    case SIGINT:  signame = "SIGINT"; break;
-                    case SIGHUP:  signame = "SIGHUP"; break;
-                    case SIGQUIT: signame = "SIGQUIT"; break;
-                    case SIGABRT: signame = "SIGABRT"; break;
-                    case SIGKILL: signame = "SIGKILL"; break;
-                    case SIGSEGV: signame = "SIGSEGV"; break;
-                    case SIGILL:  signame = "SIGILL"; break;
-                    case SIGTERM: signame = "SIGTERM"; break;
-                    default:      snprintf(tmp, sizeof(tmp), "signal %d", WTERMSIG(exit_code)); signame = tmp; break;
-                }
-                acutest_error_("Test interrupted by %s.", signame);
-            } else {
-                acutest_error_("Test ended in an unexpected way [%d].", exit_code);
-            }
-        }
+    for(i = 0; i < acutest_n_conns_; i++) {
+        if(acutest_conns_[i].fd < 0)
+            continue;
+        acutest_event_begin_("quit", NULL);
+        acutest_net_send_event_(acutest_conns_[i].fd);
+        acutest_conn_close_(&acutest_conns_[i]);
+    }
+    free(acutest_conns_);
+    acutest_conns_ = NULL;
+    acutest_n_conns_ = 0;
+    if(acutest_coordinator_fd_ >= 0) {
+        close(acutest_coordinator_fd_);
+        acutest_coordinator_fd_ = -1;
+    }
+}
+#endif  /* defined ACUTEST_HAS_NET_ */
 
-#elif defined(ACUTEST_WIN_)
+/* Record details about a failure of the current test, for the XUnit output.
+ * A child process sends them to the parent right away, so they are not lost
+ * even if the child crashes later. */
+#define ACUTEST_TEST_LOG_MAXSIZE_   4096
 
-        char buffer[512] = {0};
-        STARTUPINFOA startupInfo;
-        PROCESS_INFORMATION processInfo;
-        DWORD exitCode;
+static void
+acutest_test_log_send_(const char* text, size_t size)
+{
+    if(acutest_report_fd_ >= 0) {
+        while(size > 0) {
+            size_t n = (size < 256) ? size : 256;
 
-        /* Windows has no fork(). So we propagate all info into the child
-         * through a command line arguments. */
-        snprintf(buffer, sizeof(buffer),
-                 "%s --worker=%d %s --no-exec --no-summary %s --verbose=%d --color=%s -- \"%s\"",
-                 acutest_argv0_, index, acutest_timer_ ? "--time" : "",
-                 acutest_tap_ ? "--tap" : "", acutest_verbose_level_,
-                 acutest_colorize_ ? "always" : "never",
-                 test->name);
-        memset(&startupInfo, 0, sizeof(startupInfo));
-        startupInfo.cb = sizeof(STARTUPINFO);
-        if(CreateProcessA(NULL, buffer, NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &processInfo)) {
-            WaitForSingleObject(processInfo.hProcess, INFINITE);
-            GetExitCodeProcess(processInfo.hProcess, &exitCode);
-            CloseHandle(processInfo.hThread);
-            CloseHandle(processInfo.hProcess);
-            switch(exitCode) {
-                case 0:             state = ACUTEST_STATE_SUCCESS; break;
-                case 1:             state = ACUTEST_STATE_FAILED; break;
-                case 2:             state = ACUTEST_STATE_SKIPPED; break;
-                case 3:             acutest_error_("Aborted."); break;
-                case 0xC0000005:    acutest_error_("Access violation."); break;
-                default:            acutest_error_("Test ended in an unexpected way [%lu].", exitCode); break;
-            }
-        } else {
-            acutest_error_("Cannot create unit test subprocess [%ld].", GetLastError());
+            acutest_report_(ACUTEST_REPORT_LOG_, text, n);
+            text += n;
+            size -= n;
         }
+        return;
+    }
 
-#else
+    acutest_buffer_append_(&acutest_current_->log_buf, text, size);
+}
 
-        /* A platform where we don't know how to run child process. */
-        state = acutest_do_run_(test, index);
+static void
+acutest_test_log_(const char* text, size_t size)
+{
+    static const char ellipsis[] = "...\n";
+    size_t avail = ACUTEST_TEST_LOG_MAXSIZE_ - acutest_current_->log_total;
 
-#endif
+    if(!acutest_test_log_on_  ||  acutest_current_->log_total >= ACUTEST_TEST_LOG_MAXSIZE_)
+        return;
 
-    } else {
-        /* Child processes suppressed through --no-exec. */
-        state = acutest_do_run_(test, index);
+    if(size > avail) {
+        /* Too much. Cut it and ignore anything more. */
+        acutest_test_log_send_(text, avail);
+        acutest_test_log_send_(ellipsis, sizeof(ellipsis) - 1);
+        acutest_current_->log_total = ACUTEST_TEST_LOG_MAXSIZE_;
+        return;
     }
-    acutest_timer_get_time_(&end);
 
-    acutest_current_test_ = NULL;
+    acutest_test_log_send_(text, size);
+    acutest_current_->log_total += size;
+}
 
-    acutest_test_data_[master_index].state = state;
-    acutest_test_data_[master_index].duration = acutest_timer_diff_(start, end);
+/* Send out the event composed since acutest_event_begin_(). A child process
+ * sends it to the parent, who writes it together with the rest of what it
+ * knows about the test once the test is over. (On Windows, the child of
+ * acutest_run_() writes its events out on its own.) */
+static void
+acutest_event_end_(void)
+{
+    acutest_buffer_append_(&acutest_event_, "}\n", 2);
+#if defined ACUTEST_UNIX_
+    if(acutest_report_fd_ >= 0) {
+        acutest_report_(ACUTEST_REPORT_EVENT_, acutest_event_.data, acutest_event_.size);
+        return;
+    }
+#endif
+    acutest_out_put_(acutest_event_.data, acutest_event_.size);
 }
 
 #if defined(ACUTEST_WIN_)
@@ -1344,8 +9531,7 @@ acutest_seh_exception_filter_(EXCEPTION_POINTERS *ptrs)
     acutest_message_("Exception code:    0x%08lx", ptrs->ExceptionRecord->ExceptionCode);
     acutest_message_("Exception address: 0x%p", ptrs->ExceptionRecord->ExceptionAddress);
 
-    fflush(stdout);
-    fflush(stderr);
+    acutest_out_flush_all_();
 
     return EXCEPTION_EXECUTE_HANDLER;
 }
@@ -1518,12 +9704,51 @@ acutest_help_(void)
     printf("Run the specified unit tests; or if the option '--exclude' is used, run all\n");
     printf("tests in the suite but those listed.  By default, if no tests are specified\n");
     printf("on the command line, all unit tests in the suite are run.\n");
+    printf("\n");
+    printf("A test may be specified by its name, by a word (or words) of its name, by\n");
+    printf("a wildcard pattern using '*', '?' and '[...]', or by any part of its name.\n");
+#if defined ACUTEST_UNIX_
+    printf("A pattern in the form '/REGEX/' is an extended regular expression.\n");
+#endif
     printf("\n");
     printf("Options:\n");
     printf("  -X, --exclude         Execute all unit tests but the listed ones\n");
+    printf("      --tests-from=FILE Read further tests (one per line) from FILE\n");
+    printf("                          ('-' means the standard input)\n");
     printf("      --exec[=WHEN]     If supported, execute unit tests as child processes\n");
     printf("                          (WHEN is one of 'auto', 'always', 'never')\n");
     printf("  -E, --no-exec         Same as --exec=never\n");
+#if defined ACUTEST_HAS_THREADS_
+    printf("      --threads=N       Run unit tests marked as thread-safe in N threads\n");
+    printf("                          of this process (implies --exec=never; 0 means\n");
+    printf("                          the number of available CPUs)\n");
+#endif
+#if defined ACUTEST_UNIX_
+    printf("  -j, --jobs=N          Run up to N unit tests in parallel (as child processes)\n");
+    printf("                          (0 means the number of available CPUs)\n");
+    printf("      --output-order=ORDER\n");
+    printf("                        Order of output of parallel unit tests\n");
+    printf("                          (ORDER is one of 'list', 'completion')\n");
+#endif
+#if defined ACUTEST_UNIX_  ||  defined ACUTEST_WIN_
+    printf("      --persistent[=N]  Reuse child processes for running more unit tests;\n");
+    printf("                          replace each one after N tests (default: never)\n");
+    printf("      --worker-max-rss=MB\n");
+    printf("                        Replace a persistent child process once its peak\n");
+    printf("                          memory usage reaches MB megabytes\n");
+#endif
+#if defined ACUTEST_UNIX_
+#if defined ACUTEST_HAS_NET_
+    printf("      --coordinator=[HOST:]PORT\n");
+    printf("                        Run unit tests on the agents connecting to PORT\n");
+    printf("                          (of HOST, or of all interfaces if it is '*';\n");
+    printf("                          default: the loopback only)\n");
+    printf("      --agent=HOST:PORT Run unit tests the coordinator at HOST:PORT asks for\n");
+    printf("                          (up to --jobs of them at once)\n");
+#endif
+    printf("      --watch           Run the unit tests again whenever the binary gets\n");
+    printf("                          rebuilt (the failed ones first)\n");
+#endif
 #if defined ACUTEST_WIN_
     printf("  -t, --time            Measure test duration\n");
 #elif defined ACUTEST_HAS_POSIX_TIMER_
@@ -1531,10 +9756,62 @@ acutest_help_(void)
     printf("      --time=TIMER      Measure test duration, using given timer\n");
     printf("                          (TIMER is one of 'real', 'cpu')\n");
 #endif
+    printf("      --rerun-failed=FILE\n");
+    printf("                        Run only unit tests which have failed in the last\n");
+    printf("                          run recorded in FILE (all if none has), and\n");
+    printf("                          record the outcomes of this run there\n");
+    printf("      --fail-fast[=N]   Stop after N unit tests have failed (default: 1)\n");
+    printf("      --repeat=N        Run each unit test N times and report those with\n");
+    printf("                          mixed results as flaky\n");
+    printf("      --until-fail      Repeat the unit tests until any of them fails\n");
+    printf("                          (at most N times with --repeat=N)\n");
+    printf("      --timing-db=FILE  Append durations, check counts and outcomes of the\n");
+    printf("                          unit tests to the CSV file FILE (and use the\n");
+    printf("                          durations to run the longest ones first)\n");
+    printf("      --history=FILE    Same as --timing-db=FILE (kept for compatibility)\n");
+    printf("      --baseline=FILE   Fail tests (and benchmarks) slower than their\n");
+    printf("                          records in the timing database FILE\n");
+    printf("      --max-regression=PCT\n");
+    printf("                        Allowed slow-down against the baseline (default: 10)\n");
+    printf("      --timeout=SECS    Kill tests running longer than SECS seconds\n");
+    printf("                          (unless overridden in the test list)\n");
+    printf("      --max-rss=MB      Fail tests whose peak memory usage exceeds MB\n");
+    printf("      --perf-counters[=LIST]\n");
+    printf("                        Measure hardware performance counters (a comma\n");
+    printf("                          separated list of: cycles, instructions,\n");
+    printf("                          cache-references, cache-misses, branches,\n");
+    printf("                          branch-misses; default: cycles,instructions,\n");
+    printf("                          cache-misses,branch-misses)\n");
+#if defined ACUTEST_HAS_PROFILE_
+    printf("      --profile=DIR     Sample call stacks of each unit test into the file\n");
+    printf("                          DIR/<test name>.folded (for flame graphs)\n");
+#endif
+    printf("      --bench-time=SECS Time budget for each TEST_BENCH (default: 0.5)\n");
+    printf("      --bench-samples=N Count of samples measured by each TEST_BENCH\n");
+    printf("                          (default: 10)\n");
+    printf("      --bench-report=FILE\n");
+    printf("                        Write all benchmark results (and complexities of\n");
+    printf("                          TEST_BENCH_RANGE curves) to FILE as CSV (or JSON\n");
+    printf("                          if FILE ends with '.json')\n");
+#if defined ACUTEST_HAS_AFFINITY_
+    printf("      --pin-cpus[=LIST] Pin each job to one of the CPUs in LIST (e.g.\n");
+    printf("                          '0-3,8'; default: all), physical cores first\n");
+    printf("      --numa-node=N     Run (and allocate memory) only on the NUMA node N\n");
+#endif
+    printf("      --warmup[=N]      Run each unit test N times (default: 1) before\n");
+    printf("                          the measured run, discarding the results\n");
+    printf("      --env-report      Report CPU governor, turbo boost, SMT and load\n");
+    printf("                          average before running the tests\n");
     printf("      --no-summary      Suppress printing of test results summary\n");
     printf("      --tap             Produce TAP-compliant output\n");
     printf("                          (See https://testanything.org/)\n");
+    printf("      --format=FORMAT   Output format (FORMAT is one of 'text' (default),\n");
+    printf("                          'tap' (same as --tap), 'jsonl' (JSON Lines events))\n");
     printf("  -x, --xml-output=FILE Enable XUnit output to the given file\n");
+    printf("      --shard=K/N       Run only the K-th of N disjoint parts of the suite\n");
+    printf("      --shard-by=HOW    How to split the suite into the shards\n");
+    printf("                          (HOW is one of 'name' (stable hash of the name),\n");
+    printf("                          'duration' (balanced by --timing-db))\n");
     printf("  -l, --list            List unit tests in the suite and exit\n");
     printf("  -v, --verbose         Make output more verbose\n");
     printf("      --verbose=LEVEL   Set verbose level to LEVEL:\n");
@@ -1559,6 +9836,24 @@ static const ACUTEST_CMDLINE_OPTION_ acutest_cmdline_options_[] = {
     { 's',  "skip",         'X', 0 },   /* kept for compatibility, use --exclude instead */
     {  0,   "exec",         'e', ACUTEST_CMDLINE_OPTFLAG_OPTIONALARG_ },
     { 'E',  "no-exec",      'E', 0 },
+#if defined ACUTEST_HAS_THREADS_
+    {  0,   "threads",      'J', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+#endif
+#if defined ACUTEST_UNIX_
+    { 'j',  "jobs",         'j', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "output-order", 'o', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+#endif
+#if defined ACUTEST_UNIX_  ||  defined ACUTEST_WIN_
+    {  0,   "persistent",   'p', ACUTEST_CMDLINE_OPTFLAG_OPTIONALARG_ },
+    {  0,   "worker-max-rss", 'r', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+#endif
+#if defined ACUTEST_UNIX_
+#if defined ACUTEST_HAS_NET_
+    {  0,   "coordinator",  'Q', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "agent",        'A', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+#endif
+    {  0,   "watch",        'W', 0 },
+#endif
 #if defined ACUTEST_WIN_
     { 't',  "time",         't', 0 },
     {  0,   "timer",        't', 0 },   /* kept for compatibility */
@@ -1566,8 +9861,35 @@ static const ACUTEST_CMDLINE_OPTION_ acutest_cmdline_options_[] = {
     { 't',  "time",         't', ACUTEST_CMDLINE_OPTFLAG_OPTIONALARG_ },
     {  0,   "timer",        't', ACUTEST_CMDLINE_OPTFLAG_OPTIONALARG_ },  /* kept for compatibility */
 #endif
+    {  0,   "history",      'D', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },  /* kept for compatibility */
+    {  0,   "rerun-failed", 'R', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "fail-fast",    'y', ACUTEST_CMDLINE_OPTFLAG_OPTIONALARG_ },
+    {  0,   "repeat",       'n', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "until-fail",   'U', 0 },
+    {  0,   "timing-db",    'D', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "baseline",     'g', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "max-regression", 'G', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "timeout",      'u', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "max-rss",      'm', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "perf-counters", 'P', ACUTEST_CMDLINE_OPTFLAG_OPTIONALARG_ },
+#if defined ACUTEST_HAS_PROFILE_
+    {  0,   "profile",      'O', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+#endif
+    {  0,   "bench-time",   'b', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "bench-samples", 'B', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "bench-report", 'Z', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+#if defined ACUTEST_HAS_AFFINITY_
+    {  0,   "pin-cpus",     'I', ACUTEST_CMDLINE_OPTFLAG_OPTIONALARG_ },
+    {  0,   "numa-node",    'N', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+#endif
+    {  0,   "warmup",       'V', ACUTEST_CMDLINE_OPTFLAG_OPTIONALARG_ },
+    {  0,   "env-report",   'Y', 0 },
+    {  0,   "tests-from",   'F', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
     {  0,   "no-summary",   'S', 0 },
     {  0,   "tap",          'T', 0 },
+    {  0,   "format",       'f', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "shard",        'k', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
+    {  0,   "shard-by",     'K', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
     { 'l',  "list",         'l', 0 },
     { 'v',  "verbose",      'v', ACUTEST_CMDLINE_OPTFLAG_OPTIONALARG_ },
     { 'q',  "quiet",        'q', 0 },
@@ -1575,6 +9897,11 @@ static const ACUTEST_CMDLINE_OPTION_ acutest_cmdline_options_[] = {
     {  0,   "no-color",     'C', 0 },
     { 'h',  "help",         'h', 0 },
     {  0,   "worker",       'w', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },  /* internal */
+#if defined ACUTEST_WIN_
+    {  0,   "worker-report", 'z', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },  /* internal */
+    {  0,   "worker-log",   'L', 0 },   /* internal */
+    {  0,   "worker-commands", 'i', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },  /* internal */
+#endif
     { 'x',  "xml-output",   'x', ACUTEST_CMDLINE_OPTFLAG_REQUIREDARG_ },
     {  0,   NULL,            0,  0 }
 };
@@ -1605,6 +9932,60 @@ acutest_cmdline_callback_(int id, const char* arg)
             acutest_no_exec_ = 1;
             break;
 
+        case 'j':
+        {
+            char* end;
+
+            acutest_jobs_ = (int) strtol(arg, &end, 10);
+#if defined ACUTEST_UNIX_
+            if(acutest_jobs_ == 0  &&  *end == '\0') {
+                long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                acutest_jobs_ = (n_cpus > 0 ? (int) n_cpus : 1);
+            }
+#endif
+            if(acutest_jobs_ < 1  ||  *end != '\0') {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --jobs.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+        }
+
+        case 'Q':
+            acutest_coordinator_ = arg;
+            break;
+
+        case 'A':
+            acutest_agent_ = arg;
+            break;
+
+        case 'W':
+            acutest_watch_ = 1;
+            break;
+
+        case 'J':
+        {
+            char* end;
+
+            acutest_threads_ = (int) strtol(arg, &end, 10);
+            if(acutest_threads_ == 0  &&  *end == '\0') {
+#if defined ACUTEST_UNIX_
+                long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                acutest_threads_ = (n_cpus > 0 ? (int) n_cpus : 1);
+#elif defined ACUTEST_WIN_
+                SYSTEM_INFO info;
+                GetSystemInfo(&info);
+                acutest_threads_ = (info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1);
+#endif
+            }
+            if(acutest_threads_ < 1  ||  *end != '\0') {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --threads.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+        }
+
         case 't':
 #if defined ACUTEST_WIN_  ||  defined ACUTEST_HAS_POSIX_TIMER_
             if(arg == NULL || strcmp(arg, "real") == 0) {
@@ -1621,6 +10002,215 @@ acutest_cmdline_callback_(int id, const char* arg)
 #endif
             break;
 
+#if defined ACUTEST_UNIX_
+        case 'o':
+            if(strcmp(arg, "list") == 0) {
+                acutest_output_order_completion_ = 0;
+            } else if(strcmp(arg, "completion") == 0) {
+                acutest_output_order_completion_ = 1;
+            } else {
+                fprintf(stderr, "%s: Unrecognized argument '%s' for option --output-order.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+#endif
+
+#if defined ACUTEST_UNIX_  ||  defined ACUTEST_WIN_
+        case 'p':
+            acutest_persistent_ = 1;
+            acutest_persistent_max_tests_ = (arg != NULL ? atoi(arg) : 0);
+            break;
+
+        case 'r':
+            acutest_persistent_max_rss_ = atol(arg) * 1024;
+            break;
+#endif
+
+        case 'R':
+            acutest_rerun_file_ = arg;
+            break;
+
+        case 'n':
+        {
+            char* end;
+
+            acutest_repeat_ = (int) strtol(arg, &end, 10);
+            if(acutest_repeat_ < 1  ||  *end != '\0') {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --repeat.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+        }
+
+        case 'U':
+            acutest_until_fail_ = 1;
+            break;
+
+        case 'y':
+            if(arg != NULL) {
+                char* end;
+
+                acutest_fail_fast_ = (int) strtol(arg, &end, 10);
+                if(acutest_fail_fast_ < 1  ||  *end != '\0') {
+                    fprintf(stderr, "%s: Invalid argument '%s' for option --fail-fast.\n", acutest_argv0_, arg);
+                    fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                    acutest_exit_(2);
+                }
+            } else {
+                acutest_fail_fast_ = 1;
+            }
+            break;
+
+        case 'D':
+            acutest_timing_db_file_ = arg;
+            break;
+
+        case 'g':
+            acutest_baseline_file_ = arg;
+            break;
+
+        case 'G':
+        {
+            char* end;
+
+            acutest_max_regression_ = strtod(arg, &end);
+            if(end == arg  ||  *end != '\0'  ||  acutest_max_regression_ < 0.0) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --max-regression.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+        }
+
+        case 'u':
+        {
+            char* end;
+
+            acutest_timeout_ = strtod(arg, &end);
+            if(end == arg  ||  *end != '\0'  ||  acutest_timeout_ < 0.0) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --timeout.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+        }
+
+        case 'm':
+        {
+            char* end;
+            long mb = strtol(arg, &end, 10);
+
+            if(end == arg  ||  *end != '\0'  ||  mb <= 0) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --max-rss.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            acutest_max_rss_ = mb * 1024;
+            break;
+        }
+
+#if defined ACUTEST_HAS_PROFILE_
+        case 'O':
+            acutest_profile_dir_ = arg;
+            break;
+#endif
+
+        case 'P':
+        {
+            const char* name;
+            const char* end;
+            int i;
+
+            if(arg == NULL  ||  arg[0] == '\0')
+                arg = "cycles,instructions,cache-misses,branch-misses";
+            acutest_perf_counters_arg_ = arg;
+            acutest_perf_mask_ = 0;
+            for(name = arg; *name != '\0'; name = (*end == ',' ? end+1 : end)) {
+                end = strchr(name, ',');
+                if(end == NULL)
+                    end = name + strlen(name);
+                for(i = 0; i < ACUTEST_PERF_MAX_; i++) {
+                    if(strlen(acutest_perf_counters_[i].name) == (size_t)(end - name)  &&
+                       strncmp(acutest_perf_counters_[i].name, name, (size_t)(end - name)) == 0)
+                        break;
+                }
+                if(i >= ACUTEST_PERF_MAX_) {
+                    fprintf(stderr, "%s: Unrecognized argument '%s' for option --perf-counters.\n", acutest_argv0_, arg);
+                    fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                    acutest_exit_(2);
+                }
+                acutest_perf_mask_ |= (1u << i);
+            }
+            break;
+        }
+
+        case 'b':
+            acutest_bench_time_ = atof(arg);
+            if(acutest_bench_time_ <= 0.0) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --bench-time.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+
+        case 'B':
+            acutest_bench_samples_ = atoi(arg);
+            if(acutest_bench_samples_ < 1) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --bench-samples.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+
+        case 'Z':
+            acutest_bench_report_file_ = arg;
+            break;
+
+#if defined ACUTEST_HAS_AFFINITY_
+        case 'I':
+            if(arg != NULL) {
+                static unsigned char set[ACUTEST_MAX_CPUS_];
+
+                if(acutest_cpu_list_parse_(arg, set) != 0  ||  arg[0] == '\0') {
+                    fprintf(stderr, "%s: Invalid argument '%s' for option --pin-cpus.\n", acutest_argv0_, arg);
+                    fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                    acutest_exit_(2);
+                }
+            }
+            acutest_pin_requested_ = 1;
+            acutest_pin_cpus_arg_ = arg;
+            break;
+
+        case 'N':
+        {
+            char* end;
+
+            acutest_numa_node_ = (int) strtol(arg, &end, 10);
+            if(end == arg  ||  *end != '\0'  ||  acutest_numa_node_ < 0) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --numa-node.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            acutest_pin_requested_ = 1;
+            break;
+        }
+#endif
+
+        case 'V':
+            acutest_warmup_ = (arg != NULL) ? atoi(arg) : 1;
+            if(acutest_warmup_ < 1) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --warmup.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+
+        case 'Y':
+            acutest_env_report_ = 1;
+            break;
+
         case 'S':
             acutest_no_summary_ = 1;
             break;
@@ -1629,9 +10219,46 @@ acutest_cmdline_callback_(int id, const char* arg)
             acutest_tap_ = 1;
             break;
 
+        case 'f':
+            if(strcmp(arg, "text") == 0) {
+                acutest_tap_ = 0;
+                acutest_jsonl_ = 0;
+            } else if(strcmp(arg, "tap") == 0) {
+                acutest_tap_ = 1;
+                acutest_jsonl_ = 0;
+            } else if(strcmp(arg, "jsonl") == 0) {
+                acutest_tap_ = 0;
+                acutest_jsonl_ = 1;
+            } else {
+                fprintf(stderr, "%s: Unrecognized argument '%s' for option --format.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+
+        case 'k':
+            if(sscanf(arg, "%d/%d", &acutest_shard_, &acutest_shard_count_) != 2  ||
+               acutest_shard_count_ < 1  ||  acutest_shard_ < 1  ||  acutest_shard_ > acutest_shard_count_) {
+                fprintf(stderr, "%s: Invalid argument '%s' for option --shard.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+
+        case 'K':
+            if(strcmp(arg, "name") == 0) {
+                acutest_shard_by_duration_ = 0;
+            } else if(strcmp(arg, "duration") == 0) {
+                acutest_shard_by_duration_ = 1;
+            } else {
+                fprintf(stderr, "%s: Unrecognized argument '%s' for option --shard-by.\n", acutest_argv0_, arg);
+                fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+                acutest_exit_(2);
+            }
+            break;
+
         case 'l':
-            acutest_list_names_();
-            acutest_exit_(0);
+            acutest_list_only_ = 1;
             break;
 
         case 'v':
@@ -1669,12 +10296,32 @@ acutest_cmdline_callback_(int id, const char* arg)
             acutest_worker_ = 1;
             acutest_worker_index_ = atoi(arg);
             break;
+#if defined ACUTEST_WIN_
+        case 'z':
+            /* The write end of the report pipe, as inherited from the parent
+             * (see acutest_run_()). */
+            acutest_report_fd_ = _open_osfhandle((intptr_t) strtoul(arg, NULL, 10), _O_BINARY);
+            break;
+        case 'L':
+            acutest_test_log_on_ = 1;
+            break;
+        case 'i':
+            /* The read end of the command pipe of a persistent worker (see
+             * acutest_win_worker_spawn_()). */
+            acutest_worker_cmd_fd_ = _open_osfhandle((intptr_t) strtoul(arg, NULL, 10), _O_BINARY | _O_RDONLY);
+            break;
+#endif
         case 'x':
             acutest_xml_output_ = fopen(arg, "w");
             if (!acutest_xml_output_) {
                 fprintf(stderr, "Unable to open '%s': %s\n", arg, strerror(errno));
                 acutest_exit_(2);
             }
+            acutest_test_log_on_ = 1;
+            break;
+
+        case 'F':
+            acutest_select_from_file_(arg);
             break;
 
         case 0:
@@ -1806,10 +10453,11 @@ acutest_under_debugger_(void)
 int
 main(int argc, char** argv)
 {
-    int i, index;
+    int i, j, index, round, prio;
     int exit_code = 1;
 
     acutest_argv0_ = argv[0];
+    acutest_thread_no_ = 1;
 
 #if defined ACUTEST_UNIX_
     acutest_colorize_ = isatty(STDOUT_FILENO);
@@ -1823,6 +10471,14 @@ main(int argc, char** argv)
     acutest_colorize_ = 0;
 #endif
 
+    /* Unless the output is interactive, give it a large buffer (see the output
+     * layer). (This has to happen before any output.) */
+    if(!acutest_colorize_)
+        setvbuf(stdout, NULL, _IOFBF, ACUTEST_STDOUT_SIZE_);
+
+    acutest_registry_merge_();
+    acutest_params_expand_();
+
     /* Count all test units */
     acutest_list_size_ = 0;
     for(i = 0; acutest_list_[i].func != NULL; i++)
@@ -1833,13 +10489,87 @@ main(int argc, char** argv)
         fprintf(stderr, "Out of memory.\n");
         acutest_exit_(2);
     }
+    for(i = 0; i < acutest_list_size_; i++) {
+        acutest_test_data_[i].cpu_time = -1.0;
+        acutest_test_data_[i].estimate = -1.0;
+        for(j = 0; j < ACUTEST_PERF_MAX_; j++)
+            acutest_test_data_[i].perf[j] = -1.0;
+        acutest_rusage_reset_(&acutest_test_data_[i].rusage);
+        acutest_test_data_[i].last_state = ACUTEST_STATE_INITIAL;
+        acutest_test_data_[i].repeat_fail_state = ACUTEST_STATE_INITIAL;
+    }
 
     /* Parse options */
     acutest_cmdline_read_(acutest_cmdline_options_, argc, argv, acutest_cmdline_callback_);
 
+    if(acutest_threads_ > 1) {
+        /* The threads run in this process. */
+        if(acutest_no_exec_ == 0) {
+            fprintf(stderr, "%s: Option --threads cannot be used with --exec.\n", acutest_argv0_);
+            fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+            acutest_exit_(2);
+        }
+        acutest_no_exec_ = 1;
+#if defined ACUTEST_HAS_PROFILE_
+        if(acutest_profile_dir_ != NULL) {
+            /* SIGPROF is for the whole process. */
+            fprintf(stderr, "%s: Option --profile cannot be used with --threads.\n", acutest_argv0_);
+            fprintf(stderr, "Try '%s --help' for more information.\n", acutest_argv0_);
+            acutest_exit_(2);
+        }
+#endif
+#if defined ACUTEST_WIN_
+        /* The console colors cannot follow the output collected in the
+         * threads. */
+        acutest_colorize_ = 0;
+#endif
+    }
+
     /* Initialize the proper timer. */
     acutest_timer_init_();
 
+    if(acutest_timing_db_file_ != NULL  &&  !acutest_worker_)
+        acutest_timing_db_load_();
+    if(acutest_baseline_file_ != NULL  &&  !acutest_worker_)
+        acutest_baseline_load_();
+    if(acutest_rerun_file_ != NULL  &&  !acutest_worker_)
+        acutest_rerun_load_();
+#if defined ACUTEST_UNIX_
+    if(acutest_watch_  &&  !acutest_worker_)
+        acutest_watch_load_();
+    /* The failed tests run first, so let us see them first. */
+    if(acutest_output_order_completion_ < 0)
+        acutest_output_order_completion_ = acutest_watch_;
+#endif
+    if(acutest_perf_mask_ != 0  &&  !acutest_worker_  &&  !acutest_list_only_)
+        acutest_perf_probe_();
+
+    if(acutest_shard_count_ > 0)
+        acutest_shard_assign_();
+
+    if(acutest_list_only_) {
+        acutest_list_names_();
+        acutest_exit_(0);
+    }
+
+    if(acutest_timing_db_file_ != NULL  &&  !acutest_worker_)
+        acutest_timing_db_open_();
+#if defined ACUTEST_HAS_AFFINITY_
+    if(acutest_pin_requested_  &&  !acutest_worker_)
+        acutest_pin_setup_(acutest_pin_cpus_arg_, acutest_numa_node_);
+#endif
+    if(!acutest_worker_  &&  (acutest_env_report_  ||  acutest_jsonl_  ||  acutest_xml_output_ != NULL))
+        acutest_env_collect_();
+#if defined ACUTEST_HAS_PROFILE_
+    if(acutest_profile_dir_ != NULL  &&  !acutest_worker_) {
+        if(mkdir(acutest_profile_dir_, 0777) != 0  &&  errno != EEXIST) {
+            fprintf(stderr, "%s: Cannot create directory '%s'. %s [%d]\n", acutest_argv0_,
+                    acutest_profile_dir_, strerror(errno), errno);
+            acutest_exit_(2);
+        }
+    }
+#endif
+
 #if defined(ACUTEST_WIN_)
     SetUnhandledExceptionFilter(acutest_seh_exception_filter_);
 #ifdef _MSC_VER
@@ -1872,16 +10602,52 @@ main(int argc, char** argv)
             acutest_test_data_[i].state = ACUTEST_STATE_NEEDTORUN;
     }
 
+    /* Leave out tests of the other shards. (Worker processes on Windows get
+     * the test on the command line, so they have nothing to filter.) */
+    if(acutest_shard_count_ > 0  &&  !acutest_worker_) {
+        for(i = 0; acutest_list_[i].func != NULL; i++) {
+            if(acutest_test_data_[i].shard != acutest_shard_)
+                acutest_test_data_[i].state = ACUTEST_STATE_EXCLUDED;
+        }
+    }
+
+    if(acutest_rerun_file_ != NULL  &&  !acutest_worker_)
+        acutest_rerun_apply_();
+
     /* By default, we want to suppress running tests as child processes if we
      * run just one test, or if we're under debugger: Debugging tests is then
-     * so much easier. */
+     * so much easier. (But only a child process can be killed when the test
+     * runs out of its time.) */
     if(acutest_no_exec_ < 0) {
-        if(acutest_count_(ACUTEST_STATE_NEEDTORUN) <= 1  ||  acutest_under_debugger_())
+        int n_timeouts = 0;
+
+        for(i = 0; i < acutest_list_size_; i++) {
+            if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN  &&  acutest_test_timeout_(i) > 0.0)
+                n_timeouts++;
+        }
+
+        if(acutest_under_debugger_()  ||  (acutest_count_(ACUTEST_STATE_NEEDTORUN) <= 1  &&  n_timeouts == 0))
             acutest_no_exec_ = 1;
         else
             acutest_no_exec_ = 0;
     }
 
+#if defined ACUTEST_HAS_AFFINITY_
+    /* The tests run right in this process. */
+    if(acutest_no_exec_)
+        acutest_pin_(0);
+#endif
+
+#if defined ACUTEST_HAS_NET_
+    if(acutest_agent_ != NULL) {
+        /* The output goes to the coordinator, in the form it has asked for. */
+        acutest_fixtures_setup_();
+        acutest_agent_main_();
+        acutest_fixtures_teardown_();
+        acutest_exit_(0);
+    }
+#endif
+
     if(acutest_tap_) {
         /* TAP requires we know test result ("ok", "not ok") before we output
          * anything about the test, and this gets problematic for larger verbose
@@ -1892,74 +10658,190 @@ main(int argc, char** argv)
         /* TAP harness should provide some summary. */
         acutest_no_summary_ = 1;
 
-        if(!acutest_worker_)
-            printf("1..%d\n", acutest_count_(ACUTEST_STATE_NEEDTORUN));
+        /* (With repeated runs, the count is only known in the end.) */
+        if(!acutest_worker_  &&  !acutest_repeating_())
+            acutest_out_printf_("1..%d\n", acutest_count_(ACUTEST_STATE_NEEDTORUN));
+    }
+
+    if(acutest_jsonl_) {
+        /* The events replace any other output. */
+        acutest_out_muted_ = 1;
+
+        if(!acutest_worker_) {
+            acutest_event_begin_("run_start", NULL);
+            acutest_event_str_("suite", acutest_basename_(argv[0]));
+            acutest_event_int_("tests", acutest_count_(ACUTEST_STATE_NEEDTORUN));
+            acutest_env_event_();
+            acutest_event_end_();
+        }
+    }
+
+    if(acutest_env_report_  &&  !acutest_worker_)
+        acutest_env_print_();
+
+    if(acutest_xml_output_ != NULL)
+        acutest_xml_begin_(acutest_basename_(argv[0]));
+
+#if defined ACUTEST_WIN_
+    /* The child processes are not forked, they set the fixtures up on their
+     * own. */
+    if(acutest_no_exec_  ||  acutest_worker_)
+#elif defined ACUTEST_UNIX_
+    /* The agents set the fixtures up on their own. */
+    if(acutest_coordinator_ == NULL)
+#endif
+        acutest_fixtures_setup_();
+
+#if defined ACUTEST_WIN_
+    /* A persistent worker runs whatever tests it is told to (see
+     * acutest_win_worker_run_()). */
+    if(acutest_worker_cmd_fd_ >= 0) {
+        acutest_worker_loop_(acutest_worker_cmd_fd_);
+        acutest_fixtures_teardown_();
+        acutest_exit_(0);
     }
+#endif
 
     index = acutest_worker_index_;
-    for(i = 0; acutest_list_[i].func != NULL; i++) {
-        if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN)
-            acutest_run_(&acutest_list_[i], index++, i);
+    for(round = 1; ; round++) {
+        int n_failed;
+
+#if defined ACUTEST_HAS_NET_
+        if(acutest_coordinator_ != NULL) {
+            index = acutest_coordinate_(index);
+        } else
+#endif
+#if defined ACUTEST_UNIX_
+        if(!acutest_no_exec_  &&  acutest_pool_needed_()) {
+            index = acutest_run_pool_(index);
+        } else
+#endif
+        {
+#if defined ACUTEST_HAS_THREADS_
+            /* The thread-safe tests first, the rest of them one by one. */
+            if(acutest_threads_ > 1)
+                index = acutest_run_threads_(index);
+#endif
+            for(prio = 0; prio <= 2; prio++) {
+                for(i = 0; acutest_list_[i].func != NULL; i++) {
+                    if(acutest_fail_fast_reached_())
+                        break;
+                    if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN  &&
+                       acutest_watch_priority_(i) == prio)
+                        acutest_run_(&acutest_list_[i], index++, i);
+                }
+            }
+        }
+
+        if(!acutest_repeating_())
+            break;
+        n_failed = acutest_repeat_collect_();
+        if((acutest_repeat_ > 0  &&  round >= acutest_repeat_)  ||
+           (acutest_until_fail_  &&  n_failed > 0)  ||  acutest_fail_fast_reached_())
+            break;
+        acutest_repeat_reset_();
+    }
+    if(acutest_repeating_()) {
+        acutest_repeat_finish_();
+        if(acutest_tap_  &&  !acutest_worker_)
+            acutest_out_printf_("1..%d\n", index);
+    }
+
+#if defined ACUTEST_WIN_
+    acutest_win_worker_close_();
+#endif
+
+    /* Tests left out because of --fail-fast. */
+    for(i = 0; i < acutest_list_size_; i++) {
+        if(acutest_test_data_[i].state == ACUTEST_STATE_NEEDTORUN) {
+            acutest_test_data_[i].state = ACUTEST_STATE_EXCLUDED;
+            acutest_n_not_run_++;
+        }
     }
+    if(acutest_n_not_run_ > 0  &&  acutest_tap_  &&  !acutest_worker_)
+        acutest_out_printf_("Bail out! Stopped after %d failed unit test%s (--fail-fast).\n",
+                acutest_n_failed_, (acutest_n_failed_ == 1) ? "" : "s");
+
+#if defined ACUTEST_HAS_NET_
+    if(acutest_coordinator_ != NULL)
+        acutest_coordinator_close_();
+    else
+#endif
+        acutest_fixtures_teardown_();
+
+    if(acutest_rerun_file_ != NULL  &&  !acutest_worker_)
+        acutest_rerun_save_();
+    if(acutest_timing_db_ != NULL)
+        acutest_timing_db_close_();
+    if(acutest_bench_report_file_ != NULL  &&  !acutest_worker_)
+        acutest_bench_report_write_();
 
     /* Write a summary */
     if(!acutest_no_summary_ && acutest_verbose_level_ >= 1) {
-        int n_run, n_success, n_failed ;
+        int n_run, n_success, n_failed, n_flaky;
 
         n_run = acutest_list_size_ - acutest_count_(ACUTEST_STATE_EXCLUDED);
         n_success = acutest_count_(ACUTEST_STATE_SUCCESS);
-        n_failed = acutest_count_(ACUTEST_STATE_FAILED);
+        n_failed = acutest_count_(ACUTEST_STATE_FAILED) + acutest_count_(ACUTEST_STATE_TIMEOUT);
+        n_flaky = acutest_count_(ACUTEST_STATE_FLAKY);
+
+        if(acutest_repeating_())
+            acutest_repeat_print_();
 
         if(acutest_verbose_level_ >= 3) {
             acutest_colored_printf_(ACUTEST_COLOR_DEFAULT_INTENSIVE_, "Summary:\n");
 
-            printf("  Count of run unit tests:        %4d\n", n_run);
-            printf("  Count of successful unit tests: %4d\n", n_success);
-            printf("  Count of failed unit tests:     %4d\n", n_failed);
+            acutest_out_printf_("  Count of run unit tests:        %4d\n", n_run);
+            acutest_out_printf_("  Count of successful unit tests: %4d\n", n_success);
+            acutest_out_printf_("  Count of failed unit tests:     %4d\n", n_failed);
+            if(acutest_repeating_())
+                acutest_out_printf_("  Count of flaky unit tests:      %4d\n", n_flaky);
+            if(acutest_n_not_run_ > 0)
+                acutest_out_printf_("  Count of cancelled unit tests:  %4d\n", acutest_n_not_run_);
+        }
+
+        if(acutest_n_not_run_ > 0) {
+            acutest_colored_printf_(ACUTEST_COLOR_YELLOW_INTENSIVE_, "STOPPED:");
+            acutest_out_printf_(" %d unit test%s not run because of --fail-fast.\n",
+                    acutest_n_not_run_, (acutest_n_not_run_ == 1) ? " was" : "s were");
         }
 
-        if(n_failed == 0) {
+        if(n_failed == 0  &&  n_flaky == 0) {
             acutest_colored_printf_(ACUTEST_COLOR_GREEN_INTENSIVE_, "SUCCESS:");
-            printf(" No unit tests have failed.\n");
-        } else {
+            acutest_out_printf_(" No unit tests have failed.\n");
+        } else if(n_failed > 0) {
             acutest_colored_printf_(ACUTEST_COLOR_RED_INTENSIVE_, "FAILED:");
-            printf(" %d of %d unit tests %s failed.\n",
+            acutest_out_printf_(" %d of %d unit tests %s failed.\n",
                     n_failed, n_run, (n_failed == 1) ? "has" : "have");
         }
+        if(n_flaky > 0) {
+            acutest_colored_printf_(ACUTEST_COLOR_YELLOW_INTENSIVE_, "FLAKY:");
+            acutest_out_printf_(" %d of %d unit tests %s both passed and failed.\n",
+                    n_flaky, n_run, (n_flaky == 1) ? "has" : "have");
+        }
 
         if(acutest_verbose_level_ >= 3)
-            printf("\n");
+            acutest_out_printf_("\n");
     }
 
-    if (acutest_xml_output_) {
-        const char* suite_name = acutest_basename_(argv[0]);
-        fprintf(acutest_xml_output_, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-        fprintf(acutest_xml_output_, "<testsuite name=\"%s\" tests=\"%d\" errors=\"0\" failures=\"%d\" skip=\"%d\">\n",
-            suite_name,
-            (int)acutest_list_size_,
-            acutest_count_(ACUTEST_STATE_FAILED),
-            acutest_count_(ACUTEST_STATE_SKIPPED) + acutest_count_(ACUTEST_STATE_EXCLUDED));
-        for(i = 0; acutest_list_[i].func != NULL; i++) {
-            struct acutest_test_data_ *details = &acutest_test_data_[i];
-            const char* str_state;
-            fprintf(acutest_xml_output_, "  <testcase name=\"%s\" time=\"%.2f\">\n", acutest_list_[i].name, details->duration);
-
-            switch(details->state) {
-                case ACUTEST_STATE_SUCCESS:     str_state = NULL; break;
-                case ACUTEST_STATE_EXCLUDED:    /* Fall through. */
-                case ACUTEST_STATE_SKIPPED:     str_state = "<skipped />"; break;
-                case ACUTEST_STATE_FAILED:      /* Fall through. */
-                default:                        str_state = "<failure />"; break;
-            }
-
-            if(str_state != NULL)
-                fprintf(acutest_xml_output_, "    %s\n", str_state);
-            fprintf(acutest_xml_output_, "  </testcase>\n");
-        }
-        fprintf(acutest_xml_output_, "</testsuite>\n");
-        fclose(acutest_xml_output_);
+    if(acutest_jsonl_  &&  !acutest_worker_) {
+        acutest_event_begin_("run_end", NULL);
+        acutest_event_int_("run", acutest_list_size_ - acutest_count_(ACUTEST_STATE_EXCLUDED));
+        acutest_event_int_("success", acutest_count_(ACUTEST_STATE_SUCCESS));
+        acutest_event_int_("skipped", acutest_count_(ACUTEST_STATE_SKIPPED));
+        acutest_event_int_("failed", acutest_count_(ACUTEST_STATE_FAILED));
+        acutest_event_int_("timeout", acutest_count_(ACUTEST_STATE_TIMEOUT));
+        if(acutest_repeating_())
+            acutest_event_int_("flaky", acutest_count_(ACUTEST_STATE_FLAKY));
+        if(acutest_n_not_run_ > 0)
+            acutest_event_int_("not_run", acutest_n_not_run_);
+        acutest_event_end_();
+        acutest_out_flush_all_();
     }
 
+    if(acutest_xml_output_ != NULL)
+        acutest_xml_end_();
+
     if(acutest_worker_  &&  acutest_count_(ACUTEST_STATE_EXCLUDED)+1 == acutest_list_size_) {
         /* If we are the child process, we need to propagate the test state
          * without any moderation. */
@@ -1970,19 +10852,23 @@ main(int argc, char** argv)
             }
         }
     } else {
-        if(acutest_count_(ACUTEST_STATE_FAILED) > 0)
+        if(acutest_count_(ACUTEST_STATE_FAILED) + acutest_count_(ACUTEST_STATE_TIMEOUT) +
+           acutest_count_(ACUTEST_STATE_FLAKY) > 0)
             exit_code = 1;
         else
             exit_code = 0;
     }
 
+#if defined ACUTEST_UNIX_
+    if(acutest_watch_  &&  !acutest_worker_)
+        acutest_watch_wait_(argv);
+#endif
+
     acutest_cleanup_();
     return exit_code;
 }
 
 
-#endif  /* #ifndef TEST_NO_MAIN */
-
 #ifdef _MSC_VER
     #pragma warning(pop)
 #endif
@@ -1991,4 +10877,6 @@ main(int argc, char** argv)
     }  /* extern "C" */
 #endif
 
+#endif  /* #ifndef TEST_NO_MAIN */
+
 #endif  /* #ifndef ACUTEST_H */